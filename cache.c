@@ -0,0 +1,145 @@
+/*
+ * cache.c - decoded-content LRU (chained hash on link number, recency list)
+ */
+
+#include "cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_MIN_BUCKETS 64ul
+
+#define ITEM_DATA(it) ((unsigned char*)((it) + 1))
+#define ITEM_BYTES(len) ((unsigned long)sizeof(cacheItem_t) + (len))
+
+static cacheItem_t **slot(contentCache_t *c, unsigned long key) {
+    return &c->buckets[key % c->nbuckets];
+}
+
+static void unlink_recent(contentCache_t *c, cacheItem_t *it) {
+    if (it->prev) it->prev->next = it->next; else c->head = it->next;
+    if (it->next) it->next->prev = it->prev; else c->tail = it->prev;
+    it->prev = it->next = NULL;
+}
+
+static void push_recent(contentCache_t *c, cacheItem_t *it) {
+    it->prev = NULL;
+    it->next = c->head;
+    if (c->head) c->head->prev = it; else c->tail = it;
+    c->head = it;
+}
+
+static cacheItem_t *find(contentCache_t *c, unsigned long key) {
+    cacheItem_t *it;
+    if (!c->buckets) return NULL;
+    for (it = *slot(c, key); it && it->key != key; it = it->chain) {}
+    return it;
+}
+
+/* Unhook `it` from its chain and the recency list and free it. */
+static void release(contentCache_t *c, cacheItem_t *it) {
+    cacheItem_t **p = slot(c, it->key);
+    while (*p != it) p = &(*p)->chain;
+    *p = it->chain;
+    unlink_recent(c, it);
+    c->bytes -= ITEM_BYTES(it->len);
+    c->count--;
+    free(it);
+}
+
+/* Double the bucket array once chains average two items. Keeps the old
+ * array if memory is short. */
+static void grow(contentCache_t *c) {
+    unsigned long n = c->nbuckets ? c->nbuckets * 2u : CACHE_MIN_BUCKETS;
+    unsigned long i;
+    cacheItem_t **buckets = (cacheItem_t**)calloc((size_t)n, sizeof(cacheItem_t*));
+    if (!buckets) return;
+    for (i = 0u; i < c->nbuckets; i++) {
+        cacheItem_t *it = c->buckets[i];
+        while (it) {
+            cacheItem_t *nx = it->chain;
+            it->chain = buckets[it->key % n];
+            buckets[it->key % n] = it;
+            it = nx;
+        }
+    }
+    free(c->buckets);
+    c->buckets = buckets;
+    c->nbuckets = n;
+}
+
+/* Drop least recently used items until `extra` more bytes fit. */
+static void evict(contentCache_t *c, unsigned long extra) {
+    while (c->tail && c->bytes + extra > c->maxBytes) {
+        release(c, c->tail);
+        c->evictions++;
+    }
+}
+
+void cacheSetBudget(contentCache_t *c, unsigned long maxBytes) {
+    if (!c) return;
+    c->maxBytes = maxBytes;
+    if (maxBytes == 0u) cacheClear(c);
+    else evict(c, 0u);
+}
+
+void cacheClear(contentCache_t *c) {
+    cacheItem_t *it;
+    if (!c) return;
+    it = c->head;
+    while (it) { cacheItem_t *nx = it->next; free(it); it = nx; }
+    if (c->buckets) memset(c->buckets, 0, (size_t)c->nbuckets * sizeof(cacheItem_t*));
+    c->head = c->tail = NULL;
+    c->count = 0u;
+    c->bytes = 0u;
+}
+
+void cacheFree(contentCache_t *c) {
+    if (!c) return;
+    cacheClear(c);
+    free(c->buckets);
+    memset(c, 0, sizeof(*c));
+}
+
+int cacheGet(contentCache_t *c, unsigned long key, unsigned char **out, unsigned long *len) {
+    cacheItem_t *it;
+    unsigned char *copy;
+    if (!c || !out || !len || c->maxBytes == 0u) return 0;
+    it = find(c, key);
+    if (!it) { c->misses++; return 0; }
+    copy = (unsigned char*)malloc((size_t)it->len + 1u);
+    if (!copy) return -1;
+    memcpy(copy, ITEM_DATA(it), (size_t)it->len);
+    copy[it->len] = 0;
+    if (it != c->head) { unlink_recent(c, it); push_recent(c, it); }
+    c->hits++;
+    *out = copy;
+    *len = it->len;
+    return 1;
+}
+
+void cachePut(contentCache_t *c, unsigned long key, const unsigned char *data, unsigned long len) {
+    cacheItem_t *it;
+    if (!c || c->maxBytes == 0u || (len > 0u && !data)) return;
+    if (ITEM_BYTES(len) > c->maxBytes / 8u) return;
+    cacheDrop(c, key);
+    if (c->count >= c->nbuckets * 2u) grow(c);
+    if (!c->buckets) return;
+    evict(c, ITEM_BYTES(len));
+    it = (cacheItem_t*)malloc((size_t)ITEM_BYTES(len));
+    if (!it) return;
+    it->key = key;
+    it->len = len;
+    if (len > 0u) memcpy(ITEM_DATA(it), data, (size_t)len);
+    it->chain = *slot(c, key);
+    *slot(c, key) = it;
+    push_recent(c, it);
+    c->bytes += ITEM_BYTES(len);
+    c->count++;
+}
+
+void cacheDrop(contentCache_t *c, unsigned long key) {
+    cacheItem_t *it;
+    if (!c) return;
+    it = find(c, key);
+    if (it) release(c, it);
+}
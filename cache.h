@@ -0,0 +1,50 @@
+/*
+ * cache.h
+ * Decoded-content cache: an LRU of plain entry content keyed by the
+ * entry's link number, within a byte budget, so a hot entry is decoded
+ * once and then served by a lookup and a copy.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+typedef struct cacheItem {
+    unsigned long key;          /* link number of the entry */
+    unsigned long len;          /* content bytes, stored after the item */
+    struct cacheItem *prev;     /* recency list, most recent first */
+    struct cacheItem *next;
+    struct cacheItem *chain;    /* hash chain */
+} cacheItem_t;
+
+typedef struct {
+    cacheItem_t **buckets;
+    unsigned long nbuckets;
+    cacheItem_t *head;          /* most recently used */
+    cacheItem_t *tail;          /* next to go */
+    unsigned long count;
+    unsigned long bytes;        /* items and content held */
+    unsigned long maxBytes;     /* budget; 0 = off */
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} contentCache_t;
+
+/* A zeroed cache is valid and off. A new budget drops least recently used
+ * items until the cache fits (0 empties it); counters are kept. */
+void cacheSetBudget(contentCache_t *c, unsigned long maxBytes);
+void cacheClear(contentCache_t *c);
+void cacheFree(contentCache_t *c);
+
+/* On a hit, a malloc'ed copy of the content (len + 1 bytes allocated) in
+ * *out and its length in *len: returns 1. Returns 0 on a miss (or when
+ * off) and -1 if the copy cannot be allocated. */
+int cacheGet(contentCache_t *c, unsigned long key, unsigned char **out, unsigned long *len);
+
+/* Keep a copy of `len` bytes for `key`, replacing any older one. Content
+ * over an eighth of the budget is not kept. */
+void cachePut(contentCache_t *c, unsigned long key, const unsigned char *data, unsigned long len);
+
+/* Forget `key` (its entry changed). No-op if not cached. */
+void cacheDrop(contentCache_t *c, unsigned long key);
+
+#endif /* CACHE_H */
@@ -0,0 +1,72 @@
+/*
+ * chunk.c - gear-hash content-defined chunker
+ */
+
+#include "chunk.h"
+
+/* A cut is made where the top CDC_AVG_BITS bits of the 32-bit gear hash
+ * are zero; the top bits depend on the last 32 input bytes. */
+#define CDC_MASK ((0xFFFFFFFFul << (32 - CDC_AVG_BITS)) & 0xFFFFFFFFul)
+
+/* Fixed pseudo-random table (xorshift32 from 0x9E3779B9): chunk boundaries
+ * must be identical across runs and hosts. Constant, so sessions on other
+ * threads can chunk at the same time. */
+static const unsigned long g_gear[256] = {
+    0x510C4619ul, 0xE02E553Eul, 0x7BB98F3Aul, 0x0183A8B5ul, 0xE6336D1Ful, 0xF989D237ul,
+    0xBA2529D0ul, 0xFCFBEDBFul, 0xA8C5EE39ul, 0xB55A53B8ul, 0x1A88A9EEul, 0xF918A8B4ul,
+    0x6DC588D3ul, 0x472F513Cul, 0x0C1870B8ul, 0x43E1465Ful, 0x0E78EA8Aul, 0x761DC0DEul,
+    0x0ECA9C7Dul, 0xF5E7493Ful, 0x84D44CBFul, 0xA536E9DEul, 0x79AFAED8ul, 0x02E9F4A2ul,
+    0xB3C8F91Cul, 0x318EC249ul, 0xD13543EAul, 0x504FD68Eul, 0xF9563BE1ul, 0xFB6A9A74ul,
+    0xACAD82A6ul, 0x83D0D79Aul, 0xBD58BA6Bul, 0xE8A46341ul, 0xFD4255C7ul, 0x48A7297Aul,
+    0x1C8FC87Eul, 0x558F2D7Eul, 0xB43618AEul, 0x935F84DFul, 0x1B4EF29Dul, 0x66BB3273ul,
+    0x1E5F1329ul, 0x7B73EBB4ul, 0xC6A87E76ul, 0xE5BD8265ul, 0xEBD01B3Dul, 0xFE4E23A6ul,
+    0x7D6529DBul, 0xD39A9B74ul, 0x9E7F3ACEul, 0x5DFE0DFDul, 0x147D987Dul, 0x493F1344ul,
+    0xC1AF1B0Ful, 0x7B13A768ul, 0xF02AB277ul, 0x6AE429E5ul, 0x14C73F29ul, 0x976EB1B8ul,
+    0x6A6BB394ul, 0x9F3E8E98ul, 0x9358942Eul, 0xBA7F8CC0ul, 0x37128F53ul, 0xB9E359CFul,
+    0x8980C4E2ul, 0xB28541ECul, 0x4DA15AB0ul, 0xB81A50ABul, 0xB3E67C2Cul, 0xF01B81BDul,
+    0x85A054CBul, 0x681719B7ul, 0xEF1638C7ul, 0x29D754C0ul, 0xAAA99987ul, 0xAABF9C2Bul,
+    0x7E60C676ul, 0xB3689101ul, 0x8854D505ul, 0x4C7BF39Ful, 0x730959FBul, 0x5EF4A9E0ul,
+    0xB2D14C84ul, 0xF371A5A4ul, 0x3F6D8E86ul, 0x591C32D8ul, 0x37ACF21Bul, 0x94171B6Cul,
+    0x982EBAF1ul, 0xA1671469ul, 0x3EA8A61Cul, 0x670D5609ul, 0x744E0D0Ful, 0x081948F8ul,
+    0x01CD571Bul, 0xCEE2330Cul, 0x98FD1EEDul, 0x5F34CCDDul, 0x134EFECAul, 0x5E6CC8A1ul,
+    0x2869E8BDul, 0xBAB60242ul, 0x2531989Dul, 0xD264420Cul, 0x1E980CDEul, 0xFF7BA8BFul,
+    0xC7EDBCA9ul, 0x7F6C3635ul, 0xCCF7B6E0ul, 0x7F5ED555ul, 0x1B70D24Ful, 0x261F68B3ul,
+    0xAA24CBD7ul, 0x58987D78ul, 0xB1DD8A83ul, 0x1130B265ul, 0xE8FE2ABBul, 0x9882D18Ful,
+    0x94D94A16ul, 0x0EE14FBBul, 0xC5D1BA30ul, 0xA06FAC1Bul, 0xE8703B4Dul, 0x0C2474E1ul,
+    0xD5BAA21Dul, 0xBED11EC1ul, 0x3C2778E5ul, 0xB44D9E78ul, 0xF7D12A99ul, 0x82CE18D8ul,
+    0x7B723E72ul, 0xAB3065ACul, 0x57337BAEul, 0x3092562Dul, 0x30AEABC6ul, 0x5F153C8Dul,
+    0xE818F92Ful, 0x10913491ul, 0xF662FD90ul, 0x93C58678ul, 0x4258685Dul, 0xA52E1174ul,
+    0x8714FC74ul, 0x0BD47719ul, 0x23D5A5C2ul, 0x7AD860F4ul, 0xAE1DA977ul, 0x7D5BD92Eul,
+    0xC9BD5831ul, 0x35D264ECul, 0x50B4D12Bul, 0x98AB5803ul, 0x86C37B16ul, 0xDD983706ul,
+    0xB46BCDFAul, 0x77498910ul, 0x8B1EEE85ul, 0x8F02D9A2ul, 0x52E88499ul, 0x0D0B3124ul,
+    0x0EDF12D3ul, 0x7C2596B1ul, 0x1089E8C8ul, 0x9F8F3E00ul, 0x71AF46C7ul, 0xB78AA5FCul,
+    0x859FD8A6ul, 0xAFEFDB83ul, 0xC76DA84Cul, 0x3EE63EBEul, 0xDF01C6E6ul, 0x1C73D408ul,
+    0xB8AE0951ul, 0x4906A7F3ul, 0x22E9A8EFul, 0xE97C21B5ul, 0xC41C5510ul, 0x99703BAFul,
+    0x5EB7010Dul, 0x6C493686ul, 0x19A3AA8Aul, 0xF2A94293ul, 0x8592B22Eul, 0xA9346365ul,
+    0x8E42E8E9ul, 0xB8AB8986ul, 0xFAFE842Bul, 0x6505D3D6ul, 0x3090F149ul, 0xF98104B5ul,
+    0xFBEECFFEul, 0x6032C036ul, 0x3EB799ACul, 0x7DCD92CDul, 0x3D1EF5E7ul, 0x97EEE2F6ul,
+    0x3DB0E2EEul, 0x1C4B7118ul, 0x3F614DACul, 0xCC4C1E06ul, 0xBE13C1C0ul, 0x035FF875ul,
+    0x7675EDFDul, 0xB28F2B18ul, 0xAA6C1D2Eul, 0x10F0F08Aul, 0xD2D748BAul, 0x43C2BE1Aul,
+    0x943F775Aul, 0x20554C30ul, 0xB3B213F9ul, 0xC86428FFul, 0xE2062602ul, 0xFE08D941ul,
+    0x4131F1F1ul, 0x9EF220B6ul, 0x86753544ul, 0x3B69006Aul, 0x77EDF6D8ul, 0xEFE4DA23ul,
+    0xE0B08E13ul, 0xDF2043EAul, 0x3CF060C4ul, 0x2DF7EEB0ul, 0xD41152A0ul, 0x36E09DC2ul,
+    0x8E4122AEul, 0xE8824324ul, 0xBC34F9B7ul, 0x43430EF6ul, 0x712628B8ul, 0x321F26A0ul,
+    0x0FA2F565ul, 0x70C1C1A2ul, 0x56411ED8ul, 0xC6DEA6B5ul, 0x5309F991ul, 0xEB461E0Cul,
+    0x3876C3AFul, 0xE069266Eul, 0x503403BCul, 0xD83E983Dul, 0x6C1E8981ul, 0x18F015D6ul,
+    0x5311C693ul, 0x13B1FD32ul, 0xAEE2CC19ul, 0x1B536289ul, 0x974D5808ul, 0xB5C483EEul,
+    0x92937772ul, 0x73D460CCul, 0x067E7A6Aul, 0xEF588093ul
+};
+
+size_t cdc_cut(const unsigned char *p, size_t n, int final) {
+    unsigned long h = 0ul;
+    size_t i, limit;
+    if (!p || n == 0) return 0;
+    if (n <= CDC_MIN_SIZE) return final ? n : 0;
+    limit = n < CDC_MAX_SIZE ? n : CDC_MAX_SIZE;
+    for (i = CDC_MIN_SIZE - 32u; i < limit; i++) {
+        h = ((h << 1) + g_gear[p[i]]) & 0xFFFFFFFFul;
+        if (i >= CDC_MIN_SIZE && (h & CDC_MASK) == 0ul) return i + 1;
+    }
+    if (limit == CDC_MAX_SIZE) return CDC_MAX_SIZE;
+    return final ? n : 0;
+}
@@ -0,0 +1,25 @@
+/*
+ * chunk.h
+ * Content-defined chunking (CDC) with a gear rolling hash. Boundaries depend
+ * only on nearby bytes, so an insert or edit in a large file changes just
+ * the chunks around it and every other chunk keeps its content (and can be
+ * deduplicated against the previous revision).
+ */
+
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <stddef.h>
+
+#define CDC_MIN_SIZE 2048u    /* no cut before this many bytes */
+#define CDC_AVG_BITS 13       /* ~8 KiB average chunk */
+#define CDC_MAX_SIZE 65536u   /* forced cut */
+
+/* Length of the next chunk at the start of `p` (n bytes available).
+ * Returns 0 when no boundary is found in a window shorter than
+ * CDC_MAX_SIZE and more input may follow (`final` == 0): the caller should
+ * supply more bytes. With `final` set the remaining bytes form the last
+ * chunk. */
+size_t cdc_cut(const unsigned char *p, size_t n, int final);
+
+#endif /* CHUNK_H */
@@ -0,0 +1,171 @@
+/*
+ * codec.c - fused payload decode and the session encoder
+ */
+
+#include "codec.h"
+#include "compress.h"
+#include "crypto.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* FNV-1a step, as in hash_update */
+#define CODEC_FNV_PRIME 16777619UL
+
+void codec_decodeInit(codecDecode_t *d, const unsigned char *key, size_t keyLen, int rle) {
+    d->key = (key && keyLen > 0) ? key : NULL;
+    d->keyLen = keyLen;
+    d->keyPos = 0ul;
+    d->rle = rle;
+    d->hash = FILE_HASH_INIT;
+}
+
+size_t codec_decode(codecDecode_t *d, const unsigned char *in, size_t n, unsigned char *out, size_t outCap) {
+    const unsigned char *key = d->key;
+    unsigned long h = d->hash;
+    size_t i, oi = 0, k = 0;
+    if (!in || !out) return 0;
+    if (key) k = (size_t)(d->keyPos % (unsigned long)d->keyLen); /* key byte for in[0] */
+    if (!d->rle) {
+        if (n > outCap) return 0;
+        if (key) {
+            for (i = 0; i < n; i++) {
+                unsigned char b = (unsigned char)(in[i] ^ key[k]);
+                if (++k == d->keyLen) k = 0;
+                out[i] = b;
+                h = (h ^ b) * CODEC_FNV_PRIME;
+            }
+        } else {
+            if (out != in) memcpy(out, in, n);
+            for (i = 0; i < n; i++) h = (h ^ out[i]) * CODEC_FNV_PRIME;
+        }
+        oi = n;
+    } else {
+        for (i = 0; i + 1 < n; i += 2) {
+            unsigned char count = in[i], b = in[i + 1], c;
+            if (key) {
+                count = (unsigned char)(count ^ key[k]);
+                if (++k == d->keyLen) k = 0;
+                b = (unsigned char)(b ^ key[k]);
+                if (++k == d->keyLen) k = 0;
+            }
+            if (count > outCap - oi) return 0;
+            memset(out + oi, b, count);
+            oi += count;
+            for (c = 0; c < count; c++) h = (h ^ b) * CODEC_FNV_PRIME;
+        }
+    }
+    d->keyPos += (unsigned long)n;
+    d->hash = h;
+    return oi;
+}
+
+void codec_encoderInit(codecEncoder_t *enc) {
+    memset(enc, 0, sizeof(*enc));
+}
+
+void codec_encoderFree(codecEncoder_t *enc) {
+    int timed = enc->timed; /* a setting, not state */
+    int i;
+    free(enc->work);
+    for (i = 0; i < enc->pooled; i++) free(enc->pool[i]);
+    free(enc->spare);
+    free(enc->input);
+    codec_encoderInit(enc);
+    enc->timed = timed;
+}
+
+/* Grow `*buf` to at least `need` bytes (contents are not kept). */
+static unsigned char *reserve(codecEncoder_t *enc, unsigned char **buf, size_t *cap, size_t need) {
+    if (need == 0) need = 1;
+    if (*buf && *cap >= need) return *buf;
+    free(*buf);
+    *buf = (unsigned char*)malloc(need);
+    *cap = *buf ? need : 0;
+    if (*buf) enc->stats.allocations++;
+    return *buf;
+}
+
+/* Start a new work buffer from the pool: the smallest one that holds
+ * `need` bytes, if any. */
+static void take_pooled(codecEncoder_t *enc, size_t need) {
+    int i, best = -1;
+    for (i = 0; i < enc->pooled; i++) {
+        if (enc->poolCap[i] >= need && (best < 0 || enc->poolCap[i] < enc->poolCap[best])) best = i;
+    }
+    if (best < 0) return;
+    enc->work = enc->pool[best];
+    enc->workCap = enc->poolCap[best];
+    enc->poolBytes -= enc->poolCap[best];
+    enc->pooled--;
+    enc->pool[best] = enc->pool[enc->pooled];
+    enc->poolCap[best] = enc->poolCap[enc->pooled];
+}
+
+unsigned char *codec_workspace(codecEncoder_t *enc, size_t cap) {
+    if (!enc->work && enc->pooled > 0) take_pooled(enc, cap ? cap : 1);
+    return reserve(enc, &enc->work, &enc->workCap, cap);
+}
+
+void codec_recycle(codecEncoder_t *enc, unsigned char *p, size_t cap) {
+    if (!p) return;
+    if (cap == 0 || enc->pooled == CODEC_POOL || cap > CODEC_POOL_BYTES - enc->poolBytes) { free(p); return; }
+    enc->pool[enc->pooled] = p;
+    enc->poolCap[enc->pooled++] = cap;
+    enc->poolBytes += cap;
+}
+
+unsigned char *codec_spare(codecEncoder_t *enc, size_t cap) {
+    return reserve(enc, &enc->spare, &enc->spareCap, cap);
+}
+
+/* Stage clock: processor time, read only when timings are wanted. */
+static double stage_clock(const codecEncoder_t *enc) {
+    return enc->timed ? util_seconds() : 0.0;
+}
+
+int codec_encode(codecEncoder_t *enc, const unsigned char *in, size_t n, int *compress,
+                 const unsigned char *key, size_t keyLen, unsigned int *hash, size_t *outLen) {
+    size_t cap = n, len = 0; /* RLE that would grow the input is not kept */
+    double t0, t1, t2, t3;
+    if (!codec_workspace(enc, cap)) return -1;
+    t0 = stage_clock(enc);
+    *hash = n > 0 ? (unsigned int)compute_file_hash(in, n) : 0u;
+    t1 = stage_clock(enc);
+    if (*compress && n > 0) {
+        len = rle_compress(in, n, enc->work, cap);
+        if (len == 0) *compress = 0;
+    }
+    if (len == 0) {
+        if (n > 0) memcpy(enc->work, in, n);
+        len = n;
+    }
+    t2 = stage_clock(enc);
+    if (key && len > 0) xor_cipher(enc->work, len, key, keyLen);
+    t3 = stage_clock(enc);
+    enc->stats.encodes++;
+    enc->stats.bytesIn += (unsigned long)n;
+    enc->stats.bytesOut += (unsigned long)len;
+    enc->stats.hashSeconds += t1 - t0;
+    enc->stats.compressSeconds += t2 - t1;
+    enc->stats.encryptSeconds += t3 - t2;
+    enc->stamp = t3;
+    *outLen = len;
+    return 0;
+}
+
+unsigned char *codec_adopt(codecEncoder_t *enc, size_t len, size_t *cap) {
+    unsigned char *p = enc->work;
+    if (!p || len == 0 || len > enc->workCap) return NULL;
+    /* RLE output can be far smaller than the n bytes reserved for it; a
+     * buffer headed back to the pool keeps them for the next encode */
+    if (cap) *cap = enc->workCap;
+    else if (enc->workCap - len > len / 4u + 64u) {
+        unsigned char *q = (unsigned char*)realloc(p, len);
+        if (q) p = q;
+    }
+    enc->work = NULL;
+    enc->workCap = 0;
+    enc->stats.adopted++;
+    return p;
+}
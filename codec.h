@@ -0,0 +1,98 @@
+/*
+ * codec.h
+ * Payload coding. The read path is a fused kernel: it undoes the
+ * encryption (xor_cipher) and the RLE encoding (rle_compress) of a stored
+ * payload and hashes the result (compute_file_hash) in one pass over the
+ * stored bytes, writing each run straight into the caller's buffer. The
+ * write path is an encoder owned by the session whose scratch buffers
+ * outlive each call, with per-stage timings.
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+
+/* State carried across the pieces of one payload. */
+typedef struct {
+    const unsigned char *key;  /* xor_cipher key, or NULL if not encrypted */
+    size_t keyLen;
+    unsigned long keyPos;      /* payload offset of the next stored byte */
+    int rle;                   /* stored bytes are <count><byte> pairs */
+    unsigned long hash;        /* running hash_update of the output */
+} codecDecode_t;
+
+/* Ready `d` for a payload read from its start (hash FILE_HASH_INIT). */
+void codec_decodeInit(codecDecode_t *d, const unsigned char *key, size_t keyLen, int rle);
+
+/* Decode the next `n` stored bytes into `out` (room for outCap bytes).
+ * RLE pieces must hold whole pairs (a trailing odd byte is ignored, as by
+ * rle_decompress). Without RLE `out` may be `in`. Returns the number of
+ * bytes written, or 0 if they do not fit. */
+size_t codec_decode(codecDecode_t *d, const unsigned char *in, size_t n, unsigned char *out, size_t outCap);
+
+/* Cumulative encoder counters; seconds are processor time per stage, kept
+ * only while the encoder is `timed`. */
+typedef struct {
+    unsigned long encodes;       /* codec_encode calls */
+    unsigned long bytesIn;
+    unsigned long bytesOut;
+    unsigned long allocations;   /* scratch buffers allocated or grown */
+    unsigned long adopted;       /* work buffers handed over (codec_adopt) */
+    double hashSeconds;
+    double compressSeconds;
+    double encryptSeconds;
+} codecEncodeStats_t;
+
+/* Adopted work buffers given back (codec_recycle) are kept for later
+ * encodes: up to CODEC_POOL of them (a default write-behind group) and
+ * CODEC_POOL_BYTES in all. */
+#define CODEC_POOL 64
+#define CODEC_POOL_BYTES (1024u * 1024u)
+
+/* Encode pipeline: hash, RLE (optional), XOR (optional) into `work`.
+ * Zero-initialise (or codec_encoderInit) before first use. */
+typedef struct {
+    unsigned char *work;         /* output of the last codec_encode */
+    size_t workCap;
+    unsigned char *pool[CODEC_POOL]; /* recycled work buffers */
+    size_t poolCap[CODEC_POOL];
+    int pooled;
+    size_t poolBytes;
+    unsigned char *spare;        /* second scratch buffer (codec_spare) */
+    size_t spareCap;
+    unsigned char *input;        /* file contents to encode (util_readInto) */
+    size_t inputCap;
+    int timed;                   /* take per-stage timings (off: no clock reads) */
+    double stamp;                /* util_seconds when the last timed encode ended */
+    codecEncodeStats_t stats;
+} codecEncoder_t;
+
+void codec_encoderInit(codecEncoder_t *enc);
+void codec_encoderFree(codecEncoder_t *enc);
+
+/* Encode `n` bytes of `in` into enc->work: RLE when *compress (cleared if
+ * the RLE output would be larger than `n`), then XOR with `key` unless it
+ * is NULL.
+ * Sets *hash to compute_file_hash of the input and *outLen to the encoded
+ * length. Returns -1 if the work buffer cannot grow. */
+int codec_encode(codecEncoder_t *enc, const unsigned char *in, size_t n, int *compress,
+                 const unsigned char *key, size_t keyLen, unsigned int *hash, size_t *outLen);
+
+/* Hand over the work buffer holding `len` encoded bytes instead of copying
+ * them. With `cap` NULL it is trimmed with realloc when it is mostly slack;
+ * otherwise (a buffer to be recycled soon) it keeps its size, stored in
+ * *cap. The next encode takes a recycled one, or allocates. NULL if `len`
+ * is 0 or memory is short. */
+unsigned char *codec_adopt(codecEncoder_t *enc, size_t len, size_t *cap);
+
+/* Give back an adopted buffer (`cap` bytes at least) once its payload is
+ * written: kept for the next encodes if the pool has room, else freed. */
+void codec_recycle(codecEncoder_t *enc, unsigned char *p, size_t cap);
+
+/* Scratch of at least `cap` bytes kept between calls: the work buffer
+ * (overwritten by codec_encode) or the spare one. NULL if memory is short. */
+unsigned char *codec_workspace(codecEncoder_t *enc, size_t cap);
+unsigned char *codec_spare(codecEncoder_t *enc, size_t cap);
+
+#endif /* CODEC_H */
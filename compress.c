@@ -1,5 +1,11 @@
 #include "compress.h"
 
+/* Runs are scanned a machine word at a time: a word of the input XORed
+ * with the run byte repeated in every lane is zero while the run holds.
+ * Words are loaded with memcpy, so the input needs no alignment. */
+#define RLE_WORD sizeof(unsigned long)
+#define RLE_ONES (~0ul / 255ul) /* 0x0101...01 */
+
 size_t rle_compress(const unsigned char *in, size_t n, unsigned char *out, size_t outCap) {
     size_t oi;
     size_t i;
@@ -8,11 +14,22 @@ size_t rle_compress(const unsigned char *in, size_t n, unsigned char *out, size_
     i = 0;
     while (i < n) {
         unsigned char b;
-        size_t run;
+        size_t run, limit;
         b = in[i];
         run = 1;
-        while (i + run < n && in[i + run] == b && run < 255) {
+        limit = n - i < 255 ? n - i : 255;
+        /* literal bytes end their run at the first compare, without a word load */
+        if (run < limit && in[i + run] == b) {
+            unsigned long pattern = RLE_ONES * b, w;
             run++;
+            while (run + RLE_WORD <= limit) {
+                memcpy(&w, in + i + run, RLE_WORD);
+                if (w != pattern) break;
+                run += RLE_WORD;
+            }
+            while (run < limit && in[i + run] == b) {
+                run++;
+            }
         }
         if (oi + 2 > outCap) return 0; /* no room */
         out[oi++] = (unsigned char)run;
@@ -29,18 +46,18 @@ size_t rle_decompress(const unsigned char *in, size_t n, unsigned char *out, siz
     oi = 0;
     i = 0;
     while (i + 1 < n) {
-        unsigned char count;
         unsigned char byte;
-        unsigned char k;
-        count = in[i];
-        byte  = in[i + 1];
-        if (oi + count > outCap) return 0;
-        k = 0;
-        while (k < count) {
-            out[oi++] = byte;
-            k++;
-        }
-        i += 2;
+        size_t count;
+        /* a long run is a string of pairs of one byte: expand it with one store */
+        byte = in[i + 1];
+        count = 0;
+        do {
+            count += in[i];
+            i += 2;
+        } while (i + 1 < n && in[i + 1] == byte);
+        if (count > outCap - oi) return 0;
+        memset(out + oi, byte, count);
+        oi += count;
     }
     return oi;
 }
@@ -65,6 +65,13 @@ void xor_cipher(unsigned char *data, size_t n, const unsigned char *key, size_t
     for (i = 0; i < n; i++) data[i] ^= key[i % keyLen]; /* XOR each byte of data with corresponding byte of key (cycling through key) */
 }
 
+void xor_cipher_at(unsigned char *data, size_t n, const unsigned char *key, size_t keyLen, unsigned long pos) {
+    size_t i, k;
+    if (!data || !key || keyLen == 0) return;
+    k = (size_t)(pos % (unsigned long)keyLen); /* key byte for data[0] */
+    for (i = 0; i < n; i++) { data[i] ^= key[k]; if (++k == keyLen) k = 0; }
+}
+
 int encrypt_data(unsigned char *data, size_t n, const char *pin) {
     unsigned char key[256]; size_t keyLen; /* Buffer for derived key */
     /* Validate inputs */
@@ -79,13 +86,18 @@ int decrypt_data(unsigned char *data, size_t n, const char *pin) {
     return encrypt_data(data, n, pin); /* symmetric */
 }
 
-unsigned long compute_file_hash(const unsigned char *data, size_t n) {
-    unsigned long hash = 2166136261UL; size_t i;
-    if (!data || n == 0) return 0;
+unsigned long hash_update(unsigned long hash, const unsigned char *data, size_t n) {
+    size_t i;
+    if (!data) return hash;
     for (i = 0; i < n; i++) { hash ^= (unsigned long)data[i]; hash *= 16777619UL; }
     return hash;
 }
 
+unsigned long compute_file_hash(const unsigned char *data, size_t n) {
+    if (!data || n == 0) return 0;
+    return hash_update(FILE_HASH_INIT, data, n);
+}
+
 int verify_file_integrity(const unsigned char *data, size_t n, unsigned long storedHash) {
     if (!data) return 0;
     return (compute_file_hash(data, n) == storedHash) ? 1 : 0;
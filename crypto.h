@@ -23,12 +23,18 @@ unsigned long hash_pin(const char *pin);
 
 /* Encryption/Decryption Functions */
 void xor_cipher(unsigned char *data, size_t n, const unsigned char *key, size_t keyLen);
+/* xor_cipher for the piece of a longer stream that starts at byte `pos`. */
+void xor_cipher_at(unsigned char *data, size_t n, const unsigned char *key, size_t keyLen, unsigned long pos);
 int encrypt_data(unsigned char *data, size_t n, const char *pin);
 int decrypt_data(unsigned char *data, size_t n, const char *pin);
 
 
 /* File Integrity Functions */
 unsigned long compute_file_hash(const unsigned char *data, size_t n);
+/* Incremental compute_file_hash: start from FILE_HASH_INIT and feed the
+ * pieces in order (a non-empty input hashes the same either way). */
+#define FILE_HASH_INIT 2166136261UL
+unsigned long hash_update(unsigned long hash, const unsigned char *data, size_t n);
 int verify_file_integrity(const unsigned char *data, size_t n, unsigned long storedHash);
 
 
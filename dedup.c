@@ -0,0 +1,111 @@
+/*
+ * dedup.c - content-addressed blob table (chained hash on content hash)
+ */
+
+#include "dedup.h"
+
+static unsigned long bucket_of(const blobTable_t *t, unsigned int hash) {
+    return (unsigned long)hash % t->nbuckets;
+}
+
+static int same_content(const blob_t *b, const indexEntry_t *e) {
+    return b->hash == e->hash && b->originalSize == e->originalSize
+        && b->storedSize == e->storedSize && b->flags == e->flags;
+}
+
+int blobTableInit(blobTable_t *t, unsigned long nbuckets) {
+    if (!t || nbuckets == 0u) return -1;
+    memset(t, 0, sizeof(*t));
+    t->buckets = (blob_t**)calloc((size_t)nbuckets, sizeof(blob_t*));
+    if (!t->buckets) return -1;
+    t->nbuckets = nbuckets;
+    return 0;
+}
+
+void blobTableClear(blobTable_t *t) {
+    unsigned long i;
+    if (!t || !t->buckets) return;
+    for (i = 0u; i < t->nbuckets; i++) {
+        blob_t *b = t->buckets[i];
+        while (b) { blob_t *nx = b->next; free(b); b = nx; }
+        t->buckets[i] = NULL;
+    }
+    t->count = 0u; t->refs = 0u; t->bytesShared = 0u;
+}
+
+void blobTableFree(blobTable_t *t) {
+    if (!t) return;
+    blobTableClear(t);
+    free(t->buckets);
+    memset(t, 0, sizeof(*t));
+}
+
+blob_t *blobFind(blobTable_t *t, const indexEntry_t *e, blob_t *after) {
+    blob_t *b;
+    if (!t || !t->buckets || !e) return NULL;
+    b = after ? after->next : t->buckets[bucket_of(t, e->hash)];
+    while (b && !same_content(b, e)) b = b->next;
+    return b;
+}
+
+/* Double the bucket array once chains average two blobs, so lookups stay
+ * O(1) as the locker grows. Keeps the old array if memory is short. */
+static void grow(blobTable_t *t) {
+    unsigned long n = t->nbuckets * 2u;
+    unsigned long i;
+    blob_t **buckets = (blob_t**)calloc((size_t)n, sizeof(blob_t*));
+    if (!buckets) return;
+    for (i = 0u; i < t->nbuckets; i++) {
+        blob_t *b = t->buckets[i];
+        while (b) {
+            blob_t *nx = b->next;
+            unsigned long h = (unsigned long)b->hash % n;
+            b->next = buckets[h];
+            buckets[h] = b;
+            b = nx;
+        }
+    }
+    free(t->buckets);
+    t->buckets = buckets;
+    t->nbuckets = n;
+}
+
+int blobRef(blobTable_t *t, const indexEntry_t *e) {
+    blob_t *b;
+    unsigned long h;
+    if (!t || !t->buckets || !e || e->storedSize == 0u) return -1;
+    h = bucket_of(t, e->hash);
+    for (b = t->buckets[h]; b; b = b->next) {
+        if (b->offset == e->offset) {
+            b->refs++; t->refs++; t->bytesShared += b->storedSize;
+            return 0;
+        }
+    }
+    b = (blob_t*)malloc(sizeof(blob_t));
+    if (!b) return -1;
+    b->offset = e->offset;
+    b->storedSize = e->storedSize;
+    b->originalSize = e->originalSize;
+    b->hash = e->hash;
+    b->flags = e->flags;
+    b->refs = 1u;
+    b->next = t->buckets[h];
+    t->buckets[h] = b;
+    t->count++; t->refs++;
+    if (t->count > t->nbuckets * 2u) grow(t);
+    return 0;
+}
+
+void blobUnref(blobTable_t *t, const indexEntry_t *e) {
+    blob_t *b, *prev = NULL;
+    if (!t || !t->buckets || !e) return;
+    for (b = t->buckets[bucket_of(t, e->hash)]; b; prev = b, b = b->next) {
+        if (b->offset != e->offset) continue;
+        t->refs--;
+        if (--b->refs > 0u) { t->bytesShared -= b->storedSize; return; }
+        if (prev) prev->next = b->next; else t->buckets[bucket_of(t, e->hash)] = b->next;
+        free(b);
+        t->count--;
+        return;
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * dedup.h
+ * Content-addressed blob table: entries whose original content is identical
+ * (same hash, size and encoding flags) share one stored payload in the
+ * locker file. Each blob counts the entries that reference it.
+ */
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "locker.h"
+
+typedef struct blob {
+    unsigned long offset;       /* stored payload in the locker file */
+    unsigned long storedSize;
+    unsigned long originalSize;
+    unsigned int hash;          /* content hash of the original bytes */
+    unsigned int flags;         /* FLAG_COMPRESSED / FLAG_ENCRYPTED */
+    unsigned long refs;         /* entries pointing at this payload */
+    struct blob *next;          /* hash chain */
+} blob_t;
+
+typedef struct {
+    blob_t **buckets;
+    unsigned long nbuckets;
+    unsigned long count;        /* distinct blobs */
+    unsigned long refs;         /* sum of all reference counts */
+    unsigned long bytesShared;  /* stored bytes not written thanks to sharing */
+} blobTable_t;
+
+/* Returns 0 on success. A zeroed table is valid (and empty) until init.
+ * `nbuckets` is the initial size; the table doubles as blobs are added. */
+int blobTableInit(blobTable_t *t, unsigned long nbuckets);
+void blobTableClear(blobTable_t *t);
+void blobTableFree(blobTable_t *t);
+
+/* Iterate candidates for `e`'s content: pass NULL first, then the previous
+ * result. Candidates must still be verified byte for byte. */
+blob_t *blobFind(blobTable_t *t, const indexEntry_t *e, blob_t *after);
+
+/* Count a reference from disk-backed entry `e`, creating its blob if new. */
+int blobRef(blobTable_t *t, const indexEntry_t *e);
+/* Drop the reference from `e`; a blob with no references is forgotten (its
+ * bytes stay in the file until the next checkpoint). No-op if not found. */
+void blobUnref(blobTable_t *t, const indexEntry_t *e);
+
+#endif /* DEDUP_H */
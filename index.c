@@ -0,0 +1,930 @@
+/*
+ * index.c - title hash (linear probing, backward-shift deletion), skip-list
+ * orders and title trigram posting lists over the entry list, with nodes,
+ * links and titles carved from an arena
+ */
+
+#include "index.h"
+#include "terms.h"
+
+#define INDEX_MIN_SLOTS 64ul
+
+#define POST_MIN_SLOTS 256ul
+#define POST_MIN_DEAD 32ul /* dead postings a list keeps before compaction */
+#define POST_BLOCK 128u /* link numbers per posting block */
+#define SEQ_MIN_CAP 1024ul
+
+#define ARENA_BLOCK (64ul * 1024ul)
+#define ARENA_ALIGN 8ul /* also the room kept for the link to the previous block */
+
+/* link `i` of `n` in order `o` */
+#define LINK(n, o, i) ((n)->links[(o) * (n)->level + (i)])
+
+/* the three bytes at `p` as one trigram key (never 0: titles hold no NUL) */
+#define GRAM_KEY(p) (((unsigned long)(unsigned char)(p)[0] << 16) | ((unsigned long)(unsigned char)(p)[1] << 8) | (unsigned long)(unsigned char)(p)[2])
+
+/* A run of at most POST_BLOCK link numbers of one posting list, ascending. */
+struct indexBlock {
+    unsigned int *ids;
+    unsigned int n;
+    unsigned int cap;
+};
+
+/* Posting list of one key (a title trigram or a content term hash): link
+ * numbers of the nodes holding it, ascending across a row of non-empty
+ * blocks, so an add reusing a freed link number moves at most one block
+ * (a full one splits). Removes are lazy: a withdrawn number stays until
+ * `dead` reaches half the list, then one pass drops all such. Readers
+ * skip unlinked numbers and verify the rest (a number may have been
+ * reused by an entry without the key). `key` 0 = empty slot. */
+struct indexGram {
+    unsigned long key;
+    struct indexBlock *blocks;
+    unsigned long nblocks;
+    unsigned long blocksCap;
+    unsigned long count;          /* postings, dead ones included */
+    unsigned long dead;           /* withdrawn since the last compaction (an estimate) */
+};
+
+/* last link number of block `b` */
+#define BLOCK_LAST(b) ((b).ids[(b).n - 1u])
+
+/* `size` bytes from the newest arena block, opening another when it is
+ * full; `aligned` pads to ARENA_ALIGN first (titles need no padding). */
+static void *arena_alloc(index_t *idx, unsigned long size, int aligned) {
+    indexArena_t *a = &idx->arena;
+    unsigned long pad = 0u;
+    void *p;
+    if (a->blocks && aligned) pad = (ARENA_ALIGN - (unsigned long)(a->next - (char*)a->blocks) % ARENA_ALIGN) % ARENA_ALIGN;
+    if (!a->blocks || pad + size > a->left) {
+        char *block = (char*)malloc((size_t)ARENA_BLOCK);
+        if (!block) return NULL;
+        *(void**)block = a->blocks;
+        a->blocks = block;
+        a->next = block + ARENA_ALIGN;
+        a->left = ARENA_BLOCK - ARENA_ALIGN;
+        pad = 0u;
+    }
+    p = a->next + pad;
+    a->next += pad + size;
+    a->left -= pad + size;
+    return p;
+}
+
+indexNode_t *indexNewNode(index_t *idx) {
+    indexNode_t *n;
+    if (!idx) return NULL;
+    n = idx->arena.freeNodes;
+    if (n) idx->arena.freeNodes = n->next;
+    else if (!(n = (indexNode_t*)arena_alloc(idx, (unsigned long)sizeof(indexNode_t), 1))) return NULL;
+    memset(n, 0, sizeof(*n));
+    return n;
+}
+
+void indexFreeNode(index_t *idx, indexNode_t *node) {
+    if (!idx || !node) return;
+    node->next = idx->arena.freeNodes;
+    idx->arena.freeNodes = node;
+}
+
+/* Zeroed links for a node of `level`; NULL if memory is short. */
+static indexNode_t **links_new(index_t *idx, int level) {
+    size_t bytes = (size_t)(INDEX_ORDERS * level) * sizeof(indexNode_t*);
+    indexNode_t **l = idx->arena.freeLinks[level - 1];
+    if (l) memcpy(&idx->arena.freeLinks[level - 1], l, sizeof(indexNode_t**));
+    else if (!(l = (indexNode_t**)arena_alloc(idx, (unsigned long)bytes, 1))) return NULL;
+    memset(l, 0, bytes);
+    return l;
+}
+
+static void links_free(index_t *idx, indexNode_t **l, int level) {
+    memcpy(l, &idx->arena.freeLinks[level - 1], sizeof(indexNode_t**));
+    idx->arena.freeLinks[level - 1] = l;
+}
+
+/* Copy of `title` (cut to MAX_TITLE - 1 bytes) in the arena. */
+static const char *title_intern(index_t *idx, const char *title) {
+    size_t len = strlen(title);
+    char *s;
+    if (len > MAX_TITLE - 1) len = MAX_TITLE - 1;
+    s = (char*)arena_alloc(idx, (unsigned long)len + 1u, 0);
+    if (!s) return NULL;
+    memcpy(s, title, len);
+    s[len] = '\0';
+    return s;
+}
+
+/* FNV-1a over the title */
+static unsigned long title_hash(const char *s) {
+    unsigned long h = 2166136261ul;
+    while (*s) {
+        h ^= (unsigned long)(unsigned char)*s++;
+        h = (h * 16777619ul) & 0xFFFFFFFFul;
+    }
+    return h;
+}
+
+/* Slot holding `title` (hash `h`), or the empty slot where it would go. */
+static unsigned long probe(const index_t *idx, const char *title, unsigned long h) {
+    unsigned long mask = idx->slotCount - 1u;
+    unsigned long i = h & mask;
+    while (idx->slots[i].node) {
+        if (idx->slots[i].hash == h && strcmp(idx->slots[i].node->entry.title, title) == 0) break;
+        i = (i + 1u) & mask;
+    }
+    return i;
+}
+
+/* Rehash into `count` slots (a power of two). */
+static int resize(index_t *idx, unsigned long count) {
+    indexSlot_t *old = idx->slots;
+    unsigned long oldCount = idx->slotCount;
+    unsigned long i;
+    indexSlot_t *slots = (indexSlot_t*)calloc((size_t)count, sizeof(indexSlot_t));
+    if (!slots) return -1;
+    idx->slots = slots;
+    idx->slotCount = count;
+    for (i = 0u; i < oldCount; i++) {
+        if (old[i].node) {
+            unsigned long j = old[i].hash & (count - 1u);
+            while (slots[j].node) j = (j + 1u) & (count - 1u);
+            slots[j] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+/* Empty slot `i` and pull later members of its probe run back into the gap,
+ * so lookups never need tombstones. */
+static void remove_slot(index_t *idx, unsigned long i) {
+    unsigned long mask = idx->slotCount - 1u;
+    unsigned long j = i;
+    idx->slots[i].node = NULL;
+    for (;;) {
+        unsigned long home;
+        j = (j + 1u) & mask;
+        if (!idx->slots[j].node) return;
+        home = idx->slots[j].hash & mask;
+        /* stays put if its home lies cyclically in (i, j] */
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+        idx->slots[i] = idx->slots[j];
+        idx->slots[j].node = NULL;
+        i = j;
+    }
+}
+
+static void remap_title(index_t *idx, const char *title);
+
+/* Map `node` by its title, replacing a node that had it. */
+static int map_title(index_t *idx, indexNode_t *node) {
+    unsigned long h = title_hash(node->entry.title);
+    unsigned long i;
+    /* keep the load factor at or below 3/4 */
+    if (((unsigned long)idx->count + 1u) * 4u > idx->slotCount * 3u) {
+        unsigned long count = idx->slotCount ? idx->slotCount * 2u : INDEX_MIN_SLOTS;
+        if (resize(idx, count) != 0) return -1;
+    }
+    i = probe(idx, node->entry.title, h);
+    idx->slots[i].node = node;
+    idx->slots[i].hash = h;
+    return 0;
+}
+
+/* Skip-list level with P(level > k) = 4^-k, drawn from the link number
+ * (mixed by xorshift), so runs are reproducible and indexes share no
+ * state. */
+static int random_level(unsigned long seq) {
+    unsigned long x = (seq * 2654435761ul + 0x2545F491ul) & 0xFFFFFFFFul;
+    int level = 1;
+    if (x == 0ul) x = 0x2545F491ul;
+    x ^= (x << 13) & 0xFFFFFFFFul;
+    x ^= x >> 17;
+    x ^= (x << 5) & 0xFFFFFFFFul;
+    while (level < INDEX_LEVELS && ((x >> (2 * level)) & 3u) == 0u) level++;
+    return level;
+}
+
+static int cmp_key(const indexNode_t *a, const indexNode_t *b, int o) {
+    int c;
+    if (o == INDEX_BY_SIZE && a->sizeKey != b->sizeKey) return a->sizeKey < b->sizeKey ? -1 : 1;
+    c = strcmp(a->entry.title, b->entry.title);
+    if (c != 0) return c;
+    return a->seq < b->seq ? -1 : (a->seq > b->seq ? 1 : 0);
+}
+
+static void order_insert(index_t *idx, indexNode_t *n, int o) {
+    indexNode_t *update[INDEX_LEVELS];
+    indexNode_t *x = NULL; /* NULL = the head */
+    int i;
+    for (i = idx->levels - 1; i >= 0; i--) {
+        indexNode_t *next = x ? LINK(x, o, i) : idx->orderHead[o][i];
+        while (next && cmp_key(next, n, o) < 0) { x = next; next = LINK(x, o, i); }
+        update[i] = x;
+    }
+    for (i = 0; i < n->level; i++) {
+        indexNode_t **at = update[i] ? &LINK(update[i], o, i) : &idx->orderHead[o][i];
+        LINK(n, o, i) = *at;
+        *at = n;
+    }
+}
+
+static void order_remove(index_t *idx, indexNode_t *n, int o) {
+    indexNode_t *x = NULL;
+    int i;
+    for (i = idx->levels - 1; i >= 0; i--) {
+        indexNode_t **at = x ? &LINK(x, o, i) : &idx->orderHead[o][i];
+        while (*at && *at != n && cmp_key(*at, n, o) < 0) { x = *at; at = &LINK(x, o, i); }
+        if (*at == n) *at = LINK(n, o, i);
+    }
+}
+
+/* Distinct trigram keys of `s` (shorter than MAX_TITLE) into `keys`. */
+static unsigned long grams_of(const char *s, unsigned long *keys) {
+    unsigned long n = 0u, j;
+    size_t len = strlen(s), i;
+    for (i = 0; i + 3u <= len; i++) {
+        unsigned long k = GRAM_KEY(s + i);
+        for (j = 0u; j < n && keys[j] != k; j++) { /* seen? */ }
+        if (j == n) keys[n++] = k;
+    }
+    return n;
+}
+
+static unsigned long post_home(const indexPostings_t *t, unsigned long key) {
+    unsigned long h = (key * 2654435761ul) & 0xFFFFFFFFul;
+    return (h ^ (h >> 16)) & (t->slots - 1u);
+}
+
+static struct indexGram *post_find(const indexPostings_t *t, unsigned long key) {
+    unsigned long i;
+    if (t->slots == 0u) return NULL;
+    for (i = post_home(t, key); t->lists[i].key; i = (i + 1u) & (t->slots - 1u))
+        if (t->lists[i].key == key) return &t->lists[i];
+    return NULL;
+}
+
+/* The list for `key`, created (and the table grown) if missing. Lists are
+ * never removed; an emptied one keeps its slot. */
+static struct indexGram *post_get(indexPostings_t *t, unsigned long key) {
+    struct indexGram *g = post_find(t, key);
+    unsigned long i;
+    if (g) return g;
+    if ((t->count + 1u) * 4u > t->slots * 3u) {
+        unsigned long count = t->slots ? t->slots * 2u : POST_MIN_SLOTS;
+        struct indexGram *old = t->lists;
+        unsigned long oldCount = t->slots;
+        struct indexGram *lists = (struct indexGram*)calloc((size_t)count, sizeof(struct indexGram));
+        if (!lists) return NULL;
+        t->lists = lists;
+        t->slots = count;
+        for (i = 0u; i < oldCount; i++) {
+            if (old[i].key) {
+                unsigned long j = post_home(t, old[i].key);
+                while (lists[j].key) j = (j + 1u) & (count - 1u);
+                lists[j] = old[i];
+            }
+        }
+        free(old);
+    }
+    for (i = post_home(t, key); t->lists[i].key; i = (i + 1u) & (t->slots - 1u)) { /* probe */ }
+    t->lists[i].key = key;
+    t->count++;
+    return &t->lists[i];
+}
+
+static void post_free(indexPostings_t *t) {
+    unsigned long i;
+    for (i = 0u; t->lists && i < t->slots; i++) {
+        unsigned long b;
+        for (b = 0u; b < t->lists[i].nblocks; b++) free(t->lists[i].blocks[b].ids);
+        free(t->lists[i].blocks);
+    }
+    free(t->lists);
+    t->lists = NULL;
+    t->slots = t->count = 0u;
+}
+
+/* First position at or after `lo` whose id is not below `id`: galloping
+ * from `lo`, then a binary search. */
+static unsigned long gallop(const unsigned int *p, unsigned long n, unsigned long lo, unsigned int id) {
+    unsigned long step = 1u, hi = lo;
+    while (hi < n && p[hi] < id) { lo = hi + 1u; hi += step; step <<= 1; }
+    if (hi > n) hi = n;
+    while (lo < hi) {
+        unsigned long mid = lo + (hi - lo) / 2u;
+        if (p[mid] < id) lo = mid + 1u; else hi = mid;
+    }
+    return lo;
+}
+
+/* First block at or after `lo` of `g` whose last id is not below `id`
+ * (nblocks if none), as gallop() does within a block. */
+static unsigned long block_gallop(const struct indexGram *g, unsigned long lo, unsigned int id) {
+    unsigned long step = 1u, hi = lo, n = g->nblocks;
+    while (hi < n && BLOCK_LAST(g->blocks[hi]) < id) { lo = hi + 1u; hi += step; step <<= 1; }
+    if (hi > n) hi = n;
+    while (lo < hi) {
+        unsigned long mid = lo + (hi - lo) / 2u;
+        if (BLOCK_LAST(g->blocks[mid]) < id) lo = mid + 1u; else hi = mid;
+    }
+    return lo;
+}
+
+/* Open an empty block of `cap` ids at position `b` of `g`; NULL if out
+ * of memory. Earlier block pointers are invalidated. */
+static struct indexBlock *block_open(struct indexGram *g, unsigned long b, unsigned int cap) {
+    unsigned int *ids = (unsigned int*)malloc((size_t)cap * sizeof(unsigned int));
+    if (!ids) return NULL;
+    if (g->nblocks == g->blocksCap) {
+        unsigned long n = g->blocksCap ? g->blocksCap * 2u : 1u;
+        struct indexBlock *blocks = (struct indexBlock*)realloc(g->blocks, (size_t)n * sizeof(struct indexBlock));
+        if (!blocks) { free(ids); return NULL; }
+        g->blocks = blocks;
+        g->blocksCap = n;
+    }
+    memmove(g->blocks + b + 1, g->blocks + b, (size_t)(g->nblocks - b) * sizeof(struct indexBlock));
+    g->nblocks++;
+    g->blocks[b].ids = ids;
+    g->blocks[b].n = 0u;
+    g->blocks[b].cap = cap;
+    return &g->blocks[b];
+}
+
+/* 1 if `id` was posted, 0 if already there (a withdrawn posting of a
+ * reused link number, live again), -1 if out of memory. */
+static int post_insert(struct indexGram *g, unsigned int id) {
+    struct indexBlock *k;
+    unsigned long b;
+    unsigned int at;
+    if (g->nblocks == 0u || BLOCK_LAST(g->blocks[g->nblocks-1u]) < id) {
+        /* an append: the last block, or a new one once it is full */
+        b = g->nblocks;
+        if (b > 0u && g->blocks[b-1u].n < POST_BLOCK) b--;
+        else if (!block_open(g, b, b > 0u ? POST_BLOCK : 4u)) return -1;
+        k = &g->blocks[b];
+        at = k->n;
+    } else {
+        b = block_gallop(g, 0u, id);
+        k = &g->blocks[b];
+        at = (unsigned int)gallop(k->ids, k->n, 0u, id);
+        if (k->ids[at] == id) {
+            if (g->dead > 0u) g->dead--;
+            return 0;
+        }
+        if (k->n == POST_BLOCK) {
+            /* split off the upper half */
+            struct indexBlock *next = block_open(g, b + 1u, POST_BLOCK);
+            if (!next) return -1;
+            k = &g->blocks[b];
+            memcpy(next->ids, k->ids + POST_BLOCK / 2u, (size_t)(POST_BLOCK / 2u) * sizeof(unsigned int));
+            next->n = POST_BLOCK / 2u;
+            k->n = POST_BLOCK / 2u;
+            if (at > POST_BLOCK / 2u) { k = next; at -= POST_BLOCK / 2u; }
+        }
+    }
+    if (k->n == k->cap) {
+        unsigned int cap = k->cap * 2u;
+        unsigned int *ids = (unsigned int*)realloc(k->ids, (size_t)cap * sizeof(unsigned int));
+        if (!ids) return -1;
+        k->ids = ids;
+        k->cap = cap;
+    }
+    memmove(k->ids + at + 1, k->ids + at, (size_t)(k->n - at) * sizeof(unsigned int));
+    k->ids[at] = id;
+    k->n++;
+    g->count++;
+    return 1;
+}
+
+/* 1 if link number `id` belongs in list `g` of table `t`: a linked node
+ * whose title (or term set) has the list's key. */
+static int post_holds(const index_t *idx, const indexPostings_t *t, const struct indexGram *g, unsigned int id) {
+    const indexNode_t *n = id < idx->seq ? idx->bySeq[id] : NULL;
+    if (!n) return 0;
+    if (t == &idx->terms) {
+        unsigned long at;
+        for (at = 0u; at < n->termsLen; at += (unsigned long)strlen((const char*)n->terms + at) + 1u)
+            if (termsHash((const char*)n->terms + at) == g->key) return 1;
+    } else {
+        size_t j, len = strlen(n->entry.title);
+        for (j = 0; j + 3u <= len; j++) if (GRAM_KEY(n->entry.title + j) == g->key) return 1;
+    }
+    return 0;
+}
+
+/* Withdraw `id` from `g` (a list of `t`), lazily. Callers first unlink the
+ * node or drop the key from it, so a compaction here sees it gone. */
+static void post_remove(const index_t *idx, const indexPostings_t *t, struct indexGram *g, unsigned int id) {
+    unsigned long b, d, kept;
+    unsigned int i, at;
+    if (!g) return;
+    b = block_gallop(g, 0u, id);
+    if (b == g->nblocks) return;
+    at = (unsigned int)gallop(g->blocks[b].ids, g->blocks[b].n, 0u, id);
+    if (g->blocks[b].ids[at] != id) return;
+    g->dead++;
+    if (g->dead < POST_MIN_DEAD || g->dead * 2u < g->count) return;
+    /* repack the survivors into the leading blocks, filling each; the
+     * write position never passes the read position */
+    for (b = d = kept = 0u, at = 0u; b < g->nblocks; b++) {
+        for (i = 0u; i < g->blocks[b].n; i++) {
+            unsigned int v = g->blocks[b].ids[i];
+            if (!post_holds(idx, t, g, v)) continue;
+            if (at == g->blocks[d].cap) { g->blocks[d++].n = at; at = 0u; }
+            g->blocks[d].ids[at++] = v;
+            kept++;
+        }
+    }
+    if (kept > 0u) g->blocks[d++].n = at;
+    for (b = d; b < g->nblocks; b++) free(g->blocks[b].ids);
+    g->nblocks = d;
+    g->count = kept;
+    g->dead = 0u;
+}
+
+/* 1 if `s` (may be NULL) has trigram `key`. */
+static int has_gram(const char *s, unsigned long key) {
+    size_t j, len;
+    if (!s) return 0;
+    len = strlen(s);
+    for (j = 0; j + 3u <= len; j++) if (GRAM_KEY(s + j) == key) return 1;
+    return 0;
+}
+
+/* Post `id` under every trigram of `title` that `skip` (may be NULL, the
+ * title being replaced) does not hold; on failure the postings made here
+ * are withdrawn again. */
+static int gram_add(index_t *idx, unsigned int id, const char *title, const char *skip) {
+    unsigned long keys[MAX_TITLE];
+    unsigned long n = grams_of(title, keys), i, j;
+    for (i = 0u; i < n; i++) {
+        struct indexGram *g;
+        if (has_gram(skip, keys[i])) continue;
+        g = post_get(&idx->grams, keys[i]);
+        if (!g || post_insert(g, id) < 0) break;
+    }
+    if (i == n) return 0;
+    for (j = 0u; j < i; j++) {
+        if (!has_gram(skip, keys[j])) post_remove(idx, &idx->grams, post_find(&idx->grams, keys[j]), id);
+    }
+    return -1;
+}
+
+/* Withdraw `id` from the trigrams of `title` that `keep` (may be NULL)
+ * does not also hold. */
+static void gram_remove(index_t *idx, unsigned int id, const char *title, const char *keep) {
+    unsigned long keys[MAX_TITLE];
+    unsigned long n = grams_of(title, keys), i;
+    for (i = 0u; i < n; i++) {
+        if (has_gram(keep, keys[i])) continue;
+        post_remove(idx, &idx->grams, post_find(&idx->grams, keys[i]), id);
+    }
+}
+
+/* Grow bySeq and the columns to `cap` link numbers. Arrays already grown
+ * keep their new size if a later one fails; the capacity only moves once
+ * all have. */
+static int grow_seq(index_t *idx, unsigned long cap) {
+    indexColumns_t *c = &idx->cols;
+    unsigned long oldWords = idx->bySeqCap / INDEX_WORD_BITS, words = cap / INDEX_WORD_BITS;
+    void *p;
+    if (!(p = realloc(idx->bySeq, (size_t)cap * sizeof(indexNode_t*)))) return -1;
+    idx->bySeq = (indexNode_t**)p;
+    if (!(p = realloc(c->originalSize, (size_t)cap * sizeof(unsigned long)))) return -1;
+    c->originalSize = (unsigned long*)p;
+    if (!(p = realloc(c->storedSize, (size_t)cap * sizeof(unsigned long)))) return -1;
+    c->storedSize = (unsigned long*)p;
+    if (!(p = realloc(idx->spare, (size_t)cap * sizeof(unsigned long)))) return -1;
+    idx->spare = (unsigned long*)p;
+    if (!(p = realloc(c->flags, (size_t)cap * sizeof(unsigned int)))) return -1;
+    c->flags = (unsigned int*)p;
+    if (!(p = realloc(c->live, (size_t)words * sizeof(unsigned long)))) return -1;
+    c->live = (unsigned long*)p;
+    memset(c->live + oldWords, 0, (size_t)(words - oldWords) * sizeof(unsigned long));
+    if (!(p = realloc(c->pub, (size_t)words * sizeof(unsigned long)))) return -1;
+    c->pub = (unsigned long*)p;
+    memset(c->pub + oldWords, 0, (size_t)(words - oldWords) * sizeof(unsigned long));
+    idx->bySeqCap = cap;
+    return 0;
+}
+
+#define BIT_WORD(seq) ((seq) / INDEX_WORD_BITS)
+#define BIT_MASK(seq) (1ul << ((seq) % INDEX_WORD_BITS))
+
+/* Copy the metadata of linked `node` into the columns. */
+static void set_cols(index_t *idx, const indexNode_t *node) {
+    indexColumns_t *c = &idx->cols;
+    unsigned long s = node->seq;
+    c->originalSize[s] = node->entry.originalSize;
+    c->storedSize[s] = node->entry.storedSize;
+    c->flags[s] = node->entry.flags;
+    c->live[BIT_WORD(s)] |= BIT_MASK(s);
+    if (node->entry.isPublic) c->pub[BIT_WORD(s)] |= BIT_MASK(s);
+    else c->pub[BIT_WORD(s)] &= ~BIT_MASK(s);
+}
+
+/* Bitmap word `w` of the entries in `scope`. */
+static unsigned long scope_word(const index_t *idx, int scope, unsigned long w) {
+    return idx->cols.live[w] & (scope == INDEX_PUBLIC ? idx->cols.pub[w] : ~0ul);
+}
+
+int indexLink(index_t *idx, indexNode_t *node) {
+    const char *title;
+    unsigned long seq;
+    int o, level;
+    if (!idx || !node || !node->entry.title) return -1;
+    /* a link number freed by an unlink first, so the columns follow the
+     * live entries rather than every add made */
+    seq = idx->spareCount > 0u ? idx->spare[idx->spareCount - 1u] : idx->seq;
+    if (seq >= idx->bySeqCap && grow_seq(idx, idx->bySeqCap ? idx->bySeqCap * 2u : SEQ_MIN_CAP) != 0) return -1;
+    level = random_level(seq);
+    title = title_intern(idx, node->entry.title);
+    if (!title) return -1;
+    node->links = links_new(idx, level);
+    if (!node->links) return -1;
+    if (gram_add(idx, (unsigned int)seq, title, NULL) != 0) { links_free(idx, node->links, level); node->links = NULL; return -1; }
+    node->entry.title = title;
+    if (map_title(idx, node) != 0) {
+        gram_remove(idx, (unsigned int)seq, title, NULL);
+        links_free(idx, node->links, level); node->links = NULL;
+        return -1;
+    }
+    node->level = level;
+    node->seq = seq;
+    if (seq == idx->seq) idx->seq++; else idx->spareCount--;
+    idx->bySeq[node->seq] = node;
+    set_cols(idx, node);
+    node->terms = NULL;
+    node->termsLen = 0u;
+    node->sizeKey = node->entry.originalSize;
+    if (level > idx->levels) idx->levels = level;
+    for (o = 0; o < INDEX_ORDERS; o++) order_insert(idx, node, o);
+    node->prev = NULL;
+    node->next = idx->head;
+    if (idx->head) idx->head->prev = node;
+    idx->head = node;
+    idx->count++;
+    return 0;
+}
+
+indexNode_t *indexFind(const index_t *idx, const char *title) {
+    if (!idx || !title || idx->slotCount == 0u) return NULL;
+    return idx->slots[probe(idx, title, title_hash(title))].node;
+}
+
+void indexUnlink(index_t *idx, indexNode_t *node) {
+    int mapped = 0;
+    if (!idx || !node) return;
+    if (idx->slotCount > 0u) {
+        unsigned long i = probe(idx, node->entry.title, title_hash(node->entry.title));
+        if (idx->slots[i].node == node) { remove_slot(idx, i); mapped = 1; }
+    }
+    if (node->links) {
+        int o;
+        indexSetTerms(idx, node, NULL, 0u);
+        for (o = 0; o < INDEX_ORDERS; o++) order_remove(idx, node, o);
+        links_free(idx, node->links, node->level);
+        node->links = NULL;
+        idx->bySeq[node->seq] = NULL;
+        idx->cols.live[BIT_WORD(node->seq)] &= ~BIT_MASK(node->seq);
+        idx->cols.pub[BIT_WORD(node->seq)] &= ~BIT_MASK(node->seq);
+        gram_remove(idx, (unsigned int)node->seq, node->entry.title, NULL);
+        idx->spare[idx->spareCount++] = node->seq;
+        if (mapped) remap_title(idx, node->entry.title);
+    }
+    if (node->prev) node->prev->next = node->next; else idx->head = node->next;
+    if (node->next) node->next->prev = node->prev;
+    node->next = node->prev = NULL;
+    idx->count--;
+}
+
+int indexRename(index_t *idx, indexNode_t *node, const char *newTitle) {
+    indexNode_t *other;
+    const char *title, *oldTitle = node->entry.title;
+    unsigned long i;
+    int o, mapped = 0;
+    if (!idx || !node || !newTitle) return -1;
+    other = indexFind(idx, newTitle);
+    if (other == node) return 0;
+    if (other) return -1;
+    /* the copy and trigrams first: the only steps that can fail */
+    title = title_intern(idx, newTitle);
+    if (!title) return -1;
+    if (node->links && gram_add(idx, (unsigned int)node->seq, title, oldTitle) != 0) return -1;
+    if (idx->slotCount > 0u) {
+        i = probe(idx, node->entry.title, title_hash(node->entry.title));
+        if (idx->slots[i].node == node) { remove_slot(idx, i); mapped = 1; }
+    }
+    /* both orders tie-break on the title */
+    for (o = 0; node->links && o < INDEX_ORDERS; o++) order_remove(idx, node, o);
+    node->entry.title = title;
+    for (o = 0; node->links && o < INDEX_ORDERS; o++) order_insert(idx, node, o);
+    if (node->links) gram_remove(idx, (unsigned int)node->seq, oldTitle, title);
+    /* the slot just freed guarantees room without growing */
+    i = probe(idx, node->entry.title, title_hash(node->entry.title));
+    idx->slots[i].node = node;
+    idx->slots[i].hash = title_hash(node->entry.title);
+    if (mapped && node->links) remap_title(idx, oldTitle);
+    return 0;
+}
+
+void indexUpdate(index_t *idx, indexNode_t *node) {
+    if (!idx || !node || !node->links) return;
+    set_cols(idx, node);
+    if (node->sizeKey == node->entry.originalSize) return;
+    order_remove(idx, node, INDEX_BY_SIZE);
+    node->sizeKey = node->entry.originalSize;
+    order_insert(idx, node, INDEX_BY_SIZE);
+}
+
+void indexFree(index_t *idx) {
+    if (!idx) return;
+    while (idx->head) {
+        indexNode_t *tmp = idx->head;
+        idx->head = tmp->next;
+        if (tmp->entry.data) free(tmp->entry.data);
+        free(tmp->terms);
+    }
+    while (idx->arena.blocks) {
+        void *block = idx->arena.blocks;
+        idx->arena.blocks = *(void**)block;
+        free(block);
+    }
+    memset(&idx->arena, 0, sizeof idx->arena);
+    free(idx->slots);
+    idx->slots = NULL;
+    idx->slotCount = 0u;
+    idx->count = 0;
+    memset(idx->orderHead, 0, sizeof idx->orderHead);
+    idx->levels = 0;
+    post_free(&idx->grams);
+    post_free(&idx->terms);
+    free(idx->bySeq);
+    idx->bySeq = NULL;
+    free(idx->spare);
+    idx->spare = NULL;
+    idx->spareCount = 0u;
+    free(idx->cols.originalSize);
+    free(idx->cols.storedSize);
+    free(idx->cols.flags);
+    free(idx->cols.live);
+    free(idx->cols.pub);
+    memset(&idx->cols, 0, sizeof idx->cols);
+    idx->bySeqCap = 0u;
+    idx->seq = 0u;
+}
+
+/* First node in order `o` not before the key (`title`, `size`): the
+ * descent of a skip-list search. */
+static indexNode_t *seek(const index_t *idx, int o, const char *title, unsigned long size) {
+    const indexNode_t *x = NULL;
+    indexNode_t *next = NULL;
+    int i;
+    for (i = idx->levels - 1; i >= 0; i--) {
+        next = x ? LINK(x, o, i) : idx->orderHead[o][i];
+        while (next) {
+            int before = o == INDEX_BY_SIZE ? next->sizeKey < size : strcmp(next->entry.title, title) < 0;
+            if (!before) break;
+            x = next;
+            next = LINK(x, o, i);
+        }
+    }
+    return x ? LINK(x, o, 0) : idx->orderHead[o][0];
+}
+
+/* `title` lost its mapped node. Lockers written before titles were unique
+ * can hold it twice: map a remaining node with it, if any, so none becomes
+ * unreachable. */
+static void remap_title(index_t *idx, const char *title) {
+    indexNode_t *n, *dup = NULL;
+    unsigned long h, i;
+    for (n = seek(idx, INDEX_BY_TITLE, title, 0u); n && strcmp(n->entry.title, title) == 0; n = LINK(n, INDEX_BY_TITLE, 0)) dup = n;
+    if (!dup) return;
+    h = title_hash(title);
+    i = probe(idx, title, h);
+    idx->slots[i].node = dup;
+    idx->slots[i].hash = h;
+}
+
+unsigned long indexRange(const index_t *idx, const char *from, const char *to, indexVisit_t fn, void *ctx) {
+    indexNode_t *n;
+    unsigned long visited = 0u;
+    if (!idx || !fn) return 0u;
+    n = from ? seek(idx, INDEX_BY_TITLE, from, 0u) : idx->orderHead[INDEX_BY_TITLE][0];
+    for (; n && (!to || strcmp(n->entry.title, to) < 0); n = LINK(n, INDEX_BY_TITLE, 0)) {
+        visited++;
+        if (fn(n, ctx)) break;
+    }
+    return visited;
+}
+
+unsigned long indexPrefix(const index_t *idx, const char *prefix, indexVisit_t fn, void *ctx) {
+    indexNode_t *n;
+    unsigned long visited = 0u;
+    size_t len;
+    if (!idx || !prefix || !fn) return 0u;
+    len = strlen(prefix);
+    for (n = seek(idx, INDEX_BY_TITLE, prefix, 0u); n && strncmp(n->entry.title, prefix, len) == 0; n = LINK(n, INDEX_BY_TITLE, 0)) {
+        visited++;
+        if (fn(n, ctx)) break;
+    }
+    return visited;
+}
+
+unsigned long indexSizeRange(const index_t *idx, unsigned long minSize, unsigned long maxSize, indexVisit_t fn, void *ctx) {
+    indexNode_t *n;
+    unsigned long visited = 0u;
+    if (!idx || !fn) return 0u;
+    for (n = seek(idx, INDEX_BY_SIZE, NULL, minSize); n && n->sizeKey <= maxSize; n = LINK(n, INDEX_BY_SIZE, 0)) {
+        visited++;
+        if (fn(n, ctx)) break;
+    }
+    return visited;
+}
+
+/* Substring check of every title in `scope`, in link order; the bitmap
+ * skips entries out of scope a word at a time. */
+static unsigned long scan_substring(const index_t *idx, const char *pattern, int scope, indexVisit_t fn, void *ctx) {
+    unsigned long w, b, checked = 0u;
+    for (w = 0u; w * INDEX_WORD_BITS < idx->seq; w++) {
+        unsigned long bits = scope_word(idx, scope, w);
+        for (b = 0u; bits; b++, bits >>= 1) {
+            indexNode_t *n;
+            if (!(bits & 1ul)) continue;
+            n = idx->bySeq[w * INDEX_WORD_BITS + b];
+            checked++;
+            if (strstr(n->entry.title, pattern) && fn(n, ctx)) return checked;
+        }
+    }
+    return checked;
+}
+
+/* 1 if link number `seq` is linked and in `scope` (postings may hold
+ * unlinked ones). */
+static int in_scope(const index_t *idx, int scope, unsigned long seq) {
+    return (scope_word(idx, scope, BIT_WORD(seq)) & BIT_MASK(seq)) != 0ul;
+}
+
+/* Insert `g` into lists[0..n) kept shortest first. */
+static void add_list(const struct indexGram **lists, unsigned long n, const struct indexGram *g) {
+    unsigned long j;
+    for (j = n; j > 0u && lists[j-1]->count > g->count; j--) lists[j] = lists[j-1];
+    lists[j] = g;
+}
+
+/* Ids present in all `n` lists (shortest first): the shortest list is
+ * copied and filtered by a galloping search through each other list.
+ * Returns a malloc'd array (NULL if out of memory). */
+static unsigned int *intersect(const struct indexGram **lists, unsigned long n, unsigned long *ncand) {
+    unsigned int *cand = (unsigned int*)malloc((size_t)lists[0]->count * sizeof(unsigned int) + 1u);
+    unsigned long i, j;
+    if (!cand) return NULL;
+    for (i = j = 0u; i < lists[0]->nblocks; j += lists[0]->blocks[i++].n)
+        memcpy(cand + j, lists[0]->blocks[i].ids, (size_t)lists[0]->blocks[i].n * sizeof(unsigned int));
+    *ncand = j;
+    for (j = 1u; j < n && *ncand > 0u; j++) {
+        const struct indexGram *g = lists[j];
+        unsigned long b = 0u, at = 0u, kept = 0u;
+        for (i = 0u; i < *ncand; i++) {
+            unsigned long nb = block_gallop(g, b, cand[i]);
+            if (nb == g->nblocks) break;
+            if (nb != b) { b = nb; at = 0u; }
+            at = gallop(g->blocks[b].ids, g->blocks[b].n, at, cand[i]);
+            if (g->blocks[b].ids[at] == cand[i]) cand[kept++] = cand[i];
+        }
+        *ncand = kept;
+    }
+    return cand;
+}
+
+unsigned long indexSubstring(const index_t *idx, const char *pattern, int scope, indexVisit_t fn, void *ctx) {
+    unsigned long keys[MAX_TITLE];
+    const struct indexGram *lists[MAX_TITLE];
+    unsigned int *cand;
+    unsigned long nkeys, ncand, i, checked = 0u;
+    size_t len;
+    if (!idx || !pattern || !fn) return 0u;
+    len = strlen(pattern);
+    if (len >= MAX_TITLE) return 0u;
+    if (len < 3u) return scan_substring(idx, pattern, scope, fn, ctx);
+    nkeys = grams_of(pattern, keys);
+    for (i = 0u; i < nkeys; i++) {
+        const struct indexGram *g = post_find(&idx->grams, keys[i]);
+        if (!g || g->count == 0u) return 0u;
+        add_list(lists, i, g);
+    }
+    cand = intersect(lists, nkeys, &ncand);
+    if (!cand) return scan_substring(idx, pattern, scope, fn, ctx);
+    /* the trigrams may sit apart in a candidate: verify */
+    for (i = 0u; i < ncand; i++) {
+        indexNode_t *n;
+        if (!in_scope(idx, scope, cand[i])) continue;
+        n = idx->bySeq[cand[i]];
+        checked++;
+        if (strstr(n->entry.title, pattern) && fn(n, ctx)) break;
+    }
+    free(cand);
+    return checked;
+}
+
+/* Post (`add`) or withdraw link number `id` under each of the `len` bytes
+ * of `terms`. A withdrawn set must already be off its node. Returns -1 if
+ * a posting could not be made. */
+static int term_post(index_t *idx, unsigned int id, const unsigned char *terms, unsigned long len, int add) {
+    unsigned long at = 0u;
+    while (at < len) {
+        const char *t = (const char*)terms + at;
+        if (add) {
+            struct indexGram *g = post_get(&idx->terms, termsHash(t));
+            if (!g || post_insert(g, id) < 0) return -1;
+        } else {
+            post_remove(idx, &idx->terms, post_find(&idx->terms, termsHash(t)), id);
+        }
+        at += (unsigned long)strlen(t) + 1u;
+    }
+    return 0;
+}
+
+int indexSetTerms(index_t *idx, indexNode_t *node, unsigned char *terms, unsigned long len) {
+    unsigned char *old;
+    unsigned long oldLen;
+    if (!idx || !node || !node->links) { free(terms); return -1; }
+    old = node->terms;
+    oldLen = node->termsLen;
+    node->terms = NULL;
+    node->termsLen = 0u;
+    if (old) term_post(idx, (unsigned int)node->seq, old, oldLen, 0);
+    free(old);
+    if (!terms || len == 0u) { free(terms); return 0; }
+    if (terms[len-1] != '\0') { free(terms); return -1; } /* malformed */
+    if (term_post(idx, (unsigned int)node->seq, terms, len, 1) != 0) {
+        term_post(idx, (unsigned int)node->seq, terms, len, 0);
+        free(terms);
+        return -1;
+    }
+    node->terms = terms;
+    node->termsLen = len;
+    return 0;
+}
+
+unsigned long indexContent(const index_t *idx, const char *query, int scope, indexVisit_t fn, void *ctx) {
+    termsBuilder_t b;
+    unsigned char *q;
+    const struct indexGram **lists;
+    unsigned int *cand = NULL;
+    unsigned long qLen, nterms = 0u, at, ncand = 0u, i, checked = 0u;
+    if (!idx || !query || !fn) return 0u;
+    termsInit(&b);
+    termsFeed(&b, (const unsigned char*)query, (unsigned long)strlen(query));
+    if (termsFinish(&b, &q, &qLen) != 0 || !q) return 0u;
+    for (at = 0u; at < qLen; at += (unsigned long)strlen((const char*)q + at) + 1u) nterms++;
+    lists = (const struct indexGram**)malloc((size_t)nterms * sizeof(*lists));
+    if (!lists) { free(q); return 0u; }
+    for (at = 0u, i = 0u; at < qLen; at += (unsigned long)strlen((const char*)q + at) + 1u, i++) {
+        const struct indexGram *g = post_find(&idx->terms, termsHash((const char*)q + at));
+        if (!g || g->count == 0u) break;
+        add_list(lists, i, g);
+    }
+    if (i == nterms) cand = intersect(lists, nterms, &ncand);
+    /* distinct terms may share a hash: verify against the term sets */
+    for (i = 0u; cand && i < ncand; i++) {
+        indexNode_t *n;
+        if (!in_scope(idx, scope, cand[i])) continue;
+        n = idx->bySeq[cand[i]];
+        checked++;
+        for (at = 0u; at < qLen; at += (unsigned long)strlen((const char*)q + at) + 1u) {
+            if (!termsHas(n->terms, n->termsLen, (const char*)q + at)) break;
+        }
+        if (at >= qLen && fn(n, ctx)) break;
+    }
+    free(cand);
+    free(lists);
+    free(q);
+    return checked;
+}
+
+void indexTotals(const index_t *idx, int scope, lockerTotals_t *out) {
+    const indexColumns_t *c;
+    unsigned long w, b;
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    if (!idx) return;
+    c = &idx->cols;
+    /* no branch per entry (out-of-scope entries add under a zero mask);
+     * only empty words are skipped */
+    for (w = 0u; w * INDEX_WORD_BITS < idx->seq; w++) {
+        unsigned long bits = scope_word(idx, scope, w);
+        unsigned long base = w * INDEX_WORD_BITS;
+        unsigned long end = idx->seq - base < INDEX_WORD_BITS ? idx->seq - base : INDEX_WORD_BITS;
+        if (!bits) continue;
+        for (b = 0u; b < end; b++) {
+            unsigned long one = (bits >> b) & 1ul, mask = 0ul - one;
+            out->count += one;
+            out->originalBytes += c->originalSize[base + b] & mask;
+            out->storedBytes += c->storedSize[base + b] & mask;
+            out->compressed += one & (unsigned long)(c->flags[base + b] & FLAG_COMPRESSED);
+            out->encrypted += one & (unsigned long)((c->flags[base + b] & FLAG_ENCRYPTED) >> 1);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ * index.h
+ * Entry store maintenance: the doubly-linked entry list of an `index_t`
+ * together with its open-addressing (linear probing) hash on the title and
+ * its ordered views (skip lists by title and by original size), a
+ * trigram index on titles, the content term index and metadata columns
+ * by link number. Every insert,
+ * rename, resize, term update and removal goes through here so they never
+ * disagree; title lookups cost O(1), ordered walks O(log n) to start, and
+ * substring and content queries touch only candidates.
+ */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "locker.h"
+
+/* Nodes come from the index's arena: a zeroed node, or NULL if memory is
+ * short. Hand back nodes that were never linked or have been unlinked
+ * with indexFreeNode (their payload and terms are the caller's). */
+indexNode_t *indexNewNode(index_t *idx);
+void indexFreeNode(index_t *idx, indexNode_t *node);
+
+/* Link `node` at the head of the list and map its title to it. The title
+ * is copied into the arena (cut to MAX_TITLE - 1 bytes), so it may sit in
+ * a temporary buffer until then. A node that already had the title stays
+ * in the list but is shadowed until the newer one is removed or renamed
+ * (legacy files may hold duplicates; new titles are checked with indexFind
+ * first).
+ * Returns -1 if memory is short; the node is then not linked. */
+int indexLink(index_t *idx, indexNode_t *node);
+
+/* The node holding `title`, or NULL. */
+indexNode_t *indexFind(const index_t *idx, const char *title);
+
+/* Remove `node` from the list, hash and orders; the caller frees it. A node
+ * it shadowed takes its title back. */
+void indexUnlink(index_t *idx, indexNode_t *node);
+
+/* Give `node` a new title (copied like indexLink's). Returns -1 if another node already has it (or
+ * memory is short); the node then keeps its title. */
+int indexRename(index_t *idx, indexNode_t *node, const char *newTitle);
+
+/* Refresh the metadata columns of `node` and re-file it in the size order
+ * after its sizes, flags or visibility changed. */
+void indexUpdate(index_t *idx, indexNode_t *node);
+
+/* Give linked `node` the term set `terms` (len bytes, terms.h format, or
+ * NULL to clear it), replacing its postings. Takes ownership of `terms`.
+ * Returns -1 if it is malformed or memory is short; the node then has no
+ * terms. */
+int indexSetTerms(index_t *idx, indexNode_t *node, unsigned char *terms, unsigned long len);
+
+/* Free every node (and resident payload and terms), all lookups and the
+ * arena, the latter a block at a time. */
+void indexFree(index_t *idx);
+
+/* Ordered walks: `fn` gets each node in order and returns non-zero to stop.
+ * Return the number of nodes visited. */
+#define INDEX_BY_TITLE 0
+#define INDEX_BY_SIZE  1
+typedef int (*indexVisit_t)(indexNode_t *node, void *ctx);
+/* Titles in [from, to); NULL leaves that end open. */
+unsigned long indexRange(const index_t *idx, const char *from, const char *to, indexVisit_t fn, void *ctx);
+/* Titles starting with `prefix`. */
+unsigned long indexPrefix(const index_t *idx, const char *prefix, indexVisit_t fn, void *ctx);
+/* Original sizes in [minSize, maxSize] (ties by title). */
+unsigned long indexSizeRange(const index_t *idx, unsigned long minSize, unsigned long maxSize, indexVisit_t fn, void *ctx);
+/* Scope of the scans below and of indexTotals: every entry, or public
+ * ones only (told from the bitmap before any node is read). */
+#define INDEX_ALL    0
+#define INDEX_PUBLIC 1
+/* Titles containing `pattern`, by ascending link number (not add order:
+ * removed entries' numbers are reused). The posting lists of the
+ * pattern's trigrams are intersected first; only titles in all of them
+ * are checked with strstr (patterns under three bytes scan the list).
+ * Returns the number of titles checked, matching or not. */
+unsigned long indexSubstring(const index_t *idx, const char *pattern, int scope, indexVisit_t fn, void *ctx);
+/* Nodes whose term set holds every term of `query` (tokenized as content
+ * is), by ascending link number. Posting lists are intersected and the
+ * survivors checked against their term sets. Returns the number checked. */
+unsigned long indexContent(const index_t *idx, const char *query, int scope, indexVisit_t fn, void *ctx);
+/* Count and sum the entries in `scope` from the columns alone. */
+void indexTotals(const index_t *idx, int scope, lockerTotals_t *out);
+
+#endif /* INDEX_H */
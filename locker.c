@@ -6,448 +6,2385 @@
 #include "compress.h"
 #include "crypto.h"
 #include "util.h"
+#include "platform.h"
 #include "storage.h"
+#include "dedup.h"
+#include "chunk.h"
+#include "index.h"
+#include "terms.h"
+#include "codec.h"
+#include "cache.h"
 
-/* Internal global index */
-static index_t g_index = { NULL, 0 };
-static char g_masterPin[MAX_PIN] = "admin"; /* placeholder; later hash & persist */
-static FILE *g_lockerFile = NULL;            /* optional backing file */
-static char g_lockerPath[1024] = {0};        /* path to current locker file */
-static int g_role = ROLE_PUBLIC;             /* current session role */
+/* A plain entry's payload, resident for lockerViewContent: read and
+ * checked once, then lent out to every view of the entry. Once no view
+ * holds it, it is kept only within the cache budget; a stale one goes with
+ * its last view. */
+typedef struct {
+    unsigned long seq;              /* link number of the entry */
+    int current;                    /* entry not edited or removed since */
+    unsigned char *data;
+    unsigned long size;
+    unsigned long refs;             /* views held on it */
+    unsigned long used;             /* viewClock at its last view */
+} lockerView_t;
+
+/* A payload buffer riding in the write-behind group. The group owns it
+ * until the commit recycles it: an edit or remove meanwhile only lets go
+ * of it, so the entry at `seq` holds it iff its data still points here. */
+typedef struct {
+    unsigned long seq;              /* link number of the entry it was queued for */
+    unsigned char *data;
+    size_t cap;                     /* bytes allocated */
+} lockerQueued_t;
+
+/* One locker session (locker_t): the index, the file and everything kept
+ * between calls. The legacy locker* API runs on a default one. */
+struct lockerSession {
+    index_t index;
+    char masterPin[MAX_PIN];        /* placeholder; later hash & persist */
+    FILE *lockerFile;               /* optional backing file */
+    char lockerPath[1024];          /* path to current locker file */
+    int role;                       /* current session role */
+    int journalReady;               /* base image loaded; appends are valid */
+    int needCheckpoint;             /* journal unusable; rewrite on save */
+    int readOnly;                   /* public session: never writes the file */
+    storageGroup_t group;           /* write-behind queue */
+    double groupSince;              /* platform_clock() when the oldest queued record was queued */
+    lockerQueued_t *queued;         /* payload buffers it carries */
+    unsigned long nqueued;
+    unsigned long queuedCap;
+    unsigned long wbMaxRecords;     /* write-behind thresholds; 0 = write-through */
+    unsigned long wbMaxBytes;
+    double wbMaxSeconds;
+    blobTable_t blobs;              /* shared payloads by content */
+    blobTable_t chunks;             /* stored chunks by content */
+    int blobsStale;                 /* offsets moved: rebuild both before use */
+    int batch;                      /* a batch is open (lockerBeginBatch) */
+    codecEncoder_t enc;
+    double storeSeconds;            /* placing encoded payloads: dedup and journal */
+    unsigned char key[128];         /* master key, derived once per PIN */
+    int keyReady;
+    lockerLockHooks_t hooks;
+    lockerPool_t pool;              /* run NULL: whole-locker passes run inline */
+    int verifyOnOpen;
+    lockerVerifyStats_t verified;   /* last integrity pass */
+    contentCache_t cache;           /* decoded content of hot entries; I/O lock */
+    lockerView_t *views;            /* resident payloads of views; I/O lock */
+    unsigned long nviews;
+    unsigned long viewsCap;
+    unsigned long viewsIdle;        /* bytes of those no view holds */
+    unsigned long viewClock;
+};
+
+static locker_t g_locker;           /* session of the legacy API */
+static int g_lockerReady = 0;
+
+static void sessionInit(locker_t *L, const lockerLockHooks_t *hooks) {
+    memset(L, 0, sizeof(*L));
+    strcpy(L->masterPin, "admin");
+    L->role = ROLE_PUBLIC;
+    L->blobsStale = 1;
+    if (hooks) L->hooks = *hooks;
+}
+
+static locker_t *legacy(void) {
+    if (!g_lockerReady) { sessionInit(&g_locker, NULL); g_lockerReady = 1; }
+    return &g_locker;
+}
+
+/* Session locks (no-ops without hooks). */
+static void lockSession(locker_t *L, int mode) {
+    if (L->hooks.lock) L->hooks.lock(L->hooks.ctx, mode);
+}
+
+static void unlockSession(locker_t *L, int mode) {
+    if (L->hooks.unlock) L->hooks.unlock(L->hooks.ctx, mode);
+}
+
+static int sessionLoadIndex(locker_t *L);
+static void discardGroup(locker_t *L);
+static int sessionSaveIndex(locker_t *L);
+static int sessionFlush(locker_t *L);
+static int sessionCheckpoint(locker_t *L);
+static int sessionAbortBatch(locker_t *L);
+static int sessionAddContent(locker_t *L, const char *title, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic);
+static int sessionGetContent(locker_t *L, const char *title, unsigned char **outBuf, unsigned long *outSize);
+static int verifyAll(locker_t *L, lockerVerifyStats_t *out, const lockerScrubHooks_t *hooks);
+
+/* Journal checkpoint policy: fold the log back into the base image once it
+ * outgrows the image or holds this many records. */
+#define LOCKER_JOURNAL_MAX_RECORDS 4096ul
+
+#define LOCKER_BLOB_BUCKETS 1024ul
+
+/* The master key, derived from the PIN once and kept for the session. */
+static const unsigned char *sessionKey(locker_t *L) {
+    if (!L->keyReady && derive_key(L->masterPin, L->key, sizeof L->key) == 0) return NULL;
+    L->keyReady = 1;
+    return L->key;
+}
+
+/* Drop the cached key (PIN changed, reloaded or session over). */
+static void forgetKey(locker_t *L) {
+    memset(L->key, 0, sizeof L->key);
+    L->keyReady = 0;
+}
+
+/* Decoded-content cache. Readers share it, so every use holds the I/O
+ * lock. Entries are keyed by link number, which a later add can reuse once
+ * the entry is removed: removes drop theirs first. */
+static int cacheLookup(locker_t *L, const indexNode_t *n, unsigned char **out, unsigned long *size) {
+    int rc;
+    if (L->cache.maxBytes == 0ul) return 0;
+    lockSession(L, LOCKER_LOCK_IO);
+    rc = cacheGet(&L->cache, n->seq, out, size);
+    unlockSession(L, LOCKER_LOCK_IO);
+    return rc;
+}
+
+static void cacheKeep(locker_t *L, const indexNode_t *n, const unsigned char *buf, unsigned long size) {
+    if (L->cache.maxBytes == 0ul) return;
+    lockSession(L, LOCKER_LOCK_IO);
+    cachePut(&L->cache, n->seq, buf, size);
+    unlockSession(L, LOCKER_LOCK_IO);
+}
+
+/* Free resident payload `i`; the slot is filled from the end, so callers
+ * walk backwards. Caller holds the I/O lock. */
+static void viewFree(locker_t *L, unsigned long i) {
+    if (L->views[i].refs == 0ul) L->viewsIdle -= L->views[i].size;
+    free(L->views[i].data);
+    L->views[i] = L->views[--L->nviews];
+}
+
+/* Drop the least recently viewed payloads no view holds until they fit
+ * the cache budget (all of them with the cache off). */
+static void viewTrim(locker_t *L) {
+    while (L->viewsIdle > L->cache.maxBytes) {
+        unsigned long i, victim = L->nviews;
+        for (i = 0; i < L->nviews; i++) {
+            if (L->views[i].refs == 0ul && (victim == L->nviews || L->views[i].used < L->views[victim].used)) victim = i;
+        }
+        if (victim == L->nviews) break;
+        viewFree(L, victim);
+    }
+}
+
+/* A resident payload no longer matches its entry: free it now unless
+ * views still hold it (the last release does). */
+static void viewStale(locker_t *L, unsigned long i) {
+    L->views[i].current = 0;
+    if (L->views[i].refs == 0ul) viewFree(L, i);
+}
+
+/* Content of `n` is about to change or go: later reads and views must not
+ * get the old bytes (views already held keep them). */
+static void cacheForget(locker_t *L, const indexNode_t *n) {
+    unsigned long i;
+    if (L->cache.count == 0ul && L->nviews == 0ul) return;
+    lockSession(L, LOCKER_LOCK_IO);
+    cacheDrop(&L->cache, n->seq);
+    for (i = L->nviews; i-- > 0; ) if (L->views[i].current && L->views[i].seq == n->seq) viewStale(L, i);
+    unlockSession(L, LOCKER_LOCK_IO);
+}
+
+/* Link numbers are reused after a reload, or the PIN changed. */
+static void cacheForgetAll(locker_t *L) {
+    unsigned long i;
+    lockSession(L, LOCKER_LOCK_IO);
+    cacheClear(&L->cache);
+    for (i = L->nviews; i-- > 0; ) if (L->views[i].current) viewStale(L, i);
+    unlockSession(L, LOCKER_LOCK_IO);
+}
+
+/* Resident payloads, and the views held on them, end with the session. */
+static void releaseViews(locker_t *L) {
+    unsigned long i;
+    for (i = 0; i < L->nviews; i++) free(L->views[i].data);
+    L->nviews = 0;
+    L->viewsIdle = 0;
+}
 
 /* Accessor */
-index_t *lockerGetIndex(void) { return &g_index; }
-int lockerGetRole(void) { return g_role; }
-
-/* File open helper (creates file if missing) */
-static int openLockerFile(const char *lockerPath) {
-    lockerHeader_t hdr;
-    if (g_lockerFile) return 0;
-    g_lockerFile = fopen(lockerPath, "r+b");
-    if (!g_lockerFile) {
-        g_lockerFile = fopen(lockerPath, "w+b");
-        if (!g_lockerFile) return -1;
-        hdr.magic = LOCKER_MAGIC; hdr.version = LOCKER_VERSION; hdr.count = 0; 
-        strncpy(hdr.masterPin, "admin", MAX_PIN-1); hdr.masterPin[MAX_PIN-1]='\0';
-        strncpy(g_masterPin, "admin", MAX_PIN-1); g_masterPin[MAX_PIN-1]='\0';
-        fwrite(&hdr, sizeof hdr, 1, g_lockerFile); fflush(g_lockerFile);
+static int sessionGetRole(locker_t *L) { return L->role; }
+
+/* File open helper (creates file if missing, except in read-only mode
+ * where a missing locker simply opens empty) */
+static int openLockerFile(locker_t *L, const char *lockerPath) {
+    if (L->lockerFile) return 0;
+    if (L->readOnly) {
+        L->lockerFile = fopen(lockerPath, "rb");
+        if (lockerPath && lockerPath[0]) strncpy(L->lockerPath, lockerPath, sizeof(L->lockerPath)-1);
+        return 0;
+    }
+    L->lockerFile = fopen(lockerPath, "r+b");
+    if (!L->lockerFile) {
+        /* new locker: write an empty base image with the default PIN */
+        strncpy(L->masterPin, "admin", MAX_PIN-1); L->masterPin[MAX_PIN-1]='\0';
+        forgetKey(L);
+        if (storageSaveAll(lockerPath, &L->index, L->masterPin) != 0) return -1;
+        L->lockerFile = fopen(lockerPath, "r+b");
+        if (!L->lockerFile) return -1;
     }
     /* remember path for persistence helpers */
-    if (lockerPath && lockerPath[0]) strncpy(g_lockerPath, lockerPath, sizeof(g_lockerPath)-1);
+    if (lockerPath && lockerPath[0]) strncpy(L->lockerPath, lockerPath, sizeof(L->lockerPath)-1);
     return 0;
 }
 
-int lockerOpen(const char *lockerPath, const char *pin) {
+/* Drop the session without saving: close the file and free the index. */
+static void releaseSession(locker_t *L) {
+    if (L->lockerFile) { fclose(L->lockerFile); L->lockerFile = NULL; }
+    discardGroup(L);
+    storageGroupFree(&L->group);
+    free(L->queued); L->queued = NULL; L->queuedCap = 0;
+    codec_encoderFree(&L->enc); L->storeSeconds = 0.0; forgetKey(L);
+    blobTableFree(&L->blobs); blobTableFree(&L->chunks); L->blobsStale = 1;
+    cacheClear(&L->cache); /* the budget stays */
+    releaseViews(L);
+    L->journalReady = 0; L->needCheckpoint = 0; L->readOnly = 0;
+    L->lockerPath[0] = '\0'; /* nothing left to save */
+    indexFree(&L->index);
+    L->index.baseBytes = 0u; L->index.journalBytes = 0u; L->index.journalRecords = 0u;
+    L->index.termsOn = 0;
+}
+
+static int sessionOpen(locker_t *L, const char *lockerPath, const char *pin) {
     if (!lockerPath || !*lockerPath) return -1;
-    if (openLockerFile(lockerPath) != 0) return -1;
+    /* public sessions never mutate, so they open the file read-only */
+    if (!L->lockerFile) L->readOnly = (pin && *pin) ? 0 : 1;
+    if (openLockerFile(L, lockerPath) != 0) return -1;
     /* attempt to load persisted index; non-fatal if it fails */
-    if (lockerLoadIndex() != 0) {
+    if (sessionLoadIndex(L) != 0) {
         DBG("[DBG] lockerLoadIndex: no persisted data or error\n");
     }
     if (pin && *pin) {
-        if (strcmp(pin, g_masterPin) != 0) { DBG("[DBG] PIN mismatch\n"); return -1; }
-        g_role = ROLE_ADMIN;
+        if (strcmp(pin, L->masterPin) != 0) { DBG("[DBG] PIN mismatch\n"); releaseSession(L); return -1; }
+        L->role = ROLE_ADMIN;
+        /* records of a batch cut short are ignored; wipe them before appending */
+        if (!L->readOnly && L->journalReady) storageClearTail(L->lockerFile, &L->index);
     } else {
-        g_role = ROLE_PUBLIC;
+        L->role = ROLE_PUBLIC;
+    }
+    if (L->verifyOnOpen && verifyAll(L, &L->verified, NULL) != 0) {
+        DBG("[DBG] open-time integrity check could not run\n");
     }
     return 0;
 }
 
-int lockerClose(void) {
+static int sessionClose(locker_t *L) {
+    if (L->batch) sessionAbortBatch(L);
+    if (!L->readOnly) sessionSaveIndex(L);
+    releaseSession(L);
+    return 0;
+}
+
+static int rewriteImage(locker_t *L, const char *newPin);
+
+static int sessionChangePIN(locker_t *L, const char *oldPin, const char *newPin) {
+    unsigned char key[128];
+    char pin[MAX_PIN];
+    int rc;
+    if (!oldPin || !newPin) return -1;
+    if (L->readOnly) return -3;
+    if (L->batch) return LOCKER_ERR_BATCH;
+    if (strcmp(oldPin, L->masterPin) != 0) return -2;
+    if (L->lockerPath[0] == '\0') return -1;
+    strncpy(pin, newPin, MAX_PIN-1); pin[MAX_PIN-1] = '\0'; /* as kept */
+    if (derive_key(oldPin, key, sizeof key) == 0) return -3;
+    if (derive_key(pin, key, sizeof key) == 0) return -4;
+    memset(key, 0, sizeof key);
+    /* Every encrypted payload and chunk is re-encrypted as the rewrite
+     * copies it, one buffer at a time, and the manifests written to the new
+     * image point at the new copies; the PIN changes only once that image
+     * is in place, so a failure leaves the locker as it was (queued
+     * records are committed first so that holds for them too). */
+    sessionFlush(L);
+    rc = rewriteImage(L, pin);
+    if (rc != 0) return rc;
+    strncpy(L->masterPin, pin, MAX_PIN-1); L->masterPin[MAX_PIN-1] = '\0';
+    forgetKey(L);
+    cacheForgetAll(L); /* no plaintext decoded under the old PIN outlives it */
+    return 0;
+}
+
+/* Find node by title (title hash, O(1)) */
+static indexNode_t *findNode(locker_t *L, const char *title) {
+    return indexFind(&L->index, title);
+}
+
+/* 0 if `title` fits and no entry other than `self` uses it. */
+static int titleFree(locker_t *L, const char *title, const indexNode_t *self) {
     indexNode_t *n;
-    lockerSaveIndex();
-    if (g_lockerFile) { fclose(g_lockerFile); g_lockerFile = NULL; }
-    /* free list */
-    n = g_index.head;
-    while (n) {
-        indexNode_t *nx = n->next;
-        if (n->entry.data) free(n->entry.data);
-        free(n);
-        n = nx;
+    if (strlen(title) >= MAX_TITLE) return -1;
+    n = findNode(L, title);
+    return (n && n != self) ? LOCKER_ERR_EXISTS : 0;
+}
+
+/* Journal helpers: log a change so the save costs only its size. If the
+ * journal can't be used, the next save falls back to a full checkpoint.
+ * In write-behind mode records are queued and committed in groups; a
+ * queued payload stays resident until its group is on disk. */
+
+/* 1 if the resident payload of `e` rides in the write-behind group. */
+static int queuedPayload(const locker_t *L, const indexEntry_t *e) {
+    unsigned long end = L->index.baseBytes + L->index.journalBytes;
+    unsigned long i;
+    if (!e->data || L->nqueued == 0u || e->offset < end - L->group.len || e->offset >= end) return 0;
+    for (i = 0; i < L->nqueued; i++) if (L->queued[i].data == e->data) return 1;
+    return 0;
+}
+
+/* Free an entry's resident bytes, unless they are the encoder's work
+ * buffer, which an entry only borrows until its record is written, or a
+ * queued payload, which its group frees. */
+static void freePayload(locker_t *L, indexEntry_t *e) {
+    if (e->data && e->data != L->enc.work && !queuedPayload(L, e)) free(e->data);
+    e->data = NULL;
+}
+
+/* Once logged, a payload lives on disk and is dropped from memory; an
+ * adopted buffer goes back to the encoder for the next adds. */
+static void releaseLogged(locker_t *L, indexEntry_t *e) {
+    if (e->data && e->data != L->enc.work) codec_recycle(&L->enc, e->data, (size_t)e->storedSize);
+    e->data = NULL;
+}
+
+/* After the journal call: a payload still borrowed (queued, or the journal
+ * failed) takes over the work buffer. */
+static void keepPayload(locker_t *L, indexEntry_t *e) {
+    if (e->data && e->data == L->enc.work) e->data = codec_adopt(&L->enc, (size_t)e->storedSize, NULL);
+}
+
+/* Count a payload that just reached the disk in the blob table. Manifests
+ * are never shared; their chunks were counted as they were written. */
+static void refPayload(locker_t *L, const indexEntry_t *e) {
+    if (!L->blobsStale && e->storedSize > 0u && !(e->flags & FLAG_CHUNKED)) blobRef(&L->blobs, e);
+}
+
+/* Batches queue like write-behind (with its default bounds unless set):
+ * a large batch is written a group at a time, each commit visiting only
+ * that group's payloads. */
+static storageGroup_t *journalGroup(locker_t *L) {
+    return (L->wbMaxRecords > 0u || L->batch) ? &L->group : NULL;
+}
+
+/* The entry a queued payload was queued for, if it still holds it. */
+static indexNode_t *queuedOwner(locker_t *L, const lockerQueued_t *q) {
+    indexNode_t *n = q->seq < L->index.bySeqCap ? L->index.bySeq[q->seq] : NULL;
+    return n && n->entry.data == q->data ? n : NULL;
+}
+
+/* Drop the queued records (a checkpoint supersedes them): payloads still
+ * held go back to their entries, the others are freed. */
+static void discardGroup(locker_t *L) {
+    unsigned long i;
+    for (i = 0; i < L->nqueued; i++) {
+        if (!queuedOwner(L, &L->queued[i])) free(L->queued[i].data);
     }
-    g_index.head = NULL; g_index.count = 0;
+    L->nqueued = 0;
+    storageGroupDiscard(&L->group);
+}
+
+/* The payload of `n` was just queued: the group takes its buffer over
+ * (adopting the work buffer at full size, for the pool). -1 if out of
+ * memory. */
+static int queuePayload(locker_t *L, indexNode_t *n) {
+    lockerQueued_t *q;
+    size_t cap = (size_t)n->entry.storedSize;
+    if (L->nqueued == L->queuedCap) {
+        unsigned long qc = L->queuedCap ? L->queuedCap * 2u : 64u;
+        q = (lockerQueued_t*)realloc(L->queued, (size_t)qc * sizeof(lockerQueued_t));
+        if (!q) return -1;
+        L->queued = q;
+        L->queuedCap = qc;
+    }
+    if (n->entry.data == L->enc.work) {
+        unsigned char *p = codec_adopt(&L->enc, cap, &cap);
+        if (!p) return -1;
+        n->entry.data = p;
+    }
+    q = &L->queued[L->nqueued++];
+    q->seq = n->seq;
+    q->data = n->entry.data;
+    q->cap = cap;
     return 0;
 }
 
-int lockerChangePIN(const char *oldPin, const char *newPin) {
-    unsigned char oldKey[128];
-    unsigned char newKey[128];
-    size_t klen;
+/* Commit the queued group with one write. Payloads it carried now live on
+ * disk and go back to the encoder; only the group's own list is visited,
+ * so a commit costs the size of its group. */
+static int commitGroup(locker_t *L) {
+    unsigned long i;
     indexNode_t *n;
-    if (!oldPin || !newPin) return -1;
-    if (strcmp(oldPin, g_masterPin) != 0) return -2;
-    klen = sizeof oldKey;
-    if (derive_key(oldPin, oldKey, klen) == 0) return -3;
-    if (derive_key(newPin, newKey, klen) == 0) return -4;
-    /* Re-encrypt all encrypted entries from old key to new key, in-place */
-    n = g_index.head;
-    while (n) {
-        if ((n->entry.flags & FLAG_ENCRYPTED) && n->entry.storedSize > 0) {
-            xor_cipher(n->entry.data, (size_t)n->entry.storedSize, oldKey, klen);
-            xor_cipher(n->entry.data, (size_t)n->entry.storedSize, newKey, klen);
+    if (L->group.len == 0u) return 0;
+    if (storageGroupCommit(L->lockerFile, &L->index, &L->group) != 0) {
+        /* payloads are still resident: a checkpoint writes them out */
+        discardGroup(L);
+        L->needCheckpoint = 1;
+        return -1;
+    }
+    for (i = 0; i < L->nqueued; i++) {
+        n = queuedOwner(L, &L->queued[i]);
+        if (n) {
+            n->entry.data = NULL;
+            refPayload(L, &n->entry);
         }
-        n = n->next;
+        codec_recycle(&L->enc, L->queued[i].data, L->queued[i].cap);
     }
-    strncpy(g_masterPin, newPin, MAX_PIN-1); g_masterPin[MAX_PIN-1] = '\0';
-    return lockerSaveIndex();
+    L->nqueued = 0;
+    DBG("[DBG] group commit #%lu\n", L->group.commits);
+    return 0;
+}
+
+/* The oldest queued record has waited longer than the write-behind bound. */
+static int groupExpired(locker_t *L) {
+    return L->wbMaxSeconds > 0.0 && L->group.records > 0u
+        && platform_clock() - L->groupSince >= L->wbMaxSeconds;
 }
 
-/* Find node by title: returns node and previous via outPrev (may be NULL) */
-static indexNode_t *findNode(const char *title, indexNode_t **outPrev) {
-    indexNode_t *p = NULL; indexNode_t *n = g_index.head;
-    while (n) {
-        if (strcmp(n->entry.title, title) == 0) { if (outPrev) *outPrev = p; return n; }
-        p = n; n = n->next;
+/* After a record was logged: release it (write-through) or commit the group
+ * once a threshold is reached. `n` is the entry it logged, if any. */
+static void journalLogged(locker_t *L, indexNode_t *n) {
+    indexEntry_t *e = n ? &n->entry : NULL;
+    /* shared payloads are on disk already; write-through ones are now */
+    if (e && (!e->data || !journalGroup(L))) {
+        releaseLogged(L, e);
+        refPayload(L, e);
+    } else if (e && queuePayload(L, n) != 0) {
+        /* not noted: commit it now rather than leave it resident */
+        if (commitGroup(L) == 0) {
+            releaseLogged(L, e);
+            refPayload(L, e);
+        }
+        return;
     }
-    if (outPrev) {
-        *outPrev = NULL;
+    if (!journalGroup(L)) return;
+    if (L->group.records == 1u) L->groupSince = platform_clock();
+    if (L->wbMaxRecords == 0u ? (L->group.records >= LOCKER_WB_RECORDS || L->group.len >= LOCKER_WB_BYTES)
+        : (L->group.records >= L->wbMaxRecords || (L->wbMaxBytes > 0u && L->group.len >= L->wbMaxBytes)
+           || groupExpired(L))) {
+        commitGroup(L);
     }
-    return NULL;
 }
 
-int lockerAddFile(const char *filepath, const char *title, int compressFlag, int encryptFlag, int makePublic) {
-    unsigned char *inBuf = NULL;
-    size_t inSize = 0;
-    unsigned char *workBuf = NULL;
-    size_t workCap, workSize;
-    unsigned char key[128];
-    unsigned int hash32 = 0u;
-    int rc;
-    indexNode_t *node;
+static void journalAdd(locker_t *L, indexNode_t *n) {
+    if (L->needCheckpoint || !L->journalReady) L->needCheckpoint = 1;
+    else if (storageAppendAdd(L->lockerFile, &L->index, journalGroup(L), &n->entry) != 0) L->needCheckpoint = 1;
+    else journalLogged(L, n);
+    keepPayload(L, &n->entry);
+}
 
-    if (g_role != ROLE_ADMIN) return -3; /* only admin */
-    if (!title || !*title) return -1;
-    /* Allow empty filepath to create an empty file entry */
-    if (!filepath || !*filepath) {
-        inBuf = (unsigned char*)""; /* safe for memcpy with size 0 */
-        inSize = 0;
-        rc = 0;
-    } else {
-        rc = util_readFile(filepath, &inBuf, &inSize);
-        if (rc != 0) return rc;
-    }
-    if (inSize > 0) {
-        hash32 = (unsigned int)compute_file_hash(inBuf, inSize);
-    } else {
-        hash32 = 0u;
-    }
-    workCap = inSize * 2 + 4;
-    workBuf = (unsigned char*)malloc(workCap);
-    if (!workBuf) { free(inBuf); return -5; }
-    if (compressFlag && inSize > 0) {
-        workSize = rle_compress(inBuf, inSize, workBuf, workCap);
-        if (workSize == 0) { memcpy(workBuf, inBuf, inSize); workSize = inSize; compressFlag = 0; }
-    } else { memcpy(workBuf, inBuf, inSize); workSize = inSize; }
-    if (encryptFlag && workSize > 0) {
-        if (derive_key(g_masterPin, key, sizeof key) == 0) { free(inBuf); free(workBuf); return -6; }
-        xor_cipher(workBuf, workSize, key, sizeof key);
-    }
-    /* create node */
-    node = (indexNode_t*)malloc(sizeof(indexNode_t));
-    if (!node) { free(inBuf); free(workBuf); return -7; }
-    memset(&node->entry, 0, sizeof(node->entry));
-    strncpy(node->entry.title, title, MAX_TITLE-1);
-    node->entry.originalSize = (unsigned long)inSize;
-    node->entry.storedSize = (unsigned long)workSize;
-    node->entry.flags = (compressFlag?FLAG_COMPRESSED:0u) | (encryptFlag?FLAG_ENCRYPTED:0u);
-    node->entry.hash = hash32;
-    node->entry.isPublic = makePublic ? 1 : 0;
-    if (workSize > 0) {
-        node->entry.data = (unsigned char*)malloc(workSize);
-        if (!node->entry.data) { free(node); free(inBuf); free(workBuf); return -8; }
-        memcpy(node->entry.data, workBuf, workSize);
-    } else {
-        node->entry.data = NULL; /* zero-length payload */
+static void journalEdit(locker_t *L, const char *oldTitle, indexNode_t *n) {
+    if (L->needCheckpoint || !L->journalReady) L->needCheckpoint = 1;
+    else if (storageAppendEdit(L->lockerFile, &L->index, journalGroup(L), oldTitle, &n->entry) != 0) L->needCheckpoint = 1;
+    else journalLogged(L, n);
+    keepPayload(L, &n->entry);
+}
+
+static void journalRemove(locker_t *L, const char *title) {
+    if (L->needCheckpoint || !L->journalReady) { L->needCheckpoint = 1; return; }
+    if (storageAppendRemove(L->lockerFile, &L->index, journalGroup(L), title) != 0) { L->needCheckpoint = 1; return; }
+    journalLogged(L, NULL);
+}
+
+static void journalTerms(locker_t *L, const indexNode_t *n) {
+    if (L->needCheckpoint || !L->journalReady) { L->needCheckpoint = 1; return; }
+    if (storageAppendTerms(L->lockerFile, &L->index, journalGroup(L), n->entry.title, n->terms, n->termsLen, L->masterPin) != 0) { L->needCheckpoint = 1; return; }
+    journalLogged(L, NULL);
+}
+
+/* Content index upkeep after `n` got new content: give it the terms
+ * collected in `b` (released here) and log them after the entry's own
+ * record. Nothing is kept unless the locker has the index on. */
+static void setTerms(locker_t *L, indexNode_t *n, termsBuilder_t *b) {
+    unsigned char *terms;
+    unsigned long len;
+    if (!L->index.termsOn) { termsFree(b); return; }
+    if (termsFinish(b, &terms, &len) != 0) { terms = NULL; len = 0u; }
+    indexSetTerms(&L->index, n, terms, len);
+    journalTerms(L, n);
+}
+
+static void setTermsOf(locker_t *L, indexNode_t *n, const unsigned char *text, unsigned long len) {
+    termsBuilder_t b;
+    termsInit(&b);
+    if (L->index.termsOn) termsFeed(&b, text, len);
+    setTerms(L, n, &b);
+}
+
+/* Blob-table key of one chunk of chunked entry `e`: chunks only match
+ * chunks stored with the same encoding. */
+static void chunkProbe(indexEntry_t *probe, const indexEntry_t *e, const storageChunkRef_t *r) {
+    memset(probe, 0, sizeof(*probe));
+    probe->offset = r->offset;
+    probe->storedSize = r->storedSize;
+    probe->originalSize = r->originalSize;
+    probe->hash = r->hash;
+    probe->flags = r->flags | (e->flags & FLAG_ENCRYPTED);
+}
+
+/* Count (or, with `drop`, release) the references a chunked entry holds on
+ * its chunks. Returns -1 if the manifest cannot be read. */
+static int refChunks(locker_t *L, const indexEntry_t *e, int drop) {
+    unsigned long count, k;
+    unsigned char *m = storageLoadManifest(L->lockerFile, e, &count);
+    if (!m) return -1;
+    for (k = 0u; k < count; k++) {
+        storageChunkRef_t r;
+        indexEntry_t probe;
+        if (storageManifestGet(m, k, &r) != 0) continue;
+        chunkProbe(&probe, e, &r);
+        if (drop) blobUnref(&L->chunks, &probe); else blobRef(&L->chunks, &probe);
     }
-    node->next = g_index.head; g_index.head = node; g_index.count++;
-    /* Only free inBuf if it was allocated by util_readFile. When filepath is empty,
-       inBuf points to a string literal and must not be freed. */
-    if (filepath && *filepath) free(inBuf);
-    free(workBuf);
-    DBG("[DBG] Added entry %s (orig=%lu stored=%lu flags=0x%X public=%d)\n", node->entry.title, node->entry.originalSize, node->entry.storedSize, node->entry.flags, node->entry.isPublic);
+    free(m);
     return 0;
 }
 
-int lockerExtractFile(const char *title, const char *outputPath) {
+/* Content-addressed payload sharing. The blob table holds disk-backed
+ * payloads and the chunk table the chunks of chunked entries; both are
+ * rebuilt from the index after offsets move. */
+static blobTable_t *blobs(locker_t *L) {
     indexNode_t *n;
-    unsigned char *buf = NULL, *tmp = NULL;
-    size_t nbytes, outN;
-    unsigned char key[128];
-    unsigned int calcHash;
-
-    if (!title || !outputPath) return -1;
-    n = findNode(title, NULL);
-    if (!n) return -2;
-    if (g_role == ROLE_PUBLIC && !n->entry.isPublic) return -3;
-    DBG("[DBG] lockerExtractFile: found entry '%s' stored=%lu orig=%lu flags=0x%X public=%d\n", n->entry.title, n->entry.storedSize, n->entry.originalSize, n->entry.flags, n->entry.isPublic);
-    nbytes = (size_t)n->entry.storedSize;
-    if (nbytes > 0) {
-        buf = (unsigned char*)malloc(nbytes);
-        if (!buf) return -4;
-        memcpy(buf, n->entry.data, nbytes);
-    } else {
-        buf = NULL; /* zero-length content */
+    if (!L->blobsStale) return &L->blobs;
+    if (!L->blobs.buckets && blobTableInit(&L->blobs, LOCKER_BLOB_BUCKETS) != 0) return NULL;
+    if (!L->chunks.buckets && blobTableInit(&L->chunks, LOCKER_BLOB_BUCKETS) != 0) return NULL;
+    blobTableClear(&L->blobs);
+    blobTableClear(&L->chunks);
+    for (n = L->index.head; n; n = n->next) {
+        if (n->entry.flags & FLAG_CHUNKED) refChunks(L, &n->entry, 0);
+        else if (!n->entry.data && n->entry.storedSize > 0u) blobRef(&L->blobs, &n->entry);
     }
-    if ((n->entry.flags & FLAG_ENCRYPTED) && nbytes > 0) {
-        if (derive_key(g_masterPin, key, sizeof key) == 0) { free(buf); return -5; }
-        xor_cipher(buf, nbytes, key, sizeof key);
+    L->blobsStale = 0;
+    return &L->blobs;
+}
+
+/* Point `e` (sizes, flags and hash already set) at an identical payload
+ * already in the file. Candidates are verified byte for byte. Returns 1 if
+ * shared. */
+static int sharePayload(locker_t *L, indexEntry_t *e, const unsigned char *work, size_t workSize) {
+    blobTable_t *t;
+    blob_t *b;
+    unsigned char *cmp;
+    int found = 0;
+    if (workSize == 0 || !L->lockerFile || L->needCheckpoint || !L->journalReady) return 0;
+    t = blobs(L);
+    if (!t || !blobFind(t, e, NULL)) return 0;
+    cmp = codec_spare(&L->enc, workSize);
+    if (!cmp) return 0;
+    for (b = blobFind(t, e, NULL); b && !found; b = blobFind(t, e, b)) {
+        indexEntry_t probe;
+        memset(&probe, 0, sizeof(probe));
+        probe.offset = b->offset;
+        probe.storedSize = b->storedSize;
+        if (storageReadPayload(L->lockerFile, &probe, cmp) == 0 && memcmp(cmp, work, workSize) == 0) {
+            e->offset = b->offset;
+            found = 1;
+        }
     }
-    if ((n->entry.flags & FLAG_COMPRESSED) && nbytes > 0) {
-        tmp = (unsigned char*)malloc((size_t)n->entry.originalSize);
-        if (!tmp) { free(buf); return -6; }
-        outN = rle_decompress(buf, nbytes, tmp, (size_t)n->entry.originalSize);
-        free(buf);
-        if (outN != (size_t)n->entry.originalSize) { free(tmp); return -7; }
-        buf = tmp; nbytes = outN;
+    return found;
+}
+
+/* Give `e` the payload in the encoder's work buffer (workSize bytes):
+ * shared with an identical stored one when possible, otherwise resident
+ * until it is logged. A usable journal logs or queues it at once, so `e`
+ * just borrows the buffer meanwhile; otherwise it takes the buffer over. */
+static int storePayload(locker_t *L, indexEntry_t *e, size_t workSize) {
+    e->data = NULL;
+    if (workSize > 0 && !sharePayload(L, e, L->enc.work, workSize)) {
+        if (!storageHasRoom(&L->index, (unsigned long)workSize)) return LOCKER_ERR_TOO_LARGE;
+        if (L->journalReady && !L->needCheckpoint) e->data = L->enc.work;
+        else if ((e->data = codec_adopt(&L->enc, workSize, NULL)) == NULL) return -8;
     }
-    /* Integrity check on the original content */
-    if (n->entry.originalSize > 0) {
-        calcHash = (unsigned int)compute_file_hash(buf, (size_t)n->entry.originalSize);
-        if (calcHash != n->entry.hash) { if (buf) free(buf); return -9; }
+    return 0;
+}
+
+/* Release an entry's payload (on edit or remove): drop its blob (or chunk)
+ * references and any resident bytes. */
+static void dropPayload(locker_t *L, indexEntry_t *e) {
+    if (e->flags & FLAG_CHUNKED) {
+        if (!L->blobsStale && refChunks(L, e, 1) != 0) L->blobsStale = 1;
+    } else if (!L->blobsStale && !e->data && e->storedSize > 0u) {
+        blobUnref(&L->blobs, e);
     }
-    if (util_writeFile(outputPath, buf, nbytes) != 0) { if (buf) free(buf); return -8; }
-    if (buf) free(buf);
-    DBG("[DBG] Extracted %s to %s\n", title, outputPath);
+    freePayload(L, e);
+}
+
+/* Undo storePayload (or writeChunked) for an entry that was never logged.
+ * Chunks were counted as they were written and are released, but a shared
+ * payload is counted only once logged (refPayload): its blob's references
+ * belong to other entries and are left alone. */
+static void unstorePayload(locker_t *L, indexEntry_t *e) {
+    if (e->flags & FLAG_CHUNKED) dropPayload(L, e);
+    else freePayload(L, e);
+}
+
+static int sessionGetDedupStats(locker_t *L, lockerDedupStats_t *out) {
+    blobTable_t *t;
+    if (!out) return -1;
+    t = blobs(L);
+    if (!t) return -5;
+    out->blobs = t->count;
+    out->refs = t->refs;
+    out->bytesShared = t->bytesShared;
+    out->chunks = L->chunks.count;
+    out->chunkRefs = L->chunks.refs;
+    out->chunkBytesShared = L->chunks.bytesShared;
     return 0;
 }
 
-int lockerRemoveFile(const char *title) {
-    indexNode_t *prev = NULL; indexNode_t *n;
-    if (!title) return -1;
-    if (g_role != ROLE_ADMIN) return -3;
-    n = findNode(title, &prev);
-    if (!n) return -2;
-    if (prev) prev->next = n->next; else g_index.head = n->next;
-    if (n->entry.data) free(n->entry.data);
-    free(n);
-    g_index.count--;
-    DBG("[DBG] Removed entry %s\n", title);
+/* Copy of the session key (`len` bytes). Readers call this, so the key is
+ * derived under the I/O lock. */
+static size_t masterKey(locker_t *L, unsigned char *key, size_t len) {
+    const unsigned char *k;
+    lockSession(L, LOCKER_LOCK_IO);
+    k = sessionKey(L);
+    if (!k || len > sizeof L->key) len = derive_key(L->masterPin, key, len);
+    else memcpy(key, k, len);
+    unlockSession(L, LOCKER_LOCK_IO);
+    return len;
+}
+
+/* Encode `size` bytes of `buf` into the session encoder's work buffer and
+ * set `e`'s sizes, flags and hash to match; storePayload places it. */
+static int encodeEntry(locker_t *L, indexEntry_t *e, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag) {
+    const unsigned char *key = NULL;
+    unsigned int hash32;
+    size_t workSize;
+    if (encryptFlag && size > 0u && (key = sessionKey(L)) == NULL) return -6;
+    if (codec_encode(&L->enc, buf, (size_t)size, &compressFlag, key, sizeof L->key, &hash32, &workSize) != 0) return -5;
+    e->originalSize = size;
+    e->storedSize = (unsigned long)workSize;
+    e->flags = (compressFlag?FLAG_COMPRESSED:0u) | (encryptFlag?FLAG_ENCRYPTED:0u);
+    e->hash = hash32;
     return 0;
 }
 
-void lockerList(void) {
-    indexNode_t *n = g_index.head;
-    int idx = 1; int shown = 0;
-    printf("\nStored Files (%d)\n", g_index.count);
-    while (n) {
-        if (g_role == ROLE_PUBLIC && !n->entry.isPublic) { n = n->next; idx++; continue; }
-        printf("%2d. %-30s orig=%lu stored=%lu flags=0x%02X hash=0x%08X vis=%s\n", idx, n->entry.title, n->entry.originalSize, n->entry.storedSize, n->entry.flags, n->entry.hash, n->entry.isPublic?"public":"private");
-        shown++; n = n->next; idx++;
-    }
-    if (g_role == ROLE_PUBLIC && shown==0) printf("(no public files)\n");
+static int sessionGetEncodeStats(locker_t *L, lockerEncodeStats_t *out) {
+    if (!out) return -1;
+    out->encodes = L->enc.stats.encodes;
+    out->bytesIn = L->enc.stats.bytesIn;
+    out->bytesOut = L->enc.stats.bytesOut;
+    out->allocations = L->enc.stats.allocations;
+    out->adopted = L->enc.stats.adopted;
+    out->hashSeconds = L->enc.stats.hashSeconds;
+    out->compressSeconds = L->enc.stats.compressSeconds;
+    out->encryptSeconds = L->enc.stats.encryptSeconds;
+    out->storeSeconds = L->storeSeconds;
+    return 0;
 }
 
-int lockerSearch(const char *pattern) {
-    int matches = 0; indexNode_t *n = g_index.head;
-    if (!pattern || !*pattern) return 0;
-    while (n) {
-        if (g_role == ROLE_PUBLIC && !n->entry.isPublic) { n = n->next; continue; }
-        if (strstr(n->entry.title, pattern)) { printf("Match: %s\n", n->entry.title); matches++; }
-        n = n->next;
+static int sessionSetEncodeTimings(locker_t *L, int enabled) {
+    L->enc.timed = enabled ? 1 : 0;
+    return 0;
+}
+
+static int sessionBeginBatch(locker_t *L) {
+    if (L->role != ROLE_ADMIN || L->readOnly) return -3;
+    if (L->batch) return LOCKER_ERR_BATCH;
+    if ((L->needCheckpoint || !L->journalReady) && sessionCheckpoint(L) != 0) return -5;
+    L->batch = 1;
+    if (storageAppendBegin(L->lockerFile, &L->index, journalGroup(L)) != 0) { L->batch = 0; return -5; }
+    return 0;
+}
+
+static int sessionCommitBatch(locker_t *L) {
+    int rc;
+    if (!L->batch) return LOCKER_ERR_BATCH;
+    if (!L->needCheckpoint && storageAppendCommit(L->lockerFile, &L->index, &L->group) == 0 && commitGroup(L) == 0) {
+        L->batch = 0;
+        return 0;
     }
-    return matches;
+    /* the COMMIT never reached the file: a checkpoint (all-or-nothing
+     * itself) persists the batch instead */
+    L->batch = 0;
+    L->needCheckpoint = 1;
+    rc = sessionCheckpoint(L);
+    if (rc == 0) return 0;
+    L->batch = 1;
+    sessionAbortBatch(L);
+    return -5;
 }
 
-int lockerSaveIndex(void) {
-    if (g_lockerPath[0] == '\0') { DBG("[DBG] no locker path set\n"); return -1; }
-    DBG("[DBG] saving index to %s (entries=%d)\n", g_lockerPath, g_index.count);
-    return storageSaveAll(g_lockerPath, &g_index, g_masterPin);
+static int sessionAbortBatch(locker_t *L) {
+    int rc;
+    if (!L->batch) return LOCKER_ERR_BATCH;
+    L->batch = 0;
+    discardGroup(L);
+    /* the file holds no COMMIT for it: reloading drops every change, and
+     * the orphaned records are wiped so no later COMMIT can adopt them */
+    L->needCheckpoint = 0;
+    rc = sessionLoadIndex(L);
+    if (rc == 0) storageClearTail(L->lockerFile, &L->index);
+    return rc;
 }
 
-int lockerLoadIndex(void) {
-    if (g_lockerPath[0] == '\0') { DBG("[DBG] no locker path set\n"); return -1; }
-    DBG("[DBG] loading index from %s\n", g_lockerPath);
-    return storageLoadAll(g_lockerPath, &g_index, g_masterPin, sizeof(g_masterPin));
+static int sessionInBatch(locker_t *L) { return L->batch; }
+
+static int sessionFlush(locker_t *L) {
+    if (L->readOnly) return 0;
+    return commitGroup(L);
 }
 
-void printMenu(void) {
-    printf("\nPersonal Document Locker (%s)\n", (g_role==ROLE_ADMIN?"admin":"public"));
-    printf("1. Add file (type content) %s\n", (g_role==ROLE_ADMIN?"":"(admin only)"));
-    printf("2. View file (decrypt+decompress)\n");
-    printf("3. Remove file %s\n", (g_role==ROLE_ADMIN?"":"(admin only)"));
-    printf("4. List files\n");
-    printf("5. Search by filename\n");
-    printf("6. Change master PIN %s\n", (g_role==ROLE_ADMIN?"":"(admin only)"));
-    printf("7. Edit file %s\n", (g_role==ROLE_ADMIN?"":"(admin only)"));
-    printf("8. Logout\n");
-    printf("9. Quit\n");
-    printf("Select option: ");
+/* Commit a write-behind group that has outlived `maxSeconds` (never a
+ * batch, which commits as a whole). 1 if it committed one. */
+static int sessionTick(locker_t *L) {
+    if (L->readOnly || L->batch || L->wbMaxRecords == 0u || !groupExpired(L)) return 0;
+    return commitGroup(L) == 0 ? 1 : -1;
 }
 
-int lockerEditFile(const char *title, const char *newTitle, const char *filepath, int compressFlag, int encryptFlag, int makePublic) {
-    indexNode_t *n;
-    unsigned char *inBuf;
-    size_t inSize;
-    unsigned char *workBuf;
-    size_t workCap, workSize;
+static int sessionSetWriteBehind(locker_t *L, unsigned long maxRecords, unsigned long maxBytes, double maxSeconds) {
+    int rc = 0;
+    if (maxRecords == 0u && L->lockerFile) rc = sessionFlush(L);
+    L->wbMaxRecords = maxRecords;
+    L->wbMaxBytes = maxBytes;
+    L->wbMaxSeconds = maxSeconds;
+    return rc;
+}
+
+/* Chunked store. Content is cut into content-defined chunks; each chunk is
+ * encoded on its own (compression decided per chunk, encryption from key
+ * position 0, so equal chunks always encode equally) and appended only if
+ * no identical chunk is stored yet. The entry keeps a manifest of them. */
+typedef struct {
+    unsigned char *manifest; /* built in place: room for `cap` references */
+    unsigned long count;
+    unsigned long cap;
+    unsigned long hash;      /* running hash of the whole content */
+    unsigned long total;     /* content bytes seen */
+    unsigned long written;   /* chunk bytes actually appended */
+    unsigned int flags;      /* FLAG_COMPRESSED / FLAG_ENCRYPTED requested */
     unsigned char key[128];
-    unsigned int hash32;
-    int rc;
+    unsigned char *work;     /* encoded chunk, CDC_MAX_SIZE * 2 + 4 bytes */
+    unsigned char *cmp;      /* stored candidate being verified */
+    termsBuilder_t *terms;   /* content index terms, or NULL */
+} chunkWriter_t;
 
-    if (g_role != ROLE_ADMIN) return -3;
-    if (!title || !*title) return -1;
-    n = findNode(title, NULL);
-    if (!n) return -2;
+#define CHUNK_WORK_SIZE ((size_t)CDC_MAX_SIZE * 2u + 4u)
+
+/* Store chunk `p` (n bytes, at most CDC_MAX_SIZE) or reference an identical
+ * stored one, and add it to the manifest. */
+static int chunkPut(locker_t *L, chunkWriter_t *w, const unsigned char *p, size_t n) {
+    storageChunkRef_t r;
+    indexEntry_t probe, key;
+    blob_t *b = NULL;
+    blobTable_t *t;
+    const unsigned char *stored = p;
+    size_t storedN = n;
+
+    if (w->total + (unsigned long)n < w->total) return LOCKER_ERR_TOO_LARGE; /* size would wrap */
+    w->hash = hash_update(w->hash, p, n);
+    w->total += (unsigned long)n;
+    if (w->terms) termsFeed(w->terms, p, (unsigned long)n);
+    memset(&r, 0, sizeof(r));
+    r.hash = (unsigned int)compute_file_hash(p, n);
+    r.originalSize = (unsigned long)n;
+    if (w->flags & FLAG_COMPRESSED) {
+        size_t c = rle_compress(p, n, w->work, CHUNK_WORK_SIZE);
+        if (c > 0 && c < n) { stored = w->work; storedN = c; r.flags = FLAG_COMPRESSED; }
+    }
+    if (w->flags & FLAG_ENCRYPTED) {
+        if (stored != w->work) { memcpy(w->work, p, n); stored = w->work; }
+        xor_cipher(w->work, storedN, w->key, sizeof w->key);
+    }
+    r.storedSize = (unsigned long)storedN;
 
-    /* Load new content */
-    inBuf = NULL; inSize = 0; workBuf = NULL; workCap = 0; workSize = 0; hash32 = 0u;
-    if (!filepath || !*filepath) {
-        inBuf = (unsigned char*)""; inSize = 0; rc = 0;
+    key.flags = w->flags; /* chunkProbe only reads the encryption bit */
+    chunkProbe(&probe, &key, &r);
+    t = blobs(L) ? &L->chunks : NULL;
+    for (b = blobFind(t, &probe, NULL); b; b = blobFind(t, &probe, b)) {
+        indexEntry_t at;
+        memset(&at, 0, sizeof(at));
+        at.offset = b->offset;
+        at.storedSize = b->storedSize;
+        if (storageReadPayload(L->lockerFile, &at, w->cmp) == 0 && memcmp(w->cmp, stored, storedN) == 0) break;
+    }
+    if (b) {
+        r.offset = b->offset;
     } else {
-        rc = util_readFile(filepath, &inBuf, &inSize);
-        if (rc != 0) return rc;
+        if (!storageHasRoom(&L->index, r.storedSize)) return LOCKER_ERR_TOO_LARGE;
+        if (storageAppendChunk(L->lockerFile, &L->index, &r, stored) != 0) return -10;
+        w->written += r.storedSize;
     }
-    if (inSize > 0) hash32 = (unsigned int)compute_file_hash(inBuf, inSize);
-
-    workCap = inSize * 2 + 4;
-    workBuf = (unsigned char*)malloc(workCap);
-    if (!workBuf) { if (filepath && *filepath) free(inBuf); return -5; }
-    if (compressFlag && inSize > 0) {
-        workSize = rle_compress(inBuf, inSize, workBuf, workCap);
-        if (workSize == 0) { memcpy(workBuf, inBuf, inSize); workSize = inSize; compressFlag = 0; }
-    } else { memcpy(workBuf, inBuf, inSize); workSize = inSize; }
-    if (encryptFlag && workSize > 0) {
-        if (derive_key(g_masterPin, key, sizeof key) == 0) { if (filepath && *filepath) free(inBuf); free(workBuf); return -6; }
-        xor_cipher(workBuf, workSize, key, sizeof key);
-    }
-
-    /* Replace entry data */
-    if (n->entry.data) free(n->entry.data);
-    n->entry.data = NULL;
-    if (workSize > 0) {
-        n->entry.data = (unsigned char*)malloc(workSize);
-        if (!n->entry.data) { if (filepath && *filepath) free(inBuf); free(workBuf); return -8; }
-        memcpy(n->entry.data, workBuf, workSize);
-    }
-    if (newTitle && *newTitle) { strncpy(n->entry.title, newTitle, MAX_TITLE-1); n->entry.title[MAX_TITLE-1] = '\0'; }
-    n->entry.originalSize = (unsigned long)inSize;
-    n->entry.storedSize = (unsigned long)workSize;
-    n->entry.flags = (compressFlag?FLAG_COMPRESSED:0u) | (encryptFlag?FLAG_ENCRYPTED:0u);
-    n->entry.hash = hash32;
-    n->entry.isPublic = makePublic ? 1 : 0;
+    probe.offset = r.offset;
+    if (t) blobRef(t, &probe);
 
-    if (filepath && *filepath) free(inBuf);
-    free(workBuf);
-    DBG("[DBG] Edited entry %s (newTitle=%s)\n", title, (newTitle&&*newTitle)?newTitle:title);
+    if (w->count == w->cap) {
+        unsigned long cap = w->cap ? w->cap * 2u : 64u;
+        unsigned char *m = (unsigned char*)realloc(w->manifest, (size_t)STORAGE_MANIFEST_SIZE(cap));
+        if (!m) return -5;
+        w->manifest = m;
+        w->cap = cap;
+    }
+    storageManifestSet(w->manifest, w->count++, &r);
     return 0;
 }
 
-int lockerAddContent(const char *title, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic) {
-    unsigned char *workBuf;
-    size_t workCap, workSize;
-    unsigned char key[128];
-    unsigned int hash32;
-    indexNode_t *node;
+/* Content source of a streamed add: bytes already read ahead (served
+ * first), then the caller's reader. */
+typedef struct {
+    lockerRead_t fn;
+    void *ctx;
+    const unsigned char *ahead;
+    unsigned long aheadLen;
+} streamSource_t;
 
-    if (g_role != ROLE_ADMIN) return -3;
-    if (!title || !*title || (!buf && size>0)) return -1;
-    hash32 = (size>0)?(unsigned int)compute_file_hash(buf, (size_t)size):0u;
-    workCap = (size_t)size * 2u + 4u;
-    workBuf = (unsigned char*)malloc(workCap);
-    if (!workBuf) return -5;
-    if (compressFlag && size > 0u) {
-        workSize = rle_compress(buf, (size_t)size, workBuf, workCap);
-        if (workSize == 0) { memcpy(workBuf, buf, (size_t)size); workSize = (size_t)size; compressFlag = 0; }
-    } else { memcpy(workBuf, buf, (size_t)size); workSize = (size_t)size; }
-    if (encryptFlag && workSize > 0u) {
-        if (derive_key(g_masterPin, key, sizeof key) == 0) { free(workBuf); return -6; }
-        xor_cipher(workBuf, workSize, key, sizeof key);
-    }
-    node = (indexNode_t*)malloc(sizeof(indexNode_t));
-    if (!node) { free(workBuf); return -7; }
-    memset(&node->entry, 0, sizeof(node->entry));
-    strncpy(node->entry.title, title, MAX_TITLE-1);
-    node->entry.originalSize = (unsigned long)size;
-    node->entry.storedSize = (unsigned long)workSize;
-    node->entry.flags = (compressFlag?FLAG_COMPRESSED:0u) | (encryptFlag?FLAG_ENCRYPTED:0u);
-    node->entry.hash = hash32;
-    node->entry.isPublic = makePublic ? 1 : 0;
-    if (workSize > 0u) {
-        node->entry.data = (unsigned char*)malloc(workSize);
-        if (!node->entry.data) { free(node); free(workBuf); return -8; }
-        memcpy(node->entry.data, workBuf, workSize);
+/* Up to `cap` bytes into `buf`; 0 at the end, negative on a read error. */
+static long sourceRead(streamSource_t *src, unsigned char *buf, unsigned long cap) {
+    long got;
+    if (src->aheadLen > 0u) {
+        unsigned long n = src->aheadLen < cap ? src->aheadLen : cap;
+        memcpy(buf, src->ahead, (size_t)n);
+        src->ahead += n;
+        src->aheadLen -= n;
+        return (long)n;
+    }
+    got = src->fn(buf, cap, src->ctx);
+    return (got < 0 || (unsigned long)got > cap) ? -1 : got;
+}
+
+static long fileRead(unsigned char *buf, unsigned long cap, void *ctx) {
+    FILE *f = (FILE*)ctx;
+    size_t got = fread(buf, 1, (size_t)cap, f);
+    return (got == 0 && ferror(f)) ? -1 : (long)got;
+}
+
+static int fileWrite(const unsigned char *buf, unsigned long n, void *ctx) {
+    return fwrite(buf, 1, (size_t)n, (FILE*)ctx) == (size_t)n ? 0 : -1;
+}
+
+/* Split the content of `in` (read incrementally) or of `mem` into chunks
+ * and store them, feeding the plain content to `terms` if given. On success
+ * `e` (title, flags and visibility set) becomes a chunked entry whose
+ * manifest is resident until logged. */
+static int writeChunked(locker_t *L, streamSource_t *in, const unsigned char *mem, unsigned long memSize, indexEntry_t *e, termsBuilder_t *terms) {
+    chunkWriter_t w;
+    unsigned char *buf = NULL;
+    int rc = 0;
+
+    /* chunks are written through at the journal tail: queued records first */
+    commitGroup(L);
+    if ((L->needCheckpoint || !L->journalReady) && sessionCheckpoint(L) != 0) return -10;
+    if (!L->lockerFile) return -10;
+    memset(&w, 0, sizeof(w));
+    w.hash = FILE_HASH_INIT;
+    w.terms = terms;
+    w.flags = e->flags & (FLAG_COMPRESSED | FLAG_ENCRYPTED);
+    if ((w.flags & FLAG_ENCRYPTED) && masterKey(L, w.key, sizeof w.key) == 0) return -6;
+    /* chunks are encoded in the session encoder's scratch buffers */
+    w.work = codec_workspace(&L->enc, CHUNK_WORK_SIZE);
+    w.cmp = codec_spare(&L->enc, CHUNK_WORK_SIZE);
+    if (!w.work || !w.cmp) { rc = -5; goto done; }
+
+    if (!in) {
+        unsigned long pos = 0ul;
+        while (rc == 0 && pos < memSize) {
+            size_t cut = cdc_cut(mem + pos, (size_t)(memSize - pos), 1);
+            rc = chunkPut(L, &w, mem + pos, cut);
+            pos += (unsigned long)cut;
+        }
     } else {
-        node->entry.data = NULL;
+        /* keep at least one maximal chunk buffered ahead of the cut */
+        size_t cap = (size_t)LOCKER_STREAM_CHUNK + CDC_MAX_SIZE;
+        size_t have = 0, start = 0, cut;
+        int eof = 0;
+        buf = (unsigned char*)malloc(cap);
+        if (!buf) { rc = -5; goto done; }
+        while (rc == 0) {
+            if (!eof && have - start < CDC_MAX_SIZE) {
+                long got;
+                memmove(buf, buf + start, have - start);
+                have -= start; start = 0;
+                got = sourceRead(in, buf + have, (unsigned long)(cap - have));
+                if (got < 0) { rc = -4; break; }
+                if (got == 0) eof = 1;
+                have += (size_t)got;
+            }
+            if (start == have) break;
+            cut = cdc_cut(buf + start, have - start, eof);
+            if (cut == 0) continue; /* boundary may lie beyond: read more */
+            rc = chunkPut(L, &w, buf + start, cut);
+            start += cut;
+        }
+    }
+    if (rc == 0 && !storageHasRoom(&L->index, STORAGE_MANIFEST_SIZE(w.count))) rc = LOCKER_ERR_TOO_LARGE;
+    if (rc != 0) goto done;
+
+    if (!w.manifest) {
+        w.manifest = (unsigned char*)malloc((size_t)STORAGE_MANIFEST_HEAD);
+        if (!w.manifest) { rc = -5; goto done; }
     }
-    node->next = g_index.head; g_index.head = node; g_index.count++;
-    free(workBuf);
+    storageManifestInit(w.manifest, w.count);
+    e->data = w.manifest;
+    w.manifest = NULL;
+    e->flags |= FLAG_CHUNKED;
+    e->storedSize = STORAGE_MANIFEST_SIZE(w.count);
+    e->originalSize = w.total;
+    e->hash = w.total > 0ul ? (unsigned int)w.hash : 0u;
+    DBG("[DBG] chunked %lu bytes into %lu chunks, %lu stored bytes written\n", w.total, w.count, w.written);
+done:
+    /* references counted for a manifest that was never kept */
+    if (rc != 0) L->blobsStale = 1;
+    free(buf);
+    free(w.manifest);
+    return rc;
+}
+
+/* Add (`n` NULL) or replace entry `n` with chunked content. */
+static int putChunked(locker_t *L, indexNode_t *n, const char *title, streamSource_t *in, const unsigned char *mem, unsigned long memSize, int compressFlag, int encryptFlag, int makePublic) {
+    indexEntry_t e, old;
+    char oldTitle[MAX_TITLE];
+    termsBuilder_t tb;
+    int rc;
+    memset(&e, 0, sizeof(e));
+    e.title = title;
+    e.flags = (compressFlag?FLAG_COMPRESSED:0u) | (encryptFlag?FLAG_ENCRYPTED:0u);
+    e.isPublic = makePublic ? 1 : 0;
+    termsInit(&tb);
+    rc = writeChunked(L, in, mem, memSize, &e, L->index.termsOn ? &tb : NULL);
+    if (rc != 0) { termsFree(&tb); return rc; }
+    if (!n) {
+        n = indexNewNode(&L->index);
+        if (!n) { unstorePayload(L, &e); termsFree(&tb); return -7; }
+        n->entry = e;
+        if (indexLink(&L->index, n) != 0) { unstorePayload(L, &n->entry); indexFreeNode(&L->index, n); termsFree(&tb); return -7; }
+        journalAdd(L, n);
+        setTerms(L, n, &tb);
+        return 0;
+    }
+    /* the old chunks are released after the new ones hold their references,
+     * so chunks shared between the two revisions stay counted */
+    strcpy(oldTitle, n->entry.title);
+    /* the title was checked free, so only running out of memory fails */
+    if (indexRename(&L->index, n, e.title) != 0) { unstorePayload(L, &e); termsFree(&tb); return -7; }
+    cacheForget(L, n);
+    e.title = n->entry.title;
+    old = n->entry;
+    n->entry = e;
+    dropPayload(L, &old);
+    indexUpdate(&L->index, n);
+    journalEdit(L, oldTitle, n);
+    setTerms(L, n, &tb);
     return 0;
 }
 
-int lockerEditContent(const char *title, const char *newTitle, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic) {
-    indexNode_t *n;
-    unsigned char *workBuf;
-    size_t workCap, workSize;
+/* Chunked add/edit of a file, read while it is chunked. */
+static int putChunkedFile(locker_t *L, indexNode_t *n, const char *title, const char *filepath, int compressFlag, int encryptFlag, int makePublic) {
+    streamSource_t src;
+    FILE *in = fopen(filepath, "rb");
+    int rc;
+    if (!in) return -2;
+    memset(&src, 0, sizeof(src));
+    src.fn = fileRead;
+    src.ctx = in;
+    rc = putChunked(L, n, title, &src, NULL, 0ul, compressFlag, encryptFlag, makePublic);
+    fclose(in);
+    return rc;
+}
+
+/* Reads of the file for readers: the file position is shared, so each
+ * read holds the I/O lock. */
+static int readPayloadAt(locker_t *L, const indexEntry_t *e, unsigned long pos, unsigned char *buf, unsigned long n) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_IO);
+    rc = storageReadPayloadAt(L->lockerFile, e, pos, buf, n);
+    unlockSession(L, LOCKER_LOCK_IO);
+    return rc;
+}
+
+static int readPayload(locker_t *L, const indexEntry_t *e, unsigned char *buf) {
+    return readPayloadAt(L, e, 0ul, buf, e->storedSize);
+}
+
+/* Stored bytes read per block when decoding from disk (even, so a block
+ * holds whole RLE pairs). */
+#define DECODE_BLOCK 16384ul
+
+/* Decode the payload of unchunked `e` into `out` (originalSize bytes) in
+ * one codec_decode pass: from memory if resident, else a block at a time
+ * through the stack (plain payloads are read into `out` and decoded in
+ * place). Sets *hash to the content hash. */
+static int decodeInto(locker_t *L, const indexEntry_t *e, unsigned char *out, unsigned int *hash) {
+    codecDecode_t d;
     unsigned char key[128];
-    unsigned int hash32;
+    unsigned char block[DECODE_BLOCK];
+    const unsigned char *in;
+    unsigned long pos = 0ul, total = 0ul;
+    int enc = (e->flags & FLAG_ENCRYPTED) != 0;
 
-    if (g_role != ROLE_ADMIN) return -3;
-    if (!title || !*title || (!buf && size>0)) return -1;
-    n = findNode(title, NULL);
-    if (!n) return -2;
-    hash32 = (size>0)?(unsigned int)compute_file_hash(buf, (size_t)size):0u;
-    workCap = (size_t)size * 2u + 4u;
-    workBuf = (unsigned char*)malloc(workCap);
-    if (!workBuf) return -5;
-    if (compressFlag && size > 0u) {
-        workSize = rle_compress(buf, (size_t)size, workBuf, workCap);
-        if (workSize == 0) { memcpy(workBuf, buf, (size_t)size); workSize = (size_t)size; compressFlag = 0; }
-    } else { memcpy(workBuf, buf, (size_t)size); workSize = (size_t)size; }
-    if (encryptFlag && workSize > 0u) {
-        if (derive_key(g_masterPin, key, sizeof key) == 0) { free(workBuf); return -6; }
-        xor_cipher(workBuf, workSize, key, sizeof key);
-    }
-    if (n->entry.data) free(n->entry.data);
-    n->entry.data = NULL;
-    if (workSize > 0u) {
-        n->entry.data = (unsigned char*)malloc(workSize);
-        if (!n->entry.data) { free(workBuf); return -8; }
-        memcpy(n->entry.data, workBuf, workSize);
-    }
-    if (newTitle && *newTitle) { strncpy(n->entry.title, newTitle, MAX_TITLE-1); n->entry.title[MAX_TITLE-1]='\0'; }
-    n->entry.originalSize = (unsigned long)size;
-    n->entry.storedSize = (unsigned long)workSize;
-    n->entry.flags = (compressFlag?FLAG_COMPRESSED:0u) | (encryptFlag?FLAG_ENCRYPTED:0u);
-    n->entry.hash = hash32;
-    n->entry.isPublic = makePublic ? 1 : 0;
-    free(workBuf);
+    if (enc && masterKey(L, key, sizeof key) == 0) return -5;
+    codec_decodeInit(&d, key, enc ? sizeof key : 0u, (e->flags & FLAG_COMPRESSED) != 0);
+    in = e->data; /* only writers set or drop it; views keep their own copies */
+    if (in || !d.rle) {
+        if (!in) {
+            if (e->storedSize > e->originalSize) return -7;
+            if (readPayload(L, e, out) != 0) return -4;
+            in = out;
+        }
+        total = (unsigned long)codec_decode(&d, in, (size_t)e->storedSize, out, (size_t)e->originalSize);
+    } else {
+        while (pos < e->storedSize) {
+            unsigned long n = e->storedSize - pos < DECODE_BLOCK ? e->storedSize - pos : DECODE_BLOCK;
+            size_t outN;
+            if (readPayloadAt(L, e, pos, block, n) != 0) return -4;
+            outN = codec_decode(&d, block, (size_t)n, out + total, (size_t)(e->originalSize - total));
+            if (outN == 0 && n > 1u) return -7;
+            total += (unsigned long)outN;
+            pos += n;
+        }
+    }
+    if (total != e->originalSize) return -7;
+    *hash = (unsigned int)d.hash;
     return 0;
 }
 
-int lockerGetContent(const char *title, unsigned char **outBuf, unsigned long *outSize) {
-    indexNode_t *n;
-    unsigned char *buf;
-    size_t nbytes;
+/* Manifest references read from disk at a time while decoding. */
+#define MANIFEST_WINDOW 1024ul
+
+/* Decode chunked entry `e` chunk by chunk into `out` (originalSize bytes)
+ * or, when `out` is NULL, into writer `fn`, checking the content hash. A
+ * disk-backed manifest is read a window at a time, so memory stays flat. */
+static int readChunked(locker_t *L, const indexEntry_t *e, unsigned char *out, lockerWrite_t fn, void *ctx) {
+    unsigned char *win = NULL, *stored = NULL, *plain = NULL;
+    const unsigned char *m = e->data;
     unsigned char key[128];
-    if (!title || !outBuf || !outSize) return -1;
-    *outBuf = NULL; *outSize = 0;
-    n = findNode(title, NULL);
-    if (!n) return -2;
-    if (g_role == ROLE_PUBLIC && !n->entry.isPublic) return -3;
-    nbytes = (size_t)n->entry.storedSize;
-    if (nbytes == 0) { *outBuf = NULL; *outSize = 0; return 0; }
-    buf = (unsigned char*)malloc(nbytes);
-    if (!buf) return -4;
-    memcpy(buf, n->entry.data, nbytes);
-    if (n->entry.flags & FLAG_ENCRYPTED) {
-        if (derive_key(g_masterPin, key, sizeof key) == 0) { free(buf); return -5; }
-        xor_cipher(buf, nbytes, key, sizeof key);
-    }
-    if (n->entry.flags & FLAG_COMPRESSED) {
-        unsigned char *tmp;
+    unsigned long count, k, pos = 0ul, hash = FILE_HASH_INIT;
+    unsigned long storedCap = 0ul, plainCap = 0ul;
+    storageChunkRef_t r;
+    codecDecode_t d;
+    int rc = 0;
+
+    if (!m) {
+        /* window layout: the manifest head, then up to MANIFEST_WINDOW refs */
+        win = (unsigned char*)malloc((size_t)STORAGE_MANIFEST_SIZE(MANIFEST_WINDOW));
+        if (!win) return -4;
+        if (readPayloadAt(L, e, 0ul, win, STORAGE_MANIFEST_HEAD) != 0) { free(win); return -4; }
+        m = win;
+    }
+    if (storageManifestCount(m, e->storedSize, &count) != 0) { free(win); return -7; }
+    if ((e->flags & FLAG_ENCRYPTED) && masterKey(L, key, sizeof key) == 0) { free(win); return -5; }
+    for (k = 0u; rc == 0 && k < count; k++) {
+        indexEntry_t at;
+        unsigned char *dst;
         size_t outN;
-        tmp = (unsigned char*)malloc((size_t)n->entry.originalSize);
-        if (!tmp) { free(buf); return -6; }
-        outN = rle_decompress(buf, nbytes, tmp, (size_t)n->entry.originalSize);
-        free(buf);
-        if (outN != (size_t)n->entry.originalSize) { free(tmp); return -7; }
-        buf = tmp; nbytes = outN;
+        if (win && k % MANIFEST_WINDOW == 0u) {
+            unsigned long n = count - k < MANIFEST_WINDOW ? count - k : MANIFEST_WINDOW;
+            if (readPayloadAt(L, e, STORAGE_MANIFEST_SIZE(k), win + STORAGE_MANIFEST_HEAD,
+                              n * STORAGE_CHUNK_REF_SIZE) != 0) { rc = -4; break; }
+        }
+        if (storageManifestGet(m, win ? k % MANIFEST_WINDOW : k, &r) != 0) { rc = -7; break; }
+        if (r.originalSize > e->originalSize - pos) { rc = -7; break; }
+        if (r.storedSize > storedCap) {
+            unsigned char *p = (unsigned char*)realloc(stored, (size_t)r.storedSize);
+            if (!p) { rc = -4; break; }
+            stored = p;
+            storedCap = r.storedSize;
+        }
+        if (!out && r.originalSize > plainCap) {
+            unsigned char *p = (unsigned char*)realloc(plain, (size_t)r.originalSize);
+            if (!p) { rc = -4; break; }
+            plain = p;
+            plainCap = r.originalSize;
+        }
+        memset(&at, 0, sizeof(at));
+        at.offset = r.offset;
+        at.storedSize = r.storedSize;
+        if (readPayload(L, &at, stored) != 0) { rc = -4; break; }
+        /* chunks are encrypted from key position 0; the hash runs on */
+        codec_decodeInit(&d, key, (e->flags & FLAG_ENCRYPTED) ? sizeof key : 0u, (r.flags & FLAG_COMPRESSED) != 0);
+        d.hash = hash;
+        dst = out ? out + pos : plain;
+        outN = codec_decode(&d, stored, (size_t)r.storedSize, dst, (size_t)r.originalSize);
+        if (outN != (size_t)r.originalSize || (outN == 0u && r.storedSize > 0u)) { rc = -7; break; }
+        hash = d.hash;
+        if (!out && outN > 0u && fn(dst, (unsigned long)outN, ctx) != 0) { rc = -8; break; }
+        pos += (unsigned long)outN;
     }
-    /* Optional integrity check */
-    if (n->entry.originalSize > 0) {
-        unsigned int calc = (unsigned int)compute_file_hash(buf, (size_t)n->entry.originalSize);
-        if (n->entry.hash != 0u && calc != n->entry.hash) { free(buf); return -9; }
+    free(win);
+    free(stored);
+    free(plain);
+    if (rc == 0 && pos != e->originalSize) rc = -7;
+    if (rc == 0 && pos > 0ul && (unsigned int)hash != e->hash) rc = -9;
+    return rc;
+}
+
+/* Add entry `title` (known to be free) holding `size` bytes of `buf`,
+ * encoded by the session encoder. */
+static int addPayload(locker_t *L, const char *title, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic) {
+    indexNode_t *node;
+    int rc;
+    node = indexNewNode(&L->index);
+    if (!node) return -7;
+    rc = encodeEntry(L, &node->entry, buf, size, compressFlag, encryptFlag);
+    if (rc != 0) { indexFreeNode(&L->index, node); return rc; }
+    node->entry.title = title;
+    node->entry.isPublic = makePublic ? 1 : 0;
+    rc = storePayload(L, &node->entry, (size_t)node->entry.storedSize);
+    if (rc != 0) { indexFreeNode(&L->index, node); return rc; }
+    if (indexLink(&L->index, node) != 0) { unstorePayload(L, &node->entry); indexFreeNode(&L->index, node); return -7; }
+    journalAdd(L, node);
+    if (L->enc.timed) L->storeSeconds += util_seconds() - L->enc.stamp; /* since the encode ended */
+    setTermsOf(L, node, buf, size);
+    DBG("[DBG] Added entry %s (orig=%lu stored=%lu flags=0x%X public=%d)\n", node->entry.title, node->entry.originalSize, node->entry.storedSize, node->entry.flags, node->entry.isPublic);
+    return 0;
+}
+
+/* Replace the content of `n` with `size` bytes of `buf` and retitle it to
+ * `newTitle` if set (checked free). The old payload is released after the
+ * new one is in place, so unchanged content can share its own stored copy. */
+static int editPayload(locker_t *L, indexNode_t *n, const char *oldTitle, const char *newTitle, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic) {
+    indexEntry_t old;
+    int rc;
+    old = n->entry;
+    rc = encodeEntry(L, &n->entry, buf, size, compressFlag, encryptFlag);
+    if (rc != 0) { n->entry = old; return rc; }
+    n->entry.isPublic = makePublic ? 1 : 0;
+    rc = storePayload(L, &n->entry, (size_t)n->entry.storedSize);
+    if (rc != 0) { n->entry = old; return rc; }
+    /* the title was checked free, so only running out of memory fails */
+    if (newTitle && *newTitle && indexRename(&L->index, n, newTitle) != 0) {
+        unstorePayload(L, &n->entry);
+        n->entry = old;
+        return -7;
     }
-    *outBuf = buf; *outSize = (unsigned long)nbytes;
+    cacheForget(L, n);
+    dropPayload(L, &old);
+    indexUpdate(&L->index, n);
+    journalEdit(L, oldTitle, n);
+    if (L->enc.timed) L->storeSeconds += util_seconds() - L->enc.stamp;
+    setTermsOf(L, n, buf, size);
     return 0;
-}
\ No newline at end of file
+}
+
+static int sessionAddFile(locker_t *L, const char *filepath, const char *title, int compressFlag, int encryptFlag, int makePublic) {
+    const unsigned char *in = (const unsigned char*)""; /* empty filepath: empty entry */
+    size_t inSize = 0;
+    int rc;
+
+    if (L->role != ROLE_ADMIN) return -3; /* only admin */
+    if (!title || !*title) return -1;
+    rc = titleFree(L, title, NULL);
+    if (rc != 0) return rc;
+    if (filepath && *filepath) {
+        unsigned long fileSize;
+        rc = util_fileSize(filepath, &fileSize);
+        if (rc != 0) return rc;
+        if (fileSize >= LOCKER_CHUNK_THRESHOLD) return putChunkedFile(L, NULL, title, filepath, compressFlag, encryptFlag, makePublic);
+        /* smaller files are read into the encoder's input buffer */
+        rc = util_readInto(filepath, &L->enc.input, &L->enc.inputCap, &inSize);
+        if (rc != 0) return rc;
+        in = L->enc.input;
+    }
+    return addPayload(L, title, in, (unsigned long)inSize, compressFlag, encryptFlag, makePublic);
+}
+
+/* Large-object decode: feed a disk-backed payload chunk by chunk to `fn`.
+ * Compressed payloads are read in small even-sized steps so every step
+ * holds whole RLE pairs and expands into one chunk buffer. */
+static int decodeStreamed(locker_t *L, const indexEntry_t *e, lockerWrite_t fn, void *ctx) {
+    unsigned char *buf, *plain;
+    unsigned char key[128];
+    unsigned long step = (e->flags & FLAG_COMPRESSED) ? LOCKER_STREAM_CHUNK / 256ul * 2ul : LOCKER_STREAM_CHUNK;
+    unsigned long pos = 0ul, total = 0ul;
+    codecDecode_t d;
+    int rc = 0;
+
+    if ((e->flags & FLAG_ENCRYPTED) && masterKey(L, key, sizeof key) == 0) return -5;
+    codec_decodeInit(&d, key, (e->flags & FLAG_ENCRYPTED) ? sizeof key : 0u, (e->flags & FLAG_COMPRESSED) != 0);
+    buf = (unsigned char*)malloc((size_t)step);
+    plain = (unsigned char*)malloc((size_t)LOCKER_STREAM_CHUNK);
+    if (!buf || !plain) { free(buf); free(plain); return -4; }
+    while (rc == 0 && pos < e->storedSize) {
+        unsigned long n = e->storedSize - pos < step ? e->storedSize - pos : step;
+        size_t outN;
+        if (readPayloadAt(L, e, pos, buf, n) != 0) { rc = -4; break; }
+        outN = codec_decode(&d, buf, (size_t)n, plain, (size_t)LOCKER_STREAM_CHUNK);
+        if (outN == 0) { rc = -7; break; }
+        total += (unsigned long)outN;
+        if (fn(plain, (unsigned long)outN, ctx) != 0) rc = -8;
+        pos += n;
+    }
+    free(buf);
+    free(plain);
+    if (rc == 0 && total != e->originalSize) rc = -7;
+    if (rc == 0 && total > 0ul && (unsigned int)d.hash != e->hash) rc = -9;
+    return rc;
+}
+
+/* Decode `e` (chunked, or disk-backed) into `outputPath` with bounded memory. */
+static int extractStreamed(locker_t *L, const indexEntry_t *e, const char *outputPath) {
+    FILE *out = fopen(outputPath, "wb");
+    int rc;
+    if (!out) return -8;
+    rc = (e->flags & FLAG_CHUNKED) ? readChunked(L, e, NULL, fileWrite, out) : decodeStreamed(L, e, fileWrite, out);
+    if (fclose(out) != 0 && rc == 0) rc = -8;
+    if (rc != 0) remove(outputPath);
+    return rc;
+}
+
+static int sessionExtractFile(locker_t *L, const char *title, const char *outputPath) {
+    indexNode_t *n;
+    unsigned char *buf = NULL;
+    size_t nbytes;
+    unsigned int calcHash;
+
+    if (!title || !outputPath) return -1;
+    n = findNode(L, title);
+    if (!n) return -2;
+    if (L->role == ROLE_PUBLIC && !n->entry.isPublic) return -3;
+    DBG("[DBG] lockerExtractFile: found entry '%s' stored=%lu orig=%lu flags=0x%X public=%d\n", n->entry.title, n->entry.storedSize, n->entry.originalSize, n->entry.flags, n->entry.isPublic);
+    if ((n->entry.flags & FLAG_CHUNKED) || (!n->entry.data && n->entry.originalSize >= LOCKER_STREAM_THRESHOLD)) {
+        return extractStreamed(L, &n->entry, outputPath);
+    }
+    nbytes = (size_t)n->entry.storedSize;
+    if (nbytes > 0) {
+        int rc;
+        unsigned long hit;
+        rc = cacheLookup(L, n, &buf, &hit);
+        if (rc < 0) return -4;
+        nbytes = (size_t)n->entry.originalSize;
+        if (rc == 0) {
+            /* one buffer: decrypted, expanded and hashed in a single pass */
+            buf = (unsigned char*)malloc((size_t)n->entry.originalSize + 1u);
+            if (!buf) return -4;
+            rc = decodeInto(L, &n->entry, buf, &calcHash);
+            if (rc != 0) { free(buf); return rc; }
+            /* Integrity check on the original content */
+            if (nbytes > 0 && calcHash != n->entry.hash) { free(buf); return -9; }
+            cacheKeep(L, n, buf, n->entry.originalSize);
+        }
+    } else {
+        buf = NULL; /* zero-length content */
+    }
+    if (util_writeFile(outputPath, buf, nbytes) != 0) { if (buf) free(buf); return -8; }
+    if (buf) free(buf);
+    DBG("[DBG] Extracted %s to %s\n", title, outputPath);
+    return 0;
+}
+
+static int sessionAddStream(locker_t *L, const char *title, lockerRead_t fn, void *ctx, int compressFlag, int encryptFlag, int makePublic) {
+    streamSource_t src;
+    unsigned char *ahead;
+    unsigned long have = 0ul;
+    long got = 0;
+    int rc;
+
+    if (L->role != ROLE_ADMIN) return -3;
+    if (!title || !*title || !fn) return -1;
+    rc = titleFree(L, title, NULL);
+    if (rc != 0) return rc;
+    /* read up to the chunking threshold ahead: shorter content is stored whole */
+    ahead = (unsigned char*)malloc((size_t)LOCKER_CHUNK_THRESHOLD);
+    if (!ahead) return -5;
+    memset(&src, 0, sizeof(src));
+    src.fn = fn;
+    src.ctx = ctx;
+    while (have < LOCKER_CHUNK_THRESHOLD && (got = sourceRead(&src, ahead + have, LOCKER_CHUNK_THRESHOLD - have)) > 0) {
+        have += (unsigned long)got;
+    }
+    if (got < 0) {
+        rc = -4;
+    } else if (have < LOCKER_CHUNK_THRESHOLD) {
+        rc = sessionAddContent(L, title, ahead, have, compressFlag, encryptFlag, makePublic);
+    } else {
+        src.ahead = ahead;
+        src.aheadLen = have;
+        rc = putChunked(L, NULL, title, &src, NULL, 0ul, compressFlag, encryptFlag, makePublic);
+    }
+    free(ahead);
+    return rc;
+}
+
+static int sessionExtractStream(locker_t *L, const char *title, lockerWrite_t fn, void *ctx) {
+    indexNode_t *n;
+    unsigned char *buf;
+    unsigned long size;
+    int rc;
+
+    if (!title || !fn) return -1;
+    n = findNode(L, title);
+    if (!n) return -2;
+    if (L->role == ROLE_PUBLIC && !n->entry.isPublic) return -3;
+    if (n->entry.flags & FLAG_CHUNKED) return readChunked(L, &n->entry, NULL, fn, ctx);
+    if (!n->entry.data) return decodeStreamed(L, &n->entry, fn, ctx);
+    /* resident until written back: small, decoded whole */
+    rc = sessionGetContent(L, title, &buf, &size);
+    if (rc != 0) return rc;
+    if (size > 0ul && fn(buf, size, ctx) != 0) rc = -8;
+    free(buf);
+    return rc;
+}
+
+/* Integrity pass. Entries are taken in file order and split into
+ * contiguous ranges, run as pool tasks; each task decodes and rehashes its
+ * entries through one buffer of VERIFY_BUF bytes (larger entries stream)
+ * and records a status per entry, so results come back in file order.
+ * Tasks add to the progress count every VERIFY_STEP_* entries or bytes. */
+#define VERIFY_BUF LOCKER_STREAM_CHUNK
+#define VERIFY_TASKS_PER_WORKER 16ul
+#define VERIFY_STEP_ENTRIES 1024ul
+#define VERIFY_STEP_BYTES (64ul * 1024ul * 1024ul)
+
+typedef struct {
+    locker_t *L;
+    indexNode_t **nodes;
+    int *status;             /* per entry: 0, or the decode error */
+    unsigned long count;
+    unsigned long tasks;
+    const lockerScrubHooks_t *hooks;
+    /* entries and content bytes checked so far, under the I/O lock */
+    unsigned long done;
+    unsigned long doneBytes;
+} verifyJob_t;
+
+static void verifyProgress(verifyJob_t *j, unsigned long n, unsigned long bytes) {
+    locker_t *L = j->L;
+    lockSession(L, LOCKER_LOCK_IO);
+    j->done += n;
+    j->doneBytes += bytes;
+    if (j->hooks && j->hooks->progress) j->hooks->progress(j->done, j->count, j->doneBytes, j->hooks->ctx);
+    unlockSession(L, LOCKER_LOCK_IO);
+}
+
+static int discardWrite(const unsigned char *buf, unsigned long n, void *ctx) {
+    (void)buf; (void)n; (void)ctx;
+    return 0;
+}
+
+/* 0 if `e` decodes to content matching its hash; -9 on a mismatch, -7 if
+ * malformed, another negative code if it cannot be read. */
+static int verifyEntry(locker_t *L, const indexEntry_t *e, unsigned char *plain) {
+    unsigned int hash;
+    int rc;
+    if (e->storedSize == 0u) return 0;
+    if (e->flags & FLAG_CHUNKED) return readChunked(L, e, NULL, discardWrite, NULL);
+    if (e->originalSize > VERIFY_BUF) return decodeStreamed(L, e, discardWrite, NULL);
+    rc = decodeInto(L, e, plain, &hash);
+    if (rc == 0 && e->originalSize > 0u && hash != e->hash) rc = -9;
+    return rc;
+}
+
+static void verifyTask(void *arg, unsigned long t) {
+    verifyJob_t *j = (verifyJob_t*)arg;
+    unsigned long i = j->count / j->tasks * t + (t < j->count % j->tasks ? t : j->count % j->tasks);
+    unsigned long end = i + j->count / j->tasks + (t < j->count % j->tasks ? 1u : 0u);
+    unsigned char *plain = (unsigned char*)malloc((size_t)VERIFY_BUF);
+    unsigned long n = 0ul, bytes = 0ul;
+    for (; i < end; i++) {
+        const indexEntry_t *e = &j->nodes[i]->entry;
+        j->status[i] = plain ? verifyEntry(j->L, e, plain) : -4;
+        n++;
+        bytes += e->originalSize;
+        if (n >= VERIFY_STEP_ENTRIES || bytes >= VERIFY_STEP_BYTES) {
+            verifyProgress(j, n, bytes);
+            n = bytes = 0ul;
+        }
+    }
+    if (n > 0ul) verifyProgress(j, n, bytes);
+    free(plain);
+}
+
+/* Check every entry, on the session's pool when it may be used, and report
+ * the failures to `hooks` in file order. */
+static int verifyAll(locker_t *L, lockerVerifyStats_t *out, const lockerScrubHooks_t *hooks) {
+    verifyJob_t j;
+    indexNode_t *n;
+    unsigned long i, workers;
+    double t0 = platform_clock();
+    int parallel = L->pool.run && L->hooks.lock;
+
+    memset(out, 0, sizeof(*out));
+    memset(&j, 0, sizeof(j));
+    j.L = L;
+    j.hooks = hooks;
+    j.count = (unsigned long)L->index.count;
+    if (j.count == 0u) return 0;
+    workers = parallel && L->pool.workers > 0u ? L->pool.workers : 1u;
+    j.tasks = parallel ? workers * VERIFY_TASKS_PER_WORKER : 1u;
+    if (j.tasks > j.count) j.tasks = j.count;
+    j.nodes = (indexNode_t**)malloc((size_t)j.count * sizeof(indexNode_t*));
+    j.status = (int*)malloc((size_t)j.count * sizeof(int));
+    if (!j.nodes || !j.status) { free(j.nodes); free(j.status); return -5; }
+    /* the list is newest first */
+    for (n = L->index.head, i = j.count; n && i > 0u; n = n->next) j.nodes[--i] = n;
+    if (parallel) L->pool.run(L->pool.ctx, j.tasks, verifyTask, &j);
+    else verifyTask(&j, 0ul);
+    for (i = 0u; i < j.count; i++) {
+        if (j.status[i] == -9 || j.status[i] == -7) out->corrupt++;
+        else if (j.status[i] != 0) out->unreadable++;
+        if (j.status[i] == 0) continue;
+        DBG("[DBG] integrity: %s failed (%d)\n", j.nodes[i]->entry.title, j.status[i]);
+        if (hooks && hooks->failed) hooks->failed(j.nodes[i]->entry.title, j.status[i], hooks->ctx);
+    }
+    out->entries = j.count;
+    out->bytes = j.doneBytes;
+    out->seconds = platform_clock() - t0;
+    free(j.nodes);
+    free(j.status);
+    return 0;
+}
+
+static int sessionSetVerifyOnOpen(locker_t *L, int enabled) {
+    L->verifyOnOpen = enabled ? 1 : 0;
+    return 0;
+}
+
+static int sessionScrub(locker_t *L, const lockerScrubHooks_t *hooks, lockerVerifyStats_t *out) {
+    lockerVerifyStats_t st;
+    int rc;
+    if (L->role != ROLE_ADMIN) return -3;
+    rc = verifyAll(L, &st, hooks);
+    if (rc == 0 && out) *out = st;
+    return rc;
+}
+
+static int sessionGetVerifyStats(locker_t *L, lockerVerifyStats_t *out) {
+    if (!out) return -1;
+    *out = L->verified;
+    return 0;
+}
+
+static int sessionSetCache(locker_t *L, unsigned long maxBytes) {
+    cacheSetBudget(&L->cache, maxBytes);
+    viewTrim(L);
+    return 0;
+}
+
+static int sessionGetCacheStats(locker_t *L, lockerCacheStats_t *out) {
+    if (!out) return -1;
+    lockSession(L, LOCKER_LOCK_IO); /* readers move the counters */
+    out->hits = L->cache.hits;
+    out->misses = L->cache.misses;
+    out->evictions = L->cache.evictions;
+    out->entries = L->cache.count;
+    out->bytes = L->cache.bytes;
+    out->maxBytes = L->cache.maxBytes;
+    unlockSession(L, LOCKER_LOCK_IO);
+    return 0;
+}
+
+static int sessionRemoveFile(locker_t *L, const char *title) {
+    indexNode_t *n;
+    if (!title) return -1;
+    if (L->role != ROLE_ADMIN) return -3;
+    n = findNode(L, title);
+    if (!n) return -2;
+    journalRemove(L, n->entry.title);
+    cacheForget(L, n);
+    indexUnlink(&L->index, n);
+    dropPayload(L, &n->entry);
+    indexFreeNode(&L->index, n);
+    DBG("[DBG] Removed entry %s\n", title);
+    return 0;
+}
+
+/* Role filter between an index walk and a caller's visitor. */
+typedef struct { locker_t *L; lockerVisit_t fn; void *ctx; int shown; } visitFilter_t;
+
+/* Scope of index scans for this session. */
+static int visibleScope(locker_t *L) {
+    return L->role == ROLE_PUBLIC ? INDEX_PUBLIC : INDEX_ALL;
+}
+
+static int visitVisible(indexNode_t *n, void *ctx) {
+    visitFilter_t *v = (visitFilter_t*)ctx;
+    if (v->L->role == ROLE_PUBLIC && !n->entry.isPublic) return 0;
+    v->shown++;
+    return v->fn(&n->entry, v->ctx);
+}
+
+static int printEntry(const indexEntry_t *e, void *ctx) {
+    int *row = (int*)ctx;
+    printf("%2d. %-30s orig=%lu stored=%lu flags=0x%02X hash=0x%08X vis=%s\n", ++*row, e->title, e->originalSize, e->storedSize, e->flags, e->hash, e->isPublic?"public":"private");
+    return 0;
+}
+
+static void sessionListSorted(locker_t *L, int order) {
+    visitFilter_t v;
+    lockerTotals_t t;
+    int row = 0;
+    v.L = L; v.fn = printEntry; v.ctx = &row; v.shown = 0;
+    indexTotals(&L->index, visibleScope(L), &t);
+    printf("\nStored Files (%lu)\n", t.count);
+    if (t.count > 0u) {
+        if (order == LOCKER_ORDER_SIZE) indexSizeRange(&L->index, 0ul, ~0ul, visitVisible, &v);
+        else indexRange(&L->index, NULL, NULL, visitVisible, &v);
+        printf("Total: orig=%lu stored=%lu (%lu compressed, %lu encrypted)\n", t.originalBytes, t.storedBytes, t.compressed, t.encrypted);
+    }
+    if (L->role == ROLE_PUBLIC && v.shown==0) printf("(no public files)\n");
+}
+
+static int sessionGetTotals(locker_t *L, lockerTotals_t *out) {
+    if (!out) return -1;
+    indexTotals(&L->index, visibleScope(L), out);
+    return 0;
+}
+
+static void sessionList(locker_t *L) {
+    sessionListSorted(L, LOCKER_ORDER_TITLE);
+}
+
+static int sessionQueryPrefix(locker_t *L, const char *prefix, lockerVisit_t fn, void *ctx) {
+    visitFilter_t v;
+    if (!prefix || !fn) return 0;
+    v.L = L; v.fn = fn; v.ctx = ctx; v.shown = 0;
+    indexPrefix(&L->index, prefix, visitVisible, &v);
+    return v.shown;
+}
+
+static int sessionQueryRange(locker_t *L, const char *from, const char *to, lockerVisit_t fn, void *ctx) {
+    visitFilter_t v;
+    if (!fn) return 0;
+    v.L = L; v.fn = fn; v.ctx = ctx; v.shown = 0;
+    indexRange(&L->index, from, to, visitVisible, &v);
+    return v.shown;
+}
+
+static int sessionQuerySize(locker_t *L, unsigned long minSize, unsigned long maxSize, lockerVisit_t fn, void *ctx) {
+    visitFilter_t v;
+    if (!fn) return 0;
+    v.L = L; v.fn = fn; v.ctx = ctx; v.shown = 0;
+    indexSizeRange(&L->index, minSize, maxSize, visitVisible, &v);
+    return v.shown;
+}
+
+static int sessionQuerySubstring(locker_t *L, const char *pattern, lockerVisit_t fn, void *ctx) {
+    visitFilter_t v;
+    if (!pattern || !fn) return 0;
+    v.L = L; v.fn = fn; v.ctx = ctx; v.shown = 0;
+    indexSubstring(&L->index, pattern, visibleScope(L), visitVisible, &v);
+    return v.shown;
+}
+
+static int sessionQueryContent(locker_t *L, const char *query, lockerVisit_t fn, void *ctx) {
+    visitFilter_t v;
+    if (!query || !fn) return 0;
+    v.L = L; v.fn = fn; v.ctx = ctx; v.shown = 0;
+    indexContent(&L->index, query, visibleScope(L), visitVisible, &v);
+    return v.shown;
+}
+
+static int printMatch(const indexEntry_t *e, void *ctx) {
+    (void)ctx;
+    printf("Match: %s\n", e->title);
+    return 0;
+}
+
+static int sessionSearch(locker_t *L, const char *pattern) {
+    if (!pattern || !*pattern) return 0;
+    return sessionQuerySubstring(L, pattern, printMatch, NULL);
+}
+
+/* Answered from the title order, so it walks only the matches. */
+static int sessionSearchPrefix(locker_t *L, const char *prefix) {
+    if (!prefix) return 0;
+    return sessionQueryPrefix(L, prefix, printMatch, NULL);
+}
+
+static int sessionSearchContent(locker_t *L, const char *query) {
+    if (!query || !*query) return 0;
+    return sessionQueryContent(L, query, printMatch, NULL);
+}
+
+static int feedTerms(const unsigned char *p, unsigned long n, void *ctx) {
+    termsFeed((termsBuilder_t*)ctx, p, n);
+    return 0;
+}
+
+static void dropAllTerms(locker_t *L) {
+    indexNode_t *n;
+    for (n = L->index.head; n; n = n->next) indexSetTerms(&L->index, n, NULL, 0u);
+}
+
+static int sessionSetContentIndex(locker_t *L, int enabled) {
+    indexNode_t *n;
+    int rc = 0;
+    if (L->role != ROLE_ADMIN || L->readOnly) return -3;
+    if (L->batch) return LOCKER_ERR_BATCH;
+    enabled = enabled ? 1 : 0;
+    if (enabled == L->index.termsOn) return 0;
+    L->index.termsOn = enabled;
+    /* existing entries are streamed through the tokenizer once to index
+     * them (large ones a chunk at a time, like lockerExtractStream) */
+    for (n = L->index.head; enabled && n && rc == 0; n = n->next) {
+        unsigned char *terms;
+        unsigned long len;
+        termsBuilder_t b;
+        termsInit(&b);
+        rc = sessionExtractStream(L, n->entry.title, feedTerms, &b);
+        if (rc != 0) { termsFree(&b); break; }
+        if (termsFinish(&b, &terms, &len) != 0) rc = -4;
+        else indexSetTerms(&L->index, n, terms, len);
+    }
+    /* the header flag and the term sets are written by a checkpoint (none
+     * are written with the index off) */
+    if (rc == 0) rc = sessionCheckpoint(L);
+    if (rc != 0) {
+        L->index.termsOn = !enabled;
+        if (enabled) dropAllTerms(L);
+        return rc;
+    }
+    if (!enabled) dropAllTerms(L);
+    return 0;
+}
+
+static int sessionContentIndexEnabled(locker_t *L) { return L->index.termsOn; }
+
+static int sessionSaveIndex(locker_t *L) {
+    if (L->lockerPath[0] == '\0') { DBG("[DBG] no locker path set\n"); return -1; }
+    if (L->batch) return sessionFlush(L); /* the batch commits as a whole */
+    if (!L->needCheckpoint) sessionFlush(L);
+    if (!L->needCheckpoint && L->journalReady && L->index.journalBytes <= L->index.baseBytes
+        && L->index.journalRecords < LOCKER_JOURNAL_MAX_RECORDS) {
+        DBG("[DBG] journal up to date (records=%lu bytes=%lu)\n", L->index.journalRecords, L->index.journalBytes);
+        return 0;
+    }
+    return sessionCheckpoint(L);
+}
+
+static int sessionCheckpoint(locker_t *L) {
+    if (L->lockerPath[0] == '\0') { DBG("[DBG] no locker path set\n"); return -1; }
+    if (L->readOnly) return -3;
+    if (L->batch) return LOCKER_ERR_BATCH; /* would persist half a batch */
+    DBG("[DBG] checkpointing index to %s (entries=%d journal=%lu)\n", L->lockerPath, L->index.count, L->index.journalBytes);
+    return rewriteImage(L, NULL);
+}
+
+/* Write a fresh base image (a PIN change when `newPin` is set, under the
+ * new PIN) and reopen it for appends. */
+static int rewriteImage(locker_t *L, const char *newPin) {
+    int rc;
+    /* queued records are superseded: their payloads are still resident;
+     * should the rewrite fail, the journal tail they reserved is gone */
+    if (L->group.len > 0u) { discardGroup(L); L->needCheckpoint = 1; }
+    if (L->lockerFile) { fclose(L->lockerFile); L->lockerFile = NULL; }
+    if (newPin) rc = storageRekeyAll(L->lockerPath, &L->index, L->masterPin, newPin);
+    else rc = storageSaveAll(L->lockerPath, &L->index, L->masterPin);
+    L->blobsStale = 1;
+    if (rc == 0) { L->needCheckpoint = 0; L->journalReady = 1; }
+    L->lockerFile = fopen(L->lockerPath, "r+b");
+    if (!L->lockerFile) L->journalReady = 0;
+    return rc;
+}
+
+static double sessionFragmentation(locker_t *L) {
+    unsigned long fileBytes, liveBytes;
+    if (L->lockerPath[0] == '\0') return 0.0;
+    if (storageFileSize(L->lockerPath, &fileBytes) != 0 || fileBytes == 0u) return 0.0;
+    liveBytes = storageImageSize(L->lockerFile, &L->index, L->masterPin);
+    return fileBytes > liveBytes ? (double)(fileBytes - liveBytes) / (double)fileBytes : 0.0;
+}
+
+static int sessionCompact(locker_t *L, lockerCompactStats_t *stats) {
+    int rc;
+    if (L->role != ROLE_ADMIN || L->readOnly) return -3;
+    if (L->batch) return LOCKER_ERR_BATCH;
+    if (L->lockerPath[0] == '\0') return -1;
+    /* the old file must be closed before it is replaced */
+    if (L->group.len > 0u) { discardGroup(L); L->needCheckpoint = 1; }
+    if (L->lockerFile) { fclose(L->lockerFile); L->lockerFile = NULL; }
+    rc = storageCompact(L->lockerPath, &L->index, L->masterPin, stats);
+    L->blobsStale = 1;
+    if (rc == 0) { L->needCheckpoint = 0; L->journalReady = 1; }
+    L->lockerFile = fopen(L->lockerPath, "r+b");
+    if (!L->lockerFile) L->journalReady = 0;
+    DBG("[DBG] compact rc=%d\n", rc);
+    return rc;
+}
+
+static int sessionLoadIndex(locker_t *L) {
+    int rc;
+    if (L->lockerPath[0] == '\0') { DBG("[DBG] no locker path set\n"); return -1; }
+    DBG("[DBG] loading index from %s\n", L->lockerPath);
+    discardGroup(L); /* queued changes are not in the file */
+    rc = storageLoadAll(L->lockerPath, &L->index, L->masterPin, sizeof(L->masterPin));
+    forgetKey(L); /* the PIN comes from the file */
+    cacheForgetAll(L);
+    L->blobsStale = 1;
+    L->journalReady = (rc == 0);
+    if (rc != 0) L->needCheckpoint = 1;
+    return rc;
+}
+
+void printMenu(void) {
+    locker_t *L = legacy();
+    printf("\nPersonal Document Locker (%s)\n", (L->role==ROLE_ADMIN?"admin":"public"));
+    printf("1. Add file (type content) %s\n", (L->role==ROLE_ADMIN?"":"(admin only)"));
+    printf("2. View file (decrypt+decompress)\n");
+    printf("3. Remove file %s\n", (L->role==ROLE_ADMIN?"":"(admin only)"));
+    printf("4. List files\n");
+    printf("5. Search by filename\n");
+    printf("6. Change master PIN %s\n", (L->role==ROLE_ADMIN?"":"(admin only)"));
+    printf("7. Edit file %s\n", (L->role==ROLE_ADMIN?"":"(admin only)"));
+    printf("8. Logout\n");
+    printf("9. Quit\n");
+    printf("10. Compact locker %s\n", (L->role==ROLE_ADMIN?"":"(admin only)"));
+    printf("11. List files by size\n");
+    printf("12. Search by content%s\n", (L->index.termsOn?"":" (content index off)"));
+    printf("13. Turn content index %s %s\n", (L->index.termsOn?"off":"on"), (L->role==ROLE_ADMIN?"":"(admin only)"));
+    printf("Select option: ");
+}
+
+static int sessionEditFile(locker_t *L, const char *title, const char *newTitle, const char *filepath, int compressFlag, int encryptFlag, int makePublic) {
+    indexNode_t *n;
+    const unsigned char *in = (const unsigned char*)"";
+    size_t inSize = 0;
+    char oldTitle[MAX_TITLE];
+    int rc;
+
+    if (L->role != ROLE_ADMIN) return -3;
+    if (!title || !*title) return -1;
+    n = findNode(L, title);
+    if (!n) return -2;
+    if (newTitle && *newTitle && (rc = titleFree(L, newTitle, n)) != 0) return rc;
+    strcpy(oldTitle, n->entry.title);
+    if (filepath && *filepath) {
+        unsigned long fileSize;
+        rc = util_fileSize(filepath, &fileSize);
+        if (rc != 0) return rc;
+        if (fileSize >= LOCKER_CHUNK_THRESHOLD) {
+            return putChunkedFile(L, n, (newTitle && *newTitle) ? newTitle : oldTitle, filepath, compressFlag, encryptFlag, makePublic);
+        }
+        rc = util_readInto(filepath, &L->enc.input, &L->enc.inputCap, &inSize);
+        if (rc != 0) return rc;
+        in = L->enc.input;
+    }
+    rc = editPayload(L, n, oldTitle, newTitle, in, (unsigned long)inSize, compressFlag, encryptFlag, makePublic);
+    if (rc == 0) DBG("[DBG] Edited entry %s (newTitle=%s)\n", title, (newTitle&&*newTitle)?newTitle:title);
+    return rc;
+}
+
+static int sessionAddContent(locker_t *L, const char *title, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic) {
+    int rc;
+    if (L->role != ROLE_ADMIN) return -3;
+    if (!title || !*title || (!buf && size>0)) return -1;
+    rc = titleFree(L, title, NULL);
+    if (rc != 0) return rc;
+    if (size >= LOCKER_CHUNK_THRESHOLD) return putChunked(L, NULL, title, NULL, buf, size, compressFlag, encryptFlag, makePublic);
+    return addPayload(L, title, buf ? buf : (const unsigned char*)"", size, compressFlag, encryptFlag, makePublic);
+}
+
+/* State of a directory import across platform_walkDir callbacks. */
+typedef struct {
+    locker_t *L;
+    size_t skip;           /* length of the root prefix cut from titles */
+    int compressFlag, encryptFlag, makePublic;
+    long count;
+} importWalk_t;
+
+static int importOne(const char *path, void *ctx) {
+    importWalk_t *w = (importWalk_t*)ctx;
+    const char *title = path + w->skip;
+    int rc;
+    while (*title == '/') title++;
+    if (!*title || strlen(title) >= MAX_TITLE) return -1;
+    /* small files share the encoder's input buffer; large ones stream */
+    rc = sessionAddFile(w->L, path, title, w->compressFlag, w->encryptFlag, w->makePublic);
+    if (rc == 0) w->count++;
+    return rc;
+}
+
+static long sessionImportDir(locker_t *L, const char *dir, int compressFlag, int encryptFlag, int makePublic) {
+    importWalk_t w;
+    int own, rc;
+    if (L->role != ROLE_ADMIN || L->readOnly) return -3;
+    if (!dir || !*dir) return -1;
+    memset(&w, 0, sizeof(w));
+    w.L = L;
+    w.skip = strlen(dir);
+    w.compressFlag = compressFlag;
+    w.encryptFlag = encryptFlag;
+    w.makePublic = makePublic;
+    own = !L->batch;
+    if (own && (rc = sessionBeginBatch(L)) != 0) return rc;
+    rc = platform_walkDir(dir, importOne, &w);
+    if (rc != 0) {
+        if (own) sessionAbortBatch(L);
+        return rc;
+    }
+    if (own && (rc = sessionCommitBatch(L)) != 0) return rc;
+    return w.count;
+}
+
+static int sessionEditContent(locker_t *L, const char *title, const char *newTitle, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic) {
+    indexNode_t *n;
+    char oldTitle[MAX_TITLE];
+    int rc;
+
+    if (L->role != ROLE_ADMIN) return -3;
+    if (!title || !*title || (!buf && size>0)) return -1;
+    n = findNode(L, title);
+    if (!n) return -2;
+    if (newTitle && *newTitle && (rc = titleFree(L, newTitle, n)) != 0) return rc;
+    strcpy(oldTitle, n->entry.title);
+    if (size >= LOCKER_CHUNK_THRESHOLD) {
+        return putChunked(L, n, (newTitle && *newTitle) ? newTitle : oldTitle, NULL, buf, size, compressFlag, encryptFlag, makePublic);
+    }
+    return editPayload(L, n, oldTitle, newTitle, buf ? buf : (const unsigned char*)"", size, compressFlag, encryptFlag, makePublic);
+}
+
+static int sessionGetContent(locker_t *L, const char *title, unsigned char **outBuf, unsigned long *outSize) {
+    indexNode_t *n;
+    unsigned char *buf;
+    size_t nbytes;
+    unsigned int calc;
+    int rc;
+    if (!title || !outBuf || !outSize) return -1;
+    *outBuf = NULL; *outSize = 0;
+    n = findNode(L, title);
+    if (!n) return -2;
+    if (L->role == ROLE_PUBLIC && !n->entry.isPublic) return -3;
+    nbytes = (size_t)n->entry.storedSize;
+    if (nbytes == 0) { *outBuf = NULL; *outSize = 0; return 0; }
+    rc = cacheLookup(L, n, outBuf, outSize);
+    if (rc != 0) return rc < 0 ? -4 : 0;
+    if (n->entry.flags & FLAG_CHUNKED) {
+        buf = (unsigned char*)malloc((size_t)n->entry.originalSize + 1u);
+        if (!buf) return -4;
+        rc = readChunked(L, &n->entry, buf, NULL, NULL);
+        if (rc != 0) { free(buf); return rc; }
+    } else {
+        /* one allocation, filled by a single decrypt + expand + hash pass */
+        buf = (unsigned char*)malloc((size_t)n->entry.originalSize + 1u);
+        if (!buf) return -4;
+        rc = decodeInto(L, &n->entry, buf, &calc);
+        if (rc != 0) { free(buf); return rc; }
+        /* Optional integrity check */
+        if (n->entry.originalSize > 0 && n->entry.hash != 0u && calc != n->entry.hash) { free(buf); return -9; }
+    }
+    cacheKeep(L, n, buf, n->entry.originalSize);
+    *outBuf = buf; *outSize = n->entry.originalSize;
+    return 0;
+}
+
+static int sessionViewContent(locker_t *L, const char *title, const unsigned char **outView, unsigned long *outSize) {
+    indexNode_t *n;
+    lockerView_t *v = NULL;
+    unsigned long i;
+    int rc = 0;
+    if (!title || !outView || !outSize) return -1;
+    *outView = NULL; *outSize = 0;
+    n = findNode(L, title);
+    if (!n) return -2;
+    if (L->role == ROLE_PUBLIC && !n->entry.isPublic) return -3;
+    if (n->entry.flags & (FLAG_COMPRESSED | FLAG_ENCRYPTED | FLAG_CHUNKED)) return -10; /* needs decoding */
+    if (n->entry.storedSize == 0) return 0;
+    /* the payload is read and checked on the first view, then stays
+     * resident (within the cache budget once unheld) and later views borrow
+     * it as is. It is not the entry's queued buffer, so commits,
+     * checkpoints and writers on other threads leave it alone */
+    lockSession(L, LOCKER_LOCK_IO);
+    for (i = 0; i < L->nviews; i++) {
+        if (L->views[i].current && L->views[i].seq == n->seq) { v = &L->views[i]; break; }
+    }
+    if (!v && L->nviews == L->viewsCap) {
+        unsigned long cap = L->viewsCap ? L->viewsCap * 2u : 8u;
+        lockerView_t *nv = (lockerView_t*)realloc(L->views, (size_t)cap * sizeof(lockerView_t));
+        if (!nv) rc = -4;
+        else { L->views = nv; L->viewsCap = cap; }
+    }
+    if (!v && rc == 0) {
+        unsigned char *buf = (unsigned char*)malloc((size_t)n->entry.storedSize);
+        if (!buf) rc = -4;
+        else if (n->entry.data) memcpy(buf, n->entry.data, (size_t)n->entry.storedSize); /* still queued */
+        else if (storageReadPayload(L->lockerFile, &n->entry, buf) != 0) rc = -4;
+        if (rc == 0 && n->entry.hash != 0u && (unsigned int)compute_file_hash(buf, (size_t)n->entry.storedSize) != n->entry.hash) rc = -9;
+        if (rc == 0) {
+            v = &L->views[L->nviews++];
+            v->seq = n->seq; v->current = 1; v->data = buf; v->size = n->entry.storedSize; v->refs = 0;
+            L->viewsIdle += v->size;
+        } else free(buf);
+    }
+    if (v) {
+        if (v->refs++ == 0ul) L->viewsIdle -= v->size;
+        v->used = ++L->viewClock;
+        *outView = v->data; *outSize = n->entry.storedSize;
+    }
+    unlockSession(L, LOCKER_LOCK_IO);
+    return rc;
+}
+
+static int sessionReleaseView(locker_t *L, const unsigned char *view) {
+    unsigned long i;
+    int rc = -1;
+    if (!view) return 0; /* empty entries lend no bytes */
+    lockSession(L, LOCKER_LOCK_IO);
+    for (i = 0; i < L->nviews; i++) {
+        lockerView_t *v = &L->views[i];
+        if (v->data != view) continue;
+        if (v->refs == 0ul) break; /* resident, but not held */
+        if (--v->refs == 0ul) {
+            L->viewsIdle += v->size;
+            if (!v->current) viewFree(L, i);
+            else viewTrim(L);
+        }
+        rc = 0;
+        break;
+    }
+    unlockSession(L, LOCKER_LOCK_IO);
+    return rc;
+}
+
+/* Handle API: each call holds the session's lock around its session* body. */
+locker_t *locker_new(const lockerLockHooks_t *hooks) {
+    locker_t *L = (locker_t*)malloc(sizeof(locker_t));
+    if (L) sessionInit(L, hooks);
+    return L;
+}
+
+void locker_free(locker_t *L) {
+    if (!L) return;
+    locker_close(L);
+    cacheFree(&L->cache);
+    free(L->views);
+    free(L);
+}
+
+index_t *locker_getIndex(locker_t *L) { return &L->index; }
+
+int locker_setPool(locker_t *L, const lockerPool_t *pool) {
+    lockSession(L, LOCKER_LOCK_WRITE);
+    if (pool) L->pool = *pool;
+    else memset(&L->pool, 0, sizeof L->pool);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return 0;
+}
+
+int locker_getRole(locker_t *L) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionGetRole(L);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_open(locker_t *L, const char *lockerPath, const char *pin) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionOpen(L, lockerPath, pin);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_close(locker_t *L) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionClose(L);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_changePIN(locker_t *L, const char *oldPin, const char *newPin) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionChangePIN(L, oldPin, newPin);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_addFile(locker_t *L, const char *filepath, const char *title, int compressFlag, int encryptFlag, int makePublic) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionAddFile(L, filepath, title, compressFlag, encryptFlag, makePublic);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_extractFile(locker_t *L, const char *title, const char *outputPath) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionExtractFile(L, title, outputPath);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_removeFile(locker_t *L, const char *title) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionRemoveFile(L, title);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_editFile(locker_t *L, const char *title, const char *newTitle, const char *filepath, int compressFlag, int encryptFlag, int makePublic) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionEditFile(L, title, newTitle, filepath, compressFlag, encryptFlag, makePublic);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_addStream(locker_t *L, const char *title, lockerRead_t fn, void *ctx, int compressFlag, int encryptFlag, int makePublic) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionAddStream(L, title, fn, ctx, compressFlag, encryptFlag, makePublic);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_extractStream(locker_t *L, const char *title, lockerWrite_t fn, void *ctx) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionExtractStream(L, title, fn, ctx);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_addContent(locker_t *L, const char *title, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionAddContent(L, title, buf, size, compressFlag, encryptFlag, makePublic);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_editContent(locker_t *L, const char *title, const char *newTitle, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionEditContent(L, title, newTitle, buf, size, compressFlag, encryptFlag, makePublic);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_getContent(locker_t *L, const char *title, unsigned char **outBuf, unsigned long *outSize) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionGetContent(L, title, outBuf, outSize);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_viewContent(locker_t *L, const char *title, const unsigned char **outView, unsigned long *outSize) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionViewContent(L, title, outView, outSize);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_releaseView(locker_t *L, const unsigned char *view) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionReleaseView(L, view);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+void locker_list(locker_t *L) {
+    lockSession(L, LOCKER_LOCK_READ);
+    sessionList(L);
+    unlockSession(L, LOCKER_LOCK_READ);
+}
+
+int locker_search(locker_t *L, const char *pattern) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionSearch(L, pattern);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_searchPrefix(locker_t *L, const char *prefix) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionSearchPrefix(L, prefix);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+void locker_listSorted(locker_t *L, int order) {
+    lockSession(L, LOCKER_LOCK_READ);
+    sessionListSorted(L, order);
+    unlockSession(L, LOCKER_LOCK_READ);
+}
+
+int locker_queryPrefix(locker_t *L, const char *prefix, lockerVisit_t fn, void *ctx) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionQueryPrefix(L, prefix, fn, ctx);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_queryRange(locker_t *L, const char *from, const char *to, lockerVisit_t fn, void *ctx) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionQueryRange(L, from, to, fn, ctx);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_querySize(locker_t *L, unsigned long minSize, unsigned long maxSize, lockerVisit_t fn, void *ctx) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionQuerySize(L, minSize, maxSize, fn, ctx);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_querySubstring(locker_t *L, const char *pattern, lockerVisit_t fn, void *ctx) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionQuerySubstring(L, pattern, fn, ctx);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_setContentIndex(locker_t *L, int enabled) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionSetContentIndex(L, enabled);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_contentIndexEnabled(locker_t *L) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionContentIndexEnabled(L);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_queryContent(locker_t *L, const char *query, lockerVisit_t fn, void *ctx) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionQueryContent(L, query, fn, ctx);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_searchContent(locker_t *L, const char *query) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionSearchContent(L, query);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_getTotals(locker_t *L, lockerTotals_t *out) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionGetTotals(L, out);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_saveIndex(locker_t *L) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionSaveIndex(L);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_loadIndex(locker_t *L) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionLoadIndex(L);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_setWriteBehind(locker_t *L, unsigned long maxRecords, unsigned long maxBytes, double maxSeconds) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionSetWriteBehind(L, maxRecords, maxBytes, maxSeconds);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_tick(locker_t *L) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionTick(L);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_flush(locker_t *L) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionFlush(L);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_checkpoint(locker_t *L) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionCheckpoint(L);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+double locker_fragmentation(locker_t *L) {
+    double rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionFragmentation(L);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_compact(locker_t *L, lockerCompactStats_t *stats) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionCompact(L, stats);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_getDedupStats(locker_t *L, lockerDedupStats_t *out) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionGetDedupStats(L, out);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_getEncodeStats(locker_t *L, lockerEncodeStats_t *out) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionGetEncodeStats(L, out);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_setEncodeTimings(locker_t *L, int enabled) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionSetEncodeTimings(L, enabled);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_setVerifyOnOpen(locker_t *L, int enabled) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionSetVerifyOnOpen(L, enabled);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_scrub(locker_t *L, const lockerScrubHooks_t *hooks, lockerVerifyStats_t *out) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionScrub(L, hooks, out);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_getVerifyStats(locker_t *L, lockerVerifyStats_t *out) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionGetVerifyStats(L, out);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_setCache(locker_t *L, unsigned long maxBytes) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionSetCache(L, maxBytes);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_getCacheStats(locker_t *L, lockerCacheStats_t *out) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionGetCacheStats(L, out);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+int locker_beginBatch(locker_t *L) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionBeginBatch(L);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_commitBatch(locker_t *L) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionCommitBatch(L);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_abortBatch(locker_t *L) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionAbortBatch(L);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+int locker_inBatch(locker_t *L) {
+    int rc;
+    lockSession(L, LOCKER_LOCK_READ);
+    rc = sessionInBatch(L);
+    unlockSession(L, LOCKER_LOCK_READ);
+    return rc;
+}
+
+long locker_importDir(locker_t *L, const char *dir, int compressFlag, int encryptFlag, int makePublic) {
+    long rc;
+    lockSession(L, LOCKER_LOCK_WRITE);
+    rc = sessionImportDir(L, dir, compressFlag, encryptFlag, makePublic);
+    unlockSession(L, LOCKER_LOCK_WRITE);
+    return rc;
+}
+
+/* Legacy API: the default session. */
+index_t *lockerGetIndex(void) { return locker_getIndex(legacy()); }
+int lockerGetRole(void) { return locker_getRole(legacy()); }
+int lockerOpen(const char *lockerPath, const char *pin) { return locker_open(legacy(), lockerPath, pin); }
+int lockerClose(void) { return locker_close(legacy()); }
+int lockerChangePIN(const char *oldPin, const char *newPin) { return locker_changePIN(legacy(), oldPin, newPin); }
+int lockerAddFile(const char *filepath, const char *title, int compressFlag, int encryptFlag, int makePublic) { return locker_addFile(legacy(), filepath, title, compressFlag, encryptFlag, makePublic); }
+int lockerExtractFile(const char *title, const char *outputPath) { return locker_extractFile(legacy(), title, outputPath); }
+int lockerRemoveFile(const char *title) { return locker_removeFile(legacy(), title); }
+int lockerEditFile(const char *title, const char *newTitle, const char *filepath, int compressFlag, int encryptFlag, int makePublic) { return locker_editFile(legacy(), title, newTitle, filepath, compressFlag, encryptFlag, makePublic); }
+int lockerAddStream(const char *title, lockerRead_t fn, void *ctx, int compressFlag, int encryptFlag, int makePublic) { return locker_addStream(legacy(), title, fn, ctx, compressFlag, encryptFlag, makePublic); }
+int lockerExtractStream(const char *title, lockerWrite_t fn, void *ctx) { return locker_extractStream(legacy(), title, fn, ctx); }
+int lockerAddContent(const char *title, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic) { return locker_addContent(legacy(), title, buf, size, compressFlag, encryptFlag, makePublic); }
+int lockerEditContent(const char *title, const char *newTitle, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic) { return locker_editContent(legacy(), title, newTitle, buf, size, compressFlag, encryptFlag, makePublic); }
+int lockerGetContent(const char *title, unsigned char **outBuf, unsigned long *outSize) { return locker_getContent(legacy(), title, outBuf, outSize); }
+int lockerViewContent(const char *title, const unsigned char **outView, unsigned long *outSize) { return locker_viewContent(legacy(), title, outView, outSize); }
+int lockerReleaseView(const unsigned char *view) { return locker_releaseView(legacy(), view); }
+void lockerList(void) { locker_list(legacy()); }
+int lockerSearch(const char *pattern) { return locker_search(legacy(), pattern); }
+int lockerSearchPrefix(const char *prefix) { return locker_searchPrefix(legacy(), prefix); }
+void lockerListSorted(int order) { locker_listSorted(legacy(), order); }
+int lockerQueryPrefix(const char *prefix, lockerVisit_t fn, void *ctx) { return locker_queryPrefix(legacy(), prefix, fn, ctx); }
+int lockerQueryRange(const char *from, const char *to, lockerVisit_t fn, void *ctx) { return locker_queryRange(legacy(), from, to, fn, ctx); }
+int lockerQuerySize(unsigned long minSize, unsigned long maxSize, lockerVisit_t fn, void *ctx) { return locker_querySize(legacy(), minSize, maxSize, fn, ctx); }
+int lockerQuerySubstring(const char *pattern, lockerVisit_t fn, void *ctx) { return locker_querySubstring(legacy(), pattern, fn, ctx); }
+int lockerSetContentIndex(int enabled) { return locker_setContentIndex(legacy(), enabled); }
+int lockerContentIndexEnabled(void) { return locker_contentIndexEnabled(legacy()); }
+int lockerQueryContent(const char *query, lockerVisit_t fn, void *ctx) { return locker_queryContent(legacy(), query, fn, ctx); }
+int lockerSearchContent(const char *query) { return locker_searchContent(legacy(), query); }
+int lockerGetTotals(lockerTotals_t *out) { return locker_getTotals(legacy(), out); }
+int lockerSaveIndex(void) { return locker_saveIndex(legacy()); }
+int lockerLoadIndex(void) { return locker_loadIndex(legacy()); }
+int lockerSetWriteBehind(unsigned long maxRecords, unsigned long maxBytes, double maxSeconds) { return locker_setWriteBehind(legacy(), maxRecords, maxBytes, maxSeconds); }
+int lockerFlush(void) { return locker_flush(legacy()); }
+int lockerTick(void) { return locker_tick(legacy()); }
+int lockerCheckpoint(void) { return locker_checkpoint(legacy()); }
+double lockerFragmentation(void) { return locker_fragmentation(legacy()); }
+int lockerCompact(lockerCompactStats_t *stats) { return locker_compact(legacy(), stats); }
+int lockerGetDedupStats(lockerDedupStats_t *out) { return locker_getDedupStats(legacy(), out); }
+int lockerGetEncodeStats(lockerEncodeStats_t *out) { return locker_getEncodeStats(legacy(), out); }
+int lockerSetEncodeTimings(int enabled) { return locker_setEncodeTimings(legacy(), enabled); }
+int lockerSetVerifyOnOpen(int enabled) { return locker_setVerifyOnOpen(legacy(), enabled); }
+int lockerGetVerifyStats(lockerVerifyStats_t *out) { return locker_getVerifyStats(legacy(), out); }
+int lockerScrub(const lockerScrubHooks_t *hooks, lockerVerifyStats_t *out) { return locker_scrub(legacy(), hooks, out); }
+int lockerSetCache(unsigned long maxBytes) { return locker_setCache(legacy(), maxBytes); }
+int lockerGetCacheStats(lockerCacheStats_t *out) { return locker_getCacheStats(legacy(), out); }
+int lockerBeginBatch(void) { return locker_beginBatch(legacy()); }
+int lockerCommitBatch(void) { return locker_commitBatch(legacy()); }
+int lockerAbortBatch(void) { return locker_abortBatch(legacy()); }
+int lockerInBatch(void) { return locker_inBatch(legacy()); }
+long lockerImportDir(const char *dir, int compressFlag, int encryptFlag, int makePublic) { return locker_importDir(legacy(), dir, compressFlag, encryptFlag, makePublic); }
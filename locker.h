@@ -22,25 +22,98 @@
 /* Flags */
 #define FLAG_COMPRESSED (1u<<0)
 #define FLAG_ENCRYPTED  (1u<<1)
+#define FLAG_CHUNKED    (1u<<2) /* payload is a manifest of shared chunks */
 
 typedef struct {
-    char title[MAX_TITLE];
+    const char *title;    /* NUL-terminated, under MAX_TITLE bytes; interned by the index once linked */
     unsigned long originalSize;
     unsigned long storedSize;
     unsigned int flags;
     unsigned int hash; /* 32-bit hash of original (decompressed, decrypted) content */
     int isPublic;
-    unsigned char *data;
+    unsigned long offset; /* file offset of the stored bytes when data is NULL */
+    unsigned char *data;  /* resident stored bytes, or NULL once on disk */
 } indexEntry_t;
 
 typedef struct indexNode {
     indexEntry_t entry;
     struct indexNode *next;
+    struct indexNode *prev;
+    struct indexNode **links;     /* skip-list links: `level` by title, then `level` by size */
+    int level;
+    unsigned long seq;            /* link number (reused once unlinked); breaks ties between equal keys */
+    unsigned long sizeKey;        /* originalSize the size order files it under */
+    unsigned char *terms;         /* content index term set (terms.h), or NULL */
+    unsigned long termsLen;
 } indexNode_t;
 
+/* One title hash slot (index.c); `node` NULL = empty. */
+typedef struct {
+    indexNode_t *node;
+    unsigned long hash;
+} indexSlot_t;
+
+/* Ordered views kept by index.c: skip lists by title and by size. */
+#define INDEX_ORDERS 2
+#define INDEX_LEVELS 16
+
+/* Posting lists by key (index.c): open addressing, `slots` a power of two. */
+typedef struct {
+    struct indexGram *lists;
+    unsigned long slots;
+    unsigned long count;
+} indexPostings_t;
+
+/* Entry metadata by link number (index.c), so filters and aggregates
+ * scan flat arrays instead of nodes. Bit `seq` of the bitmaps is bit
+ * seq % INDEX_WORD_BITS of word seq / INDEX_WORD_BITS. There is no
+ * content hash column: no filter or aggregate reads the hash (dedup keeps
+ * its own table), only loads and scrubs of single entries, which have the
+ * node. Titles stay in the nodes, interned in the arena. */
+#define INDEX_WORD_BITS (sizeof(unsigned long) * 8u)
+typedef struct {
+    unsigned long *originalSize;
+    unsigned long *storedSize;
+    unsigned int *flags;
+    unsigned long *live;          /* linked entries */
+    unsigned long *pub;           /* public entries */
+} indexColumns_t;
+
+/* Storage behind the nodes, skip-list links and titles of an index
+ * (index.c): carved from large blocks and released together by indexFree.
+ * Nodes and link arrays handed back are reused; title bytes are not. */
+typedef struct {
+    void *blocks;                 /* newest block; each begins with a pointer to the one before */
+    char *next;                   /* free space in the newest block */
+    unsigned long left;
+    indexNode_t *freeNodes;       /* chained through `next` */
+    indexNode_t **freeLinks[INDEX_LEVELS]; /* link arrays by level - 1, chained through their first link */
+} indexArena_t;
+
+/* Entries live in a doubly-linked list, found by title through an
+ * open-addressing hash, in order through skip lists, by substring through
+ * title trigrams and by content terms when the content index is on. Link,
+ * unlink, rename, resize and set terms through index.h. */
 typedef struct {
     indexNode_t *head;
     int count;
+    unsigned long baseBytes;      /* size of the checkpointed base image */
+    unsigned long journalBytes;   /* bytes of valid journal records after it */
+    unsigned long journalRecords; /* number of journal records after it */
+    indexSlot_t *slots;           /* title hash, slotCount (a power of two) slots */
+    unsigned long slotCount;
+    indexNode_t *orderHead[INDEX_ORDERS][INDEX_LEVELS];
+    int levels;                   /* skip-list levels in use */
+    unsigned long seq;            /* link numbers in use are below this */
+    indexPostings_t grams;        /* title trigrams */
+    indexPostings_t terms;        /* content terms, by termsHash */
+    indexNode_t **bySeq;          /* node by link number (NULL once unlinked) */
+    unsigned long bySeqCap;       /* capacity of bySeq, spare and cols */
+    unsigned long *spare;         /* link numbers freed by unlinks, reused first */
+    unsigned long spareCount;
+    indexColumns_t cols;          /* metadata by link number */
+    int termsOn;                  /* content index kept for this locker */
+    indexArena_t arena;           /* nodes, links and titles */
 } index_t;
 
 typedef struct {
@@ -50,6 +123,108 @@ typedef struct {
     char masterPin[MAX_PIN];
 } lockerHeader_t;
 
+/* Content at least this large is split into content-defined chunks, each
+ * stored once and shared by every entry (or revision) containing it, so
+ * re-storing a slightly changed file writes only the chunks that changed.
+ * Files are chunked while they are read and never held in memory whole. */
+#define LOCKER_CHUNK_THRESHOLD (256ul * 1024ul)
+
+/* Unchunked entries at least this large are extracted one buffer at a time
+ * instead of being held in memory. */
+#define LOCKER_STREAM_THRESHOLD (64ul * 1024ul * 1024ul)
+#define LOCKER_STREAM_CHUNK     (1024ul * 1024ul)
+
+/* Default write-behind group bounds used by the interactive program. */
+#define LOCKER_WB_RECORDS 64ul
+#define LOCKER_WB_BYTES   (1024ul * 1024ul)
+#define LOCKER_WB_SECONDS 5.0
+
+/* Payload deduplication: entries with identical content share one stored
+ * copy. */
+typedef struct {
+    unsigned long blobs;       /* distinct shared-able payloads on disk */
+    unsigned long refs;        /* entries referencing them */
+    unsigned long bytesShared; /* stored bytes saved by sharing */
+    unsigned long chunks;      /* distinct chunks of chunked entries */
+    unsigned long chunkRefs;   /* references to them from manifests */
+    unsigned long chunkBytesShared;
+} lockerDedupStats_t;
+
+/* Write-path counters of the session encoder: payloads encoded, bytes in
+ * and out, scratch buffers allocated or grown (none in steady state, once
+ * write-behind groups recycle their buffers), work buffers kept by entries
+ * instead of copied, and processor seconds per
+ * stage (store = dedup probe and journal write; 0 unless timings are on,
+ * see lockerSetEncodeTimings). */
+typedef struct {
+    unsigned long encodes;
+    unsigned long bytesIn;
+    unsigned long bytesOut;
+    unsigned long allocations;
+    unsigned long adopted;
+    double hashSeconds;
+    double compressSeconds;
+    double encryptSeconds;
+    double storeSeconds;
+} lockerEncodeStats_t;
+
+/* Result of an integrity pass: every entry decoded (decrypted, expanded)
+ * and rehashed against its stored hash. */
+typedef struct {
+    unsigned long entries;     /* entries checked */
+    unsigned long bytes;       /* content bytes rehashed */
+    unsigned long corrupt;     /* hash mismatch or malformed payload */
+    unsigned long unreadable;  /* read or memory failure */
+    double seconds;
+} lockerVerifyStats_t;
+
+/* Decoded-content cache counters. */
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;   /* dropped to make room */
+    unsigned long entries;     /* held now */
+    unsigned long bytes;       /* held now, bookkeeping included */
+    unsigned long maxBytes;    /* budget; 0 = off */
+} lockerCacheStats_t;
+
+/* Titles are unique: adding an entry under (or renaming one to) a title
+ * that is already in use fails with this code. */
+#define LOCKER_ERR_EXISTS (-11)
+/* Returned by calls that cannot run inside (or without) an open batch. */
+#define LOCKER_ERR_BATCH (-12)
+/* Sizes and file offsets are unsigned long and long: where those are 32
+ * bits (64-bit Windows) an entry holds at most 4 GiB and a locker file at
+ * most 2 GiB. An add or edit that would pass either limit fails with this
+ * code before the file grows past it (a streamed add may have appended
+ * some chunks, reclaimed by compaction). */
+#define LOCKER_ERR_TOO_LARGE (-13)
+
+/* Compaction throughput goal; lockerCompact reports against it. */
+#define LOCKER_COMPACT_TARGET_MBPS 200.0
+
+/* Aggregates over the entries a session can see. Stored bytes count a
+ * shared payload once per entry. */
+typedef struct {
+    unsigned long count;
+    unsigned long originalBytes;
+    unsigned long storedBytes;
+    unsigned long compressed;      /* entries with FLAG_COMPRESSED */
+    unsigned long encrypted;       /* entries with FLAG_ENCRYPTED */
+} lockerTotals_t;
+
+/* Result of a compaction (vacuum) pass */
+typedef struct {
+    unsigned long fileBytesBefore; /* locker file size before */
+    unsigned long fileBytesAfter;  /* locker file size after */
+    unsigned long liveBytes;       /* size of a freshly written image */
+    unsigned long deadBytes;       /* reclaimable space before the pass */
+    double fragmentation;          /* deadBytes / fileBytesBefore */
+    unsigned long bytesCopied;     /* live payload bytes moved from the old file */
+    double seconds;                /* wall time of the copy */
+    double mbPerSec;
+} lockerCompactStats_t;
+
 /* Debug function: implemented in util.c. Use DBG(...) in code which maps to dbg. */
 void dbg(const char *fmt, ...);
 #define DBG dbg
@@ -58,6 +233,8 @@ void dbg(const char *fmt, ...);
 index_t *lockerGetIndex(void);
 int lockerGetRole(void);
 
+/* A NULL/empty pin opens a read-only public session: the file is opened
+ * "rb", never created and never written back. */
 int lockerOpen(const char *lockerPath, const char *pin);
 int lockerClose(void);
 
@@ -69,16 +246,236 @@ int lockerRemoveFile(const char *title);
 /* Edit existing entry: replace content/metadata, optionally rename. */
 int lockerEditFile(const char *title, const char *newTitle, const char *filepath, int compressFlag, int encryptFlag, int makePublic);
 
+/* Streaming content APIs: content moves through fixed-size buffers, so
+ * memory use does not grow with the entry. A reader fills up to `cap` bytes
+ * and returns how many (0 at the end, negative on error); a writer returns
+ * non-zero to stop. Added content of LOCKER_CHUNK_THRESHOLD bytes or more is
+ * chunked as it arrives; extraction checks the content hash at the end
+ * (-9), after the writer has seen the bytes. */
+typedef long (*lockerRead_t)(unsigned char *buf, unsigned long cap, void *ctx);
+typedef int (*lockerWrite_t)(const unsigned char *buf, unsigned long n, void *ctx);
+int lockerAddStream(const char *title, lockerRead_t fn, void *ctx, int compressFlag, int encryptFlag, int makePublic);
+int lockerExtractStream(const char *title, lockerWrite_t fn, void *ctx);
+
 /* New in-memory content APIs (caller owns buffers passed in; returned buffers must be freed by caller) */
 int lockerAddContent(const char *title, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic);
 int lockerEditContent(const char *title, const char *newTitle, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic);
 int lockerGetContent(const char *title, unsigned char **outBuf, unsigned long *outSize);
+/* View of a plain (uncompressed, unencrypted) entry: a borrowed pointer to
+ * its stored bytes. The first view reads and checks them into a session
+ * buffer that every view held at the same time borrows without a copy.
+ * Once released it is kept, least recently viewed dropped first, within
+ * the lockerSetCache budget (not at all with the cache off). A view stays
+ * valid, whatever else runs meanwhile, until it is passed to
+ * lockerReleaseView or the locker is closed; an edit is seen by views taken
+ * after it. Do not free it. Returns -10 for entries that need decoding (use
+ * lockerGetContent instead). */
+int lockerViewContent(const char *title, const unsigned char **outView, unsigned long *outSize);
+/* Give back a view (NULL is a no-op); -1 if it is not held. */
+int lockerReleaseView(const unsigned char *view);
 
 void lockerList(void);
+/* Print the visible titles containing `pattern` (`*` is literal); the count. */
 int lockerSearch(const char *pattern);
+/* Print the visible titles starting with `prefix`; the count. */
+int lockerSearchPrefix(const char *prefix);
+
+/* Ordered listing and queries, served from the ordered index in order
+ * without a scan or sort. `fn` is called per visible entry and may return
+ * non-zero to stop; the result is the number of entries visited. */
+#define LOCKER_ORDER_TITLE 0
+#define LOCKER_ORDER_SIZE  1
+typedef int (*lockerVisit_t)(const indexEntry_t *e, void *ctx);
+void lockerListSorted(int order);
+/* Titles starting with `prefix`. */
+int lockerQueryPrefix(const char *prefix, lockerVisit_t fn, void *ctx);
+/* Titles in [from, to); NULL leaves that end open. */
+int lockerQueryRange(const char *from, const char *to, lockerVisit_t fn, void *ctx);
+/* Original sizes in [minSize, maxSize], smallest first. */
+int lockerQuerySize(unsigned long minSize, unsigned long maxSize, lockerVisit_t fn, void *ctx);
+/* Titles containing `pattern`, in no set order (not oldest first: new
+ * entries reuse the slots of removed ones). Patterns of three or more
+ * bytes are answered from the trigram index and verify only the titles
+ * holding all of their trigrams. */
+int lockerQuerySubstring(const char *pattern, lockerVisit_t fn, void *ctx);
+
+/* Content index (optional, per locker). When on, the text of every added
+ * or edited entry is tokenized (terms.h) into a term set kept with the
+ * entry and stored encrypted in the locker file, so content queries never
+ * decode payloads. Turning it on indexes existing entries once, streaming
+ * large ones; either way the locker is checkpointed. If an entry cannot be
+ * read or the checkpoint fails, its error is returned and the setting is
+ * left as it was. Admin only. */
+int lockerSetContentIndex(int enabled);
+int lockerContentIndexEnabled(void);
+/* Entries containing every term of `query`, in no set order. */
+int lockerQueryContent(const char *query, lockerVisit_t fn, void *ctx);
+/* Print matching titles; returns the number of matches. */
+int lockerSearchContent(const char *query);
+
+/* Totals over the visible entries (public ones in a public session),
+ * summed from the metadata columns without reading any entry. */
+int lockerGetTotals(lockerTotals_t *out);
 
 int lockerSaveIndex(void);
 int lockerLoadIndex(void);
+/* Write-behind mode: changes are queued in memory and committed to the
+ * journal as one write once `maxRecords` records or `maxBytes` bytes are
+ * pending, or the oldest pending change is `maxSeconds` old (0 disables a
+ * bound). The locker starts no thread: thresholds are checked when a change
+ * is logged and when lockerTick() is called, so a program that wants the
+ * time bound kept while the queue stops growing calls it from its own loop
+ * or timer. Queued changes are lost on a crash until committed. maxRecords
+ * 0 returns to write-through. */
+int lockerSetWriteBehind(unsigned long maxRecords, unsigned long maxBytes, double maxSeconds);
+/* Barrier: commit every queued change now. Save and close also flush. */
+int lockerFlush(void);
+/* Commit the queued changes if the oldest is `maxSeconds` old (an open
+ * batch is left alone). 1 if it committed, 0 if nothing was due, -1 if the
+ * commit failed. Cheap enough to call often. */
+int lockerTick(void);
+/* Fold the journal into a fresh base image (full rewrite). */
+int lockerCheckpoint(void);
+/* Dead space (from removes, edits and journal overhead) as a fraction of the
+ * locker file; lockerCompact rewrites only live extents and reports stats. */
+double lockerFragmentation(void);
+int lockerCompact(lockerCompactStats_t *stats);
+int lockerGetDedupStats(lockerDedupStats_t *out);
+int lockerGetEncodeStats(lockerEncodeStats_t *out);
+/* Per-stage encode timings cost four clock reads per add or edit, so they
+ * are taken only while enabled. Off by default; the counters are always kept. */
+int lockerSetEncodeTimings(int enabled);
+/* Integrity check at open: after the index is loaded, every entry is
+ * decoded and rehashed (in parallel with a worker pool, see
+ * locker_setPool). Corrupt entries do not fail the open; the counts of the
+ * last check are kept for lockerGetVerifyStats. Off by default. */
+int lockerSetVerifyOnOpen(int enabled);
+int lockerGetVerifyStats(lockerVerifyStats_t *out);
+/* Scrub: the same check on demand, as a read (other reads go on meanwhile).
+ * `progress` gets the entries and content bytes checked so far as the
+ * pass goes; `failed` then gets each corrupt (-9, -7) or unreadable entry
+ * in file order. Memory stays at about 1 MiB per running task plus a
+ * pointer and a status per entry. Admin only. */
+typedef struct {
+    void (*progress)(unsigned long done, unsigned long total, unsigned long bytes, void *ctx);
+    void (*failed)(const char *title, int code, void *ctx);
+    void *ctx;
+} lockerScrubHooks_t;
+int lockerScrub(const lockerScrubHooks_t *hooks, lockerVerifyStats_t *out);
+/* Decoded-content cache: lockerGetContent and lockerExtractFile keep the
+ * content they decode, least recently used dropped first once `maxBytes`
+ * are held (content over an eighth of it is not kept), so a repeat read is
+ * a lookup and a copy. Payloads of released views are kept within a
+ * budget of the same size. Edits, renames, removes, PIN changes and reloads
+ * drop what they touch. 0 (the default) turns it off and empties it. */
+int lockerSetCache(unsigned long maxBytes);
+int lockerGetCacheStats(lockerCacheStats_t *out);
+
+/* Batches: every change between Begin and Commit is persisted as one unit
+ * (journal BEGIN/COMMIT markers; a batch without its COMMIT is ignored on
+ * load). Records queue as in write-behind. Checkpoint, compaction, PIN and
+ * content-index changes return LOCKER_ERR_BATCH meanwhile. Abort (and
+ * close) reloads the locker as it was before Begin. Admin only. */
+int lockerBeginBatch(void);
+int lockerCommitBatch(void);
+int lockerAbortBatch(void);
+int lockerInBatch(void);
+/* Add every regular file under `dir` (recursively, in name order) titled by
+ * its path relative to `dir`, as one batch (or within the caller's). Stops
+ * at the first failure, and then nothing is imported. Returns the number of
+ * files added or a negative error. */
+long lockerImportDir(const char *dir, int compressFlag, int encryptFlag, int makePublic);
+
+/* Sessions. A locker_t is one open locker with its own index, file, role,
+ * settings and encoder, so a process can keep several open. Every call
+ * above has a locker_ form taking the session first (lockerAddFile ->
+ * locker_addFile); the locker* calls run on a default session.
+ *
+ * Threads: with lock hooks a session may be used from any thread. Reads
+ * (content, views, extraction, listings, queries, totals, role, encode
+ * stats) hold LOCKER_LOCK_READ and run side by side; every other call
+ * holds LOCKER_LOCK_WRITE. Readers also take LOCKER_LOCK_IO, briefly,
+ * around reads of the file and the payloads views borrow. So
+ * READ/WRITE is a reader-writer lock and IO a mutex taken inside READ.
+ * Visitors and stream callbacks run under the session's lock and must
+ * not call back into the same session. Sessions share no state. */
+#define LOCKER_LOCK_READ  0
+#define LOCKER_LOCK_WRITE 1
+#define LOCKER_LOCK_IO    2
+typedef struct {
+    void (*lock)(void *ctx, int mode);
+    void (*unlock)(void *ctx, int mode);
+    void *ctx;
+} lockerLockHooks_t;
+typedef struct lockerSession locker_t;
+
+/* A closed session; `hooks` NULL for one used by a single thread at a
+ * time. NULL if memory is short. */
+locker_t *locker_new(const lockerLockHooks_t *hooks);
+/* Close (as locker_close) and free the session. */
+void locker_free(locker_t *L);
+/* The session's index, for inspection; the caller keeps other threads out. */
+index_t *locker_getIndex(locker_t *L);
+/* Worker pool for whole-locker passes: `run` calls task(arg, i) for every
+ * i < n, up to `workers` at a time, and returns when all are done. Used
+ * only by sessions with lock hooks (tasks read the file under
+ * LOCKER_LOCK_IO); otherwise, or with `pool` NULL, tasks run inline. */
+typedef void (*lockerTask_t)(void *arg, unsigned long i);
+typedef struct {
+    void (*run)(void *ctx, unsigned long n, lockerTask_t task, void *arg);
+    void *ctx;
+    unsigned long workers;
+} lockerPool_t;
+int locker_setPool(locker_t *L, const lockerPool_t *pool);
+int locker_getRole(locker_t *L);
+int locker_open(locker_t *L, const char *lockerPath, const char *pin);
+int locker_close(locker_t *L);
+int locker_changePIN(locker_t *L, const char *oldPin, const char *newPin);
+int locker_addFile(locker_t *L, const char *filepath, const char *title, int compressFlag, int encryptFlag, int makePublic);
+int locker_extractFile(locker_t *L, const char *title, const char *outputPath);
+int locker_removeFile(locker_t *L, const char *title);
+int locker_editFile(locker_t *L, const char *title, const char *newTitle, const char *filepath, int compressFlag, int encryptFlag, int makePublic);
+int locker_addStream(locker_t *L, const char *title, lockerRead_t fn, void *ctx, int compressFlag, int encryptFlag, int makePublic);
+int locker_extractStream(locker_t *L, const char *title, lockerWrite_t fn, void *ctx);
+int locker_addContent(locker_t *L, const char *title, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic);
+int locker_editContent(locker_t *L, const char *title, const char *newTitle, const unsigned char *buf, unsigned long size, int compressFlag, int encryptFlag, int makePublic);
+int locker_getContent(locker_t *L, const char *title, unsigned char **outBuf, unsigned long *outSize);
+int locker_viewContent(locker_t *L, const char *title, const unsigned char **outView, unsigned long *outSize);
+int locker_releaseView(locker_t *L, const unsigned char *view);
+void locker_list(locker_t *L);
+int locker_search(locker_t *L, const char *pattern);
+int locker_searchPrefix(locker_t *L, const char *prefix);
+void locker_listSorted(locker_t *L, int order);
+int locker_queryPrefix(locker_t *L, const char *prefix, lockerVisit_t fn, void *ctx);
+int locker_queryRange(locker_t *L, const char *from, const char *to, lockerVisit_t fn, void *ctx);
+int locker_querySize(locker_t *L, unsigned long minSize, unsigned long maxSize, lockerVisit_t fn, void *ctx);
+int locker_querySubstring(locker_t *L, const char *pattern, lockerVisit_t fn, void *ctx);
+int locker_setContentIndex(locker_t *L, int enabled);
+int locker_contentIndexEnabled(locker_t *L);
+int locker_queryContent(locker_t *L, const char *query, lockerVisit_t fn, void *ctx);
+int locker_searchContent(locker_t *L, const char *query);
+int locker_getTotals(locker_t *L, lockerTotals_t *out);
+int locker_saveIndex(locker_t *L);
+int locker_loadIndex(locker_t *L);
+int locker_setWriteBehind(locker_t *L, unsigned long maxRecords, unsigned long maxBytes, double maxSeconds);
+int locker_flush(locker_t *L);
+int locker_tick(locker_t *L);
+int locker_checkpoint(locker_t *L);
+double locker_fragmentation(locker_t *L);
+int locker_compact(locker_t *L, lockerCompactStats_t *stats);
+int locker_getDedupStats(locker_t *L, lockerDedupStats_t *out);
+int locker_getEncodeStats(locker_t *L, lockerEncodeStats_t *out);
+int locker_setEncodeTimings(locker_t *L, int enabled);
+int locker_setVerifyOnOpen(locker_t *L, int enabled);
+int locker_getVerifyStats(locker_t *L, lockerVerifyStats_t *out);
+int locker_scrub(locker_t *L, const lockerScrubHooks_t *hooks, lockerVerifyStats_t *out);
+int locker_setCache(locker_t *L, unsigned long maxBytes);
+int locker_getCacheStats(locker_t *L, lockerCacheStats_t *out);
+int locker_beginBatch(locker_t *L);
+int locker_commitBatch(locker_t *L);
+int locker_abortBatch(locker_t *L);
+int locker_inBatch(locker_t *L);
+long locker_importDir(locker_t *L, const char *dir, int compressFlag, int encryptFlag, int makePublic);
 
 void printMenu(void);
 
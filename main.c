@@ -6,6 +6,7 @@
  * This driver provides two runtime modes:
  *  - Interactive: admin/public login and menu-driven operations (add/extract/list/...)
  *  - CLI tool: `encrypt` minimal demo to compress+encrypt a file for extra marks
+ *  - CLI tools: `compact` a locker, `import` a directory tree in one batch
  */
 
 #include <stdio.h>
@@ -52,12 +53,38 @@ static int encrypt_demo(const char *inpath, const char *outpath, const char *pin
   return rc;
 }
 
+static void printCompactStats(const lockerCompactStats_t *st) {
+  printf("Fragmentation before: %.1f%% (%lu of %lu bytes dead)\n", st->fragmentation * 100.0, st->deadBytes, st->fileBytesBefore);
+  printf("Size after: %lu bytes; copied %lu payload bytes in %.3fs", st->fileBytesAfter, st->bytesCopied, st->seconds);
+  if (st->mbPerSec > 0.0) printf(" (%.1f MB/s, target %.0f MB/s)", st->mbPerSec, LOCKER_COMPACT_TARGET_MBPS);
+  printf("\n");
+}
+
+static void scrubProgress(unsigned long done, unsigned long total, unsigned long bytes, void *ctx) {
+  (void)ctx;
+  fprintf(stderr, "\rscrub: %lu/%lu entries, %.1f MB", done, total, (double)bytes / (1024.0 * 1024.0));
+  if (done == total) fprintf(stderr, "\n");
+}
+
+static void scrubFailed(const char *title, int code, void *ctx) {
+  (void)ctx;
+  printf("%s: %s (%d)\n", code == -9 || code == -7 ? "CORRUPT" : "UNREADABLE", title, code);
+}
+
+static void printScrubStats(const lockerVerifyStats_t *st) {
+  printf("Scrubbed %lu entries, %.1f MB in %.2f s", st->entries, (double)st->bytes / (1024.0 * 1024.0), st->seconds);
+  if (st->seconds > 0.0) printf(" (%.1f MB/s)", (double)st->bytes / (1024.0 * 1024.0) / st->seconds);
+  printf(": %lu corrupt, %lu unreadable\n", st->corrupt, st->unreadable);
+}
+
 int main(int argc, char **argv) {
-  /* Runtime mode parsing: --debug or 'debug' enables verbose logs; 'encrypt' subcommand. */
+  /* Runtime mode parsing: --debug or 'debug' enables verbose logs; 'encrypt' subcommand;
+   * --write-behind groups journal commits instead of writing each change. */
   {
     int i; int enableDebug = 0;
     for (i = 1; i < argc; i++) {
       if (strcmp(argv[i], "--debug") == 0 || strcmp(argv[i], "debug") == 0) { enableDebug = 1; }
+      if (strcmp(argv[i], "--write-behind") == 0) lockerSetWriteBehind(LOCKER_WB_RECORDS, LOCKER_WB_BYTES, LOCKER_WB_SECONDS);
     }
     if (enableDebug) { g_runtimeDebug = 1; }
   }
@@ -79,6 +106,56 @@ int main(int argc, char **argv) {
     return 0;
   }
 
+  /* CLI: ./program.out [--debug] compact <locker> <pin> */
+  if (argc >= 2 && strcmp(argv[1], "compact") == 0) {
+    lockerCompactStats_t st;
+    int r;
+    if (argc < 4) {
+      fprintf(stderr, "Usage: %s [--debug] compact <locker> <pin>\n", argv[0]);
+      return 1;
+    }
+    if (lockerOpen(argv[2], argv[3]) != 0) { fprintf(stderr, "Failed to open locker (wrong PIN?)\n"); return 1; }
+    r = lockerCompact(&st);
+    if (r == 0) printCompactStats(&st); else fprintf(stderr, "compact failed (%d)\n", r);
+    lockerClose();
+    return r == 0 ? 0 : 1;
+  }
+
+  /* CLI: ./program.out [--debug] import <locker> <pin> <dir> */
+  if (argc >= 2 && strcmp(argv[1], "import") == 0) {
+    long n;
+    if (argc < 5) {
+      fprintf(stderr, "Usage: %s [--debug] import <locker> <pin> <dir>\n", argv[0]);
+      return 1;
+    }
+    if (lockerOpen(argv[2], argv[3]) != 0) { fprintf(stderr, "Failed to open locker (wrong PIN?)\n"); return 1; }
+    /* private, compressed and encrypted; all files or none */
+    n = lockerImportDir(argv[4], 1, 1, 0);
+    if (n >= 0) printf("Imported %ld file(s) from %s\n", n, argv[4]);
+    else fprintf(stderr, "import failed (%ld); nothing was imported\n", n);
+    lockerClose();
+    return n >= 0 ? 0 : 1;
+  }
+
+  /* CLI: ./program.out [--debug] scrub <locker> <pin> */
+  if (argc >= 2 && strcmp(argv[1], "scrub") == 0) {
+    lockerScrubHooks_t hooks;
+    lockerVerifyStats_t st;
+    int r;
+    if (argc < 4) {
+      fprintf(stderr, "Usage: %s [--debug] scrub <locker> <pin>\n", argv[0]);
+      return 1;
+    }
+    if (lockerOpen(argv[2], argv[3]) != 0) { fprintf(stderr, "Failed to open locker (wrong PIN?)\n"); return 1; }
+    hooks.progress = scrubProgress;
+    hooks.failed = scrubFailed;
+    hooks.ctx = NULL;
+    r = lockerScrub(&hooks, &st);
+    if (r == 0) printScrubStats(&st); else fprintf(stderr, "scrub failed (%d)\n", r);
+    lockerClose();
+    return (r == 0 && st.corrupt == 0u && st.unreadable == 0u) ? 0 : 1;
+  }
+
   for (;;) {
     int roleChoice;
     char pin[64];
@@ -105,6 +182,7 @@ int main(int argc, char **argv) {
       printMenu();
       if (scanf("%d", &choice) != 1) { printf("Exiting.\n"); lockerClose(); return 0; }
       consumeLine();
+      lockerTick(); /* commit a write-behind group that aged at the prompt */
       if (choice == 8) { /* logout */
         printf("Logged out.\n");
         lockerClose();
@@ -137,9 +215,18 @@ int main(int argc, char **argv) {
         free(buf);
       } else if (choice == 2) {
         char title[128];
-        unsigned char *buf; unsigned long n; int rc;
+        unsigned char *buf; const unsigned char *view; unsigned long n; int rc;
         printf("Title to view: "); if (!fgets(title,sizeof title,stdin)) continue; title[strcspn(title,"\n")] = 0;
-        rc = lockerGetContent(title, &buf, &n);
+        /* plain entries are borrowed from the session's resident copy */
+        rc = lockerViewContent(title, &view, &n);
+        if (rc == 0) {
+          printf("----- %s (size=%lu) -----\n", title, n);
+          if (n>0 && view) { fwrite(view, 1, (size_t)n, stdout); }
+          printf("\n----- end -----\n");
+          lockerReleaseView(view);
+          continue;
+        }
+        if (rc == -10) rc = lockerGetContent(title, &buf, &n);
         if (rc == 0) {
           printf("----- %s (size=%lu) -----\n", title, n);
           if (n>0 && buf) { fwrite(buf, 1, (size_t)n, stdout); }
@@ -154,10 +241,27 @@ int main(int argc, char **argv) {
         if (lockerRemoveFile(title)==0) printf("Removed %s\n", title); else printf("Remove failed\n");
       } else if (choice == 4) {
         lockerList();
+      } else if (choice == 11) {
+        lockerListSorted(LOCKER_ORDER_SIZE);
+      } else if (choice == 12) {
+        char query[256]; int m;
+        printf("Content words: "); if (!fgets(query,sizeof query,stdin)) continue; query[strcspn(query,"\n")] = 0;
+        m = lockerSearchContent(query);
+        printf("%d match(es).\n", m);
+      } else if (choice == 13) {
+        int on = !lockerContentIndexEnabled();
+        if (lockerSetContentIndex(on)==0) printf("Content index %s.\n", on?"on":"off"); else printf("Failed (admin only or error)\n");
       } else if (choice == 5) {
-        char pattern[128]; int m;
-        printf("Search pattern: "); if (!fgets(pattern,sizeof pattern,stdin)) continue; pattern[strcspn(pattern,"\n")] = 0;
-        m = lockerSearch(pattern);
+        char pattern[128]; size_t len; int m;
+        printf("Search pattern (end with * for a prefix): "); if (!fgets(pattern,sizeof pattern,stdin)) continue; pattern[strcspn(pattern,"\n")] = 0;
+        /* the menu's own syntax: a single trailing `*` asks for a prefix */
+        len = strlen(pattern);
+        if (len > 0 && pattern[len-1] == '*' && strchr(pattern, '*') == pattern + len - 1) {
+          pattern[len-1] = '\0';
+          m = lockerSearchPrefix(pattern);
+        } else {
+          m = lockerSearch(pattern);
+        }
         printf("%d match(es).\n", m);
       } else if (choice == 6) {
         char oldPin[64], newPin[64];
@@ -185,6 +289,10 @@ int main(int argc, char **argv) {
         printf("Make public? (y/n): "); if (!fgets(ans, sizeof ans, stdin)) ans[0] = 'n';
         if (lockerEditContent(title, newTitle[0]?newTitle:NULL, buf, (unsigned long)len, 1, 1, (ans[0]=='y'||ans[0]=='Y'))==0) printf("Edited %s\n", title); else printf("Edit failed (admin only or error)\n");
         free(buf);
+      } else if (choice == 10) {
+        lockerCompactStats_t st;
+        printf("Fragmentation: %.1f%%\n", lockerFragmentation() * 100.0);
+        if (lockerCompact(&st) == 0) printCompactStats(&st); else printf("Compact failed (admin only or error)\n");
       } else {
         printf("Invalid choice.\n");
       }
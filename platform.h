@@ -0,0 +1,25 @@
+/*
+ * platform.h
+ * The few services standard C does not offer. Everything else in the
+ * locker is ANSI C with standard headers only; these live in one file per
+ * host (platform_posix.c, which MinGW also builds), so a port replaces
+ * that file and nothing else.
+ */
+
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+/* Call `fn` on the path of every regular file under `dir`, recursively,
+ * in name order. Stops at the first non-zero result from `fn` (returned);
+ * -1 if a directory cannot be read. */
+#define PLATFORM_PATH_MAX 4096
+typedef int (*platform_walkFn)(const char *path, void *ctx);
+int platform_walkDir(const char *dir, platform_walkFn fn, void *ctx);
+
+/* Wall-clock seconds from a monotonic source, for throughput of passes
+ * that wait on the disk or run on several threads (processor time would
+ * leave out the waits or add the threads up) and for how long write-behind
+ * changes have been queued. */
+double platform_clock(void);
+
+#endif /* PLATFORM_H */
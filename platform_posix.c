@@ -0,0 +1,66 @@
+/* platform_posix.c - directory walk and wall clock on POSIX (opendir/stat,
+ * clock_gettime; MinGW has them) */
+
+/* -ansi hides the POSIX declarations otherwise */
+#define _POSIX_C_SOURCE 200112L
+
+#include "platform.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static int cmp_name(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+int platform_walkDir(const char *dir, platform_walkFn fn, void *ctx) {
+    DIR *d;
+    struct dirent *de;
+    char **names = NULL;
+    size_t count = 0, cap = 0, i;
+    int rc = 0;
+    if (!dir || !fn) return -1;
+    d = opendir(dir);
+    if (!d) return -1;
+    /* names are sorted so a walk visits files in a stable order */
+    while ((de = readdir(d)) != NULL) {
+        char *name;
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        if (count == cap) {
+            size_t ncap = cap ? cap * 2u : 32u;
+            char **nn = (char**)realloc(names, ncap * sizeof(char*));
+            if (!nn) { rc = -1; break; }
+            names = nn;
+            cap = ncap;
+        }
+        name = (char*)malloc(strlen(de->d_name) + 1u);
+        if (!name) { rc = -1; break; }
+        strcpy(name, de->d_name);
+        names[count++] = name;
+    }
+    closedir(d);
+    if (rc == 0 && count > 1u) qsort(names, count, sizeof(char*), cmp_name);
+    for (i = 0; rc == 0 && i < count; i++) {
+        char path[PLATFORM_PATH_MAX];
+        struct stat st;
+        size_t len = strlen(dir);
+        if (len + strlen(names[i]) + 2u > sizeof path) { rc = -1; break; }
+        strcpy(path, dir);
+        if (len > 0u && dir[len-1] != '/') strcat(path, "/");
+        strcat(path, names[i]);
+        if (stat(path, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) rc = platform_walkDir(path, fn, ctx);
+        else if (S_ISREG(st.st_mode)) rc = fn(path, ctx);
+    }
+    for (i = 0; i < count; i++) free(names[i]);
+    free(names);
+    return rc;
+}
+
+double platform_clock(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) return (double)clock() / (double)CLOCKS_PER_SEC;
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
@@ -1,168 +1,1276 @@
 /* storage.c
  * Clean ANSI-C implementation for locker persistence.
+ *
+ * Version 3 files are a checkpointed base image followed by an append-only
+ * journal. Adds, edits and removes append one record each, so a save costs
+ * the size of the change; storageLoadAll replays the journal on top of the
+ * base image and storageSaveAll (the checkpoint) folds it back in.
+ *
+ * Payloads are not read at load time: each entry records the file offset of
+ * its stored bytes and storageReadPayload fetches them on demand.
+ *
+ * Since version 4 the base image keeps all entry metadata in one table of
+ * contents (TOC) after the payloads, located through a fixed trailer, so
+ * opening a locker (and list/search over it) reads only that block.
+ *
+ * Since version 5 every on-disk structure is fixed-width little-endian:
+ * a 64-byte header, 40-byte TOC records (8-byte aligned, titles kept in a
+ * pool after the record array) and a 32-byte trailer. Records are encoded
+ * and decoded in batches through one buffer, never field by field through
+ * stdio.
+ *
+ * Version 6 widens journal payload lengths to 64 bits.
+ *
+ * Version 7 adds chunked entries: the payload is a manifest of references
+ * to content-defined chunks, each logged once as a CHUNK record and shared
+ * by every entry (or revision) containing the same bytes.
+ *
+ * Version 8 adds the optional content index: each entry's term set is kept
+ * encrypted in a section after the title pool and logged as TERMS records,
+ * and a header flag says whether the locker keeps the index.
+ *
+ * Version 9 extends the check of TERMS journal records over their data, the
+ * one payload replay reads, so a garbled term set ends the journal like a
+ * torn head does. Other payloads are left on disk and are checked by their
+ * content hash when they are read. Versions 1-8 are still readable and are
+ * upgraded by the next checkpoint.
  */
 
 #include "storage.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "util.h"
+#include "crypto.h"
+#include "index.h"
+#include "terms.h"
+#include "platform.h"
 
 #define STORAGE_MAGIC 0x4C434B52U /* 'L' 'C' 'K' 'R' */
-#define STORAGE_VERSION 2
+#define STORAGE_VERSION 9
 
-static int write_u32(FILE *f, unsigned int v) {
-    return fwrite(&v, sizeof(v), 1, f) == 1 ? 0 : -1;
-}
+/* v5 header = [magic][version][baseEnd:8][pinLen][flags][pin:32][reserved:8];
+ * baseEnd is patched once the image is complete; flags are v8+ */
+#define HEADER_SIZE 64u
+#define HEADER_BASE_END_AT 8L
+#define HEADER_FLAGS_AT 20u
+#define HEADER_FLAG_TERMS 1u
+#define HEADER_PIN_AT 24u
+#define HEADER_PIN_MAX 32u
+
+/* v5 TOC record, 40 bytes:
+ *   0 offset:8   8 originalSize:8   16 storedSize:8
+ *  24 hash      28 flags (bit 31 = public)   32 titleOffset   36 titleLen */
+#define TOC_RECORD_SIZE 40u
+#define TOC_FLAG_PUBLIC 0x80000000u
+#define TOC_BATCH 4096u
+
+#define TOC_MAGIC 0x43544F43U /* 'C' 'O' 'T' 'C' */
+/* v5 trailer = [magic][count][tocOffset:8][tocBytes:8][poolBytes][termsBytes];
+ * v8 images with terms put a [len][encrypted term set] per TOC record
+ * (termsBytes in all, padded to 8) between the pool and the trailer */
+#define TOC_TRAILER_SIZE 32u
+/* v4 trailer = [magic][count][tocOffset][tocBytes], host byte order */
+#define TOC_TRAILER_V4_SIZE 16u
+
+#define JOURNAL_MAGIC 0x4A524E4CU /* 'J' 'R' 'N' 'L' */
+#define JOURNAL_OP_ADD    1u
+#define JOURNAL_OP_EDIT   2u
+#define JOURNAL_OP_REMOVE 3u
+#define JOURNAL_OP_CHUNK  4u
+#define JOURNAL_OP_TERMS  5u
+#define JOURNAL_OP_BEGIN  6u
+#define JOURNAL_OP_COMMIT 7u
+
+/* v6 record = [magic][op][metaLen][reserved][dataLen:8] meta data [check];
+ * v3-5 records have a 32-bit dataLen and no reserved word. The check covers
+ * meta and dataLen, and since v9 the data of TERMS records as well.
+ * v5+ meta: ADD    = toc record, title
+ *          EDIT   = [oldTitleLen][0], toc record, old title, title
+ *          REMOVE = [titleLen][0], title
+ *          CHUNK  = [hash][originalSize][flags][0] (v7; data = the chunk)
+ *          TERMS  = [titleLen][0], title (v8; data = the encrypted term set,
+ *                   empty to clear it)
+ *          BEGIN, COMMIT = no meta; the records between a BEGIN and its
+ *                   COMMIT replay only once the COMMIT is on disk (batches,
+ *                   v6+; older readers skip both and replay the records)
+ * An ADD/EDIT with dataLen 0 but a stored size shares (deduplicates) the
+ * payload at the toc record's offset instead of carrying one. */
+#define JOURNAL_HEAD_SIZE 24u
+#define JOURNAL_HEAD_V3_SIZE 16u
+#define JOURNAL_META_MAX  (8u + TOC_RECORD_SIZE + 2u * MAX_TITLE)
 
+/* Checkpoints stream live payloads through one buffer of this size, so a
+ * compaction's memory use is bounded regardless of entry sizes. */
+#define COPY_CHUNK (1024u * 1024u)
+
+/* Host byte order field I/O, used only by the version 1-4 readers. */
 static int read_u32(FILE *f, unsigned int *out) {
     return fread(out, sizeof(*out), 1, f) == 1 ? 0 : -1;
 }
 
-int storageSaveAll(const char *path, const index_t *idx, const char *masterPin) {
+static size_t get_u32(const unsigned char *p, unsigned int *out) {
+    memcpy(out, p, sizeof(*out));
+    return sizeof(*out);
+}
+
+static void put_le32(unsigned char *p, unsigned long v) {
+    p[0] = (unsigned char)(v & 0xFFu);
+    p[1] = (unsigned char)((v >> 8) & 0xFFu);
+    p[2] = (unsigned char)((v >> 16) & 0xFFu);
+    p[3] = (unsigned char)((v >> 24) & 0xFFu);
+}
+
+static unsigned int get_le32(const unsigned char *p) {
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+/* 64-bit fields are two 32-bit halves; the split shift stays defined where
+ * unsigned long is only 32 bits wide. */
+static void put_le64(unsigned char *p, unsigned long v) {
+    put_le32(p, v & 0xFFFFFFFFul);
+    put_le32(p + 4, (v >> 16) >> 16);
+}
+
+/* Returns -1 if the value does not fit an unsigned long on this host. */
+static int get_le64(const unsigned char *p, unsigned long *out) {
+    unsigned long hi = (unsigned long)get_le32(p + 4);
+    if (hi != 0u && sizeof(unsigned long) < 8u) return -1;
+    *out = (unsigned long)get_le32(p) | ((hi << 16) << 16);
+    return 0;
+}
+
+static unsigned long align8(unsigned long v) {
+    return (v + 7u) & ~7ul;
+}
+
+/* Both halves of dataLen are folded in; for lengths under 4 GB this is the
+ * version 3-5 check. From version 9 the hash of a TERMS record runs on over
+ * its `data` (unused for other records, whose data replay never reads). */
+static unsigned int journal_check(unsigned int version, unsigned int op, const unsigned char *meta, size_t metaLen, const unsigned char *data, unsigned long dataLen) {
+    unsigned int lo = (unsigned int)(dataLen & 0xFFFFFFFFul);
+    unsigned int hi = (unsigned int)((dataLen >> 16) >> 16);
+    unsigned long h = compute_file_hash(meta, metaLen);
+    if (version >= 9u && op == JOURNAL_OP_TERMS && dataLen > 0u) h = hash_update(h, data, (size_t)dataLen);
+    return (unsigned int)h ^ lo ^ hi;
+}
+
+/* fseek to an absolute offset, refusing offsets a long cannot hold (the
+ * stdio limit where long is 32 bits) instead of wrapping. */
+static int seek_to(FILE *f, unsigned long offset) {
+    if (offset > (unsigned long)LONG_MAX) return -1;
+    return fseek(f, (long)offset, SEEK_SET);
+}
+
+/* Encode the fixed part of `e` as a TOC record. */
+static void put_toc_record(unsigned char *p, const indexEntry_t *e, unsigned long offset, unsigned long titleOffset) {
+    unsigned long flags = (unsigned long)e->flags & 0x7FFFFFFFul;
+    if (e->isPublic) flags |= TOC_FLAG_PUBLIC;
+    put_le64(p, offset);
+    put_le64(p + 8, e->originalSize);
+    put_le64(p + 16, e->storedSize);
+    put_le32(p + 24, (unsigned long)e->hash);
+    put_le32(p + 28, flags);
+    put_le32(p + 32, titleOffset);
+    put_le32(p + 36, (unsigned long)strlen(e->title));
+}
+
+/* Decode a TOC record into `e`; the title is left NULL for the caller. */
+static int get_toc_record(const unsigned char *p, indexEntry_t *e, unsigned int *titleOffset, unsigned int *titleLen) {
+    unsigned int flags;
+    memset(e, 0, sizeof(*e));
+    if (get_le64(p, &e->offset) != 0) return -1;
+    if (get_le64(p + 8, &e->originalSize) != 0) return -1;
+    if (get_le64(p + 16, &e->storedSize) != 0) return -1;
+    e->hash = get_le32(p + 24);
+    flags = get_le32(p + 28);
+    e->flags = flags & 0x7FFFFFFFu;
+    e->isPublic = (flags & TOC_FLAG_PUBLIC) ? 1 : 0;
+    *titleOffset = get_le32(p + 32);
+    *titleLen = get_le32(p + 36);
+    return *titleLen < MAX_TITLE ? 0 : -1;
+}
+
+void storageManifestInit(unsigned char *m, unsigned long count) {
+    put_le32(m, count);
+    put_le32(m + 4, 0u);
+}
+
+int storageManifestCount(const unsigned char *m, unsigned long len, unsigned long *count) {
+    unsigned long c;
+    if (!m || !count || len < STORAGE_MANIFEST_HEAD) return -1;
+    c = (unsigned long)get_le32(m);
+    if (STORAGE_MANIFEST_SIZE(c) != len) return -1;
+    *count = c;
+    return 0;
+}
+
+void storageManifestSet(unsigned char *m, unsigned long i, const storageChunkRef_t *r) {
+    unsigned char *p = m + STORAGE_MANIFEST_SIZE(i);
+    put_le64(p, r->offset);
+    put_le32(p + 8, r->storedSize);
+    put_le32(p + 12, r->originalSize);
+    put_le32(p + 16, (unsigned long)r->hash);
+    put_le32(p + 20, (unsigned long)r->flags);
+}
+
+int storageManifestGet(const unsigned char *m, unsigned long i, storageChunkRef_t *r) {
+    const unsigned char *p = m + STORAGE_MANIFEST_SIZE(i);
+    if (get_le64(p, &r->offset) != 0) return -1;
+    r->storedSize = (unsigned long)get_le32(p + 8);
+    r->originalSize = (unsigned long)get_le32(p + 12);
+    r->hash = get_le32(p + 16);
+    r->flags = get_le32(p + 20);
+    return 0;
+}
+
+unsigned char *storageLoadManifest(FILE *f, const indexEntry_t *e, unsigned long *count) {
+    unsigned char *m;
+    if (!e || !count || !(e->flags & FLAG_CHUNKED) || e->storedSize < STORAGE_MANIFEST_HEAD) return NULL;
+    m = (unsigned char*)malloc((size_t)e->storedSize);
+    if (!m) return NULL;
+    if (e->data) {
+        memcpy(m, e->data, (size_t)e->storedSize);
+    } else if (!f || seek_to(f, e->offset) != 0
+               || fread(m, 1, (size_t)e->storedSize, f) != (size_t)e->storedSize) {
+        free(m);
+        return NULL;
+    }
+    if (storageManifestCount(m, e->storedSize, count) != 0) { free(m); return NULL; }
+    return m;
+}
+
+/* PIN change folded into a checkpoint: encrypted payloads are moved from
+ * the old PIN's key to the new one piece by piece as they are copied. */
+#define REKEY_KEY_LEN 128u /* the session's payload key */
+typedef struct {
+    unsigned char from[REKEY_KEY_LEN];
+    unsigned char to[REKEY_KEY_LEN];
+} rekey_t;
+
+/* Re-encrypt the `n` bytes at payload position `pos` in place. */
+static void rekey_piece(const rekey_t *rk, unsigned char *p, size_t n, unsigned long pos) {
+    xor_cipher_at(p, n, rk->from, REKEY_KEY_LEN, pos);
+    xor_cipher_at(p, n, rk->to, REKEY_KEY_LEN, pos);
+}
+
+/* Copy `n` bytes at `offset` in `src` to the current position of `dst`,
+ * re-encrypted with `rk` unless it is NULL. Skips the seek when `src` is
+ * already there (sequential extents). */
+static int copy_payload(FILE *src, unsigned long offset, unsigned long n, FILE *dst, unsigned char *buf, const rekey_t *rk) {
+    unsigned long pos = 0u;
+    long at;
+    if (!src) return -1;
+    at = ftell(src);
+    if ((at < 0 || (unsigned long)at != offset) && seek_to(src, offset) != 0) return -1;
+    while (pos < n) {
+        size_t step = n - pos < (unsigned long)COPY_CHUNK ? (size_t)(n - pos) : (size_t)COPY_CHUNK;
+        if (fread(buf, 1, step, src) != step) return -1;
+        if (rk) rekey_piece(rk, buf, step, pos);
+        if (fwrite(buf, 1, step, dst) != step) return -1;
+        pos += (unsigned long)step;
+    }
+    return 0;
+}
+
+/* Write the resident payload `data` to `dst`; re-encrypted through `buf`
+ * when `rk` is set, so the caller's bytes are left as they are. */
+static int write_payload(const unsigned char *data, unsigned long n, FILE *dst, unsigned char *buf, const rekey_t *rk) {
+    unsigned long pos = 0u;
+    if (!rk) return fwrite(data, 1, (size_t)n, dst) == (size_t)n ? 0 : -1;
+    while (pos < n) {
+        size_t step = n - pos < (unsigned long)COPY_CHUNK ? (size_t)(n - pos) : (size_t)COPY_CHUNK;
+        memcpy(buf, data + pos, step);
+        rekey_piece(rk, buf, step, pos);
+        if (fwrite(buf, 1, step, dst) != step) return -1;
+        pos += (unsigned long)step;
+    }
+    return 0;
+}
+
+/* Replace `path` with `tmpPath`. rename() is atomic on POSIX; Windows
+ * refuses to rename over an existing file, so fall back to remove first. */
+static int replace_file(const char *tmpPath, const char *path) {
+    if (rename(tmpPath, path) == 0) return 0;
+    remove(path);
+    return rename(tmpPath, path) == 0 ? 0 : -1;
+}
+
+static int write_zeros(FILE *f, unsigned long n) {
+    static const unsigned char zeros[8] = {0};
+    return (n == 0u || fwrite(zeros, 1, (size_t)n, f) == (size_t)n) ? 0 : -1;
+}
+
+/* One live extent of a checkpoint: the node, where its bytes come from
+ * and where they land in the new image. */
+typedef struct {
+    indexNode_t *node;
+    unsigned long newOffset;
+} extent_t;
+
+/* Order extents by source offset so the old file is read front to back;
+ * resident payloads (not in the old file) go last. */
+static int cmp_extent_src(const void *a, const void *b) {
+    const indexEntry_t *x = &(*(const extent_t * const *)a)->node->entry;
+    const indexEntry_t *y = &(*(const extent_t * const *)b)->node->entry;
+    if ((x->data != NULL) != (y->data != NULL)) return x->data ? 1 : -1;
+    if (x->offset != y->offset) return x->offset < y->offset ? -1 : 1;
+    return 0;
+}
+
+/* Write the TOC for `count` extents in list order: the record array,
+ * TOC_BATCH records per fwrite, then the title pool padded to 8 bytes.
+ * `buf` holds COPY_CHUNK bytes. */
+static int write_toc(FILE *f, const extent_t *ext, unsigned long count, unsigned char *buf, unsigned long *outPoolBytes) {
+    unsigned long i = 0u;
+    unsigned long titleOffset = 0u;
+    size_t used;
+
+    while (i < count) {
+        unsigned long batchEnd = count - i > TOC_BATCH ? i + TOC_BATCH : count;
+        used = 0u;
+        for (; i < batchEnd; i++) {
+            const indexEntry_t *e = &ext[i].node->entry;
+            put_toc_record(buf + used, e, ext[i].newOffset, titleOffset);
+            titleOffset += (unsigned long)strlen(e->title);
+            used += TOC_RECORD_SIZE;
+        }
+        if (fwrite(buf, 1, used, f) != used) return -1;
+    }
+
+    used = 0u;
+    for (i = 0u; i < count; i++) {
+        const char *t = ext[i].node->entry.title;
+        size_t len = strlen(t);
+        if (used + len > COPY_CHUNK) {
+            if (fwrite(buf, 1, used, f) != used) return -1;
+            used = 0u;
+        }
+        memcpy(buf + used, t, len);
+        used += len;
+    }
+    if (used > 0u && fwrite(buf, 1, used, f) != used) return -1;
+    if (write_zeros(f, align8(titleOffset) - titleOffset) != 0) return -1;
+    *outPoolBytes = titleOffset;
+    return 0;
+}
+
+/* One chunk reference being moved to the new image by a checkpoint.
+ * Sorted by old offset, so the old file is read front to back and each
+ * distinct chunk is copied once. */
+typedef struct {
+    storageChunkRef_t ref;
+    unsigned long newOffset;
+    int encrypted;              /* referenced by an encrypted entry */
+} chunk_move_t;
+
+static int cmp_move(const void *a, const void *b) {
+    unsigned long x = ((const chunk_move_t*)a)->ref.offset;
+    unsigned long y = ((const chunk_move_t*)b)->ref.offset;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Point every reference in manifest `m` at the moved copy of its chunk. */
+static void patch_manifest(unsigned char *m, unsigned long count, const chunk_move_t *moves, unsigned long nmoves) {
+    unsigned long k;
+    for (k = 0u; k < count; k++) {
+        chunk_move_t key;
+        const chunk_move_t *hit;
+        if (storageManifestGet(m, k, &key.ref) != 0) continue;
+        hit = (const chunk_move_t*)bsearch(&key, moves, (size_t)nmoves, sizeof(chunk_move_t), cmp_move);
+        if (hit) {
+            key.ref.offset = hit->newOffset;
+            storageManifestSet(m, k, &key.ref);
+        }
+    }
+}
+
+/* Gather the chunk references of the manifests of `count` extents into
+ * one sorted array. */
+static chunk_move_t *gather_moves(const extent_t *ext, unsigned char **man, const unsigned long *nrefs, unsigned long count, unsigned long total) {
+    chunk_move_t *moves = (chunk_move_t*)malloc(((size_t)total + 1u) * sizeof(chunk_move_t));
+    unsigned long i, k, used = 0u;
+    if (!moves) return NULL;
+    for (i = 0u; i < count; i++) {
+        for (k = 0u; man[i] && k < nrefs[i]; k++) {
+            if (storageManifestGet(man[i], k, &moves[used].ref) != 0) { free(moves); return NULL; }
+            moves[used].encrypted = (ext[i].node->entry.flags & FLAG_ENCRYPTED) != 0;
+            moves[used++].newOffset = 0u;
+        }
+    }
+    qsort(moves, (size_t)total, sizeof(chunk_move_t), cmp_move);
+    return moves;
+}
+
+/* Checkpoint the chunked entries among `ext`: copy each distinct chunk they
+ * reference once (chunks of encrypted entries re-encrypted with `rk` if
+ * set, each from key position 0), then write every manifest patched with
+ * the new offsets. Resident manifests are not modified. */
+static int write_chunked(FILE *src, FILE *f, extent_t *ext, unsigned long count, unsigned char *buf, const rekey_t *rk, unsigned long *copied) {
+    unsigned char **man;
+    unsigned long *nrefs;
+    chunk_move_t *moves = NULL;
+    unsigned long total = 0u, i, k;
+    long end;
+    int rc = -1;
+
+    man = (unsigned char**)calloc((size_t)count + 1u, sizeof(unsigned char*));
+    nrefs = (unsigned long*)calloc((size_t)count + 1u, sizeof(unsigned long));
+    if (!man || !nrefs) goto done;
+    for (i = 0u; i < count; i++) {
+        const indexEntry_t *e = &ext[i].node->entry;
+        if (!(e->flags & FLAG_CHUNKED)) continue;
+        man[i] = storageLoadManifest(src, e, &nrefs[i]);
+        if (!man[i]) goto done;
+        total += nrefs[i];
+    }
+    if (total > 0u) {
+        moves = gather_moves(ext, man, nrefs, count, total);
+        if (!moves) goto done;
+    }
+    for (k = 0u; k < total; k++) {
+        if (k > 0u && moves[k].ref.offset == moves[k - 1u].ref.offset) {
+            moves[k].newOffset = moves[k - 1u].newOffset;
+            continue;
+        }
+        end = ftell(f);
+        if (end < 0) goto done;
+        moves[k].newOffset = (unsigned long)end;
+        if (copy_payload(src, moves[k].ref.offset, moves[k].ref.storedSize, f, buf, moves[k].encrypted ? rk : NULL) != 0) goto done;
+        *copied += moves[k].ref.storedSize;
+    }
+    for (i = 0u; i < count; i++) {
+        size_t len;
+        if (!man[i]) continue;
+        patch_manifest(man[i], nrefs[i], moves, total);
+        end = ftell(f);
+        if (end < 0) goto done;
+        ext[i].newOffset = (unsigned long)end;
+        len = (size_t)STORAGE_MANIFEST_SIZE(nrefs[i]);
+        if (fwrite(man[i], 1, len, f) != len) goto done;
+    }
+    rc = 0;
+done:
+    for (i = 0u; man && i < count; i++) free(man[i]);
+    free(man);
+    free(nrefs);
+    free(moves);
+    return rc;
+}
+
+/* Term sets are encrypted with the PIN's key, each from key position 0. */
+#define TERMS_KEY_LEN 128u
+
+/* Size of the terms section for `idx`: 0 when no entry has terms or the
+ * content index is off (term sets still held are not written). */
+static unsigned long terms_bytes(const index_t *idx) {
+    const indexNode_t *n;
+    unsigned long total = 0u;
+    int any = 0;
+    if (!idx->termsOn) return 0u;
+    for (n = idx->head; n; n = n->next) {
+        total += 4u + n->termsLen;
+        if (n->terms) any = 1;
+    }
+    return any ? total : 0u;
+}
+
+/* Write the terms section for `count` extents in list order, encrypting
+ * through `buf` (COPY_CHUNK bytes), padded to 8 bytes. */
+static int write_terms(FILE *f, const extent_t *ext, unsigned long count, unsigned char *buf, const unsigned char *key, unsigned long *outBytes) {
+    unsigned long i, total = 0u;
+    for (i = 0u; i < count; i++) {
+        const indexNode_t *n = ext[i].node;
+        unsigned long pos;
+        put_le32(buf, n->termsLen);
+        if (fwrite(buf, 1, 4u, f) != 4u) return -1;
+        for (pos = 0u; pos < n->termsLen; ) {
+            size_t step = n->termsLen - pos < (unsigned long)COPY_CHUNK ? (size_t)(n->termsLen - pos) : (size_t)COPY_CHUNK;
+            memcpy(buf, n->terms + pos, step);
+            xor_cipher_at(buf, step, key, TERMS_KEY_LEN, pos);
+            if (fwrite(buf, 1, step, f) != step) return -1;
+            pos += (unsigned long)step;
+        }
+        total += 4u + n->termsLen;
+    }
+    if (write_zeros(f, align8(total) - total) != 0) return -1;
+    *outBytes = total;
+    return 0;
+}
+
+/* Write a fresh image of `idx` to `path` via `path`.tmp. `*outCopied`
+ * receives the payload bytes carried over from the old file. With `oldPin`
+ * set, encrypted payloads are re-encrypted from its key to `masterPin`'s on
+ * the way; `idx` is only touched once the new image has replaced the old. */
+static int save_image(const char *path, index_t *idx, const char *masterPin, const char *oldPin, unsigned long *outCopied) {
     FILE *f;
-    unsigned int magic;
-    unsigned int count;
-    unsigned int pinLen;
+    FILE *src;
+    char tmpPath[1100];
+    unsigned char hdr[HEADER_SIZE];
+    unsigned char trailer[TOC_TRAILER_SIZE];
+    unsigned char key[TERMS_KEY_LEN];
+    rekey_t rekey;
+    const rekey_t *rk = NULL;
+    size_t pinLen;
+    extent_t *ext = NULL;
+    extent_t **order = NULL;
+    unsigned char *buf = NULL;
+    unsigned long copied = 0u;
+    unsigned long poolBytes = 0u;
+    unsigned long termsBytes = terms_bytes(idx);
+    unsigned long count = (unsigned long)idx->count;
+    unsigned long i;
+    long tocOffset;
+    long end;
     indexNode_t *n;
 
-    if (!path || !idx) return -1;
-    f = fopen(path, "wb");
-    if (!f) return -1;
+    if (strlen(path) + 5u > sizeof tmpPath) return -1;
+    if (termsBytes > 0u && derive_key(masterPin ? masterPin : "", key, sizeof key) == 0) return -1;
+    if (oldPin) {
+        if (derive_key(oldPin, rekey.from, REKEY_KEY_LEN) == 0) return -1;
+        if (derive_key(masterPin ? masterPin : "", rekey.to, REKEY_KEY_LEN) == 0) return -1;
+        rk = &rekey;
+    }
+    sprintf(tmpPath, "%s.tmp", path);
+    ext = (extent_t*)malloc(((size_t)count + 1u) * sizeof(*ext));
+    order = (extent_t**)malloc(((size_t)count + 1u) * sizeof(*order));
+    buf = (unsigned char*)malloc(COPY_CHUNK);
+    if (!ext || !order || !buf) { free(ext); free(order); free(buf); return -1; }
+    for (n = idx->head, i = 0u; n && i < count; n = n->next, i++) {
+        ext[i].node = n;
+        ext[i].newOffset = 0u;
+        order[i] = &ext[i];
+    }
+    qsort(order, (size_t)count, sizeof(*order), cmp_extent_src);
+
+    /* the old image is the source of any payload not resident in memory */
+    src = fopen(path, "rb");
+    f = fopen(tmpPath, "wb");
+    if (!f) { if (src) fclose(src); free(ext); free(order); free(buf); return -1; }
 
-    magic = STORAGE_MAGIC;
-    if (fwrite(&magic, sizeof(magic), 1, f) != 1) goto err;
-    if (write_u32(f, STORAGE_VERSION) != 0) goto err;
-    count = (unsigned int)idx->count;
-    if (write_u32(f, count) != 0) goto err;
-
-    pinLen = masterPin ? (unsigned int)strlen(masterPin) : 0u;
-    if (write_u32(f, pinLen) != 0) goto err;
-    if (pinLen > 0u) {
-        if (fwrite(masterPin, 1, pinLen, f) != pinLen) goto err;
-    }
-
-    n = idx->head;
-    while (n) {
-        indexEntry_t *e = &n->entry;
-        unsigned int titleLen = (unsigned int)strlen(e->title);
-        unsigned int hash = e->hash;
-        if (write_u32(f, titleLen) != 0) goto err;
-        if (titleLen > 0u && fwrite(e->title, 1, titleLen, f) != titleLen) goto err;
-        if (write_u32(f, (unsigned int)e->originalSize) != 0) goto err;
-        if (write_u32(f, (unsigned int)e->storedSize) != 0) goto err;
-        if (write_u32(f, hash) != 0) goto err;
-        /* pack flags (low 7 bits) and isPublic in high bit */
-        unsigned char meta;
-        meta = (unsigned char)(e->flags & 0x7Fu);
-        if (e->isPublic) meta |= 0x80u;
-        if (fwrite(&meta, 1, 1, f) != 1) goto err;
+    memset(hdr, 0, sizeof hdr);
+    put_le32(hdr, STORAGE_MAGIC);
+    put_le32(hdr + 4, STORAGE_VERSION);
+    pinLen = masterPin ? strlen(masterPin) : 0u;
+    if (pinLen > HEADER_PIN_MAX) pinLen = HEADER_PIN_MAX;
+    put_le32(hdr + 16, (unsigned long)pinLen);
+    put_le32(hdr + HEADER_FLAGS_AT, idx->termsOn ? HEADER_FLAG_TERMS : 0u);
+    if (pinLen > 0u) memcpy(hdr + HEADER_PIN_AT, masterPin, pinLen);
+    if (fwrite(hdr, 1, sizeof hdr, f) != sizeof hdr) goto err;
+
+    /* payload region: only live extents, in source order; entries sharing
+     * one disk-backed payload keep sharing a single copy. Chunked entries
+     * follow, chunks first and then their manifests. */
+    for (i = 0u; i < count; i++) {
+        indexEntry_t *e = &order[i]->node->entry;
+        if (e->flags & FLAG_CHUNKED) continue;
+        if (i > 0u && !e->data && e->storedSize > 0u) {
+            const indexEntry_t *p = &order[i - 1u]->node->entry;
+            if (!p->data && p->offset == e->offset && p->storedSize == e->storedSize) {
+                order[i]->newOffset = order[i - 1u]->newOffset;
+                continue;
+            }
+        }
+        end = ftell(f);
+        if (end < 0) goto err;
+        order[i]->newOffset = (unsigned long)end;
         if (e->storedSize > 0u) {
-            if (fwrite(e->data, 1, (size_t)e->storedSize, f) != (size_t)e->storedSize) goto err;
+            const rekey_t *erk = (e->flags & FLAG_ENCRYPTED) ? rk : NULL;
+            if (e->data) {
+                if (write_payload(e->data, e->storedSize, f, buf, erk) != 0) goto err;
+            } else {
+                if (copy_payload(src, e->offset, e->storedSize, f, buf, erk) != 0) goto err;
+                copied += e->storedSize;
+            }
         }
-        n = n->next;
     }
+    if (write_chunked(src, f, ext, count, buf, rk, &copied) != 0) goto err;
 
-    fclose(f);
+    /* table of contents (aligned, list order) + trailer */
+    end = ftell(f);
+    if (end < 0) goto err;
+    if (write_zeros(f, align8((unsigned long)end) - (unsigned long)end) != 0) goto err;
+    tocOffset = ftell(f);
+    if (tocOffset < 0) goto err;
+    if (write_toc(f, ext, count, buf, &poolBytes) != 0) goto err;
+    end = ftell(f);
+    if (end < 0) goto err;
+    if (termsBytes > 0u && write_terms(f, ext, count, buf, key, &termsBytes) != 0) goto err;
+    memset(trailer, 0, sizeof trailer);
+    put_le32(trailer, TOC_MAGIC);
+    put_le32(trailer + 4, count);
+    put_le64(trailer + 8, (unsigned long)tocOffset);
+    put_le64(trailer + 16, (unsigned long)(end - tocOffset));
+    put_le32(trailer + 24, poolBytes);
+    put_le32(trailer + 28, termsBytes);
+    if (fwrite(trailer, 1, sizeof trailer, f) != sizeof trailer) goto err;
+    end = ftell(f);
+    if (end < 0) goto err;
+    put_le64(hdr, (unsigned long)end);
+    if (fseek(f, HEADER_BASE_END_AT, SEEK_SET) != 0) goto err;
+    if (fwrite(hdr, 1, 8, f) != 8) goto err;
+
+    if (src) { fclose(src); src = NULL; }
+    free(buf); buf = NULL;
+    if (fclose(f) != 0) { remove(tmpPath); free(ext); free(order); return -1; }
+    if (replace_file(tmpPath, path) != 0) { free(ext); free(order); return -1; }
+
+    /* the new image is in place: every payload now lives on disk */
+    for (i = 0u; i < count; i++) {
+        indexEntry_t *e = &ext[i].node->entry;
+        e->offset = ext[i].newOffset;
+        if (e->data) { free(e->data); e->data = NULL; }
+    }
+    free(ext);
+    free(order);
+    idx->baseBytes = (unsigned long)end;
+    idx->journalBytes = 0u;
+    idx->journalRecords = 0u;
+    if (outCopied) *outCopied = copied;
     return 0;
 err:
+    if (src) fclose(src);
     fclose(f);
+    remove(tmpPath);
+    free(ext);
+    free(order);
+    free(buf);
     return -1;
 }
 
-int storageLoadAll(const char *path, index_t *idx, char *outMasterPin, size_t maxPinLen) {
-    FILE *f;
-    unsigned int magic = 0u;
-    unsigned int version = 0u;
-    unsigned int file_count = 0u;
-    unsigned int pinLen = 0u;
-    unsigned int i;
-
+int storageSaveAll(const char *path, index_t *idx, const char *masterPin) {
     if (!path || !idx) return -1;
+    return save_image(path, idx, masterPin, NULL, NULL);
+}
+
+int storageRekeyAll(const char *path, index_t *idx, const char *oldPin, const char *newPin) {
+    if (!path || !idx || !oldPin || !newPin) return -1;
+    return save_image(path, idx, newPin, oldPin, NULL);
+}
+
+/* A disk-backed payload: entries sharing one have the same offset. */
+typedef struct {
+    unsigned long offset;
+    unsigned long size;
+} span_t;
+
+static int cmp_span(const void *a, const void *b) {
+    unsigned long x = ((const span_t*)a)->offset;
+    unsigned long y = ((const span_t*)b)->offset;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Append the chunk spans of chunked entry `e` to the growing span array. */
+static int add_chunk_spans(FILE *f, const indexEntry_t *e, span_t **spans, unsigned long *nspans, unsigned long *cap) {
+    unsigned long count, k;
+    unsigned char *m = storageLoadManifest(f, e, &count);
+    if (!m) return -1;
+    if (*nspans + count > *cap) {
+        unsigned long ncap = *cap * 2u > *nspans + count ? *cap * 2u : *nspans + count;
+        span_t *ns = (span_t*)realloc(*spans, (size_t)ncap * sizeof(span_t));
+        if (!ns) { free(m); return -1; }
+        *spans = ns;
+        *cap = ncap;
+    }
+    for (k = 0u; k < count; k++) {
+        storageChunkRef_t r;
+        if (storageManifestGet(m, k, &r) != 0) continue;
+        (*spans)[*nspans].offset = r.offset;
+        (*spans)[(*nspans)++].size = r.storedSize;
+    }
+    free(m);
+    return 0;
+}
+
+unsigned long storageImageSize(FILE *f, const index_t *idx, const char *masterPin) {
+    const indexNode_t *n;
+    unsigned long payload = 0u;
+    unsigned long pool = 0u;
+    span_t *spans;
+    unsigned long nspans = 0u;
+    unsigned long cap;
+    unsigned long i;
+    (void)masterPin; /* the PIN lives in a fixed header slot */
+    if (!idx) return 0u;
+    /* shared payloads and chunks are counted once per distinct offset */
+    cap = (unsigned long)idx->count + 1u;
+    spans = (span_t*)malloc((size_t)cap * sizeof(span_t));
+    for (n = idx->head; n; n = n->next) {
+        const indexEntry_t *e = &n->entry;
+        pool += (unsigned long)strlen(e->title);
+        if (spans && !e->data && e->storedSize > 0u && !(e->flags & FLAG_CHUNKED)) {
+            spans[nspans].offset = e->offset;
+            spans[nspans].size = e->storedSize;
+            nspans++;
+        } else {
+            payload += e->storedSize; /* resident, or a manifest (never shared) */
+        }
+    }
+    for (n = idx->head; spans && n; n = n->next) {
+        if (n->entry.flags & FLAG_CHUNKED) add_chunk_spans(f, &n->entry, &spans, &nspans, &cap);
+    }
+    if (spans) {
+        qsort(spans, (size_t)nspans, sizeof(span_t), cmp_span);
+        for (i = 0u; i < nspans; i++) {
+            if (i == 0u || spans[i].offset != spans[i - 1u].offset) payload += spans[i].size;
+        }
+        free(spans);
+    }
+    return align8(HEADER_SIZE + payload) + (unsigned long)idx->count * TOC_RECORD_SIZE
+        + align8(pool) + align8(terms_bytes(idx)) + TOC_TRAILER_SIZE;
+}
+
+int storageFileSize(const char *path, unsigned long *out) {
+    FILE *f;
+    long len;
+    if (!path || !out) return -1;
     f = fopen(path, "rb");
     if (!f) return -1;
+    if (fseek(f, 0L, SEEK_END) != 0) { fclose(f); return -1; }
+    len = ftell(f);
+    fclose(f);
+    if (len < 0) return -1;
+    *out = (unsigned long)len;
+    return 0;
+}
 
-    if (fread(&magic, sizeof(magic), 1, f) != 1) goto err;
-    if (magic != STORAGE_MAGIC) goto err;
+int storageCompact(const char *path, index_t *idx, const char *masterPin, lockerCompactStats_t *stats) {
+    lockerCompactStats_t st;
+    FILE *src;
+    double t0;
+    int rc;
+    if (!path || !idx) return -1;
+    memset(&st, 0, sizeof(st));
+    if (storageFileSize(path, &st.fileBytesBefore) != 0) st.fileBytesBefore = 0u;
+    src = fopen(path, "rb");
+    st.liveBytes = storageImageSize(src, idx, masterPin);
+    if (src) fclose(src);
+    st.deadBytes = st.fileBytesBefore > st.liveBytes ? st.fileBytesBefore - st.liveBytes : 0u;
+    st.fragmentation = st.fileBytesBefore > 0u ? (double)st.deadBytes / (double)st.fileBytesBefore : 0.0;
+    t0 = platform_clock(); /* wall time: the copy waits on the disk */
+    rc = save_image(path, idx, masterPin, NULL, &st.bytesCopied);
+    st.seconds = platform_clock() - t0;
+    if (rc == 0) {
+        st.fileBytesAfter = idx->baseBytes;
+        if (st.seconds > 0.0) st.mbPerSec = ((double)st.bytesCopied / (1024.0 * 1024.0)) / st.seconds;
+    }
+    if (stats) *stats = st;
+    return rc;
+}
 
-    if (read_u32(f, &version) != 0) goto err;
-    if (version != 1u && version != 2u) goto err;
+/* Parse one version 3/4 entry header from a journal meta buffer; the
+ * title goes to `title` (MAX_TITLE bytes). Returns bytes used or 0. */
+static size_t parse_entry_meta_v3(const unsigned char *p, size_t len, indexEntry_t *e, char *title) {
+    unsigned int titleLen, originalSize, storedSize, hash;
+    size_t o;
+    if (len < 4u) return 0;
+    o = get_u32(p, &titleLen);
+    if (titleLen >= MAX_TITLE || len < o + titleLen + 13u) return 0;
+    memset(e, 0, sizeof(*e));
+    memcpy(title, p + o, titleLen);
+    title[titleLen] = '\0';
+    e->title = title;
+    o += titleLen;
+    o += get_u32(p + o, &originalSize);
+    o += get_u32(p + o, &storedSize);
+    o += get_u32(p + o, &hash);
+    e->originalSize = (unsigned long)originalSize;
+    e->storedSize = (unsigned long)storedSize;
+    e->hash = hash;
+    e->flags = (unsigned int)(p[o] & 0x7Fu);
+    e->isPublic = (p[o] & 0x80u) ? 1 : 0;
+    return o + 1u;
+}
 
-    if (read_u32(f, &file_count) != 0) goto err;
-    if (read_u32(f, &pinLen) != 0) goto err;
+/* Decode a record's meta into the title it targets (EDIT/REMOVE) and the
+ * new entry state (ADD/EDIT), whose title is kept in `title`. */
+static int parse_record_meta(unsigned int version, unsigned int op, const unsigned char *meta, size_t metaLen, char *oldTitle, indexEntry_t *entry, char *title) {
+    unsigned int oldLen = 0u;
+    unsigned int titleOffset, titleLen;
+    size_t o = 0;
 
-    if (pinLen > 0u && outMasterPin && maxPinLen > 0u) {
-        unsigned int toRead = pinLen < (unsigned int)(maxPinLen - 1u) ? pinLen : (unsigned int)(maxPinLen - 1u);
-        if (fread(outMasterPin, 1, toRead, f) != toRead) goto err;
-        outMasterPin[toRead] = '\0';
-        if (pinLen > toRead) {
-            if (fseek(f, (long)(pinLen - toRead), SEEK_CUR) != 0) goto err;
+    if (version < 5u) {
+        if (op != JOURNAL_OP_ADD) {
+            if (metaLen < 4u) return -1;
+            o = get_u32(meta, &oldLen);
+            if (oldLen >= MAX_TITLE || metaLen < o + oldLen) return -1;
+            memcpy(oldTitle, meta + o, oldLen);
+            oldTitle[oldLen] = '\0';
+            o += oldLen;
         }
-    } else if (pinLen > 0u) {
-        if (fseek(f, (long)pinLen, SEEK_CUR) != 0) goto err;
-    } else if (outMasterPin && maxPinLen > 0u) {
-        outMasterPin[0] = '\0';
+        if (op == JOURNAL_OP_REMOVE) return 0;
+        return parse_entry_meta_v3(meta + o, metaLen - o, entry, title) == 0 ? -1 : 0;
     }
 
-    /* free existing index nodes */
-    while (idx->head) {
-        indexNode_t *tmp = idx->head;
-        idx->head = tmp->next;
-        if (tmp->entry.data) free(tmp->entry.data);
-        free(tmp);
+    if (op != JOURNAL_OP_ADD) {
+        if (metaLen < 8u) return -1;
+        oldLen = get_le32(meta);
+        if (oldLen >= MAX_TITLE) return -1;
+        o = 8u;
+    }
+    if (op == JOURNAL_OP_REMOVE) {
+        if (metaLen < o + oldLen) return -1;
+        memcpy(oldTitle, meta + o, oldLen);
+        oldTitle[oldLen] = '\0';
+        return 0;
+    }
+    if (metaLen < o + TOC_RECORD_SIZE) return -1;
+    if (get_toc_record(meta + o, entry, &titleOffset, &titleLen) != 0) return -1;
+    o += TOC_RECORD_SIZE;
+    if (metaLen < o + oldLen + titleLen) return -1;
+    if (op == JOURNAL_OP_EDIT) {
+        memcpy(oldTitle, meta + o, oldLen);
+        oldTitle[oldLen] = '\0';
+        o += oldLen;
+    }
+    memcpy(title, meta + o, titleLen);
+    title[titleLen] = '\0';
+    entry->title = title;
+    return 0;
+}
+
+/* Apply one replayed record to the index; its payload sits at `offset`. */
+static int apply_record(index_t *idx, unsigned int version, unsigned int op, const unsigned char *meta, size_t metaLen, unsigned long offset, unsigned long dataLen) {
+    indexEntry_t entry;
+    indexNode_t *node = NULL;
+    char oldTitle[MAX_TITLE], title[MAX_TITLE];
+
+    /* chunks only matter through the manifests that reference them */
+    if (op == JOURNAL_OP_CHUNK && version >= 7u) return 0;
+    if (op != JOURNAL_OP_ADD && op != JOURNAL_OP_EDIT && op != JOURNAL_OP_REMOVE) return -1;
+    memset(&entry, 0, sizeof(entry));
+    if (parse_record_meta(version, op, meta, metaLen, oldTitle, &entry, title) != 0) return -1;
+    if (op != JOURNAL_OP_ADD) {
+        node = indexFind(idx, oldTitle);
+        if (!node) return -1;
+        if (op == JOURNAL_OP_REMOVE) {
+            indexUnlink(idx, node);
+            if (node->entry.data) free(node->entry.data);
+            indexFreeNode(idx, node);
+            return 0;
+        }
     }
-    idx->count = 0;
+    if (dataLen == 0u && entry.storedSize > 0u) {
+        /* shared payload: the record points at bytes logged earlier */
+        if (entry.offset + entry.storedSize > offset) return -1;
+    } else {
+        if (entry.storedSize != dataLen) return -1;
+        entry.offset = offset;
+    }
+    entry.data = NULL;
+    if (op == JOURNAL_OP_EDIT) {
+        if (strcmp(node->entry.title, entry.title) != 0 && indexRename(idx, node, entry.title) != 0) return -1;
+        if (node->entry.data) free(node->entry.data);
+        entry.title = node->entry.title;
+        node->entry = entry;
+        indexUpdate(idx, node);
+        return 0;
+    }
+    node = indexNewNode(idx);
+    if (!node) return -1;
+    node->entry = entry;
+    if (indexLink(idx, node) != 0) { indexFreeNode(idx, node); return -1; }
+    return 0;
+}
+
+/* Apply a replayed TERMS record; takes ownership of `data`, the term set
+ * (dataLen bytes) still encrypted. */
+static int apply_terms(index_t *idx, const unsigned char *meta, size_t metaLen, unsigned char *data, unsigned long dataLen, const unsigned char *key) {
+    char title[MAX_TITLE];
+    unsigned int len;
+    indexNode_t *node;
+    if (metaLen < 8u || (len = get_le32(meta)) >= MAX_TITLE || metaLen < 8u + len) { free(data); return -1; }
+    memcpy(title, meta + 8, len);
+    title[len] = '\0';
+    node = indexFind(idx, title);
+    if (!node) { free(data); return -1; }
+    if (data) xor_cipher(data, (size_t)dataLen, key, TERMS_KEY_LEN);
+    return indexSetTerms(idx, node, data, dataLen);
+}
+
+/* Read the head and meta of the next journal record. Returns -1 at the end
+ * of the readable journal. */
+static int read_record_head(FILE *f, unsigned int version, unsigned int *op, unsigned char *meta, unsigned int *metaLen, unsigned long *dataLen) {
+    unsigned char head[JOURNAL_HEAD_SIZE];
+    size_t headLen = version >= 6u ? JOURNAL_HEAD_SIZE : JOURNAL_HEAD_V3_SIZE;
+    unsigned int magic;
+    if (fread(head, 1, headLen, f) != headLen) return -1;
+    if (version >= 5u) {
+        magic = get_le32(head);
+        *op = get_le32(head + 4);
+        *metaLen = get_le32(head + 8);
+        if (version >= 6u) {
+            if (get_le64(head + 16, dataLen) != 0) return -1;
+        } else {
+            *dataLen = (unsigned long)get_le32(head + 12);
+        }
+    } else {
+        unsigned int len32;
+        get_u32(head, &magic);
+        get_u32(head + 4, op);
+        get_u32(head + 8, metaLen);
+        get_u32(head + 12, &len32);
+        *dataLen = (unsigned long)len32;
+    }
+    if (magic != JOURNAL_MAGIC || *metaLen > JOURNAL_META_MAX) return -1;
+    return fread(meta, 1, *metaLen, f) == *metaLen ? 0 : -1;
+}
+
+/* Move past a record's data: read into `into` (dataLen bytes) when given,
+ * else skipped with a seek. */
+static int read_data(FILE *f, unsigned long dataLen, unsigned char *into) {
+    long at;
+    if (dataLen == 0u) return 0;
+    if (into) return fread(into, 1, (size_t)dataLen, f) == (size_t)dataLen ? 0 : -1;
+    at = ftell(f);
+    return at < 0 ? -1 : seek_to(f, (unsigned long)at + dataLen);
+}
+
+/* Read a record's trailing check (after its data) and verify it. `data` is
+ * the record's data if read_data kept it. */
+static int read_check(FILE *f, unsigned int version, unsigned int op, const unsigned char *meta, unsigned int metaLen, const unsigned char *data, unsigned long dataLen) {
+    unsigned char tail[4];
+    unsigned int check;
+    if (fread(tail, 1, sizeof tail, f) != sizeof tail) return -1;
+    if (version >= 5u) check = get_le32(tail); else get_u32(tail, &check);
+    return check == journal_check(version, op, meta, metaLen, data, dataLen) ? 0 : -1;
+}
+
+/* Scan the records after a BEGIN: 1 if its COMMIT follows with every
+ * record in between intact. The position is left anywhere. Only term sets,
+ * whose check covers them (version 9), are read. */
+static int batch_committed(FILE *f, unsigned int version) {
+    unsigned char meta[JOURNAL_META_MAX];
+    for (;;) {
+        unsigned int op, metaLen;
+        unsigned long dataLen;
+        unsigned char *data = NULL;
+        int ok;
+        if (read_record_head(f, version, &op, meta, &metaLen, &dataLen) != 0) return 0;
+        if (op == JOURNAL_OP_TERMS && version >= 9u && dataLen > 0u) {
+            data = (unsigned char*)malloc((size_t)dataLen);
+            if (!data) return 0;
+        }
+        ok = read_data(f, dataLen, data) == 0 && read_check(f, version, op, meta, metaLen, data, dataLen) == 0;
+        free(data);
+        if (!ok) return 0;
+        if (op == JOURNAL_OP_COMMIT) return 1;
+        if (op == JOURNAL_OP_BEGIN) return 0;
+    }
+}
+
+/* Replay journal records from the current position. A record that is cut
+ * short or fails its check ends the journal (torn tail from a crash); the
+ * next append overwrites it. So does a batch without its COMMIT. Version 5
+ * records are little-endian. TERMS payloads are read and decrypted with
+ * `key`; other payloads are skipped, so replay reads metadata only. */
+static int replay_journal(FILE *f, index_t *idx, unsigned int version, const unsigned char *key) {
+    unsigned char meta[JOURNAL_META_MAX];
+    size_t headLen = version >= 6u ? JOURNAL_HEAD_SIZE : JOURNAL_HEAD_V3_SIZE;
+    for (;;) {
+        unsigned int op, metaLen;
+        unsigned long dataLen;
+        unsigned char *data = NULL;
+        long offset;
+        if (read_record_head(f, version, &op, meta, &metaLen, &dataLen) != 0) break;
+        offset = ftell(f);
+        if (offset < 0) return -1;
+        if (op == JOURNAL_OP_TERMS && version >= 8u && dataLen > 0u) {
+            data = (unsigned char*)malloc((size_t)dataLen);
+            if (!data) break;
+        }
+        /* a torn payload leaves no readable check after it */
+        if (read_data(f, dataLen, data) != 0
+            || read_check(f, version, op, meta, metaLen, data, dataLen) != 0) { free(data); break; }
+        if (op == JOURNAL_OP_BEGIN && version >= 6u) {
+            long after = ftell(f);
+            if (after < 0 || !batch_committed(f, version) || seek_to(f, (unsigned long)after) != 0) break;
+        } else if (op == JOURNAL_OP_COMMIT && version >= 6u) {
+            /* nothing to apply */
+        } else if (op == JOURNAL_OP_TERMS && version >= 8u
+            ? apply_terms(idx, meta, metaLen, data, dataLen, key) != 0
+            : apply_record(idx, version, op, meta, metaLen, (unsigned long)offset, dataLen) != 0) {
+            DBG("[DBG] journal: skipped unreplayable record op=%u\n", op);
+        }
+        idx->journalBytes += (unsigned long)(headLen + metaLen) + dataLen + 4u;
+        idx->journalRecords++;
+    }
+    return 0;
+}
+
+/* Versions 1-3: entry headers interleaved with payloads. */
+static int load_interleaved(FILE *f, unsigned int version, unsigned int file_count, index_t *idx, long fileSize) {
+    unsigned int i;
+    long end;
 
     for (i = 0u; i < file_count; ++i) {
-    unsigned int titleLen = 0u;
-        char *title = NULL;
+        char title[MAX_TITLE];
+        unsigned int titleLen = 0u;
         unsigned int originalSize = 0u;
         unsigned int storedSize = 0u;
-    unsigned int hash = 0u;
+        unsigned int hash = 0u;
         unsigned char flags = 0u;
-        indexEntry_t entry;
+        indexNode_t *node;
 
-        if (read_u32(f, &titleLen) != 0) goto err;
-        title = (char*)calloc(1, (size_t)titleLen + 1u);
+        if (read_u32(f, &titleLen) != 0 || titleLen >= MAX_TITLE) return -1;
+        node = indexNewNode(idx);
+        if (!node) return -1;
         if (titleLen > 0u) {
-            if (fread(title, 1, (size_t)titleLen, f) != (size_t)titleLen) { free(title); goto err; }
+            if (fread(title, 1, (size_t)titleLen, f) != (size_t)titleLen) { indexFreeNode(idx, node); return -1; }
         }
+        title[titleLen] = '\0';
+        node->entry.title = title;
 
-        if (read_u32(f, &originalSize) != 0) { free(title); goto err; }
-        if (read_u32(f, &storedSize) != 0) { free(title); goto err; }
+        if (read_u32(f, &originalSize) != 0) { indexFreeNode(idx, node); return -1; }
+        if (read_u32(f, &storedSize) != 0) { indexFreeNode(idx, node); return -1; }
         if (version >= 2u) {
-            if (read_u32(f, &hash) != 0) { free(title); goto err; }
+            if (read_u32(f, &hash) != 0) { indexFreeNode(idx, node); return -1; }
         } else {
             hash = 0u; /* legacy files have no stored hash */
         }
-        if (fread(&flags, 1, 1, f) != 1) { free(title); goto err; }
+        if (fread(&flags, 1, 1, f) != 1) { indexFreeNode(idx, node); return -1; }
+
+        node->entry.originalSize = (unsigned long)originalSize;
+        node->entry.storedSize = (unsigned long)storedSize;
+        node->entry.flags = (unsigned int)(flags & 0x7Fu);
+        node->entry.hash = hash;
+        node->entry.isPublic = (flags & 0x80u) ? 1 : 0;
+        node->entry.data = NULL;
+        /* leave the payload on disk; remember where it is */
+        end = ftell(f);
+        if (end < 0 || (unsigned long)end + storedSize > (unsigned long)fileSize) { indexFreeNode(idx, node); return -1; }
+        node->entry.offset = (unsigned long)end;
+        if (storedSize > 0u && fseek(f, (long)storedSize, SEEK_CUR) != 0) { indexFreeNode(idx, node); return -1; }
+        if (indexLink(idx, node) != 0) { indexFreeNode(idx, node); return -1; }
+    }
+    return 0;
+}
+
+/* Version 4: host byte order trailer and variable-length TOC entries. */
+static int load_toc_v4(FILE *f, unsigned long baseEnd, index_t *idx) {
+    unsigned int magic, count, tocOffset, tocBytes;
+    unsigned int i;
+
+    if (baseEnd < TOC_TRAILER_V4_SIZE) return -1;
+    if (seek_to(f, baseEnd - TOC_TRAILER_V4_SIZE) != 0) return -1;
+    if (read_u32(f, &magic) != 0 || magic != TOC_MAGIC) return -1;
+    if (read_u32(f, &count) != 0) return -1;
+    if (read_u32(f, &tocOffset) != 0) return -1;
+    if (read_u32(f, &tocBytes) != 0) return -1;
+    if ((unsigned long)tocOffset + tocBytes + TOC_TRAILER_V4_SIZE != baseEnd) return -1;
+    if (seek_to(f, (unsigned long)tocOffset) != 0) return -1;
+
+    for (i = 0u; i < count; ++i) {
+        char title[MAX_TITLE];
+        unsigned int titleLen, originalSize, storedSize, hash, offset;
+        unsigned char flags;
+        indexNode_t *node;
+
+        if (read_u32(f, &titleLen) != 0 || titleLen >= MAX_TITLE) return -1;
+        node = indexNewNode(idx);
+        if (!node) return -1;
+        if (fread(title, 1, (size_t)titleLen, f) != (size_t)titleLen) { indexFreeNode(idx, node); return -1; }
+        title[titleLen] = '\0';
+        node->entry.title = title;
+        if (read_u32(f, &originalSize) != 0 || read_u32(f, &storedSize) != 0
+            || read_u32(f, &hash) != 0 || fread(&flags, 1, 1, f) != 1
+            || read_u32(f, &offset) != 0) { indexFreeNode(idx, node); return -1; }
+        if ((unsigned long)offset + storedSize > (unsigned long)tocOffset) { indexFreeNode(idx, node); return -1; }
+        node->entry.originalSize = (unsigned long)originalSize;
+        node->entry.storedSize = (unsigned long)storedSize;
+        node->entry.hash = hash;
+        node->entry.flags = (unsigned int)(flags & 0x7Fu);
+        node->entry.isPublic = (flags & 0x80u) ? 1 : 0;
+        node->entry.offset = (unsigned long)offset;
+        node->entry.data = NULL;
+        if (indexLink(idx, node) != 0) { indexFreeNode(idx, node); return -1; }
+    }
+    return 0;
+}
+
+/* Read the v8 terms section (`termsBytes` at the current position) into
+ * the `count` nodes loaded from the TOC, in TOC order. */
+static int load_terms(FILE *f, index_t *idx, indexNode_t **nodes, unsigned long count, unsigned long termsBytes, const unsigned char *key) {
+    unsigned char len4[4];
+    unsigned long i, used = 0u;
+    for (i = 0u; i < count; i++) {
+        unsigned long len;
+        unsigned char *terms = NULL;
+        if (fread(len4, 1, 4u, f) != 4u) return -1;
+        len = (unsigned long)get_le32(len4);
+        used += 4u;
+        if (len > termsBytes - used) return -1;
+        if (len > 0u) {
+            terms = (unsigned char*)malloc((size_t)len);
+            if (!terms) return -1;
+            if (fread(terms, 1, (size_t)len, f) != (size_t)len) { free(terms); return -1; }
+            xor_cipher(terms, (size_t)len, key, TERMS_KEY_LEN);
+            used += len;
+        }
+        /* a term set that cannot be kept only narrows content search */
+        indexSetTerms(idx, nodes[i], terms, len);
+    }
+    return used == termsBytes ? 0 : -1;
+}
+
+/* Version 5: read the trailer, the title pool in one fread, then the
+ * record array TOC_BATCH records per fread, decoded straight into nodes.
+ * Version 8 term sets follow the pool, decrypted with `key`. */
+static int load_toc(FILE *f, unsigned long baseEnd, index_t *idx, unsigned int version, const unsigned char *key) {
+    unsigned char trailer[TOC_TRAILER_SIZE];
+    unsigned char *batch = NULL;
+    char *pool = NULL;
+    indexNode_t **nodes = NULL;
+    unsigned long count, tocOffset, tocBytes, poolBytes, recBytes, termsBytes = 0u;
+    unsigned long i = 0u;
+
+    if (baseEnd < HEADER_SIZE + TOC_TRAILER_SIZE) return -1;
+    if (seek_to(f, baseEnd - TOC_TRAILER_SIZE) != 0) return -1;
+    if (fread(trailer, 1, sizeof trailer, f) != sizeof trailer) return -1;
+    if (get_le32(trailer) != TOC_MAGIC) return -1;
+    count = (unsigned long)get_le32(trailer + 4);
+    if (get_le64(trailer + 8, &tocOffset) != 0 || get_le64(trailer + 16, &tocBytes) != 0) return -1;
+    poolBytes = (unsigned long)get_le32(trailer + 24);
+    if (version >= 8u) termsBytes = (unsigned long)get_le32(trailer + 28);
+    recBytes = count * TOC_RECORD_SIZE;
+    if (tocOffset + tocBytes + align8(termsBytes) + TOC_TRAILER_SIZE != baseEnd) return -1;
+    if (recBytes + align8(poolBytes) != tocBytes) return -1;
+
+    pool = (char*)malloc((size_t)poolBytes + 1u);
+    batch = (unsigned char*)malloc((size_t)TOC_BATCH * TOC_RECORD_SIZE);
+    if (termsBytes > 0u) nodes = (indexNode_t**)malloc((size_t)count * sizeof(indexNode_t*) + 1u);
+    if (!pool || !batch || (termsBytes > 0u && !nodes)) goto err;
+    if (seek_to(f, tocOffset + recBytes) != 0) goto err;
+    if (poolBytes > 0u && fread(pool, 1, (size_t)poolBytes, f) != (size_t)poolBytes) goto err;
+    if (seek_to(f, tocOffset) != 0) goto err;
+
+    while (i < count) {
+        unsigned long n = count - i < TOC_BATCH ? count - i : TOC_BATCH;
+        unsigned long k;
+        if (fread(batch, TOC_RECORD_SIZE, (size_t)n, f) != (size_t)n) goto err;
+        for (k = 0u; k < n; k++) {
+            char title[MAX_TITLE];
+            unsigned int titleOffset, titleLen;
+            indexNode_t *node = indexNewNode(idx);
+            if (!node) goto err;
+            if (get_toc_record(batch + k * TOC_RECORD_SIZE, &node->entry, &titleOffset, &titleLen) != 0
+                || (unsigned long)titleOffset + titleLen > poolBytes
+                || node->entry.offset + node->entry.storedSize > tocOffset) { indexFreeNode(idx, node); goto err; }
+            memcpy(title, pool + titleOffset, titleLen);
+            title[titleLen] = '\0';
+            node->entry.title = title;
+            if (indexLink(idx, node) != 0) { indexFreeNode(idx, node); goto err; }
+            if (nodes) nodes[i + k] = node;
+        }
+        i += n;
+    }
+    if (termsBytes > 0u) {
+        if (!key || seek_to(f, tocOffset + tocBytes) != 0) goto err;
+        if (load_terms(f, idx, nodes, count, termsBytes, key) != 0) goto err;
+    }
+    free(pool);
+    free(batch);
+    free(nodes);
+    return 0;
+err:
+    free(pool);
+    free(batch);
+    free(nodes);
+    return -1;
+}
 
-        memset(&entry, 0, sizeof(entry));
-        strncpy(entry.title, title, sizeof(entry.title) - 1u);
-        entry.originalSize = (unsigned long)originalSize;
-        entry.storedSize = (unsigned long)storedSize;
-        entry.flags = (unsigned int)(flags & 0x7Fu);
-        entry.hash = hash;
-        entry.isPublic = (flags & 0x80u) ? 1 : 0;
-        entry.data = NULL;
-        if (storedSize > 0u) {
-            entry.data = malloc((size_t)storedSize);
-            if (!entry.data) { free(title); goto err; }
-            if (fread(entry.data, 1, (size_t)storedSize, f) != (size_t)storedSize) { free(entry.data); free(title); goto err; }
+int storageLoadAll(const char *path, index_t *idx, char *outMasterPin, size_t maxPinLen) {
+    FILE *f;
+    unsigned char hdr[HEADER_SIZE];
+    unsigned char key[TERMS_KEY_LEN];
+    char pin[HEADER_PIN_MAX + 1u];
+    unsigned int magic = 0u;
+    unsigned int version = 0u;
+    unsigned int flags = 0u;
+    unsigned long countOrEnd = 0u; /* entry count (v1-3) or base end (v4+) */
+    unsigned int pinLen = 0u;
+    long end;
+    long fileSize;
+
+    if (!path || !idx) return -1;
+    f = fopen(path, "rb");
+    if (!f) return -1;
+    if (fseek(f, 0L, SEEK_END) != 0) goto err;
+    fileSize = ftell(f);
+    if (fileSize < 0 || fseek(f, 0L, SEEK_SET) != 0) goto err;
+
+    /* v5 headers are little-endian; v1-4 used the host byte order */
+    if (fread(hdr, 1, 16, f) != 16) goto err;
+    if (get_le32(hdr) == STORAGE_MAGIC && get_le32(hdr + 4) >= 5u) {
+        version = get_le32(hdr + 4);
+        if (version > STORAGE_VERSION) goto err;
+        if (fread(hdr + 16, 1, HEADER_SIZE - 16u, f) != HEADER_SIZE - 16u) goto err;
+        if (get_le64(hdr + 8, &countOrEnd) != 0) goto err;
+        pinLen = get_le32(hdr + 16);
+        if (pinLen > HEADER_PIN_MAX) goto err;
+        if (version >= 8u) flags = get_le32(hdr + HEADER_FLAGS_AT);
+        memmove(hdr, hdr + HEADER_PIN_AT, pinLen);
+    } else {
+        unsigned int v;
+        get_u32(hdr, &magic);
+        if (magic != STORAGE_MAGIC) goto err;
+        get_u32(hdr + 4, &version);
+        if (version < 1u || version > 4u) goto err;
+        get_u32(hdr + 8, &v);
+        countOrEnd = (unsigned long)v;
+        get_u32(hdr + 12, &pinLen);
+        /* keep what fits in the header buffer, skip the rest */
+        if (pinLen > HEADER_SIZE) {
+            if (fread(hdr, 1, HEADER_SIZE, f) != HEADER_SIZE) goto err;
+            if (fseek(f, (long)(pinLen - HEADER_SIZE), SEEK_CUR) != 0) goto err;
+            pinLen = HEADER_SIZE;
+        } else if (pinLen > 0u && fread(hdr, 1, pinLen, f) != pinLen) {
+            goto err;
         }
+    }
+
+    if (outMasterPin && maxPinLen > 0u) {
+        size_t toCopy = pinLen < maxPinLen - 1u ? (size_t)pinLen : maxPinLen - 1u;
+        memcpy(outMasterPin, hdr, toCopy);
+        outMasterPin[toCopy] = '\0';
+    }
+
+    /* term sets are encrypted with the key of the PIN in force */
+    if (version >= 8u) {
+        memcpy(pin, hdr, pinLen);
+        pin[pinLen] = '\0';
+        if (derive_key(pin, key, sizeof key) == 0) goto err;
+    }
+
+    /* free existing index nodes */
+    indexFree(idx);
+    idx->baseBytes = 0u;
+    idx->journalBytes = 0u;
+    idx->journalRecords = 0u;
+    idx->termsOn = (flags & HEADER_FLAG_TERMS) ? 1 : 0;
 
-        /* append to index (push front) */
-        {
-            indexNode_t *node = (indexNode_t*)malloc(sizeof(indexNode_t));
-            if (!node) { if (entry.data) free(entry.data); free(title); goto err; }
-            node->entry = entry;
-            node->next = idx->head;
-            idx->head = node;
-            idx->count++;
+    if (version >= 4u) {
+        if (countOrEnd > (unsigned long)fileSize) goto err;
+        if (version >= 5u) {
+            if (load_toc(f, countOrEnd, idx, version, key) != 0) goto err;
+        } else if (load_toc_v4(f, countOrEnd, idx) != 0) {
+            goto err;
         }
+        end = (long)countOrEnd;
+        if (fseek(f, end, SEEK_SET) != 0) goto err;
+    } else {
+        if (load_interleaved(f, version, (unsigned int)countOrEnd, idx, fileSize) != 0) goto err;
+        end = ftell(f);
+        if (end < 0) goto err;
+    }
 
-        free(title);
+    if (version >= 3u) {
+        if (replay_journal(f, idx, version, key) != 0) goto err;
     }
+    /* appends are only written in the current layout; for older files
+     * leaving baseBytes at 0 makes them fail so the first save upgrades
+     * the file with a checkpoint */
+    if (version == STORAGE_VERSION) idx->baseBytes = (unsigned long)end;
 
     fclose(f);
     return 0;
@@ -170,3 +1278,227 @@ err:
     fclose(f);
     return -1;
 }
+
+/* Queue `n` bytes on the write-behind group, growing its buffer. */
+static int group_put(storageGroup_t *g, const unsigned char *p, unsigned long n) {
+    if (g->len + n > g->cap) {
+        unsigned long cap = g->cap ? g->cap : 4096u;
+        unsigned char *nb;
+        while (cap < g->len + n) cap *= 2u;
+        nb = (unsigned char*)realloc(g->buf, (size_t)cap);
+        if (!nb) return -1;
+        g->buf = nb;
+        g->cap = cap;
+    }
+    if (n > 0u) memcpy(g->buf + g->len, p, (size_t)n);
+    g->len += n;
+    return 0;
+}
+
+/* Append one record at the end of the valid journal: written and flushed
+ * now, or queued on `g` (when non-NULL) for the next storageGroupCommit.
+ * `rec` holds JOURNAL_HEAD_SIZE bytes of room followed by `metaLen` bytes of
+ * meta, so head and meta go out in one fwrite. On success `*outOffset` (if
+ * given) is the file offset the payload has, or will have once committed. */
+static void put_journal_head(unsigned char *rec, unsigned int op, size_t metaLen, unsigned long dataLen) {
+    put_le32(rec, JOURNAL_MAGIC);
+    put_le32(rec + 4, op);
+    put_le32(rec + 8, (unsigned long)metaLen);
+    put_le32(rec + 12, 0u);
+    put_le64(rec + 16, dataLen);
+}
+
+static int append_record(FILE *f, index_t *idx, storageGroup_t *g, unsigned int op, unsigned char *rec, size_t metaLen, const unsigned char *data, unsigned long dataLen, unsigned long *outOffset) {
+    unsigned char tail[4];
+    unsigned long at;
+    size_t recLen = JOURNAL_HEAD_SIZE + metaLen;
+    if (!f || !idx || idx->baseBytes == 0u) return -1;
+    if (dataLen > 0u && !data) return -1;
+    at = idx->baseBytes + idx->journalBytes;
+    put_journal_head(rec, op, metaLen, dataLen);
+    put_le32(tail, journal_check(STORAGE_VERSION, op, rec + JOURNAL_HEAD_SIZE, metaLen, data, dataLen));
+    if (g) {
+        unsigned long mark = g->len;
+        if (group_put(g, rec, (unsigned long)recLen) != 0 || group_put(g, data, dataLen) != 0
+            || group_put(g, tail, sizeof tail) != 0) { g->len = mark; return -1; }
+        g->records++;
+    } else {
+        if (seek_to(f, at) != 0) return -1;
+        if (fwrite(rec, 1, recLen, f) != recLen) return -1;
+        if (dataLen > 0u && fwrite(data, 1, (size_t)dataLen, f) != (size_t)dataLen) return -1;
+        if (fwrite(tail, 1, sizeof tail, f) != sizeof tail) return -1;
+        if (fflush(f) != 0) return -1;
+    }
+    if (outOffset) *outOffset = at + (unsigned long)recLen;
+    idx->journalBytes += (unsigned long)recLen + dataLen + 4u;
+    idx->journalRecords++;
+    return 0;
+}
+
+int storageHasRoom(const index_t *idx, unsigned long n) {
+    unsigned long at, max = (unsigned long)LONG_MAX - (JOURNAL_HEAD_SIZE + JOURNAL_META_MAX + 4u);
+    if (!idx) return 0;
+    at = idx->baseBytes + idx->journalBytes;
+    return at <= max && n <= max - at;
+}
+
+int storageGroupCommit(FILE *f, index_t *idx, storageGroup_t *g) {
+    unsigned long at;
+    if (!f || !idx || !g) return -1;
+    if (g->len == 0u) return 0;
+    /* the queued records are the tail of journalBytes */
+    at = idx->baseBytes + idx->journalBytes - g->len;
+    if (seek_to(f, at) != 0) return -1;
+    if (fwrite(g->buf, 1, (size_t)g->len, f) != (size_t)g->len) return -1;
+    if (fflush(f) != 0) return -1;
+    g->len = 0u;
+    g->records = 0u;
+    g->commits++;
+    return 0;
+}
+
+void storageGroupDiscard(storageGroup_t *g) {
+    if (!g) return;
+    g->len = 0u;
+    g->records = 0u;
+}
+
+void storageGroupFree(storageGroup_t *g) {
+    if (!g) return;
+    free(g->buf);
+    g->buf = NULL;
+    g->len = 0u;
+    g->cap = 0u;
+    g->records = 0u;
+}
+
+/* An entry without resident bytes but with a size shares a payload that
+ * is already in the file: its record carries that offset and no data. */
+static int is_shared(const indexEntry_t *e) {
+    return !e->data && e->storedSize > 0u;
+}
+
+int storageAppendAdd(FILE *f, index_t *idx, storageGroup_t *g, indexEntry_t *e) {
+    unsigned char rec[JOURNAL_HEAD_SIZE + JOURNAL_META_MAX];
+    unsigned char *meta = rec + JOURNAL_HEAD_SIZE;
+    size_t len;
+    int shared;
+    if (!e) return -1;
+    len = strlen(e->title);
+    if (len >= MAX_TITLE) return -1;
+    shared = is_shared(e);
+    put_toc_record(meta, e, shared ? e->offset : 0u, 0u);
+    memcpy(meta + TOC_RECORD_SIZE, e->title, len);
+    return append_record(f, idx, g, JOURNAL_OP_ADD, rec, TOC_RECORD_SIZE + len,
+                         e->data, shared ? 0u : e->storedSize, shared ? NULL : &e->offset);
+}
+
+int storageAppendEdit(FILE *f, index_t *idx, storageGroup_t *g, const char *oldTitle, indexEntry_t *e) {
+    unsigned char rec[JOURNAL_HEAD_SIZE + JOURNAL_META_MAX];
+    unsigned char *meta = rec + JOURNAL_HEAD_SIZE;
+    size_t oldLen, len;
+    int shared;
+    if (!oldTitle || !e) return -1;
+    oldLen = strlen(oldTitle);
+    len = strlen(e->title);
+    if (oldLen >= MAX_TITLE || len >= MAX_TITLE) return -1;
+    shared = is_shared(e);
+    put_le32(meta, (unsigned long)oldLen);
+    put_le32(meta + 4, 0u);
+    put_toc_record(meta + 8, e, shared ? e->offset : 0u, 0u);
+    memcpy(meta + 8 + TOC_RECORD_SIZE, oldTitle, oldLen);
+    memcpy(meta + 8 + TOC_RECORD_SIZE + oldLen, e->title, len);
+    return append_record(f, idx, g, JOURNAL_OP_EDIT, rec, 8u + TOC_RECORD_SIZE + oldLen + len,
+                         e->data, shared ? 0u : e->storedSize, shared ? NULL : &e->offset);
+}
+
+int storageAppendRemove(FILE *f, index_t *idx, storageGroup_t *g, const char *title) {
+    unsigned char rec[JOURNAL_HEAD_SIZE + JOURNAL_META_MAX];
+    unsigned char *meta = rec + JOURNAL_HEAD_SIZE;
+    size_t len;
+    if (!title) return -1;
+    len = strlen(title);
+    if (len >= MAX_TITLE) return -1;
+    put_le32(meta, (unsigned long)len);
+    put_le32(meta + 4, 0u);
+    memcpy(meta + 8, title, len);
+    return append_record(f, idx, g, JOURNAL_OP_REMOVE, rec, 8u + len, NULL, 0u, NULL);
+}
+
+int storageReadPayload(FILE *f, const indexEntry_t *e, unsigned char *out) {
+    if (!f || !e || !out) return -1;
+    if (e->storedSize == 0u) return 0;
+    if (seek_to(f, e->offset) != 0) return -1;
+    if (fread(out, 1, (size_t)e->storedSize, f) != (size_t)e->storedSize) return -1;
+    return 0;
+}
+
+int storageReadPayloadAt(FILE *f, const indexEntry_t *e, unsigned long pos, unsigned char *out, unsigned long n) {
+    if (!f || !e || (!out && n > 0u)) return -1;
+    if (pos > e->storedSize || n > e->storedSize - pos) return -1;
+    if (n == 0u) return 0;
+    if (seek_to(f, e->offset + pos) != 0) return -1;
+    return fread(out, 1, (size_t)n, f) == (size_t)n ? 0 : -1;
+}
+
+int storageAppendBegin(FILE *f, index_t *idx, storageGroup_t *g) {
+    unsigned char rec[JOURNAL_HEAD_SIZE];
+    return append_record(f, idx, g, JOURNAL_OP_BEGIN, rec, 0u, NULL, 0u, NULL);
+}
+
+int storageAppendCommit(FILE *f, index_t *idx, storageGroup_t *g) {
+    unsigned char rec[JOURNAL_HEAD_SIZE];
+    return append_record(f, idx, g, JOURNAL_OP_COMMIT, rec, 0u, NULL, 0u, NULL);
+}
+
+void storageClearTail(FILE *f, const index_t *idx) {
+    unsigned char meta[JOURNAL_META_MAX];
+    unsigned char zero[4] = { 0, 0, 0, 0 };
+    unsigned long at;
+    if (!f || !idx || idx->baseBytes == 0u) return;
+    at = idx->baseBytes + idx->journalBytes;
+    for (;;) {
+        unsigned int op, metaLen;
+        unsigned long dataLen;
+        if (seek_to(f, at) != 0 || read_record_head(f, STORAGE_VERSION, &op, meta, &metaLen, &dataLen) != 0) break;
+        if (seek_to(f, at) != 0 || fwrite(zero, 1, sizeof zero, f) != sizeof zero) break;
+        at += JOURNAL_HEAD_SIZE + (unsigned long)metaLen + dataLen + 4u;
+    }
+    fflush(f);
+}
+
+int storageAppendChunk(FILE *f, index_t *idx, storageChunkRef_t *r, const unsigned char *data) {
+    unsigned char rec[JOURNAL_HEAD_SIZE + 16u];
+    unsigned char *meta = rec + JOURNAL_HEAD_SIZE;
+    if (!r || r->storedSize == 0u) return -1;
+    put_le32(meta, (unsigned long)r->hash);
+    put_le32(meta + 4, r->originalSize);
+    put_le32(meta + 8, (unsigned long)r->flags);
+    put_le32(meta + 12, 0u);
+    return append_record(f, idx, NULL, JOURNAL_OP_CHUNK, rec, 16u, data, r->storedSize, &r->offset);
+}
+
+int storageAppendTerms(FILE *f, index_t *idx, storageGroup_t *g, const char *title, const unsigned char *terms, unsigned long len, const char *masterPin) {
+    unsigned char rec[JOURNAL_HEAD_SIZE + JOURNAL_META_MAX];
+    unsigned char *meta = rec + JOURNAL_HEAD_SIZE;
+    unsigned char key[TERMS_KEY_LEN];
+    unsigned char *enc = NULL;
+    size_t tlen;
+    int rc;
+    if (!title || (len > 0u && !terms)) return -1;
+    tlen = strlen(title);
+    if (tlen >= MAX_TITLE) return -1;
+    if (len > 0u) {
+        if (derive_key(masterPin ? masterPin : "", key, sizeof key) == 0) return -1;
+        enc = (unsigned char*)malloc((size_t)len);
+        if (!enc) return -1;
+        memcpy(enc, terms, (size_t)len);
+        xor_cipher(enc, (size_t)len, key, sizeof key);
+    }
+    put_le32(meta, (unsigned long)tlen);
+    put_le32(meta + 4, 0u);
+    memcpy(meta + 8, title, tlen);
+    rc = append_record(f, idx, g, JOURNAL_OP_TERMS, rec, 8u + tlen, enc, len, NULL);
+    free(enc);
+    return rc;
+}
@@ -3,21 +3,136 @@
 
 /* Storage helper for persisting the locker index and data.
  * This module uses the `index_t` defined in `locker.h` (the in-memory
- * linked-list index). It exposes two simple functions to save/load the
- * entire locker to a single binary file. The format is intentionally
- * straightforward for the assignment:
- *   [lockerHeader_t][entry1_meta][entry1_data]...[entryN_meta][entryN_data]
+ * linked-list index). The file is a checkpointed base image followed by
+ * an append-only journal:
+ *   [header][data1]...[dataN][toc: rec1..recN][title pool][terms][trailer]
+ *   [record]...[record]
+ * The header records where the base image ends; the fixed-size trailer just
+ * before that points back at the TOC, so metadata is one contiguous read.
+ * Header, TOC records and trailer are fixed-width little-endian and 8-byte
+ * aligned; titles live in a pool after the record array.
+ * Each journal record is [magic][op][metaLen][dataLen][meta][data][check];
+ * sizes and offsets are 64-bit on disk. Large entries are stored as
+ * manifests of shared, content-defined chunks. With the content index on,
+ * each entry's term set is kept encrypted in the terms section and logged
+ * in TERMS records.
+ * Loading reads metadata only (term sets count as metadata); payloads stay
+ * on disk at `entry.offset` and are checked against their content hash
+ * when read.
  */
 
 #include "locker.h"
 
-/* Save the entire locker to `path`. Returns 0 on success, non-zero on error.
- * This overwrites the target file. */
-int storageSaveAll(const char *path, const index_t *idx, const char *masterPin);
+/* Checkpoint the entire locker to `path`. Payloads not resident in memory
+ * are copied from the existing file. The image is written to `path`.tmp and
+ * renamed over `path`; on success every entry is disk-backed (`data` freed,
+ * `offset` updated) and the journal is empty. Returns 0 on success. */
+int storageSaveAll(const char *path, index_t *idx, const char *masterPin);
+/* PIN change as a checkpoint: the image is written under `newPin`, every
+ * encrypted payload and chunk of an encrypted entry re-encrypted from
+ * `oldPin`'s key as it passes through the copy buffer. If anything fails
+ * the old file and `idx` are unchanged. */
+int storageRekeyAll(const char *path, index_t *idx, const char *oldPin, const char *newPin);
 
-/* Load the entire locker from `path` into an empty index. On success,
- * the function allocates nodes and data buffers; caller may use locker APIs
- * or lockerLoadIndex which wraps this. Returns 0 on success. */
+/* Load the locker index from `path`, replaying any journal records after
+ * the base image. On success, the function allocates nodes but no payload
+ * buffers; caller may use locker APIs or lockerLoadIndex which wraps this.
+ * Returns 0 on success. */
 int storageLoadAll(const char *path, index_t *idx, char *outMasterPin, size_t maxPinLen);
 
+/* Write-behind group: journal records queued in memory and committed to
+ * the file with one write. Zero-initialise before first use. */
+typedef struct {
+    unsigned char *buf;
+    unsigned long len;      /* queued bytes */
+    unsigned long cap;
+    unsigned long records;  /* queued records */
+    unsigned long commits;  /* group writes so far */
+} storageGroup_t;
+
+/* Journal appends. `f` is the open locker file and `idx` the index that was
+ * loaded from (or checkpointed to) it. With `g` NULL each call writes and
+ * flushes one record, costing only the size of the change; otherwise the
+ * record is queued on `g`. Either way `e->offset` is set to the payload's
+ * position in the file, which a queued record reaches only once committed.
+ * An entry with no resident data but a stored size shares the payload at
+ * its current `offset`: the record references it and carries no bytes.
+ * Returns 0 on success. */
+int storageAppendAdd(FILE *f, index_t *idx, storageGroup_t *g, indexEntry_t *e);
+int storageAppendEdit(FILE *f, index_t *idx, storageGroup_t *g, const char *oldTitle, indexEntry_t *e);
+int storageAppendRemove(FILE *f, index_t *idx, storageGroup_t *g, const char *title);
+/* Log the content index term set of entry `title` (len 0 clears it),
+ * encrypted with the key of `masterPin`. Follows the entry's ADD/EDIT. */
+int storageAppendTerms(FILE *f, index_t *idx, storageGroup_t *g, const char *title, const unsigned char *terms, unsigned long len, const char *masterPin);
+
+/* 1 if a record carrying `n` payload bytes still fits the journal: every
+ * offset in the file must fit a long for fseek, which caps a locker file
+ * at 2 GiB where long is 32 bits (64-bit Windows). */
+int storageHasRoom(const index_t *idx, unsigned long n);
+
+/* Batch markers: the records logged between a BEGIN and its COMMIT are
+ * replayed only if the COMMIT reached the file, so a batch lands whole
+ * or not at all. */
+int storageAppendBegin(FILE *f, index_t *idx, storageGroup_t *g);
+int storageAppendCommit(FILE *f, index_t *idx, storageGroup_t *g);
+/* Invalidate the records past the valid journal (an abandoned batch), so
+ * later appends cannot line up with one of them. */
+void storageClearTail(FILE *f, const index_t *idx);
+
+/* Write all records queued on `g` in one fwrite + fflush. On failure the
+ * queue is kept and the caller should fall back to a checkpoint. */
+int storageGroupCommit(FILE *f, index_t *idx, storageGroup_t *g);
+/* Drop queued records (a checkpoint is about to supersede them). */
+void storageGroupDiscard(storageGroup_t *g);
+void storageGroupFree(storageGroup_t *g);
+
+/* Exact size of the image storageSaveAll would write for `idx` (shared
+ * payloads and chunks count once). Manifests not resident in memory are
+ * read from `f`. */
+unsigned long storageImageSize(FILE *f, const index_t *idx, const char *masterPin);
+int storageFileSize(const char *path, unsigned long *out);
+
+/* Checkpoint that also measures the pass: fragmentation before, payload
+ * bytes copied, elapsed time and MB/s. Memory use is bounded by one copy
+ * buffer plus per-entry bookkeeping. */
+int storageCompact(const char *path, index_t *idx, const char *masterPin, lockerCompactStats_t *stats);
+
+/* Read the `storedSize` payload bytes of a disk-backed entry into `out`. */
+int storageReadPayload(FILE *f, const indexEntry_t *e, unsigned char *out);
+/* Read `n` payload bytes starting `pos` bytes into a disk-backed entry. */
+int storageReadPayloadAt(FILE *f, const indexEntry_t *e, unsigned long pos, unsigned char *out, unsigned long n);
+
+/* Chunked entries (FLAG_CHUNKED): the stored payload is a plain manifest,
+ *   [count][reserved] then `count` references of
+ *   [offset:8][storedSize][originalSize][hash][flags],
+ * naming the entry's content-defined chunks in order. Each chunk is stored
+ * (compressed and encrypted on its own) once, as a CHUNK journal record,
+ * and shared by every entry that contains the same bytes. */
+typedef struct {
+    unsigned long offset;       /* stored chunk in the locker file */
+    unsigned long storedSize;
+    unsigned long originalSize;
+    unsigned int hash;          /* content hash of the plain chunk */
+    unsigned int flags;         /* FLAG_COMPRESSED if this chunk is RLE'd */
+} storageChunkRef_t;
+
+#define STORAGE_MANIFEST_HEAD 8u
+#define STORAGE_CHUNK_REF_SIZE 24u
+#define STORAGE_MANIFEST_SIZE(count) (STORAGE_MANIFEST_HEAD + (unsigned long)(count) * STORAGE_CHUNK_REF_SIZE)
+
+/* Manifest encoding; `m` holds STORAGE_MANIFEST_SIZE(count) bytes. Count
+ * returns -1 for a manifest whose length does not match its header. */
+void storageManifestInit(unsigned char *m, unsigned long count);
+int storageManifestCount(const unsigned char *m, unsigned long len, unsigned long *count);
+void storageManifestSet(unsigned char *m, unsigned long i, const storageChunkRef_t *r);
+int storageManifestGet(const unsigned char *m, unsigned long i, storageChunkRef_t *r);
+/* Copy of chunked entry `e`'s manifest (resident or read from `f`), to be
+ * freed by the caller; NULL if unreadable or malformed. */
+unsigned char *storageLoadManifest(FILE *f, const indexEntry_t *e, unsigned long *count);
+
+/* Log one stored chunk (`r->storedSize` bytes) as a CHUNK record, written
+ * through immediately, and set `r->offset`. Queued write-behind records
+ * must be committed first. */
+int storageAppendChunk(FILE *f, index_t *idx, storageChunkRef_t *r, const unsigned char *data);
+
 #endif /* STORAGE_H */
@@ -0,0 +1,129 @@
+/*
+ * terms.c - term set builder for the content index
+ */
+
+#include "terms.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TERMS_MIN_SLOTS 256ul
+
+unsigned long termsHash(const char *term) {
+    unsigned long h = 2166136261ul;
+    while (*term) {
+        h ^= (unsigned long)(unsigned char)*term++;
+        h = (h * 16777619ul) & 0xFFFFFFFFul;
+    }
+    return h ? h : 1ul;
+}
+
+void termsInit(termsBuilder_t *b) {
+    memset(b, 0, sizeof(*b));
+}
+
+void termsFree(termsBuilder_t *b) {
+    free(b->pool);
+    free(b->slots);
+    termsInit(b);
+}
+
+/* Slot of `term` (hash `h`), or the empty slot where it would go. */
+static unsigned long find_slot(const termsBuilder_t *b, const char *term, unsigned long h) {
+    unsigned long i = h & (b->slotCount - 1u);
+    while (b->slots[i] && strcmp(b->pool + b->slots[i] - 1u, term) != 0) i = (i + 1u) & (b->slotCount - 1u);
+    return i;
+}
+
+/* Add the finished term in `cur` unless already seen. */
+static void add_term(termsBuilder_t *b) {
+    unsigned long len = b->curLen, i;
+    b->curLen = 0u;
+    if (b->failed || len < TERM_MIN_LEN || len > TERM_MAX_LEN) return;
+    b->cur[len] = '\0';
+    /* keep the set at most half full */
+    if ((b->count + 1u) * 2u > b->slotCount) {
+        unsigned long count = b->slotCount ? b->slotCount * 2u : TERMS_MIN_SLOTS;
+        unsigned long *old = b->slots, oldCount = b->slotCount;
+        unsigned long *slots = (unsigned long*)calloc((size_t)count, sizeof(unsigned long));
+        if (!slots) { b->failed = 1; return; }
+        b->slots = slots;
+        b->slotCount = count;
+        for (i = 0u; i < oldCount; i++) {
+            if (old[i]) slots[find_slot(b, b->pool + old[i] - 1u, termsHash(b->pool + old[i] - 1u))] = old[i];
+        }
+        free(old);
+    }
+    i = find_slot(b, b->cur, termsHash(b->cur));
+    if (b->slots[i]) return;
+    if (b->poolLen + len + 1u > b->poolCap) {
+        unsigned long cap = b->poolCap ? b->poolCap * 2u : 4096u;
+        char *pool = (char*)realloc(b->pool, (size_t)cap);
+        if (!pool) { b->failed = 1; return; }
+        b->pool = pool;
+        b->poolCap = cap;
+    }
+    memcpy(b->pool + b->poolLen, b->cur, (size_t)len + 1u);
+    b->slots[i] = b->poolLen + 1u;
+    b->poolLen += len + 1u;
+    b->count++;
+}
+
+void termsFeed(termsBuilder_t *b, const unsigned char *p, unsigned long n) {
+    unsigned long i;
+    for (i = 0u; i < n; i++) {
+        unsigned char c = p[i];
+        if (c >= 'A' && c <= 'Z') c = (unsigned char)(c - 'A' + 'a');
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+            if (b->curLen < TERM_MAX_LEN) b->cur[b->curLen] = (char)c;
+            if (b->curLen <= TERM_MAX_LEN) b->curLen++;
+        } else if (b->curLen > 0u) {
+            add_term(b);
+        }
+    }
+}
+
+static int cmp_term(const void *a, const void *b) {
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+int termsFinish(termsBuilder_t *b, unsigned char **out, unsigned long *outLen) {
+    const char **sorted;
+    unsigned long i, k = 0u, used = 0u;
+    int rc = 0;
+    *out = NULL;
+    *outLen = 0u;
+    if (b->curLen > 0u) add_term(b);
+    if (b->failed) rc = -1;
+    if (rc == 0 && b->count > 0u) {
+        sorted = (const char**)malloc((size_t)b->count * sizeof(char*));
+        *out = (unsigned char*)malloc((size_t)b->poolLen);
+        if (!sorted || !*out) {
+            free(sorted); free(*out); *out = NULL;
+            rc = -1;
+        } else {
+            for (i = 0u; i < b->slotCount; i++) if (b->slots[i]) sorted[k++] = b->pool + b->slots[i] - 1u;
+            qsort(sorted, (size_t)k, sizeof(char*), cmp_term);
+            for (i = 0u; i < k; i++) {
+                size_t len = strlen(sorted[i]) + 1u;
+                memcpy(*out + used, sorted[i], len);
+                used += (unsigned long)len;
+            }
+            *outLen = used;
+            free(sorted);
+        }
+    }
+    termsFree(b);
+    return rc;
+}
+
+int termsHas(const unsigned char *blob, unsigned long len, const char *term) {
+    unsigned long at = 0u;
+    while (at < len) {
+        const char *t = (const char*)blob + at;
+        int c = strcmp(t, term);
+        if (c == 0) return 1;
+        if (c > 0) return 0; /* sorted: passed it */
+        at += (unsigned long)strlen(t) + 1u;
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * terms.h
+ * Tokenizer for the content index. A term is a run of ASCII letters and
+ * digits, lowercased, of TERM_MIN_LEN to TERM_MAX_LEN bytes (longer runs
+ * are not terms). A document's term set is kept as a blob of its distinct
+ * terms in strcmp order, each NUL-terminated.
+ */
+
+#ifndef TERMS_H
+#define TERMS_H
+
+#include <stddef.h>
+
+#define TERM_MIN_LEN 2u
+#define TERM_MAX_LEN 32u
+
+/* Collects the distinct terms of text fed in pieces (a term may span two
+ * pieces). Zero-initialise (or termsInit) before first use. */
+typedef struct {
+    char *pool;              /* distinct terms, NUL-terminated, back to back */
+    unsigned long poolLen;
+    unsigned long poolCap;
+    unsigned long *slots;    /* hash set of pool offsets + 1; 0 = empty */
+    unsigned long slotCount;
+    unsigned long count;
+    char cur[TERM_MAX_LEN + 1u]; /* term in progress */
+    unsigned long curLen;    /* its length; above TERM_MAX_LEN = too long */
+    int failed;              /* out of memory: Finish reports it */
+} termsBuilder_t;
+
+void termsInit(termsBuilder_t *b);
+void termsFeed(termsBuilder_t *b, const unsigned char *p, unsigned long n);
+/* End the text and hand over its term set (NULL, 0 when there are no
+ * terms). The builder is reset for reuse. Returns -1 if out of memory. */
+int termsFinish(termsBuilder_t *b, unsigned char **out, unsigned long *outLen);
+void termsFree(termsBuilder_t *b);
+
+/* 1 if `term` is in the term set blob. */
+int termsHas(const unsigned char *blob, unsigned long len, const char *term);
+/* 32-bit FNV-1a of a term, never 0. */
+unsigned long termsHash(const char *term);
+
+#endif /* TERMS_H */
@@ -0,0 +1,63 @@
+/*
+ * tests/bench.c - `make bench`: times the title substring search. Grows a
+ * new locker to 10^4, 10^5, ... `titles` synthetic titles and at each size
+ * times the trigram query against a strstr scan of every title.
+ *
+ * Usage: tests/bench <new locker> <pin> <titles>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "locker.h"
+#include "util.h"
+
+static unsigned long g_benchHits;
+static int benchHit(const indexEntry_t *e, void *ctx) { (void)e; (void)ctx; g_benchHits++; return 0; }
+
+static int search_bench(const char *path, const char *pin, unsigned long titles) {
+    static const char *words[] = { "invoice", "memo", "report", "scan", "letter", "receipt", "contract", "photo" };
+    static const char *queries[] = { "0004242", "memo-scan", "ice-re" };
+    unsigned long n = 0, stage = 10000, i;
+    char t[MAX_TITLE];
+    if (lockerOpen(path, pin) != 0) return -1;
+    if (lockerGetIndex()->count != 0) { lockerClose(); return -2; } /* wants an empty locker */
+    lockerSetWriteBehind(100000, 0, 0.0);
+    printf("%9s  %-10s %8s %12s %12s\n", "titles", "query", "matches", "trigram ms", "scan ms");
+    for (;;) {
+        if (stage > titles) stage = titles;
+        for (; n < stage; n++) {
+            sprintf(t, "%s-%s-%07lu", words[n % 8], words[(n / 8) % 8], n);
+            if (lockerAddContent(t, (const unsigned char*)t, (unsigned long)strlen(t), 0, 0, 1) != 0) { lockerClose(); return -3; }
+        }
+        for (i = 0; i < sizeof queries / sizeof queries[0]; i++) {
+            double t0, fast, slow;
+            indexNode_t *q;
+            unsigned long scanHits = 0;
+            t0 = util_seconds();
+            g_benchHits = 0;
+            lockerQuerySubstring(queries[i], benchHit, NULL);
+            fast = util_seconds() - t0;
+            t0 = util_seconds();
+            for (q = lockerGetIndex()->head; q; q = q->next) if (strstr(q->entry.title, queries[i])) scanHits++;
+            slow = util_seconds() - t0;
+            if (scanHits != g_benchHits) { lockerClose(); return -4; }
+            printf("%9lu  %-10s %8lu %12.3f %12.3f\n", n, queries[i], g_benchHits, fast * 1000.0, slow * 1000.0);
+        }
+        if (stage == titles) break;
+        stage *= 10;
+    }
+    lockerClose();
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int r;
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <new locker> <pin> <titles>\n", argv[0]);
+        return 1;
+    }
+    r = search_bench(argv[1], argv[2], strtoul(argv[3], NULL, 10));
+    if (r != 0) fprintf(stderr, "bench failed (%d)\n", r);
+    return r == 0 ? 0 : 1;
+}
@@ -0,0 +1,1501 @@
+/*
+ * tests/check.c - `make check`: round trips and failure paths of the
+ * library, one section per feature, in the order they were added. Each
+ * prints its name; a failed check prints its line and the run exits 1.
+ *
+ * Unlike the library this program is POSIX: it needs pthreads for the
+ * session checks and mkdir/rmdir to make a checkpoint fail. It runs in
+ * the current directory and removes the files it makes.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include "locker.h"
+#include "compress.h"
+#include "codec.h"
+#include "crypto.h"
+#include "index.h"
+
+static int failures = 0;
+
+#define CHECK(c) do { if (!(c)) { printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); failures++; } } while (0)
+
+#define DAT "check.dat"
+#define DAT_TMP "check.dat.tmp" /* a directory here makes the next rewrite fail */
+#define SNAP "check-snap.dat"
+
+static void fresh(void) {
+    rmdir(DAT_TMP);
+    remove(DAT);
+    remove(SNAP);
+}
+
+static long fileSize(const char *path) {
+    FILE *f = fopen(path, "rb");
+    long n = -1;
+    if (!f) return -1;
+    if (fseek(f, 0, SEEK_END) == 0) n = ftell(f);
+    fclose(f);
+    return n;
+}
+
+/* Copy the first `keep` bytes of DAT (all if negative) to SNAP: the file a
+ * crash at this point would leave behind. */
+static int snapshot(long keep) {
+    FILE *in = fopen(DAT, "rb"), *out = fopen(SNAP, "wb");
+    char buf[4096];
+    size_t got;
+    int rc = (in && out) ? 0 : -1;
+    while (rc == 0 && keep != 0 && (got = fread(buf, 1, keep > 0 && keep < (long)sizeof buf ? (size_t)keep : sizeof buf, in)) > 0) {
+        if (fwrite(buf, 1, got, out) != got) rc = -1;
+        if (keep > 0) keep -= (long)got;
+    }
+    if (in) fclose(in);
+    if (out && fclose(out) != 0) rc = -1;
+    return rc;
+}
+
+/* Entries a fresh session finds in SNAP, or -1 if it cannot open it. */
+static int snapEntries(void) {
+    locker_t *S = locker_new(NULL);
+    lockerTotals_t tot;
+    int n = -1;
+    if (locker_open(S, SNAP, "admin") == 0 && locker_getTotals(S, &tot) == 0) n = (int)tot.count;
+    locker_free(S);
+    return n;
+}
+
+/* Content of `title` equals `n` bytes of `body`. */
+static int holds(locker_t *L, const char *title, const unsigned char *body, unsigned long n) {
+    unsigned char *got;
+    unsigned long len;
+    int ok;
+    if (locker_getContent(L, title, &got, &len) != 0) return 0;
+    ok = len == n && (n == 0 || memcmp(got, body, (size_t)n) == 0);
+    free(got);
+    return ok;
+}
+
+static int holdsText(locker_t *L, const char *title, const char *text) {
+    return holds(L, title, (const unsigned char*)text, (unsigned long)strlen(text));
+}
+
+/* ---- journal ---- */
+
+/* Flip the byte after the first occurrence of `mark` in `path`. */
+static int damage(const char *path, const char *mark) {
+    FILE *f = fopen(path, "r+b");
+    size_t len = strlen(mark), have = 0;
+    long at = 0;
+    int ch, done = 0;
+    char win[64];
+    if (!f) return -1;
+    while (!done && (ch = fgetc(f)) != EOF) {
+        at++;
+        if (have == len) { memmove(win, win + 1, len - 1); have--; }
+        win[have++] = (char)ch;
+        if (have == len && memcmp(win, mark, len) == 0) done = 1;
+    }
+    if (done && fseek(f, at, SEEK_SET) == 0 && (ch = fgetc(f)) != EOF
+        && fseek(f, at, SEEK_SET) == 0 && fputc(ch ^ 0x55, f) != EOF) done = 2;
+    fclose(f);
+    return done == 2 ? 0 : -1;
+}
+
+/* Flip the byte at `at` in `path`. */
+static int flipAt(const char *path, long at) {
+    FILE *f = fopen(path, "r+b");
+    int ch, rc = -1;
+    if (!f) return -1;
+    if (fseek(f, at, SEEK_SET) == 0 && (ch = fgetc(f)) != EOF
+        && fseek(f, at, SEEK_SET) == 0 && fputc(ch ^ 0x55, f) != EOF) rc = 0;
+    if (fclose(f) != 0) rc = -1;
+    return rc;
+}
+
+static void check_journal(void) {
+    locker_t *L = locker_new(NULL), *S = locker_new(NULL);
+    unsigned char *big = (unsigned char*)malloc(100000), *got;
+    unsigned long len;
+    char t[32];
+    long base, size, full;
+    int i, grew = 1;
+    printf("journal\n");
+    if (!L || !S || !big) { CHECK(!"memory"); locker_free(L); locker_free(S); free(big); return; }
+    for (i = 0; i < 100000; i++) big[i] = (unsigned char)(i * 31 ^ i >> 7);
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_addContent(L, "big", big, 100000, 0, 1, 1) == 0);
+    CHECK(locker_checkpoint(L) == 0);
+    base = fileSize(DAT);
+    /* each change appends a record instead of rewriting the file */
+    for (i = 0; i < 5; i++) {
+        sprintf(t, "j-%d", i);
+        size = fileSize(DAT);
+        CHECK(locker_addContent(L, t, (const unsigned char*)t, (unsigned long)strlen(t), 0, i % 2, 1) == 0);
+        if (fileSize(DAT) <= size || fileSize(DAT) > size + 1000) grew = 0;
+    }
+    CHECK(grew);
+    CHECK(locker_removeFile(L, "j-0") == 0);
+    CHECK(locker_editContent(L, "j-1", NULL, (const unsigned char*)"edited", 6, 0, 1, 1) == 0);
+    full = fileSize(DAT);
+    CHECK(full - base < 2000);
+    /* replayed by a fresh session */
+    CHECK(snapshot(-1) == 0 && snapEntries() == 5);
+    CHECK(snapshot(base) == 0 && snapEntries() == 1);
+    /* a torn last record (the edit) is dropped, and appends after it hold */
+    CHECK(snapshot(full - 2) == 0 && locker_open(S, SNAP, "admin") == 0);
+    CHECK(holdsText(S, "j-1", "j-1") && holdsText(S, "j-4", "j-4") && !holdsText(S, "j-0", "j-0"));
+    CHECK(locker_addContent(S, "after-tear", (const unsigned char*)"kept", 4, 1, 1, 1) == 0);
+    CHECK(locker_close(S) == 0 && locker_open(S, SNAP, "admin") == 0);
+    CHECK(holdsText(S, "after-tear", "kept") && holdsText(S, "j-1", "j-1") && holds(S, "big", big, 100000));
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0);
+    CHECK(holdsText(L, "j-1", "edited") && holds(L, "big", big, 100000));
+    /* replay reads no payload: a garbled one is caught by its hash on read */
+    CHECK(locker_close(S) == 0);
+    CHECK(locker_addContent(L, "garbled", (const unsigned char*)"MARK-journal-payload-bytes", 26, 0, 0, 1) == 0);
+    CHECK(snapshot(-1) == 0 && damage(SNAP, "MARK-journal") == 0 && snapEntries() == 6);
+    CHECK(locker_open(S, SNAP, "admin") == 0 && locker_getContent(S, "garbled", &got, &len) == -9);
+    CHECK(holdsText(S, "j-1", "edited"));
+    locker_free(L);
+    locker_free(S);
+    free(big);
+}
+
+/* ---- PIN change ---- */
+
+#define BIG 600000ul
+
+static unsigned char *bigBody(void) {
+    unsigned char *b = (unsigned char*)malloc(BIG);
+    unsigned long i;
+    if (b) for (i = 0; i < BIG; i++) b[i] = (unsigned char)((i * 7) ^ (i >> 9));
+    return b;
+}
+
+static int rekeyIntact(locker_t *L, const unsigned char *big) {
+    return holdsText(L, "small-enc", "secret words here") && holdsText(L, "small-plain", "plain")
+        && holds(L, "big-enc", big, BIG) && holdsText(L, "queued", "queued secret");
+}
+
+static void check_rekey(void) {
+    locker_t *L = locker_new(NULL);
+    unsigned char *big = bigBody();
+    printf("pin change\n");
+    if (!L || !big) { CHECK(!"memory"); locker_free(L); free(big); return; }
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_setContentIndex(L, 1) == 0);
+    CHECK(locker_addContent(L, "small-enc", (const unsigned char*)"secret words here", 17, 1, 1, 0) == 0);
+    CHECK(locker_addContent(L, "small-plain", (const unsigned char*)"plain", 5, 0, 0, 1) == 0);
+    CHECK(locker_addContent(L, "big-enc", big, BIG, 1, 1, 0) == 0); /* chunked */
+    CHECK(locker_checkpoint(L) == 0);
+    CHECK(locker_setWriteBehind(L, 100, 1ul << 20, 60.0) == 0);
+    CHECK(locker_addContent(L, "queued", (const unsigned char*)"queued secret", 13, 1, 1, 0) == 0);
+    /* the rewrite cannot create its temp file: nothing may change */
+    CHECK(mkdir(DAT_TMP, 0700) == 0);
+    CHECK(locker_changePIN(L, "admin", "4321") != 0);
+    CHECK(rekeyIntact(L, big));
+    CHECK(locker_close(L) == 0);
+    CHECK(locker_open(L, DAT, "4321") != 0);
+    CHECK(locker_open(L, DAT, "admin") == 0 && rekeyIntact(L, big));
+    rmdir(DAT_TMP);
+    CHECK(locker_changePIN(L, "admin", "4321") == 0 && rekeyIntact(L, big));
+    CHECK(locker_close(L) == 0);
+    CHECK(locker_open(L, DAT, "4321") == 0 && rekeyIntact(L, big));
+    locker_free(L);
+    free(big);
+}
+
+/* ---- views ---- */
+
+static void check_views(void) {
+    locker_t *L = locker_new(NULL);
+    const unsigned char *v, *v2, *v3;
+    unsigned long n, n2, n3;
+    char t[32];
+    int i;
+    printf("views\n");
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_setWriteBehind(L, 4, 1ul << 20, 60.0) == 0);
+    CHECK(locker_addContent(L, "p", (const unsigned char*)"first body", 10, 0, 0, 1) == 0);
+    CHECK(locker_addContent(L, "z", (const unsigned char*)"zz", 2, 1, 0, 1) == 0);
+    CHECK(locker_viewContent(L, "z", &v, &n) == -10);
+    /* taken while the entry is still queued, kept across group commits,
+     * a checkpoint and an edit */
+    CHECK(locker_viewContent(L, "p", &v, &n) == 0 && n == 10);
+    for (i = 0; i < 20; i++) {
+        sprintf(t, "x%d", i);
+        CHECK(locker_addContent(L, t, (const unsigned char*)t, (unsigned long)strlen(t), 0, 0, 1) == 0);
+    }
+    CHECK(locker_checkpoint(L) == 0);
+    CHECK(locker_viewContent(L, "p", &v2, &n2) == 0 && v2 == v);
+    CHECK(locker_editContent(L, "p", NULL, (const unsigned char*)"second!", 7, 0, 0, 1) == 0);
+    CHECK(locker_flush(L) == 0);
+    CHECK(locker_viewContent(L, "p", &v3, &n3) == 0 && n3 == 7 && memcmp(v3, "second!", 7) == 0);
+    CHECK(memcmp(v, "first body", 10) == 0);
+    CHECK(locker_releaseView(L, v) == 0 && locker_releaseView(L, v2) == 0);
+    CHECK(locker_releaseView(L, v) == -1);
+    CHECK(locker_releaseView(L, v3) == 0 && locker_releaseView(L, NULL) == 0);
+    CHECK(locker_releaseView(L, v3) == -1);
+    /* within the cache budget a released copy stays resident and the next
+     * view borrows it again */
+    CHECK(locker_setCache(L, 16) == 0);
+    CHECK(locker_viewContent(L, "p", &v, &n) == 0 && n == 7 && locker_releaseView(L, v) == 0);
+    CHECK(locker_releaseView(L, v) == -1);
+    CHECK(locker_viewContent(L, "p", &v2, &n) == 0 && v2 == v && locker_releaseView(L, v2) == 0);
+    CHECK(locker_editContent(L, "p", NULL, (const unsigned char*)"third", 5, 0, 0, 1) == 0);
+    CHECK(locker_viewContent(L, "p", &v, &n) == 0 && n == 5 && memcmp(v, "third", 5) == 0);
+    CHECK(locker_releaseView(L, v) == 0);
+    /* viewing many entries keeps only the budget's worth, newest first */
+    for (i = 0; i < 20; i++) {
+        sprintf(t, "x%d", i);
+        CHECK(locker_viewContent(L, t, &v2, &n) == 0 && n == strlen(t) && memcmp(v2, t, n) == 0);
+        CHECK(locker_releaseView(L, v2) == 0);
+    }
+    CHECK(locker_viewContent(L, "x19", &v, &n) == 0 && v == v2 && locker_releaseView(L, v) == 0);
+    CHECK(locker_setCache(L, 0) == 0); /* with the cache off, none is kept */
+    CHECK(locker_viewContent(L, "p", &v, &n) == 0 && n == 5 && memcmp(v, "third", 5) == 0);
+    CHECK(locker_viewContent(L, "x3", &v2, &n) == 0 && n == 2); /* held ones end with the session */
+    locker_free(L);
+}
+
+/* ---- compaction ---- */
+
+static void check_compact(void) {
+    locker_t *L = locker_new(NULL);
+    lockerCompactStats_t st;
+    char t[32], body[64];
+    int i, ok;
+    printf("compaction\n");
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    for (i = 0; i < 300; i++) {
+        sprintf(t, "doc-%d", i);
+        sprintf(body, "body of doc %d, body of doc %d", i, i);
+        CHECK(locker_addContent(L, t, (const unsigned char*)body, (unsigned long)strlen(body), i % 2, i % 3 == 0, 1) == 0);
+    }
+    for (i = 0; i < 300; i += 2) {
+        sprintf(t, "doc-%d", i);
+        CHECK(locker_removeFile(L, t) == 0);
+    }
+    CHECK(locker_editContent(L, "doc-1", "doc-one", (const unsigned char*)"edited", 6, 1, 1, 1) == 0);
+    /* a failed rewrite leaves the file and the entries as they were */
+    CHECK(mkdir(DAT_TMP, 0700) == 0);
+    CHECK(locker_compact(L, &st) != 0);
+    rmdir(DAT_TMP);
+    CHECK(holdsText(L, "doc-one", "edited") && holdsText(L, "doc-299", "body of doc 299, body of doc 299"));
+    CHECK(locker_compact(L, &st) == 0);
+    CHECK(st.deadBytes > 0u && st.fragmentation > 0.0 && st.fragmentation < 1.0);
+    CHECK(st.fileBytesAfter < st.fileBytesBefore && fileSize(DAT) == (long)st.fileBytesAfter);
+    CHECK(st.bytesCopied > 0u && st.seconds >= 0.0);
+    /* nothing left to reclaim */
+    CHECK(locker_compact(L, &st) == 0 && st.deadBytes == 0u && st.fileBytesAfter == st.fileBytesBefore);
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0);
+    for (i = 3, ok = 1; i < 300; i++) {
+        sprintf(t, "doc-%d", i);
+        sprintf(body, "body of doc %d, body of doc %d", i, i);
+        if (holdsText(L, t, body) != (i % 2)) ok = 0;
+    }
+    CHECK(ok && holdsText(L, "doc-one", "edited") && !holdsText(L, "doc-1", "edited"));
+    locker_free(L);
+}
+
+/* ---- write-behind ---- */
+
+static void check_write_behind(void) {
+    locker_t *L = locker_new(NULL);
+    char t[32], body[64];
+    struct timespec nap;
+    long size;
+    int i;
+    printf("write-behind\n");
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_setWriteBehind(L, 8, 1ul << 20, 0.0) == 0);
+    size = fileSize(DAT);
+    /* queued records are readable but not on disk until the group fills */
+    for (i = 0; i < 7; i++) {
+        sprintf(t, "wb-%d", i);
+        CHECK(locker_addContent(L, t, (const unsigned char*)t, (unsigned long)strlen(t), i % 2, i % 3 == 0, 1) == 0);
+    }
+    CHECK(holdsText(L, "wb-6", "wb-6"));
+    CHECK(fileSize(DAT) == size);
+    CHECK(snapshot(-1) == 0 && snapEntries() == 0);
+    CHECK(locker_addContent(L, "wb-7", (const unsigned char*)"wb-7", 4, 0, 0, 1) == 0);
+    CHECK(fileSize(DAT) > size);
+    CHECK(snapshot(-1) == 0 && snapEntries() == 8);
+    CHECK(locker_addContent(L, "wb-8", (const unsigned char*)"wb-8", 4, 0, 0, 1) == 0);
+    CHECK(locker_flush(L) == 0 && snapshot(-1) == 0 && snapEntries() == 9);
+    /* a group holding an edit, a remove and an add reusing its link number */
+    CHECK(locker_editContent(L, "wb-1", NULL, (const unsigned char*)"edited", 6, 1, 1, 1) == 0);
+    CHECK(locker_removeFile(L, "wb-2") == 0);
+    CHECK(locker_addContent(L, "wb-new", (const unsigned char*)"new body", 8, 0, 1, 1) == 0);
+    CHECK(holdsText(L, "wb-1", "edited") && holdsText(L, "wb-new", "new body"));
+    CHECK(locker_flush(L) == 0);
+    CHECK(holdsText(L, "wb-1", "edited") && holdsText(L, "wb-new", "new body"));
+    /* many groups in a row */
+    for (i = 0; i < 2000; i++) {
+        sprintf(t, "bulk-%d", i);
+        sprintf(body, "bulk body %d", i);
+        CHECK(locker_addContent(L, t, (const unsigned char*)body, (unsigned long)strlen(body), i % 2, i % 5 == 0, 1) == 0);
+        if (i % 7 == 3) { sprintf(t, "bulk-%d", i - 1); CHECK(locker_removeFile(L, t) == 0); }
+    }
+    CHECK(locker_addContent(L, "last", (const unsigned char*)"queued at close", 15, 0, 0, 1) == 0);
+    CHECK(locker_close(L) == 0);
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(holdsText(L, "wb-1", "edited") && holdsText(L, "wb-new", "new body") && !holdsText(L, "wb-2", "wb-2"));
+    CHECK(holdsText(L, "bulk-1999", "bulk body 1999") && !holdsText(L, "bulk-2", "bulk body 2"));
+    CHECK(holdsText(L, "last", "queued at close"));
+    /* a group that stops growing is committed by a tick once it is due */
+    CHECK(locker_setWriteBehind(L, 64, 1ul << 20, 0.05) == 0);
+    size = fileSize(DAT);
+    CHECK(locker_addContent(L, "idle", (const unsigned char*)"idle", 4, 0, 0, 1) == 0);
+    CHECK(locker_tick(L) == 0 && fileSize(DAT) == size);
+    nap.tv_sec = 0; nap.tv_nsec = 100000000L;
+    nanosleep(&nap, NULL);
+    CHECK(locker_tick(L) == 1 && fileSize(DAT) > size);
+    CHECK(locker_tick(L) == 0);
+    locker_free(L);
+}
+
+/* ---- size limits ---- */
+
+static void check_limits(void) {
+    locker_t *L = locker_new(NULL);
+    unsigned long saved;
+    printf("size limits\n");
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    /* a file about to pass the offsets fseek can reach refuses the add */
+    saved = locker_getIndex(L)->journalBytes;
+    locker_getIndex(L)->journalBytes = (unsigned long)LONG_MAX - locker_getIndex(L)->baseBytes - 10ul;
+    CHECK(locker_addContent(L, "late", (const unsigned char*)"some bytes that do not fit", 26, 0, 0, 0) == LOCKER_ERR_TOO_LARGE);
+    locker_getIndex(L)->journalBytes = saved;
+    CHECK(locker_addContent(L, "late", (const unsigned char*)"fits", 4, 0, 0, 0) == 0);
+    locker_free(L);
+}
+
+/* ---- deduplication ---- */
+
+static void check_dedup(void) {
+    locker_t *L = locker_new(NULL);
+    lockerDedupStats_t st;
+    unsigned char body[4000];
+    long size;
+    int i;
+    printf("dedup\n");
+    for (i = 0; i < 4000; i++) body[i] = (unsigned char)(i * 13 ^ i >> 5);
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_addContent(L, "a", body, 4000, 1, 1, 1) == 0);
+    size = fileSize(DAT);
+    /* identical content stores one copy, whatever the title */
+    CHECK(locker_addContent(L, "b", body, 4000, 1, 1, 0) == 0);
+    CHECK(fileSize(DAT) - size < 1000);
+    CHECK(locker_getDedupStats(L, &st) == 0 && st.blobs == 1u && st.refs == 2u && st.bytesShared > 0u);
+    /* an edit away from the shared copy, and back onto it */
+    body[0] ^= 1;
+    CHECK(locker_editContent(L, "a", NULL, body, 4000, 1, 1, 1) == 0);
+    CHECK(locker_getDedupStats(L, &st) == 0 && st.blobs == 2u && st.refs == 2u && st.bytesShared == 0u);
+    CHECK(holds(L, "a", body, 4000));
+    body[0] ^= 1;
+    CHECK(locker_editContent(L, "a", NULL, body, 4000, 1, 1, 1) == 0);
+    CHECK(locker_getDedupStats(L, &st) == 0 && st.blobs == 1u && st.refs == 2u && st.bytesShared > 0u);
+    /* the copy outlives the first entry that dropped it, and a reopen */
+    CHECK(locker_removeFile(L, "a") == 0 && holds(L, "b", body, 4000));
+    CHECK(locker_getDedupStats(L, &st) == 0 && st.blobs == 1u && st.refs == 1u && st.bytesShared == 0u);
+    CHECK(locker_addContent(L, "c", body, 4000, 1, 1, 1) == 0);
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_getDedupStats(L, &st) == 0 && st.blobs == 1u && st.refs == 2u);
+    CHECK(holds(L, "b", body, 4000) && holds(L, "c", body, 4000));
+    CHECK(locker_removeFile(L, "b") == 0 && locker_removeFile(L, "c") == 0);
+    CHECK(locker_getDedupStats(L, &st) == 0 && st.blobs == 0u && st.refs == 0u);
+    locker_free(L);
+}
+
+/* ---- chunk sharing ---- */
+
+#define CHUNKED 700000ul /* above LOCKER_CHUNK_THRESHOLD */
+
+static void check_chunks(void) {
+    locker_t *L = locker_new(NULL);
+    lockerDedupStats_t st;
+    unsigned char *body = (unsigned char*)malloc(CHUNKED);
+    unsigned long i, x = 12345ul;
+    long size;
+    printf("chunks\n");
+    if (!L || !body) { CHECK(!"memory"); locker_free(L); free(body); return; }
+    for (i = 0; i < CHUNKED; i++) {
+        x = (x * 1103515245ul + 12345ul) & 0xFFFFFFFFul;
+        body[i] = (unsigned char)(x >> 16);
+    }
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_addContent(L, "doc", body, CHUNKED, 0, 1, 1) == 0);
+    CHECK(locker_getDedupStats(L, &st) == 0 && st.chunks > 1u && st.chunkBytesShared == 0u);
+    /* a new revision with a small change writes the chunks around it only */
+    size = fileSize(DAT);
+    memcpy(body + 300000, "a small change", 14);
+    CHECK(locker_editContent(L, "doc", NULL, body, CHUNKED, 0, 1, 1) == 0);
+    CHECK(fileSize(DAT) - size < (long)(CHUNKED / 8u));
+    CHECK(holds(L, "doc", body, CHUNKED));
+    /* a second entry with the same content shares every chunk */
+    size = fileSize(DAT);
+    CHECK(locker_addContent(L, "copy", body, CHUNKED, 0, 1, 1) == 0);
+    CHECK(fileSize(DAT) - size < (long)(CHUNKED / 8u));
+    CHECK(locker_getDedupStats(L, &st) == 0 && st.chunkRefs > st.chunks && st.chunkBytesShared > 0u);
+    /* dropping one keeps the other whole, through compaction and a reopen */
+    CHECK(locker_removeFile(L, "doc") == 0 && holds(L, "copy", body, CHUNKED));
+    CHECK(locker_compact(L, NULL) == 0 && holds(L, "copy", body, CHUNKED));
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0);
+    CHECK(holds(L, "copy", body, CHUNKED));
+    CHECK(locker_getDedupStats(L, &st) == 0 && st.chunks > 1u && st.chunkRefs == st.chunks);
+    locker_free(L);
+    free(body);
+}
+
+/* ---- duplicate titles ---- */
+
+static indexNode_t *linkNode(index_t *idx, const char *title) {
+    indexNode_t *n = indexNewNode(idx);
+    if (!n) return NULL;
+    memset(&n->entry, 0, sizeof n->entry);
+    n->entry.title = title;
+    if (indexLink(idx, n) != 0) { indexFreeNode(idx, n); return NULL; }
+    return n;
+}
+
+static void check_titles(void) {
+    locker_t *L = locker_new(NULL);
+    unsigned char *big = bigBody();
+    lockerTotals_t tot;
+    lockerDedupStats_t st;
+    unsigned long refs;
+    index_t idx;
+    indexNode_t *a, *b, *c;
+    printf("duplicate titles\n");
+    if (!L || !big) { CHECK(!"memory"); locker_free(L); free(big); return; }
+    /* a clashing add or rename fails and leaves both entries as they were */
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_addContent(L, "one", (const unsigned char*)"same", 4, 0, 0, 1) == 0);
+    CHECK(locker_addContent(L, "two", (const unsigned char*)"same", 4, 0, 0, 1) == 0);
+    CHECK(locker_addContent(L, "big", big, BIG, 0, 1, 1) == 0); /* chunked */
+    CHECK(locker_getDedupStats(L, &st) == 0);
+    refs = st.refs + st.chunkRefs;
+    CHECK(locker_addContent(L, "one", (const unsigned char*)"other", 5, 0, 0, 1) == LOCKER_ERR_EXISTS);
+    CHECK(locker_editContent(L, "two", "one", (const unsigned char*)"renamed", 7, 0, 0, 1) == LOCKER_ERR_EXISTS);
+    CHECK(locker_editContent(L, "big", "two", big, BIG, 0, 1, 1) == LOCKER_ERR_EXISTS);
+    CHECK(locker_getTotals(L, &tot) == 0 && tot.count == 3);
+    CHECK(holdsText(L, "one", "same") && holdsText(L, "two", "same") && holds(L, "big", big, BIG));
+    CHECK(locker_getDedupStats(L, &st) == 0 && st.refs + st.chunkRefs == refs);
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0);
+    CHECK(holdsText(L, "one", "same") && holdsText(L, "two", "same") && holds(L, "big", big, BIG));
+    locker_free(L);
+    free(big);
+    /* duplicate titles of a legacy locker stay reachable */
+    memset(&idx, 0, sizeof idx);
+    a = linkNode(&idx, "dup"); b = linkNode(&idx, "dup"); c = linkNode(&idx, "dup");
+    CHECK(a && b && c && indexFind(&idx, "dup") == c);
+    indexUnlink(&idx, c); indexFreeNode(&idx, c);
+    CHECK(indexFind(&idx, "dup") == b);
+    CHECK(indexRename(&idx, b, "other") == 0 && indexFind(&idx, "dup") == a && indexFind(&idx, "other") == b);
+    indexFree(&idx);
+}
+
+/* ---- ordered queries ---- */
+
+/* Send stdout to /dev/null (on) and back, around calls that print. */
+static void hush(int on) {
+    static int saved = -1;
+    int fd;
+    fflush(stdout);
+    if (on && saved < 0) {
+        saved = dup(1);
+        fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) { dup2(fd, 1); close(fd); }
+    } else if (!on && saved >= 0) {
+        dup2(saved, 1);
+        close(saved);
+        saved = -1;
+    }
+}
+
+#define QN 500
+
+typedef struct {
+    char title[16];
+    unsigned long size;
+    int pub, live;
+} qEntry_t;
+
+static qEntry_t qe[QN];
+
+/* Checks what a query visits: order, and that each entry matches. */
+typedef struct {
+    const char *prefix;           /* or NULL */
+    const char *from, *to;        /* title range, or both NULL */
+    unsigned long lo, hi;         /* size range, if bySize */
+    int bySize, stopAt, n, bad;
+    char last[MAX_TITLE];
+    unsigned long lastSize;
+} walk_t;
+
+static int walkVisit(const indexEntry_t *e, void *ctx) {
+    walk_t *w = (walk_t*)ctx;
+    if (w->n > 0) {
+        int c = strcmp(e->title, w->last);
+        if (w->bySize ? (e->originalSize < w->lastSize || (e->originalSize == w->lastSize && c <= 0)) : c <= 0) w->bad++;
+    }
+    if (w->prefix && strncmp(e->title, w->prefix, strlen(w->prefix)) != 0) w->bad++;
+    if ((w->from && strcmp(e->title, w->from) < 0) || (w->to && strcmp(e->title, w->to) >= 0)) w->bad++;
+    if (w->bySize && (e->originalSize < w->lo || e->originalSize > w->hi)) w->bad++;
+    strcpy(w->last, e->title);
+    w->lastSize = e->originalSize;
+    return ++w->n == w->stopAt;
+}
+
+/* Live entries of qe[] a `pub` session sees that `w` should visit. */
+static int walkExpected(const walk_t *w, int pub) {
+    int i, n = 0;
+    for (i = 0; i < QN; i++) {
+        const qEntry_t *q = &qe[i];
+        if (!q->live || (pub && !q->pub)) continue;
+        if (w->prefix && strncmp(q->title, w->prefix, strlen(w->prefix)) != 0) continue;
+        if ((w->from && strcmp(q->title, w->from) < 0) || (w->to && strcmp(q->title, w->to) >= 0)) continue;
+        if (w->bySize && (q->size < w->lo || q->size > w->hi)) continue;
+        n++;
+    }
+    return n;
+}
+
+static int sameWalk(locker_t *L, const char *prefix, const char *from, const char *to, int bySize, unsigned long lo, unsigned long hi) {
+    walk_t w;
+    int r;
+    memset(&w, 0, sizeof w);
+    w.prefix = prefix; w.from = from; w.to = to;
+    w.bySize = bySize; w.lo = lo; w.hi = hi;
+    if (bySize) r = locker_querySize(L, lo, hi, walkVisit, &w);
+    else if (prefix) r = locker_queryPrefix(L, prefix, walkVisit, &w);
+    else r = locker_queryRange(L, from, to, walkVisit, &w);
+    return r == w.n && w.bad == 0 && w.n == walkExpected(&w, locker_getRole(L) == ROLE_PUBLIC);
+}
+
+static int sameWalks(locker_t *L) {
+    return sameWalk(L, "doc/", NULL, NULL, 0, 0, 0) && sameWalk(L, "docs", NULL, NULL, 0, 0, 0)
+        && sameWalk(L, "arch/1", NULL, NULL, 0, 0, 0) && sameWalk(L, "nothing", NULL, NULL, 0, 0, 0)
+        && sameWalk(L, NULL, "doc/100", "doc/200", 0, 0, 0) && sameWalk(L, NULL, "b", NULL, 0, 0, 0)
+        && sameWalk(L, NULL, NULL, "doc/", 0, 0, 0) && sameWalk(L, NULL, NULL, NULL, 0, 0, 0)
+        && sameWalk(L, NULL, NULL, NULL, 1, 10, 20) && sameWalk(L, NULL, NULL, NULL, 1, 0, 0)
+        && sameWalk(L, NULL, NULL, NULL, 1, 90, 1000);
+}
+
+static void check_queries(void) {
+    locker_t *L = locker_new(NULL);
+    unsigned char body[100];
+    walk_t w;
+    int i, n, m;
+    printf("ordered queries\n");
+    memset(body, 'q', sizeof body);
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    /* added out of order; then removes and renames move entries around */
+    for (i = 0; i < QN; i++) {
+        qEntry_t *q = &qe[i];
+        int k = i * 37 % QN;
+        if (k < 400) sprintf(q->title, "doc/%03d", k);
+        else sprintf(q->title, k < 450 ? "docs-%d" : "zeta-%d", k);
+        q->size = (unsigned long)(k * 53 % 97);
+        q->pub = k % 2;
+        q->live = 1;
+        CHECK(locker_addContent(L, q->title, body, q->size, 0, 0, q->pub) == 0);
+    }
+    for (i = 0; i < QN; i++) {
+        qEntry_t *q = &qe[i];
+        if (strncmp(q->title, "doc/", 4) != 0) continue;
+        if (i % 5 == 0) {
+            CHECK(locker_removeFile(L, q->title) == 0);
+            q->live = 0;
+        } else if (i % 5 == 1) {
+            char t[16];
+            sprintf(t, "arch/%s", q->title + 4);
+            q->size = (q->size + 11u) % 97u;
+            CHECK(locker_editContent(L, q->title, t, body, q->size, 0, 0, q->pub) == 0);
+            strcpy(q->title, t);
+        }
+    }
+    CHECK(sameWalks(L));
+    /* a visitor may stop the walk */
+    memset(&w, 0, sizeof w);
+    w.prefix = "doc/";
+    w.stopAt = 5;
+    CHECK(locker_queryPrefix(L, "doc/", walkVisit, &w) == 5 && w.n == 5 && w.bad == 0);
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0 && sameWalks(L));
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, NULL) == 0 && sameWalks(L));
+    /* the printing searches: a prefix search prints what the query visits,
+     * and a substring search takes `*` literally */
+    memset(&w, 0, sizeof w);
+    w.prefix = "doc/";
+    n = locker_queryPrefix(L, "doc/", walkVisit, &w);
+    hush(1); m = locker_searchPrefix(L, "doc/"); hush(0);
+    CHECK(n > 0 && m == n);
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_addContent(L, "q*r", body, 1, 0, 0, 1) == 0);
+    CHECK(locker_addContent(L, "q-r", body, 1, 0, 0, 1) == 0 && locker_addContent(L, "qr", body, 1, 0, 0, 1) == 0);
+    hush(1); n = locker_search(L, "q*"); m = locker_searchPrefix(L, "q"); hush(0);
+    CHECK(n == 1 && m == 3);
+    hush(1); n = locker_search(L, "*"); m = locker_searchPrefix(L, "q*"); hush(0);
+    CHECK(n == 1 && m == 1);
+    locker_free(L);
+}
+
+/* ---- substring and content search ---- */
+
+typedef struct {
+    locker_t *L;
+    const char *pattern;          /* title substring, or " word " in content */
+    int n;
+    unsigned long sum;
+} digest_t;
+
+static int digestAll(const indexEntry_t *e, void *ctx) {
+    digest_t *d = (digest_t*)ctx;
+    d->n++;
+    d->sum += compute_file_hash((const unsigned char*)e->title, strlen(e->title));
+    return 0;
+}
+
+/* The full scan the trigram index must agree with. */
+static int digestScan(const indexEntry_t *e, void *ctx) {
+    digest_t *d = (digest_t*)ctx;
+    unsigned char *b;
+    unsigned long n;
+    char text[128];
+    if (!d->L) return strstr(e->title, d->pattern) ? digestAll(e, ctx) : 0;
+    if (locker_getContent(d->L, e->title, &b, &n) != 0) return 0;
+    if (n < sizeof text) {
+        memcpy(text, b, (size_t)n);
+        text[n] = '\0';
+        if (strstr(text, d->pattern)) digestAll(e, ctx);
+    }
+    free(b);
+    return 0;
+}
+
+static int sameSubstring(locker_t *L, const char *pattern) {
+    digest_t a, b;
+    memset(&a, 0, sizeof a); memset(&b, 0, sizeof b);
+    a.pattern = b.pattern = pattern;
+    locker_querySubstring(L, pattern, digestAll, &a);
+    locker_queryRange(L, NULL, NULL, digestScan, &b);
+    return a.n == b.n && a.sum == b.sum;
+}
+
+static int sameContent(locker_t *L, const char *word) {
+    digest_t a, b;
+    char padded[64];
+    sprintf(padded, " %s ", word);
+    memset(&a, 0, sizeof a); memset(&b, 0, sizeof b);
+    b.L = L;
+    b.pattern = padded;
+    locker_queryContent(L, word, digestAll, &a);
+    locker_queryRange(L, NULL, NULL, digestScan, &b);
+    return a.n == b.n && a.sum == b.sum && a.n > 0;
+}
+
+static void check_search(void) {
+    static const char *const patterns[] = { "report", "port-1", ".pdf", "-12", "memo-2", "x-1", "ab", "7", "zzz", "report-2999.pdf" };
+    static const char *const words[] = { "alpha", "beta", "gamma", "w3", "w17" };
+    locker_t *L = locker_new(NULL);
+    char t[48], t2[48], body[96];
+    unsigned long p;
+    int i;
+    printf("search\n");
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_setContentIndex(L, 1) == 0);
+    CHECK(locker_setWriteBehind(L, 64, 1ul << 20, 0.0) == 0);
+    /* titles sharing trigrams, churned: removes, renames and adds that
+     * reuse the freed link numbers, so postings go dead and are compacted */
+    for (i = 0; i < 3000; i++) {
+        sprintf(t, "report-%d.pdf", i);
+        sprintf(body, " alpha %s w%d ", i % 2 ? "beta" : "gamma", i % 20);
+        CHECK(locker_addContent(L, t, (const unsigned char*)body, (unsigned long)strlen(body), 0, 0, i % 3 != 0) == 0);
+    }
+    for (i = 0; i < 3000; i++) {
+        sprintf(t, "report-%d.pdf", i);
+        if (i % 3 == 0) CHECK(locker_removeFile(L, t) == 0);
+        else if (i % 3 == 1 && i % 4 == 1) {
+            sprintf(t2, "memo-%d.txt", i);
+            sprintf(body, " beta w%d ", i % 7);
+            CHECK(locker_editContent(L, t, t2, (const unsigned char*)body, (unsigned long)strlen(body), 0, 0, 1) == 0);
+        }
+    }
+    for (i = 0; i < 800; i++) {
+        sprintf(t, "x-%d", i);
+        sprintf(body, " gamma w%d ", i % 30);
+        CHECK(locker_addContent(L, t, (const unsigned char*)body, (unsigned long)strlen(body), 0, 0, i % 2) == 0);
+    }
+    for (p = 0; p < sizeof patterns / sizeof patterns[0]; p++) CHECK(sameSubstring(L, patterns[p]));
+    for (p = 0; p < sizeof words / sizeof words[0]; p++) CHECK(sameContent(L, words[p]));
+    /* a reload rebuilds the postings; a public session sees its own scope */
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0);
+    for (p = 0; p < sizeof patterns / sizeof patterns[0]; p++) CHECK(sameSubstring(L, patterns[p]));
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, NULL) == 0);
+    for (p = 0; p < sizeof patterns / sizeof patterns[0]; p++) CHECK(sameSubstring(L, patterns[p]));
+    locker_free(L);
+}
+
+/* ---- content index ---- */
+
+static int count(const indexEntry_t *e, void *ctx) {
+    (void)e;
+    (*(int*)ctx)++;
+    return 0;
+}
+
+static void check_content_index(void) {
+    locker_t *L = locker_new(NULL), *S = locker_new(NULL);
+    unsigned char *big = bigBody();
+    long size;
+    int c;
+    printf("content index\n");
+    if (!L || !S || !big) { CHECK(!"memory"); locker_free(L); locker_free(S); free(big); return; }
+    memcpy(big + 500000, " needle ", 8);
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_addContent(L, "a", (const unsigned char*)"hello world", 11, 1, 1, 1) == 0);
+    CHECK(locker_addContent(L, "big", big, BIG, 1, 1, 1) == 0);
+    CHECK(mkdir(DAT_TMP, 0700) == 0);
+    CHECK(locker_setContentIndex(L, 1) != 0 && locker_contentIndexEnabled(L) == 0);
+    rmdir(DAT_TMP);
+    CHECK(locker_setContentIndex(L, 1) == 0 && locker_contentIndexEnabled(L) == 1);
+    c = 0; locker_queryContent(L, "needle", count, &c); CHECK(c == 1);
+    CHECK(mkdir(DAT_TMP, 0700) == 0);
+    CHECK(locker_setContentIndex(L, 0) != 0 && locker_contentIndexEnabled(L) == 1);
+    c = 0; locker_queryContent(L, "hello", count, &c); CHECK(c == 1);
+    rmdir(DAT_TMP);
+    CHECK(locker_close(L) == 0);
+    CHECK(locker_open(L, DAT, "admin") == 0 && locker_contentIndexEnabled(L) == 1);
+    c = 0; locker_queryContent(L, "needle", count, &c); CHECK(c == 1);
+    /* replay reads term sets, so their record check covers them: a garbled
+     * one (its last byte sits just before its check) ends the journal */
+    CHECK(locker_addContent(L, "late", (const unsigned char*)"late marker", 11, 0, 0, 1) == 0);
+    size = fileSize(DAT);
+    CHECK(locker_addContent(L, "later", (const unsigned char*)"later", 5, 0, 0, 1) == 0);
+    CHECK(snapshot(-1) == 0 && flipAt(SNAP, size - 5) == 0);
+    CHECK(locker_open(S, SNAP, "admin") == 0 && holdsText(S, "late", "late marker"));
+    CHECK(!holdsText(S, "later", "later"));
+    c = 0; locker_queryContent(S, "marker", count, &c); CHECK(c == 0);
+    c = 0; locker_queryContent(L, "marker", count, &c); CHECK(c == 1);
+    locker_free(S);
+    locker_free(L);
+    free(big);
+}
+
+/* ---- link reuse ---- */
+
+static void check_links(void) {
+    locker_t *L = locker_new(NULL);
+    lockerTotals_t tot;
+    char t[32];
+    int i, r;
+    printf("link reuse\n");
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    /* link numbers are reused: columns follow the live entries */
+    for (r = 0; r < 20; r++) {
+        for (i = 0; i < 50; i++) { sprintf(t, "r%d-%d", r, i); CHECK(locker_addContent(L, t, (const unsigned char*)t, (unsigned long)strlen(t), 0, 0, 1) == 0); }
+        for (i = 0; i < 50; i++) { sprintf(t, "r%d-%d", r, i); if (r < 19 || i % 10) CHECK(locker_removeFile(L, t) == 0); }
+    }
+    CHECK(locker_getIndex(L)->seq <= 50ul);
+    CHECK(locker_getTotals(L, &tot) == 0 && tot.count == 5);
+    locker_free(L);
+}
+
+/* ---- batches ---- */
+
+static void check_batch(void) {
+    locker_t *L = locker_new(NULL);
+    char t[32];
+    long size;
+    int i;
+    printf("batch\n");
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_addContent(L, "pre", (const unsigned char*)"before", 6, 0, 0, 1) == 0);
+    /* the batch outgrows a group: records reach the file before COMMIT,
+     * yet a crash mid-batch loses only the batch */
+    size = fileSize(DAT);
+    CHECK(locker_beginBatch(L) == 0 && locker_inBatch(L) == 1);
+    for (i = 0; i < 200; i++) {
+        sprintf(t, "b-%d", i);
+        CHECK(locker_addContent(L, t, (const unsigned char*)t, (unsigned long)strlen(t), i % 2, i % 3 == 0, 1) == 0);
+    }
+    CHECK(locker_editContent(L, "pre", NULL, (const unsigned char*)"in batch", 8, 0, 0, 1) == 0);
+    CHECK(locker_checkpoint(L) == LOCKER_ERR_BATCH);
+    CHECK(fileSize(DAT) > size);
+    CHECK(snapshot(-1) == 0 && snapEntries() == 1);
+    CHECK(locker_abortBatch(L) == 0 && locker_inBatch(L) == 0);
+    CHECK(holdsText(L, "pre", "before") && !holdsText(L, "b-0", "b-0"));
+    /* the abandoned records stay dead even after a later commit */
+    CHECK(locker_addContent(L, "after", (const unsigned char*)"after", 5, 0, 0, 1) == 0);
+    CHECK(locker_beginBatch(L) == 0);
+    CHECK(locker_addContent(L, "c-0", (const unsigned char*)"c-0", 3, 0, 0, 1) == 0);
+    CHECK(locker_commitBatch(L) == 0);
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0);
+    CHECK(holdsText(L, "pre", "before") && holdsText(L, "after", "after") && holdsText(L, "c-0", "c-0"));
+    CHECK(!holdsText(L, "b-0", "b-0") && !holdsText(L, "b-199", "b-199"));
+    /* a committed batch lands whole; cut inside its COMMIT, not at all */
+    size = fileSize(DAT);
+    CHECK(locker_beginBatch(L) == 0);
+    for (i = 0; i < 150; i++) {
+        sprintf(t, "d-%d", i);
+        CHECK(locker_addContent(L, t, (const unsigned char*)t, (unsigned long)strlen(t), 1, 1, 0) == 0);
+    }
+    CHECK(locker_removeFile(L, "after") == 0);
+    CHECK(locker_commitBatch(L) == 0);
+    CHECK(snapshot(-1) == 0 && snapEntries() == 152);
+    CHECK(snapshot(fileSize(DAT) - 1) == 0 && snapEntries() == 3);
+    CHECK(snapshot(size + 10) == 0 && snapEntries() == 3);
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0);
+    CHECK(holdsText(L, "d-149", "d-149") && !holdsText(L, "after", "after"));
+    locker_free(L);
+}
+
+#define IMP "check-import"
+
+static int putFile(const char *path, const unsigned char *body, unsigned long n) {
+    FILE *f = fopen(path, "wb");
+    int rc = f ? 0 : -1;
+    if (f && n > 0 && fwrite(body, 1, (size_t)n, f) != (size_t)n) rc = -1;
+    if (f && fclose(f) != 0) rc = -1;
+    return rc;
+}
+
+static void clearImport(void) {
+    static const char *files[] = { IMP "/a.txt", IMP "/sub/b.txt", IMP "/sub/big.bin", IMP "/sub/empty",
+                                   IMP "/sub/new.txt", IMP "/zz/clash" };
+    size_t i;
+    for (i = 0; i < sizeof files / sizeof files[0]; i++) remove(files[i]);
+    rmdir(IMP "/zz/locked"); rmdir(IMP "/sub"); rmdir(IMP "/zz"); rmdir(IMP);
+}
+
+static int entries(locker_t *L) {
+    lockerTotals_t tot;
+    return locker_getTotals(L, &tot) == 0 ? (int)tot.count : -1;
+}
+
+static void check_import(void) {
+    locker_t *L = locker_new(NULL);
+    unsigned char *big = bigBody();
+    long size;
+    printf("import\n");
+    if (!L || !big) { CHECK(!"memory"); locker_free(L); free(big); return; }
+    fresh();
+    clearImport();
+    CHECK(mkdir(IMP, 0700) == 0 && mkdir(IMP "/sub", 0700) == 0);
+    CHECK(putFile(IMP "/a.txt", (const unsigned char*)"hello", 5) == 0);
+    CHECK(putFile(IMP "/sub/b.txt", (const unsigned char*)"nested", 6) == 0);
+    CHECK(putFile(IMP "/sub/big.bin", big, BIG) == 0); /* streamed and chunked */
+    CHECK(putFile(IMP "/sub/empty", NULL, 0) == 0);
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_addContent(L, "pre", (const unsigned char*)"before", 6, 0, 0, 1) == 0);
+    /* every file, titled by its relative path, in one batch */
+    CHECK(locker_importDir(L, IMP, 1, 1, 0) == 4 && locker_inBatch(L) == 0);
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0 && entries(L) == 5);
+    CHECK(holdsText(L, "a.txt", "hello") && holdsText(L, "sub/b.txt", "nested"));
+    CHECK(holds(L, "sub/big.bin", big, BIG) && holdsText(L, "sub/empty", ""));
+    /* a missing directory, a clash or an unreadable subdirectory met after
+     * other files were added leaves the locker as it was */
+    CHECK(locker_addContent(L, "zz/clash", (const unsigned char*)"old", 3, 0, 0, 1) == 0);
+    size = fileSize(DAT);
+    CHECK(locker_importDir(L, IMP "-missing", 0, 0, 1) < 0);
+    CHECK(remove(IMP "/a.txt") == 0 && remove(IMP "/sub/b.txt") == 0);
+    CHECK(remove(IMP "/sub/big.bin") == 0 && remove(IMP "/sub/empty") == 0);
+    CHECK(putFile(IMP "/sub/new.txt", (const unsigned char*)"new", 3) == 0);
+    CHECK(mkdir(IMP "/zz", 0700) == 0 && putFile(IMP "/zz/clash", (const unsigned char*)"x", 1) == 0);
+    CHECK(locker_importDir(L, IMP, 0, 0, 1) == LOCKER_ERR_EXISTS && locker_inBatch(L) == 0);
+    CHECK(!holdsText(L, "sub/new.txt", "new"));
+    if (geteuid() != 0) { /* root reads it anyway */
+        CHECK(remove(IMP "/zz/clash") == 0);
+        CHECK(mkdir(IMP "/zz/locked", 0700) == 0 && chmod(IMP "/zz/locked", 0) == 0);
+        CHECK(locker_importDir(L, IMP, 0, 0, 1) < 0 && !holdsText(L, "sub/new.txt", "new"));
+    }
+    CHECK(locker_close(L) == 0 && fileSize(DAT) == size);
+    CHECK(locker_open(L, DAT, "admin") == 0 && entries(L) == 6 && !holdsText(L, "sub/new.txt", "new"));
+    CHECK(holdsText(L, "zz/clash", "old") && holdsText(L, "pre", "before") && holdsText(L, "a.txt", "hello"));
+    clearImport();
+    locker_free(L);
+    free(big);
+}
+
+/* ---- streaming ---- */
+
+/* Byte `i` of a generated stream, so neither side holds it whole. */
+#define GEN(i) ((unsigned char)(((i) * 2654435761ul) >> 13))
+
+typedef struct {
+    unsigned long pos, size;
+    long failAt;                  /* reader error once pos passes it; -1 never */
+    int stopAt;                   /* writer stops after this many calls; 0 never */
+    int calls, bad;
+} stream_t;
+
+static long genRead(unsigned char *buf, unsigned long cap, void *ctx) {
+    stream_t *st = (stream_t*)ctx;
+    unsigned long n = st->size - st->pos, i;
+    if (st->failAt >= 0 && st->pos > (unsigned long)st->failAt) return -1;
+    if (n > cap) n = cap;
+    if (n > 7777ul) n = 7777ul; /* short reads */
+    for (i = 0; i < n; i++) buf[i] = GEN(st->pos + i);
+    st->pos += n;
+    return (long)n;
+}
+
+static int genCheck(const unsigned char *buf, unsigned long n, void *ctx) {
+    stream_t *st = (stream_t*)ctx;
+    unsigned long i;
+    for (i = 0; i < n; i++) if (buf[i] != GEN(st->pos + i)) st->bad++;
+    st->pos += n;
+    return ++st->calls == st->stopAt;
+}
+
+static int streamBack(locker_t *L, const char *title, unsigned long size) {
+    stream_t st;
+    memset(&st, 0, sizeof st);
+    return locker_extractStream(L, title, genCheck, &st) == 0 && st.pos == size && st.bad == 0;
+}
+
+static void check_stream(void) {
+    static const unsigned long sizes[] = { 0ul, 1ul, 5000ul, 300000ul, 1100000ul };
+    locker_t *L = locker_new(NULL);
+    stream_t st;
+    unsigned char *got = NULL;
+    char t[32];
+    unsigned long i, n = 0;
+    int f;
+    printf("streaming\n");
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        for (f = 0; f < 4; f++) {
+            memset(&st, 0, sizeof st);
+            st.size = sizes[i];
+            st.failAt = -1;
+            sprintf(t, "s-%lu-%d", sizes[i], f);
+            CHECK(locker_addStream(L, t, genRead, &st, f & 1, f >> 1, 1) == 0);
+            CHECK(streamBack(L, t, sizes[i]));
+        }
+    }
+    /* a failed read adds nothing; a writer may stop early */
+    memset(&st, 0, sizeof st);
+    st.size = 1100000ul;
+    st.failAt = 500000;
+    CHECK(locker_addStream(L, "broken", genRead, &st, 1, 1, 1) != 0);
+    CHECK(!streamBack(L, "broken", 1100000ul));
+    memset(&st, 0, sizeof st);
+    st.stopAt = 1;
+    CHECK(locker_extractStream(L, "s-1100000-3", genCheck, &st) != 0 && st.calls == 1 && st.bad == 0);
+    /* what was streamed in reads back whole as well, after a reopen */
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0);
+    for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        for (f = 0; f < 4; f++) {
+            sprintf(t, "s-%lu-%d", sizes[i], f);
+            CHECK(streamBack(L, t, sizes[i]));
+        }
+    }
+    /* and through the whole-buffer call */
+    CHECK(locker_getContent(L, "s-300000-3", &got, &n) == 0 && n == 300000ul);
+    for (i = 0, f = 0; got && i < n; i++) if (got[i] != GEN(i)) f = 1;
+    CHECK(got && !f);
+    free(got);
+    locker_free(L);
+}
+
+/* ---- encoder ---- */
+
+/* Fixed-size, unique, compressible content for add number `i`. */
+static void encBody(unsigned char *out, int i) {
+    memset(out, 'a', 400);
+    sprintf((char*)out + 100, "body %d", i);
+    out[399] = (unsigned char)i;
+}
+
+static void check_encoder(void) {
+    locker_t *L = locker_new(NULL);
+    lockerEncodeStats_t a, b;
+    unsigned char body[400];
+    char t[32];
+    int i, mode;
+    printf("encoder\n");
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    /* steady-state adds, write-through then write-behind, allocate nothing */
+    for (mode = 0; mode < 2; mode++) {
+        CHECK(locker_setWriteBehind(L, mode ? 64ul : 0ul, 1ul << 20, 0.0) == 0);
+        for (i = 0; i < 200; i++) {
+            sprintf(t, "warm-%d-%d", mode, i);
+            encBody(body, i + mode * 10000);
+            CHECK(locker_addContent(L, t, body, 400, 1, i % 2, 1) == 0);
+        }
+        CHECK(locker_getEncodeStats(L, &a) == 0);
+        for (i = 0; i < 1000; i++) {
+            sprintf(t, "enc-%d-%d", mode, i);
+            encBody(body, i + mode * 10000 + 1000);
+            CHECK(locker_addContent(L, t, body, 400, i % 3 != 0, i % 2, 1) == 0);
+        }
+        CHECK(locker_getEncodeStats(L, &b) == 0);
+        CHECK(b.encodes - a.encodes == 1000 && b.allocations == a.allocations);
+        CHECK(mode == 0 || b.adopted - a.adopted == 1000);
+    }
+    /* queued payloads that were edited or removed before their commit */
+    CHECK(locker_addContent(L, "q-edit", (const unsigned char*)"one", 3, 1, 1, 1) == 0);
+    CHECK(locker_editContent(L, "q-edit", NULL, (const unsigned char*)"two", 3, 0, 1, 1) == 0);
+    CHECK(locker_addContent(L, "q-gone", (const unsigned char*)"gone", 4, 0, 0, 1) == 0);
+    CHECK(locker_removeFile(L, "q-gone") == 0);
+    CHECK(locker_flush(L) == 0);
+    CHECK(locker_close(L) == 0 && locker_open(L, DAT, "admin") == 0);
+    encBody(body, 10000 + 1000 + 999);
+    CHECK(holds(L, "enc-1-999", body, 400) && holdsText(L, "q-edit", "two") && !holdsText(L, "q-gone", "gone"));
+    locker_free(L);
+}
+
+/* ---- sessions shared by threads ---- */
+
+typedef struct {
+    pthread_rwlock_t rw;
+    pthread_mutex_t io;
+} locks_t;
+
+static void lockFn(void *ctx, int mode) {
+    locks_t *l = (locks_t*)ctx;
+    if (mode == LOCKER_LOCK_READ) pthread_rwlock_rdlock(&l->rw);
+    else if (mode == LOCKER_LOCK_WRITE) pthread_rwlock_wrlock(&l->rw);
+    else pthread_mutex_lock(&l->io);
+}
+
+static void unlockFn(void *ctx, int mode) {
+    locks_t *l = (locks_t*)ctx;
+    if (mode == LOCKER_LOCK_IO) pthread_mutex_unlock(&l->io);
+    else pthread_rwlock_unlock(&l->rw);
+}
+
+/* Pool running tasks on a few threads pulling indices. */
+typedef struct {
+    unsigned long n;
+    unsigned long next;
+    lockerTask_t task;
+    void *arg;
+    pthread_mutex_t m;
+} poolRun_t;
+
+static void *poolWorker(void *p) {
+    poolRun_t *b = (poolRun_t*)p;
+    for (;;) {
+        unsigned long i;
+        pthread_mutex_lock(&b->m);
+        i = b->next++;
+        pthread_mutex_unlock(&b->m);
+        if (i >= b->n) break;
+        b->task(b->arg, i);
+    }
+    return NULL;
+}
+
+#define POOL_WORKERS 4
+
+static void poolRun(void *ctx, unsigned long n, lockerTask_t task, void *arg) {
+    pthread_t th[POOL_WORKERS];
+    poolRun_t b;
+    int i;
+    (void)ctx;
+    b.n = n; b.next = 0; b.task = task; b.arg = arg;
+    pthread_mutex_init(&b.m, NULL);
+    for (i = 0; i < POOL_WORKERS; i++) pthread_create(&th[i], NULL, poolWorker, &b);
+    for (i = 0; i < POOL_WORKERS; i++) pthread_join(th[i], NULL);
+    pthread_mutex_destroy(&b.m);
+}
+
+#define SHARED_DOCS 100
+
+static locker_t *shared;
+static volatile int sharedFail = 0;
+
+/* Every revision of doc-k starts with this. */
+static void docPrefix(char *out, int k) {
+    sprintf(out, "content of document %d ", k);
+}
+
+static void *reader(void *arg) {
+    long id = (long)arg;
+    char t[32], want[64];
+    int i;
+    for (i = 0; i < 1500; i++) {
+        unsigned char *b;
+        const unsigned char *v;
+        unsigned long n;
+        int k = (int)((i * 13 + id * 5) % SHARED_DOCS);
+        sprintf(t, "doc-%d", k);
+        docPrefix(want, k);
+        if (locker_getContent(shared, t, &b, &n) != 0) { sharedFail = 1; continue; }
+        if (n < strlen(want) || memcmp(b, want, strlen(want)) != 0) sharedFail = 2;
+        free(b);
+        sprintf(t, "plain-%d", k % 10);
+        docPrefix(want, k % 10);
+        if (locker_viewContent(shared, t, &v, &n) != 0) { sharedFail = 3; continue; }
+        /* the view must survive the writer's commits meanwhile */
+        if (n < strlen(want) || memcmp(v, want, strlen(want)) != 0) sharedFail = 4;
+        locker_releaseView(shared, v);
+    }
+    return NULL;
+}
+
+static void *writer(void *arg) {
+    char t[32], body[128];
+    int i;
+    (void)arg;
+    for (i = 0; i < 400; i++) {
+        int k = i % SHARED_DOCS;
+        sprintf(t, "doc-%d", k);
+        docPrefix(body, k);
+        sprintf(body + strlen(body), "rev %d bbbbbbbbbbbbbbbbbbbbbbbb", i);
+        if (locker_editContent(shared, t, NULL, (const unsigned char*)body, (unsigned long)strlen(body), i % 2, 1, 1) != 0) sharedFail = 5;
+        if (i % 10 == 0) {
+            k = (i / 10) % 10;
+            sprintf(t, "plain-%d", k);
+            docPrefix(body, k);
+            sprintf(body + strlen(body), "plain rev %d", i);
+            if (locker_editContent(shared, t, NULL, (const unsigned char*)body, (unsigned long)strlen(body), 0, 0, 1) != 0) sharedFail = 6;
+        }
+        sprintf(t, "new-%d", i);
+        if (locker_addContent(shared, t, (const unsigned char*)t, (unsigned long)strlen(t), 1, 1, 0) != 0) sharedFail = 7;
+    }
+    return NULL;
+}
+
+static void *scrubber(void *arg) {
+    lockerVerifyStats_t st;
+    (void)arg;
+    if (locker_scrub(shared, NULL, &st) != 0 || st.corrupt != 0) sharedFail = 8;
+    return NULL;
+}
+
+static void check_threads(void) {
+    locks_t l;
+    lockerLockHooks_t h;
+    lockerPool_t pool;
+    pthread_t th[6];
+    char t[32], body[96];
+    int i;
+    printf("threads\n");
+    pthread_rwlock_init(&l.rw, NULL);
+    pthread_mutex_init(&l.io, NULL);
+    h.lock = lockFn; h.unlock = unlockFn; h.ctx = &l;
+    pool.run = poolRun; pool.ctx = NULL; pool.workers = POOL_WORKERS;
+    fresh();
+    shared = locker_new(&h);
+    CHECK(locker_open(shared, DAT, "admin") == 0);
+    CHECK(locker_setPool(shared, &pool) == 0);
+    CHECK(locker_setCache(shared, 64ul * 1024ul) == 0);
+    CHECK(locker_setWriteBehind(shared, 16, 1ul << 20, 60.0) == 0);
+    for (i = 0; i < SHARED_DOCS; i++) {
+        sprintf(t, "doc-%d", i);
+        docPrefix(body, i);
+        strcat(body, "aaaaaaaaaaaaaaaaaaaaaaaa");
+        CHECK(locker_addContent(shared, t, (const unsigned char*)body, (unsigned long)strlen(body), i % 2, i % 3 == 0, 1) == 0);
+    }
+    for (i = 0; i < 10; i++) {
+        sprintf(t, "plain-%d", i);
+        docPrefix(body, i);
+        CHECK(locker_addContent(shared, t, (const unsigned char*)body, (unsigned long)strlen(body), 0, 0, 1) == 0);
+    }
+    CHECK(locker_flush(shared) == 0);
+    for (i = 0; i < 4; i++) pthread_create(&th[i], NULL, reader, (void*)(long)i);
+    pthread_create(&th[4], NULL, writer, NULL);
+    pthread_create(&th[5], NULL, scrubber, NULL);
+    for (i = 0; i < 6; i++) pthread_join(th[i], NULL);
+    CHECK(sharedFail == 0);
+    CHECK(holdsText(shared, "new-399", "new-399"));
+    CHECK(locker_close(shared) == 0);
+    CHECK(locker_open(shared, DAT, "admin") == 0 && holdsText(shared, "new-399", "new-399"));
+    locker_free(shared);
+    pthread_rwlock_destroy(&l.rw);
+    pthread_mutex_destroy(&l.io);
+}
+
+/* ---- verify on open ---- */
+
+/* Open DAT with the check on and return the stats of that check. */
+static int verifyOpen(locker_t *L, lockerVerifyStats_t *st) {
+    memset(st, 0, sizeof *st);
+    if (locker_setVerifyOnOpen(L, 1) != 0 || locker_open(L, DAT, "admin") != 0) return -1;
+    return locker_getVerifyStats(L, st);
+}
+
+static void check_verify(void) {
+    locks_t l;
+    lockerLockHooks_t h;
+    lockerPool_t pool;
+    lockerVerifyStats_t st, one;
+    locker_t *P, *S = locker_new(NULL);
+    unsigned char *big = bigBody();
+    unsigned char *got;
+    unsigned long n;
+    char t[32], body[64];
+    int i;
+    printf("verify on open\n");
+    if (!S || !big) { CHECK(!"memory"); locker_free(S); free(big); return; }
+    pthread_rwlock_init(&l.rw, NULL);
+    pthread_mutex_init(&l.io, NULL);
+    h.lock = lockFn; h.unlock = unlockFn; h.ctx = &l;
+    pool.run = poolRun; pool.ctx = NULL; pool.workers = POOL_WORKERS;
+    P = locker_new(&h);
+    CHECK(P && locker_setPool(P, &pool) == 0);
+    fresh();
+    CHECK(locker_open(S, DAT, "admin") == 0);
+    for (i = 0; i < 300; i++) {
+        sprintf(t, "v%d", i);
+        sprintf(body, "entry %d checked on open %d", i, i * 7);
+        CHECK(locker_addContent(S, t, (const unsigned char*)body, (unsigned long)strlen(body), i % 2, i % 3 == 0, 1) == 0);
+    }
+    CHECK(locker_addContent(S, "big", big, BIG, 1, 1, 1) == 0);
+    CHECK(locker_addContent(S, "victim", (const unsigned char*)"MARK-verify-payload-bytes", 25, 0, 0, 1) == 0);
+    CHECK(locker_close(S) == 0);
+    /* clean: the pool and one thread agree */
+    CHECK(verifyOpen(P, &st) == 0 && st.entries == 302u && st.corrupt == 0u && st.unreadable == 0u && st.bytes > BIG);
+    CHECK(locker_close(P) == 0);
+    CHECK(verifyOpen(S, &one) == 0 && one.entries == st.entries && one.bytes == st.bytes && one.corrupt == 0u);
+    CHECK(locker_close(S) == 0);
+    /* a damaged payload is counted, the open still succeeds and the rest reads */
+    CHECK(damage(DAT, "MARK-verify") == 0);
+    CHECK(verifyOpen(P, &st) == 0 && st.entries == 302u && st.corrupt == 1u && st.unreadable == 0u);
+    CHECK(locker_getContent(P, "victim", &got, &n) != 0);
+    CHECK(holds(P, "big", big, BIG) && holdsText(P, "v299", "entry 299 checked on open 2093"));
+    CHECK(locker_close(P) == 0);
+    CHECK(verifyOpen(S, &one) == 0 && one.corrupt == 1u && one.entries == st.entries);
+    locker_free(S);
+    locker_free(P);
+    pthread_rwlock_destroy(&l.rw);
+    pthread_mutex_destroy(&l.io);
+    free(big);
+}
+
+/* ---- scrub ---- */
+
+typedef struct {
+    int failed;
+    char title[64];
+} scrubSeen_t;
+
+static void scrubFailed(const char *title, int code, void *ctx) {
+    scrubSeen_t *s = (scrubSeen_t*)ctx;
+    (void)code;
+    s->failed++;
+    strncpy(s->title, title, sizeof s->title - 1);
+}
+
+static void check_scrub(void) {
+    locker_t *L = locker_new(NULL);
+    lockerScrubHooks_t h;
+    lockerVerifyStats_t st;
+    scrubSeen_t seen;
+    char t[32], body[64];
+    int i;
+    printf("scrub\n");
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    for (i = 0; i < 40; i++) {
+        sprintf(t, "e%d", i);
+        sprintf(body, "entry %d body, repeated %d", i, i * 3);
+        CHECK(locker_addContent(L, t, (const unsigned char*)body, (unsigned long)strlen(body), i % 2, i % 3 == 0, 1) == 0);
+    }
+    CHECK(locker_addContent(L, "victim", (const unsigned char*)"MARK-victim-payload-bytes", 25, 0, 0, 1) == 0);
+    memset(&h, 0, sizeof h);
+    memset(&seen, 0, sizeof seen);
+    h.failed = scrubFailed;
+    h.ctx = &seen;
+    CHECK(locker_scrub(L, &h, &st) == 0 && st.corrupt == 0 && st.unreadable == 0 && seen.failed == 0);
+    CHECK(locker_close(L) == 0);
+    CHECK(damage(DAT, "MARK-victim") == 0);
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    CHECK(locker_scrub(L, &h, &st) == 0 && st.corrupt == 1 && seen.failed == 1 && strcmp(seen.title, "victim") == 0);
+    locker_free(L);
+}
+
+/* ---- cache ---- */
+
+static void check_cache(void) {
+    locker_t *L = locker_new(NULL);
+    lockerCacheStats_t st;
+    char t[32], body[80];
+    int i;
+    printf("cache\n");
+    fresh();
+    CHECK(locker_open(L, DAT, "admin") == 0);
+    for (i = 0; i < 50; i++) {
+        sprintf(t, "doc-%d", i);
+        sprintf(body, "content of document %d aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", i);
+        CHECK(locker_addContent(L, t, (const unsigned char*)body, (unsigned long)strlen(body), i % 2, i % 3 == 0, 1) == 0);
+    }
+    CHECK(holdsText(L, "doc-3", "content of document 3 aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+    CHECK(locker_getCacheStats(L, &st) == 0 && st.hits == 0 && st.misses == 0 && st.entries == 0);
+    CHECK(locker_setCache(L, 1ul << 20) == 0);
+    CHECK(holdsText(L, "doc-3", "content of document 3 aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+    CHECK(holdsText(L, "doc-3", "content of document 3 aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+    CHECK(locker_getCacheStats(L, &st) == 0 && st.hits == 1 && st.misses == 1);
+    /* edits, renames and removes are never served stale */
+    CHECK(locker_editContent(L, "doc-3", NULL, (const unsigned char*)"xx", 2, 0, 0, 1) == 0);
+    CHECK(holdsText(L, "doc-3", "xx"));
+    CHECK(locker_editContent(L, "doc-3", "doc-3r", (const unsigned char*)"yy", 2, 1, 1, 1) == 0);
+    CHECK(holdsText(L, "doc-3r", "yy"));
+    CHECK(locker_removeFile(L, "doc-3r") == 0);
+    CHECK(locker_addContent(L, "doc-3r", (const unsigned char*)"zz", 2, 0, 0, 1) == 0);
+    CHECK(holdsText(L, "doc-3r", "zz"));
+    CHECK(locker_changePIN(L, "admin", "9999") == 0);
+    CHECK(locker_getCacheStats(L, &st) == 0 && st.entries == 0);
+    CHECK(holdsText(L, "doc-4", "content of document 4 aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+    /* a small budget evicts and stays within itself */
+    CHECK(locker_setCache(L, 4096) == 0);
+    for (i = 0; i < 50; i++) {
+        if (i == 3) continue;
+        sprintf(t, "doc-%d", i);
+        sprintf(body, "content of document %d aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", i);
+        CHECK(holdsText(L, t, body));
+    }
+    CHECK(locker_getCacheStats(L, &st) == 0 && st.evictions > 0 && st.bytes <= st.maxBytes);
+    locker_free(L);
+}
+
+/* ---- RLE ---- */
+
+/* Byte-at-a-time encoder the word-at-a-time scan must match. */
+static size_t ref_rle(const unsigned char *in, size_t n, unsigned char *out, size_t outCap) {
+    size_t oi = 0, i = 0;
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && in[i + run] == in[i] && run < 255) run++;
+        if (oi + 2 > outCap) return 0;
+        out[oi++] = (unsigned char)run;
+        out[oi++] = in[i];
+        i += run;
+    }
+    return oi;
+}
+
+/* Encode `in`, compare with the reference, then decode it back with
+ * rle_decompress and with codec_decode (plain and keyed, hash folded in). */
+static int rle_roundtrip(const unsigned char *in, size_t n) {
+    static unsigned char enc[4096], ref[4096], back[2048], keyed[4096];
+    unsigned char key[16];
+    codecDecode_t d;
+    size_t c, r, i;
+    int ok = 1;
+    c = rle_compress(in, n, enc, sizeof enc);
+    r = ref_rle(in, n, ref, sizeof ref);
+    if (c != r || memcmp(enc, ref, c) != 0) return 0;
+    if (n == 0) return c == 0;
+    /* exactly enough room works, one byte less does not */
+    if (rle_compress(in, n, ref, c) != c || rle_compress(in, n, ref, c - 1) != 0) ok = 0;
+    if (rle_decompress(enc, c, back, n) != n || memcmp(back, in, n) != 0) ok = 0;
+    if (n > 0 && rle_decompress(enc, c, back, n - 1) != 0) ok = 0;
+    codec_decodeInit(&d, NULL, 0, 1);
+    memset(back, 0, sizeof back);
+    if (codec_decode(&d, enc, c, back, n) != n || memcmp(back, in, n) != 0) ok = 0;
+    if ((unsigned int)d.hash != (unsigned int)compute_file_hash(in, n)) ok = 0;
+    for (i = 0; i < sizeof key; i++) key[i] = (unsigned char)(i * 37 + 11);
+    memcpy(keyed, enc, c);
+    xor_cipher(keyed, c, key, sizeof key);
+    codec_decodeInit(&d, key, sizeof key, 1);
+    memset(back, 0, sizeof back);
+    if (codec_decode(&d, keyed, c, back, n) != n || memcmp(back, in, n) != 0) ok = 0;
+    return ok;
+}
+
+static void check_rle(void) {
+    static const size_t runs[] = { 1, 2, 3, 7, 8, 9, 15, 16, 17, 23, 24, 25, 31, 32, 33,
+                                   63, 64, 65, 127, 128, 129, 247, 248, 249, 254, 255, 256,
+                                   257, 262, 263, 264, 509, 510, 511, 512, 513, 1000 };
+    static const unsigned char fills[] = { 0x00, 'x', 0xFF };
+    static unsigned char in[2048];
+    size_t r, lead, tail, f, i, n;
+    unsigned long seed = 1ul;
+    int t;
+    printf("rle\n");
+    CHECK(rle_roundtrip(in, 0));
+    /* a run of every length near a word multiple or the 255 cap, starting
+     * at every alignment, followed by literals and a run of another byte */
+    for (r = 0; r < sizeof runs / sizeof runs[0]; r++) {
+        for (lead = 0; lead <= 2 * sizeof(unsigned long); lead++) {
+            for (f = 0; f < sizeof fills; f++) {
+                for (tail = 0; tail <= 2; tail++) {
+                    n = 0;
+                    for (i = 0; i < lead; i++) in[n++] = (unsigned char)(0x40 + i);
+                    for (i = 0; i < runs[r]; i++) in[n++] = fills[f];
+                    for (i = 0; i < tail; i++) in[n++] = (unsigned char)(fills[f] ^ (0x21 + i));
+                    for (i = 0; i < runs[r] % 19; i++) in[n++] = (unsigned char)(fills[f] ^ 0x5A);
+                    if (!rle_roundtrip(in, n)) {
+                        printf("  FAIL run %lu lead %lu fill %u tail %lu\n", (unsigned long)runs[r], (unsigned long)lead, (unsigned)fills[f], (unsigned long)tail);
+                        failures++;
+                        return;
+                    }
+                }
+            }
+        }
+    }
+    /* runs that differ from the fill only in their last byte of a word */
+    for (r = 1; r <= 3 * sizeof(unsigned long) + 1; r++) {
+        memset(in, 'a', r);
+        in[r - 1] = 'b';
+        CHECK(rle_roundtrip(in, r));
+    }
+    /* random content drawn mostly from repeats of the previous byte */
+    for (t = 0; t < 3000; t++) {
+        n = (size_t)(t % 700);
+        for (i = 0; i < n; i++) {
+            seed = (seed * 1103515245ul + 12345ul) & 0x7FFFFFFFul;
+            in[i] = (unsigned char)((seed >> 16) % 5 < 3 && i > 0 ? in[i - 1] : (seed >> 8) % 3);
+        }
+        if (!rle_roundtrip(in, n)) { printf("  FAIL random case %d\n", t); failures++; return; }
+    }
+}
+
+int main(void) {
+    check_journal();
+    check_rekey();
+    check_views();
+    check_compact();
+    check_write_behind();
+    check_limits();
+    check_dedup();
+    check_chunks();
+    check_titles();
+    check_queries();
+    check_search();
+    check_content_index();
+    check_links();
+    check_batch();
+    check_import();
+    check_stream();
+    check_encoder();
+    check_threads();
+    check_verify();
+    check_scrub();
+    check_cache();
+    check_rle();
+    fresh();
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <time.h>
 
 int g_runtimeDebug = 0; /* runtime-controlled debug printing */
 
@@ -30,6 +31,24 @@ unsigned long util_timestamp(void) {
     return ++fake;
 }
 
+double util_seconds(void) {
+    return (double)clock() / (double)CLOCKS_PER_SEC;
+}
+
+int util_fileSize(const char *path, unsigned long *size) {
+    FILE *f;
+    long len;
+    if (!path || !size) return -1;
+    f = fopen(path, "rb");
+    if (!f) return -2;
+    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return -3; }
+    len = ftell(f);
+    fclose(f);
+    if (len < 0) return -4; /* too large for ftell on this platform */
+    *size = (unsigned long)len;
+    return 0;
+}
+
 int util_readFile(const char *path, unsigned char **buffer, size_t *size) {
     FILE *f;
     long len;
@@ -40,6 +59,7 @@ int util_readFile(const char *path, unsigned char **buffer, size_t *size) {
     if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return -3; }
     len = ftell(f);
     if (len < 0) { fclose(f); return -4; }
+    if ((unsigned long)len > (unsigned long)(size_t)-1) { fclose(f); return -5; }
     rewind(f);
     buf = (unsigned char*)malloc((size_t)len);
     if (!buf) { fclose(f); return -5; }
@@ -50,6 +70,29 @@ int util_readFile(const char *path, unsigned char **buffer, size_t *size) {
     return 0;
 }
 
+int util_readInto(const char *path, unsigned char **buffer, size_t *cap, size_t *size) {
+    FILE *f;
+    long len;
+    if (!path || !buffer || !cap || !size) return -1;
+    f = fopen(path, "rb");
+    if (!f) return -2;
+    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return -3; }
+    len = ftell(f);
+    if (len < 0) { fclose(f); return -4; }
+    if ((unsigned long)len > (unsigned long)(size_t)-1) { fclose(f); return -5; }
+    rewind(f);
+    if ((size_t)len > *cap || !*buffer) {
+        unsigned char *buf = (unsigned char*)realloc(*buffer, (size_t)len + 1u);
+        if (!buf) { fclose(f); return -5; }
+        *buffer = buf;
+        *cap = (size_t)len + 1u;
+    }
+    if (fread(*buffer, 1, (size_t)len, f) != (size_t)len) { fclose(f); return -6; }
+    fclose(f);
+    *size = (size_t)len;
+    return 0;
+}
+
 int util_writeFile(const char *path, const unsigned char *buffer, size_t size) {
     FILE *f;
     /* Allow size==0 with NULL buffer to create an empty file */
@@ -16,7 +16,14 @@
 extern int g_runtimeDebug;
 
 unsigned long util_timestamp(void); /* placeholder simple counter */
+double util_seconds(void);          /* processor time in seconds, for timings */
+/* Size of a file; -4 when it is beyond what ftell can report. */
+int util_fileSize(const char *path, unsigned long *size);
+/* Read a whole file into a new buffer; use a streaming path for large files. */
 int util_readFile(const char *path, unsigned char **buffer, size_t *size);
+/* Read a whole file into *buffer (*cap bytes, grown with realloc when the
+ * file does not fit), so one buffer serves many reads. */
+int util_readInto(const char *path, unsigned char **buffer, size_t *cap, size_t *size);
 int util_writeFile(const char *path, const unsigned char *buffer, size_t size);
 
 /* Best-effort creation of 'storage' directory (POSIX). Returns 1 always. */